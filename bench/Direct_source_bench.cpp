@@ -0,0 +1,101 @@
+/*!
+ \file bench/Direct_source_bench.cpp
+ \brief WatSON Direct Read Benchmark
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "benchhelper.h"
+#include "reader.h"
+#include "watson.h"
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    //! A file of about \c sz bytes of records.
+    std::string produce(const uint64_t sz)
+    {
+        char path[] = "/var/tmp/watson_bench_XXXXXX";
+        const int fd = mkstemp(path);
+        std::string chunk;
+        for (uint32_t h = 0; chunk.size() < (1 << 20); ++h)
+        {
+            const watson::Ngrdnt::Ptr val(watson::new_ngrdnt(std::string(100 + h % 4000, 'a' + h % 26)));
+            chunk.append(reinterpret_cast<const char*>(val->data()), val->size());
+        }
+        for (uint64_t written = 0; written < sz; written += chunk.size())
+        {
+            if (static_cast<ssize_t>(chunk.size()) != write(fd, chunk.data(), chunk.size()))
+            {
+                std::cerr << "Unable to write " << path << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        fsync(fd);
+        close(fd);
+        return path;
+    }
+
+    void scan(const std::string& name, std::unique_ptr<watson::Ngrdnt_source>&& source)
+    {
+        watson::Ngrdnt_reader reader(std::move(source));
+        Bench_timer timer;
+        while (reader.next())
+        {
+        }
+        Bench_util::throughput(name, reader.offset(), timer.elapsed());
+    }
+};
+
+int main(int argc, char** argv)
+{
+    const uint64_t target = (argc > 1 ? std::stoull(argv[1]) : 512) << 20;
+    const std::string path(produce(target));
+
+    Bench_util::header("watson::Direct_source");
+    {
+        // Buffered reads, from whatever the page cache still holds.
+        const int fd = open(path.c_str(), O_RDONLY);
+        scan("page cache", std::unique_ptr<watson::Ngrdnt_source>(new watson::Fd_source(fd)));
+        close(fd);
+    }
+    scan("O_DIRECT", std::unique_ptr<watson::Ngrdnt_source>(
+            new watson::Direct_source(path, 4 << 20)));
+    scan("O_DIRECT + prefetch", std::unique_ptr<watson::Ngrdnt_source>(
+            new watson::Prefetch_source(std::unique_ptr<watson::Ngrdnt_source>(
+                    new watson::Direct_source(path, 4 << 20)), 4, 4 << 20)));
+    scan("fadvise", std::unique_ptr<watson::Ngrdnt_source>(
+            new watson::Direct_source(path, 4 << 20, false)));
+
+    unlink(path.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/*!
+ \file bench/Group_writer_bench.cpp
+ \brief WatSON Group Commit Benchmark
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "benchhelper.h"
+#include "log.h"
+#include "watson.h"
+#include <cstdlib>
+#include <future>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+    std::string temp_path()
+    {
+        char path[] = "/tmp/watson_bench_XXXXXX";
+        close(mkstemp(path));
+        return path;
+    }
+
+    void remove_log(const std::string& path)
+    {
+        unlink(path.c_str());
+        unlink((path + ".idx").c_str());
+    }
+};
+
+int main(int argc, char** argv)
+{
+    const uint32_t records = argc > 1 ? std::stoul(argv[1]) : 2000;
+    const uint32_t threads = argc > 2 ? std::stoul(argv[2]) : 8;
+    const watson::Ngrdnt::Ptr val(watson::new_ngrdnt(std::string(200, 'r')));
+
+    Bench_util::header("watson::Group_writer");
+
+    {
+        const std::string path(temp_path());
+        watson::Log_writer writer(path);
+        Bench_timer timer;
+        for (uint32_t h = 0; h < records; ++h)
+        {
+            writer.append(val);
+            writer.sync();
+        }
+        Bench_util::report("sync per record", records / timer.elapsed(), "records/s");
+        remove_log(path);
+    }
+
+    {
+        const std::string path(temp_path());
+        watson::Group_writer writer(path);
+        Bench_timer timer;
+        std::vector<std::thread> workers;
+        for (uint32_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&writer, &val, records, threads]() {
+                // Every caller waits for its record, as a request handler would.
+                for (uint32_t h = 0; h < records / threads; ++h)
+                {
+                    writer.append(val).get();
+                }
+            });
+        }
+        for (std::thread& w : workers)
+        {
+            w.join();
+        }
+        const double seconds = timer.elapsed();
+        std::ostringstream name;
+        name << "group commit, " << threads << " threads";
+        Bench_util::report(name.str(), records / threads * threads / seconds, "records/s");
+        Bench_util::report("records per batch", static_cast<double>(records / threads * threads) / writer.batches(), "records");
+        remove_log(path);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+#include "benchhelper.h"
+#include "json.h"
+#include "watson.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+    //! Newline delimited records, like a typical event stream.
+    std::string corpus(const uint32_t count)
+    {
+        std::string json;
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            json += "{\"id\": " + std::to_string(h * 7919ull) +
+                    ", \"timestamp\": " + std::to_string(1450000000000ull + h) +
+                    ", \"user\": {\"name\": \"user" + std::to_string(h % 1000) +
+                    "\", \"score\": " + std::to_string(h % 97) + "." + std::to_string(h % 13) +
+                    ", \"active\": " + (h % 3 ? "true" : "false") + "}" +
+                    ", \"tags\": [\"alpha\", \"beta\", \"gamma\"]" +
+                    ", \"message\": \"The quick brown fox jumps over the lazy dog, record " + std::to_string(h) + "\"" +
+                    ", \"location\": null}\n";
+        }
+        return json;
+    }
+}; // namespace (anonymous)
+
+int main(int argc, char** argv)
+{
+    const uint32_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    const uint32_t rounds = 10;
+    const std::string json(corpus(count));
+
+    // The records are emitted from the transcoded form.
+    watson::Json_transcoder transcoder;
+    std::vector<uint8_t> records;
+    transcoder.transcode(json.data(), json.size(), records);
+
+    Bench_util::header("watson::Json_emitter");
+    watson::Json_emitter emitter(transcoder.glossary());
+    std::string out;
+    Bench_timer timer;
+    for (uint32_t h = 0; h < rounds; ++h)
+    {
+        out.clear();
+        for (size_t offset = 0; offset < records.size(); offset += watson::ngrdnt_size(records.data() + offset))
+        {
+            emitter.emit(records.data() + offset, out);
+            out.push_back('\n');
+        }
+    }
+    Bench_util::throughput("emit", out.size() * rounds, timer.elapsed());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+#include "benchhelper.h"
+#include "json.h"
+#include "watson.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+    //! Newline delimited records, like a typical event stream.
+    std::string corpus(const uint32_t count)
+    {
+        std::string json;
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            json += "{\"id\": " + std::to_string(h * 7919ull) +
+                    ", \"timestamp\": " + std::to_string(1450000000000ull + h) +
+                    ", \"user\": {\"name\": \"user" + std::to_string(h % 1000) +
+                    "\", \"score\": " + std::to_string(h % 97) + "." + std::to_string(h % 13) +
+                    ", \"active\": " + (h % 3 ? "true" : "false") + "}" +
+                    ", \"tags\": [\"alpha\", \"beta\", \"gamma\"]" +
+                    ", \"message\": \"The quick brown fox jumps over the lazy dog, record " + std::to_string(h) + "\"" +
+                    ", \"location\": null}\n";
+        }
+        return json;
+    }
+}; // namespace (anonymous)
+
+int main(int argc, char** argv)
+{
+    const uint32_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    const uint32_t rounds = 10;
+    const std::string json(corpus(count));
+
+    Bench_util::header("watson::Json_transcoder");
+    watson::Json_transcoder transcoder;
+    std::vector<uint8_t> out;
+    Bench_timer timer;
+    for (uint32_t h = 0; h < rounds; ++h)
+    {
+        out.clear();
+        transcoder.transcode(json.data(), json.size(), out);
+    }
+    Bench_util::throughput("transcode", json.size() * rounds, timer.elapsed());
+    Bench_util::report("WatSON / JSON size", static_cast<double>(out.size()) / json.size(), "ratio");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+#include "benchhelper.h"
+#include "json.h"
+#include "msgpack.h"
+#include "watson.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+    //! Newline delimited records, like a typical event stream.
+    std::string corpus(const uint32_t count)
+    {
+        std::string json;
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            json += "{\"id\": " + std::to_string(h * 7919ull) +
+                    ", \"timestamp\": " + std::to_string(1450000000000ull + h) +
+                    ", \"user\": {\"name\": \"user" + std::to_string(h % 1000) +
+                    "\", \"score\": " + std::to_string(h % 97) + "." + std::to_string(h % 13) +
+                    ", \"active\": " + (h % 3 ? "true" : "false") + "}" +
+                    ", \"tags\": [\"alpha\", \"beta\", \"gamma\"]" +
+                    ", \"message\": \"The quick brown fox jumps over the lazy dog, record " + std::to_string(h) + "\"" +
+                    ", \"location\": null}\n";
+        }
+        return json;
+    }
+}; // namespace (anonymous)
+
+int main(int argc, char** argv)
+{
+    const uint32_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    const uint32_t rounds = 10;
+
+    // The MessagePack records are made from the JSON ones.
+    const std::string json(corpus(count));
+    watson::Json_transcoder json_transcoder;
+    std::vector<uint8_t> records;
+    json_transcoder.transcode(json.data(), json.size(), records);
+    watson::Msgpack_emitter emitter(json_transcoder.glossary());
+    std::vector<uint8_t> packed;
+    for (size_t offset = 0; offset < records.size(); offset += watson::ngrdnt_size(records.data() + offset))
+    {
+        emitter.emit(records.data() + offset, packed);
+    }
+
+    Bench_util::header("watson::Msgpack_transcoder");
+    watson::Msgpack_transcoder transcoder;
+    std::vector<uint8_t> out;
+    {
+        Bench_timer timer;
+        for (uint32_t h = 0; h < rounds; ++h)
+        {
+            out.clear();
+            transcoder.transcode(packed.data(), packed.size(), out);
+        }
+        Bench_util::throughput("MessagePack to WatSON", packed.size() * rounds, timer.elapsed());
+    }
+    {
+        Bench_timer timer;
+        for (uint32_t h = 0; h < rounds; ++h)
+        {
+            out.clear();
+            for (size_t offset = 0; offset < records.size(); offset += watson::ngrdnt_size(records.data() + offset))
+            {
+                emitter.emit(records.data() + offset, out);
+            }
+        }
+        Bench_util::throughput("WatSON to MessagePack", records.size() * rounds, timer.elapsed());
+    }
+    Bench_util::report("WatSON / MessagePack size", static_cast<double>(records.size()) / packed.size(), "ratio");
+    return EXIT_SUCCESS;
+}
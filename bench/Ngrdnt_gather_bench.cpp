@@ -0,0 +1,122 @@
+/*!
+ \file bench/Ngrdnt_gather_bench.cpp
+ \brief WatSON Scatter-Gather Benchmark
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "benchhelper.h"
+#include "gather.h"
+#include "watson.h"
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    //! A message of large blobs with a few small fields around them.
+    watson::Map message(const uint32_t blobs, const uint64_t blob_size)
+    {
+        watson::Map m;
+        for (uint32_t h = 0; h < blobs; ++h)
+        {
+            m.mutable_children()[2 * h] = watson::new_ngrdnt(static_cast<int32_t>(h));
+            m.mutable_children()[2 * h + 1] = watson::new_ngrdnt(std::string(blob_size, 'a' + h % 26));
+        }
+        return m;
+    }
+
+    void write_fully(const int fd, const uint8_t* d, uint64_t n)
+    {
+        while (0 < n)
+        {
+            const ssize_t written = ::write(fd, d, n);
+            if (0 > written)
+            {
+                std::cerr << "Write failed." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            d += written;
+            n -= written;
+        }
+    }
+};
+
+int main(int argc, char** argv)
+{
+    const uint32_t rounds = argc > 1 ? std::stoul(argv[1]) : 200;
+    const watson::Map m(message(64, 64 * 1024));
+
+    int fds[2];
+    if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+    {
+        std::cerr << "socketpair failed." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::thread drain([&fds]() {
+        std::vector<char> buffer(1 << 20);
+        while (0 < read(fds[1], buffer.data(), buffer.size()))
+        {
+        }
+    });
+
+    Bench_util::header("watson::Ngrdnt_gather");
+    uint64_t bytes = 0;
+    {
+        Bench_timer timer;
+        for (uint32_t h = 0; h < rounds; ++h)
+        {
+            const watson::Ngrdnt::Ptr val(watson::new_ngrdnt(m));
+            write_fully(fds[0], val->data(), val->size());
+            bytes += val->size();
+        }
+        Bench_util::throughput("new_ngrdnt + write", bytes, timer.elapsed());
+    }
+
+    {
+        watson::Ngrdnt_gather gather;
+        Bench_timer timer;
+        for (uint32_t h = 0; h < rounds; ++h)
+        {
+            gather.clear();
+            gather.add(m);
+            gather.write(fds[0]);
+        }
+        Bench_util::throughput("Ngrdnt_gather + writev", bytes, timer.elapsed());
+        Bench_util::report("buffers per message", gather.iov().size(), "iovecs");
+    }
+
+    close(fds[0]);
+    drain.join();
+    close(fds[1]);
+    return EXIT_SUCCESS;
+}
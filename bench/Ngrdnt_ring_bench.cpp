@@ -0,0 +1,126 @@
+/*!
+ \file bench/Ngrdnt_ring_bench.cpp
+ \brief WatSON Ring Benchmark
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "benchhelper.h"
+#include "ring.h"
+#include "watson.h"
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+int main(int argc, char** argv)
+{
+    const uint32_t count = argc > 1 ? std::stoul(argv[1]) : 2000000;
+    const std::string text(100, 'm');
+
+    Bench_util::header("watson::Ngrdnt_ring");
+    {
+        // What the ring replaces: a locked queue of shared pointers.
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<watson::Ngrdnt::Ptr> queue;
+        Bench_timer timer;
+        std::thread consumer([&]() {
+            uint64_t bytes = 0;
+            for (uint32_t h = 0; h < count; ++h)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&queue]() { return !queue.empty(); });
+                bytes += queue.front()->size();
+                queue.pop_front();
+            }
+        });
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            watson::Ngrdnt::Ptr val(watson::new_ngrdnt(text));
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(val));
+            }
+            ready.notify_one();
+        }
+        consumer.join();
+        Bench_util::report("locked queue", count / timer.elapsed() / 1e6, "M msg/s");
+    }
+
+    {
+        watson::Ngrdnt_ring ring(1 << 20);
+        Bench_timer timer;
+        std::thread consumer([&]() {
+            uint64_t bytes = 0;
+            for (uint32_t h = 0; h < count;)
+            {
+                const uint8_t* d = ring.peek();
+                if (!d)
+                {
+                    ring.release();
+                    std::this_thread::yield();
+                    continue;
+                }
+                bytes += watson::ngrdnt_size(d);
+                ring.pop();
+                if (0 == ++h % 64)
+                {
+                    ring.release();
+                }
+            }
+        });
+
+        // Encode in place, publishing every 64 messages.
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            const uint64_t sz = watson::ngrdnt_header_size(watson::size_type_necessary(text.size())) + text.size();
+            uint8_t* out;
+            while (!(out = ring.reserve(sz)))
+            {
+                ring.publish();
+                std::this_thread::yield();
+            }
+            out = watson::write_ngrdnt_header(out, watson::Ngrdnt_type::k_string, text.size());
+            memcpy(out, text.data(), text.size());
+            ring.commit(sz);
+            if (0 == h % 64)
+            {
+                ring.publish();
+            }
+        }
+        ring.publish();
+        consumer.join();
+        Bench_util::report("ring, encoded in place", count / timer.elapsed() / 1e6, "M msg/s");
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#include "benchhelper.h"
+#include "numeric.h"
+#include "watson.h"
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    template <typename T>
+    void compare(const std::string& name, const std::vector<T>& values)
+    {
+        const uint32_t rounds = 10;
+        size_t chars = 0;
+        {
+            Bench_timer timer;
+            for (uint32_t h = 0; h < rounds; ++h)
+            {
+                for (const T val : values)
+                {
+                    chars += std::to_string(val).size();
+                }
+            }
+            Bench_util::report(name + " std::to_string", values.size() * rounds / timer.elapsed() / 1000000.0, "M/s");
+        }
+        {
+            char text[watson::k_max_number_text];
+            Bench_timer timer;
+            for (uint32_t h = 0; h < rounds; ++h)
+            {
+                for (const T val : values)
+                {
+                    chars += watson::write_number(text, val) - text;
+                }
+            }
+            Bench_util::report(name + " write_number", values.size() * rounds / timer.elapsed() / 1000000.0, "M/s");
+        }
+        // Keep the work from being thrown away.
+        if (0 == chars)
+        {
+            std::abort();
+        }
+    }
+}; // namespace (anonymous)
+
+int main(int argc, char** argv)
+{
+    const uint32_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::mt19937_64 rng(1);
+
+    std::vector<int32_t> int32s(count);
+    std::vector<int64_t> int64s(count);
+    std::vector<uint64_t> uint64s(count);
+    std::vector<double> doubles(count);
+    for (uint32_t h = 0; h < count; ++h)
+    {
+        // Spread the values over every length.
+        int32s[h] = static_cast<int32_t>(rng()) >> (h % 32);
+        int64s[h] = static_cast<int64_t>(rng()) >> (h % 64);
+        uint64s[h] = rng() >> (h % 64);
+        doubles[h] = static_cast<double>(rng() >> (h % 64)) / (1ull << (h % 40));
+    }
+
+    Bench_util::header("watson::write_number");
+    compare("int32", int32s);
+    compare("int64", int64s);
+    compare("uint64", uint64s);
+    compare("double", doubles);
+    return EXIT_SUCCESS;
+}
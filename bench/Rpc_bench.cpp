@@ -0,0 +1,77 @@
+#include "benchhelper.h"
+#include "rpc.h"
+#include "watson.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+    //! Make \c count calls with at most \c window in flight.
+    void run(const std::string& path, const uint32_t count, const uint32_t window,
+            const std::string& name)
+    {
+        watson::Rpc_client client(path);
+        const watson::Ngrdnt::Ptr request(watson::new_ngrdnt(std::string(100, 'r')));
+        std::vector<std::chrono::steady_clock::time_point> started(count);
+        std::vector<double> latency(count);
+        std::mutex mutex;
+        std::condition_variable done;
+        uint32_t in_flight = 0;
+
+        Bench_timer timer;
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [&]() { return in_flight < window; });
+                ++in_flight;
+            }
+            started[h] = std::chrono::steady_clock::now();
+            client.call(request, [&, h](const watson::Ngrdnt::Ptr& response, std::exception_ptr error) {
+                latency[h] = std::chrono::duration<double, std::micro>(
+                        std::chrono::steady_clock::now() - started[h]).count();
+                std::lock_guard<std::mutex> lock(mutex);
+                --in_flight;
+                done.notify_one();
+            });
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&]() { return 0 == in_flight; });
+        }
+        const double seconds = timer.elapsed();
+
+        std::sort(latency.begin(), latency.end());
+        Bench_util::report(name, count / seconds / 1000.0, "K req/s");
+        Bench_util::report(name + " p99", latency[count * 99 / 100], "us");
+        Bench_util::report(name + " requests/write", static_cast<double>(count) / client.writes(), "req");
+    }
+}; // namespace (anonymous)
+
+int main(int argc, char** argv)
+{
+    const uint32_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    const std::string path("/tmp/watson_rpc_bench_" + std::to_string(::getpid()) + ".sock");
+
+    watson::Rpc_server server(path,
+            [](const watson::Ngrdnt::Ptr& request, const watson::Rpc_server::Reply& reply) {
+                reply(request, nullptr);
+            });
+    std::thread loop([&server]() { server.run(); });
+
+    Bench_util::header("watson::Rpc");
+    run(path, count / 10, 1, "1 in flight");
+    run(path, count, 16, "16 in flight");
+    run(path, count, 256, "256 in flight");
+
+    server.stop();
+    loop.join();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+/*!
+ \file bench/Unzip_parallel_bench.cpp
+ \brief WatSON Parallel Decompression Benchmark
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "benchhelper.h"
+#include "watson.h"
+#include "worker_pool.h"
+#include "zip.h"
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    //! A snapshot of about \c sz bytes.
+    watson::Ngrdnt::Ptr snapshot(const uint64_t sz)
+    {
+        watson::Container c;
+        uint64_t total = 0;
+        for (uint32_t h = 0; total < sz; ++h)
+        {
+            std::ostringstream oss;
+            oss << "snapshot record " << h << " value=" << (h * 2654435761u);
+            c.mutable_children().push_back(watson::new_ngrdnt(oss.str()));
+            total += c.mutable_children().back()->size();
+        }
+        return watson::new_ngrdnt(c);
+    }
+
+    double time_unzip(const watson::Ngrdnt::Ptr& z, uint8_t* out, const uint64_t sz,
+            watson::Worker_pool* pool)
+    {
+        Bench_timer timer;
+        for (int round = 0; round < 5; ++round)
+        {
+            const uint8_t* result = pool ? watson::unzip(z, out, sz, *pool) : watson::unzip(z, out, sz);
+            if (!result)
+            {
+                std::cerr << "Decompression failed." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        return timer.elapsed() / 5;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    const uint64_t target = (argc > 1 ? std::stoull(argv[1]) : 256) << 20;
+    const watson::Ngrdnt::Ptr raw(snapshot(target));
+    const watson::Ngrdnt::Ptr z(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(raw))));
+    std::unique_ptr<uint8_t[]> out(new uint8_t[raw->size()]);
+
+    Bench_util::header("watson::unzip parallel");
+    Bench_util::report("uncompressed", raw->size() / 1048576.0, "MiB");
+    Bench_util::report("compressed", z->size() / 1048576.0, "MiB");
+
+    const double serial = time_unzip(z, out.get(), raw->size(), nullptr);
+    Bench_util::throughput("serial", raw->size(), serial);
+
+    const size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t threads = 1; threads <= hw; threads *= 2)
+    {
+        // The calling thread takes part, so the pool needs one less.
+        watson::Worker_pool pool(threads - 1);
+        const double seconds = time_unzip(z, out.get(), raw->size(), &pool);
+        std::ostringstream name;
+        name << threads << " threads";
+        Bench_util::throughput(name.str(), raw->size(), seconds);
+        Bench_util::report(name.str() + " speedup", serial / seconds, "x");
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+/*!
+ \file bench/Zip_dictionary_bench.cpp
+ \brief WatSON Dictionary Compression Benchmark
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "benchhelper.h"
+#include "watson.h"
+#include "zip.h"
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+    const char* const k_words[] = {
+        "pending", "shipped", "delivered", "cancelled", "standard", "express",
+        "warehouse-east", "warehouse-west", "USD", "EUR", "gift-wrap", "fragile"
+    };
+
+    //! A recipe like the ones on the wire, between 200 B and 4 KB.
+    watson::Ngrdnt::Ptr recipe(std::mt19937& rng)
+    {
+        watson::Map m;
+        std::ostringstream id;
+        id << "order-" << rng() % 1000000;
+        m.mutable_children()[1] = watson::new_ngrdnt(id.str());
+        m.mutable_children()[2] = watson::new_ngrdnt(std::string(k_words[rng() % 4]));
+        m.mutable_children()[3] = watson::new_ngrdnt(static_cast<int64_t>(1420070400 + rng() % 31536000));
+
+        watson::Container lines;
+        const uint32_t count = 1 + rng() % 40;
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            watson::Map line;
+            std::ostringstream sku;
+            sku << "sku-" << rng() % 5000;
+            line.mutable_children()[1] = watson::new_ngrdnt(sku.str());
+            line.mutable_children()[2] = watson::new_ngrdnt(static_cast<int32_t>(1 + rng() % 5));
+            line.mutable_children()[3] = watson::new_ngrdnt(std::string(k_words[4 + rng() % 2]));
+            line.mutable_children()[4] = watson::new_ngrdnt(std::string(k_words[6 + rng() % 6]));
+            lines.mutable_children().push_back(watson::new_ngrdnt(line));
+        }
+        m.mutable_children()[4] = watson::new_ngrdnt(lines);
+        return watson::new_ngrdnt(m);
+    }
+
+    struct Result
+    {
+        uint64_t raw_bytes;
+        uint64_t zip_bytes;
+        double compress_seconds;
+        double decompress_seconds;
+    };
+
+    //! Compress and decompress every message, \c rounds times over.
+    template <typename F>
+    Result run(const std::vector<watson::Ngrdnt::Ptr>& messages, const int rounds, F compress)
+    {
+        Result result = { 0, 0, 0, 0 };
+        std::vector<watson::Ngrdnt::Ptr> zipped(messages.size());
+        Bench_timer compress_timer;
+        for (int round = 0; round < rounds; ++round)
+        {
+            for (size_t h = 0; h < messages.size(); ++h)
+            {
+                zipped[h] = compress(messages[h]);
+            }
+        }
+        result.compress_seconds = compress_timer.elapsed();
+
+        std::vector<uint8_t> out(1 << 16);
+        Bench_timer decompress_timer;
+        for (int round = 0; round < rounds; ++round)
+        {
+            for (size_t h = 0; h < zipped.size(); ++h)
+            {
+                if (!watson::unzip(zipped[h], out.data(), out.size()) ||
+                        0 != memcmp(out.data(), messages[h]->data(), messages[h]->size()))
+                {
+                    std::cerr << "Round trip failed." << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        result.decompress_seconds = decompress_timer.elapsed();
+
+        for (size_t h = 0; h < messages.size(); ++h)
+        {
+            result.raw_bytes += messages[h]->size() * rounds;
+            result.zip_bytes += zipped[h]->size() * rounds;
+        }
+        return result;
+    }
+
+    void report(const std::string& name, const Result& r)
+    {
+        Bench_util::report(name + " ratio", static_cast<double>(r.raw_bytes) / r.zip_bytes, "x");
+        Bench_util::throughput(name + " compress", r.raw_bytes, r.compress_seconds);
+        Bench_util::throughput(name + " decompress", r.raw_bytes, r.decompress_seconds);
+    }
+};
+
+int main(int argc, char** argv)
+{
+    std::mt19937 rng(42);
+    std::vector<watson::Ngrdnt::Ptr> samples;
+    for (int h = 0; h < 2000; ++h)
+    {
+        samples.push_back(recipe(rng));
+    }
+    std::vector<watson::Ngrdnt::Ptr> messages;
+    uint64_t total = 0;
+    for (int h = 0; h < 5000; ++h)
+    {
+        messages.push_back(recipe(rng));
+        total += messages.back()->size();
+    }
+
+    Bench_util::header("watson::Zip_dictionary");
+    Bench_util::report("messages", messages.size(), "count");
+    Bench_util::report("average message", static_cast<double>(total) / messages.size(), "bytes");
+
+    Bench_timer train_timer;
+    const watson::Zip_dictionary::Ptr dict(watson::Zip_dictionary::train(samples, 16384));
+    Bench_util::report("train", train_timer.elapsed() * 1000.0, "ms");
+    Bench_util::report("dictionary", dict->size(), "bytes");
+    watson::register_dictionary(dict);
+
+    const int rounds = 10;
+    report("snappy", run(messages, rounds, [](const watson::Ngrdnt::Ptr& m) {
+        return watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(m)));
+    }));
+    report("dictionary", run(messages, rounds, [&dict](const watson::Ngrdnt::Ptr& m) {
+        return watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(m)), *dict);
+    }));
+    return EXIT_SUCCESS;
+}
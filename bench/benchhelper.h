@@ -0,0 +1,84 @@
+#pragma once
+/*!
+ \file bench/benchhelper.h
+ \brief WatSON benchmark helpers
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/time.h>
+
+struct Bench_timer
+{
+    Bench_timer()
+    {
+        gettimeofday(&_start, NULL);
+    }
+
+    //! Seconds since construction.
+    double elapsed() const
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        return ((now.tv_sec - _start.tv_sec) * 1000000ULL +
+                (now.tv_usec - _start.tv_usec)) / 1000000.0;
+    }
+
+    struct timeval _start;
+};
+
+struct Bench_util
+{
+    static void header(const std::string& suite_name)
+    {
+        std::cout << "%BENCH_STARTING% " << suite_name << std::endl;
+        std::cout << std::left << std::setw(32) << "name"
+                << std::right << std::setw(14) << "value"
+                << "  unit" << std::endl;
+    }
+
+    static void report(const std::string& name, double value, const std::string& unit)
+    {
+        std::cout << std::left << std::setw(32) << name
+                << std::right << std::setw(14)
+                << std::setiosflags(std::ios::fixed) << std::setprecision(3) << value
+                << "  " << unit << std::endl;
+    }
+
+    //! Report a rate in MB/s.
+    static void throughput(const std::string& name, uint64_t bytes, double seconds)
+    {
+        report(name, bytes / seconds / 1000000.0, "MB/s");
+    }
+};
@@ -0,0 +1,220 @@
+/*!
+ \file watson/gather.cpp
+ \brief WatSON scatter-gather output implementation.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "gather.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ios>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+namespace watson
+{
+    namespace
+    {
+        //! Size of the blocks holding generated bytes.
+        const size_t k_gather_block_size = 4096;
+
+        //! Largest Ngrdnt header.
+        const size_t k_max_header_size = 9;
+    }; // namespace watson::(anonymous)
+
+
+    // ----------------------------------------------------------------
+    // Ngrdnt_gather class
+    // ----------------------------------------------------------------
+
+    Ngrdnt_gather::Ngrdnt_gather() :
+            iov_(),
+            keep_(),
+            blocks_(),
+            block_used_(k_gather_block_size),
+            size_(0)
+    {
+    }
+
+    void Ngrdnt_gather::add(const Ngrdnt::Ptr& val)
+    {
+        child(val);
+    }
+
+    void Ngrdnt_gather::add(const Container& val)
+    {
+        uint64_t sz = 0;
+        for (const Ngrdnt::Ptr& ing : val.children())
+        {
+            sz += ing->size();
+        }
+
+        uint8_t header[k_max_header_size];
+        const uint8_t* end = write_ngrdnt_header(header, Ngrdnt_type::k_container, sz);
+        append(header, end - header, true);
+
+        for (const Ngrdnt::Ptr& ing : val.children())
+        {
+            child(ing);
+        }
+    }
+
+    void Ngrdnt_gather::add(const Map& val)
+    {
+        uint64_t sz = 0;
+        for (const auto& h : val.children())
+        {
+            sz += h.second->size() + sizeof(uint32_t);
+        }
+
+        uint8_t header[k_max_header_size];
+        const uint8_t* end = write_ngrdnt_header(header, Ngrdnt_type::k_map, sz);
+        append(header, end - header, true);
+
+        for (const auto& h : val.children())
+        {
+            append(reinterpret_cast<const uint8_t*>(&h.first), sizeof(uint32_t), true);
+            child(h.second);
+        }
+    }
+
+    void Ngrdnt_gather::add(const Bytes& val)
+    {
+        uint8_t header[k_max_header_size + sizeof(uint32_t)];
+        uint8_t* end = write_ngrdnt_header(header, Ngrdnt_type::k_binary,
+                val.size() + sizeof(uint32_t));
+        const uint32_t hint = val.marshal_hint();
+        memcpy(end, &hint, sizeof(hint));
+        end += sizeof(hint);
+        append(header, end - header, true);
+
+        append(val.data(), val.size(), val.size() <= k_gather_copy_limit);
+    }
+
+    void Ngrdnt_gather::clear()
+    {
+        iov_.clear();
+        keep_.clear();
+        blocks_.clear();
+        block_used_ = k_gather_block_size;
+        size_ = 0;
+    }
+
+    uint64_t Ngrdnt_gather::write(const int fd) const
+    {
+        std::vector<iovec> batch;
+        size_t h = 0;
+        size_t done = 0;
+        while (h < iov_.size())
+        {
+            // The first buffer may have been written in part.
+            const size_t n = std::min<size_t>(IOV_MAX, iov_.size() - h);
+            batch.assign(iov_.begin() + h, iov_.begin() + h + n);
+            batch[0].iov_base = static_cast<uint8_t*>(batch[0].iov_base) + done;
+            batch[0].iov_len -= done;
+
+            ssize_t written = ::writev(fd, batch.data(), n);
+            if (0 > written && EINTR == errno)
+            {
+                continue;
+            }
+            if (0 > written)
+            {
+                throw std::ios_base::failure(std::string("Unable to write WatSON data: ") + strerror(errno));
+            }
+
+            for (size_t s = 0; s < n && 0 < written; ++s, ++h, done = 0)
+            {
+                if (static_cast<size_t>(written) < batch[s].iov_len)
+                {
+                    done += written;
+                    break;
+                }
+                written -= batch[s].iov_len;
+            }
+        }
+        return size_;
+    }
+
+    uint8_t* Ngrdnt_gather::allocate(const size_t n)
+    {
+        if (block_used_ + n > k_gather_block_size)
+        {
+            blocks_.emplace_back(new uint8_t[k_gather_block_size]);
+            block_used_ = 0;
+        }
+        uint8_t* result = blocks_.back().get() + block_used_;
+        block_used_ += n;
+        return result;
+    }
+
+    void Ngrdnt_gather::append(const uint8_t* d, const size_t n, const bool copy)
+    {
+        if (0 == n)
+        {
+            return;
+        }
+        if (copy)
+        {
+            uint8_t* target = allocate(n);
+            memcpy(target, d, n);
+            d = target;
+        }
+
+        // Pieces that follow each other in memory share a buffer.
+        iovec* last = iov_.empty() ? nullptr : &iov_.back();
+        if (last && static_cast<uint8_t*>(last->iov_base) + last->iov_len == d)
+        {
+            last->iov_len += n;
+        }
+        else
+        {
+            iov_.push_back(iovec{const_cast<uint8_t*>(d), n});
+        }
+        size_ += n;
+    }
+
+    void Ngrdnt_gather::child(const Ngrdnt::Ptr& val)
+    {
+        const bool copy = val->size() <= k_gather_copy_limit;
+        if (!copy)
+        {
+            keep_.push_back(val);
+        }
+        append(val->data(), val->size(), copy);
+    }
+}; // namespace watson
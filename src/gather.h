@@ -0,0 +1,130 @@
+#pragma once
+/*!
+ \file watson/gather.h
+ \brief WatSON scatter-gather output.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "watson.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <sys/uio.h>
+
+namespace watson
+{
+    /*!
+     \brief Children up to this size are copied rather than referenced.
+     \since 0.2
+     */
+    constexpr size_t k_gather_copy_limit = 64;
+
+    /*!
+     \brief Serializes Ngrdnts as a list of buffers for writev().
+
+     new_ngrdnt(const Container&) and new_ngrdnt(const Map&) copy every
+     child into a new buffer. Ngrdnt_gather only generates the headers
+     and map keys, and points at the children where they already are, so
+     a large child is never copied on its way to a file or socket.
+
+     Small children are copied next to the headers instead, and pieces
+     that are adjacent in memory share an iovec, which keeps the list
+     short. Every Ngrdnt added is kept alive until clear().
+
+     \code
+     watson::Ngrdnt_gather gather;
+     gather.add(map);
+     gather.write(socket_fd);
+     \endcode
+     \since 0.2
+     */
+    class Ngrdnt_gather
+    {
+    public:
+        Ngrdnt_gather();
+        Ngrdnt_gather(const Ngrdnt_gather& o) = delete;
+        Ngrdnt_gather(Ngrdnt_gather&& o) = default;
+        ~Ngrdnt_gather() = default;
+        Ngrdnt_gather& operator=(const Ngrdnt_gather& rhs) = delete;
+        Ngrdnt_gather& operator=(Ngrdnt_gather&& rhs) = default;
+
+        //! Add an Ngrdnt as it is.
+        void add(const Ngrdnt::Ptr& val);
+
+        //! Add a container, as new_ngrdnt(const Container&) would.
+        void add(const Container& val);
+
+        //! Add a map, as new_ngrdnt(const Map&) would.
+        void add(const Map& val);
+
+        /*!
+         \brief Add bytes, as new_ngrdnt(const Bytes&) would.
+
+         The data is referenced, so \c val must outlive the write.
+
+         \param val The bytes.
+         */
+        void add(const Bytes& val);
+
+        //! The buffers, in order.
+        inline const std::vector<iovec>& iov() const { return iov_; }
+
+        //! The total number of bytes.
+        inline uint64_t size() const { return size_; }
+
+        //! Forget everything added so far.
+        void clear();
+
+        /*!
+         \brief Write everything with as few writev() calls as possible.
+
+         Short writes are continued until everything is written, so a
+         non-blocking descriptor is not supported.
+
+         \param fd Where to write.
+         \return The number of bytes written.
+         */
+        uint64_t write(int fd) const;
+
+    private:
+        //! Space for generated bytes, which never moves once handed out.
+        uint8_t* allocate(size_t n);
+        void append(const uint8_t* d, size_t n, bool copy);
+        void child(const Ngrdnt::Ptr& val);
+
+        std::vector<iovec> iov_;
+        std::vector<Ngrdnt::Ptr> keep_;
+        std::vector<std::unique_ptr<uint8_t[]>> blocks_;
+        size_t block_used_;
+        uint64_t size_;
+    }; // class watson::Ngrdnt_gather
+}; // namespace watson
@@ -0,0 +1,867 @@
+/*!
+ \file watson/json.cpp
+ \brief WatSON conversion from and to JSON.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "json.h"
+#include "numeric.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <locale.h>
+#include <stdexcept>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+namespace watson
+{
+    namespace
+    {
+        inline bool is_space(const char c)
+        {
+            return ' ' == c || '\n' == c || '\r' == c || '\t' == c;
+        }
+
+        inline bool is_digit(const char c)
+        {
+            return '0' <= c && c <= '9';
+        }
+
+        int hex_value(const char c)
+        {
+            if (is_digit(c))
+            {
+                return c - '0';
+            }
+            if ('a' <= c && c <= 'f')
+            {
+                return c - 'a' + 10;
+            }
+            if ('A' <= c && c <= 'F')
+            {
+                return c - 'A' + 10;
+            }
+            return -1;
+        }
+
+        void append_utf8(std::string& out, const uint32_t cp)
+        {
+            if (cp < 0x80)
+            {
+                out.push_back(static_cast<char>(cp));
+            }
+            else if (cp < 0x800)
+            {
+                out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+            else if (cp < 0x10000)
+            {
+                out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+            else
+            {
+                out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+        }
+
+        //! Powers of ten that are exact as doubles.
+        const double k_exact_powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        //! The C locale, so strtod always reads '.' as the decimal point.
+        locale_t c_locale()
+        {
+            static const locale_t loc = newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+            if (static_cast<locale_t>(0) == loc)
+            {
+                throw std::runtime_error("Unable to create the C locale.");
+            }
+            return loc;
+        }
+
+        //! Find the first '"', '\\' or control character, eight bytes at a time.
+        inline const char* scan_plain(const char* p, const char* const end)
+        {
+            const uint64_t ones = 0x0101010101010101ull;
+            const uint64_t highs = 0x8080808080808080ull;
+            for (; end - p >= 8; p += 8)
+            {
+                uint64_t w;
+                memcpy(&w, p, sizeof(w));
+                const uint64_t quote = w ^ (ones * '"');
+                const uint64_t slash = w ^ (ones * '\\');
+                // A zero byte in any of these marks a byte to stop at.
+                const uint64_t hit = ((quote - ones) & ~quote) |
+                        ((slash - ones) & ~slash) |
+                        ((w - ones * 0x20) & ~w);
+                if (hit & highs)
+                {
+                    break;
+                }
+            }
+            while (p < end && '"' != *p && '\\' != *p && static_cast<unsigned char>(*p) >= 0x20)
+            {
+                ++p;
+            }
+            return p;
+        }
+
+        //! Text collected before it is handed to a stream.
+        const size_t k_flush_size = 65536;
+
+        const char k_base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        const char k_hex[] = "0123456789abcdef";
+    }; // namespace watson::(anonymous)
+
+    // ----------------------------------------------------------------
+    // Json_transcoder class
+    // ----------------------------------------------------------------
+
+    Json_transcoder::Json_transcoder(Glossary glossary) :
+            builder_(std::move(glossary)),
+            scratch_(),
+            single_(),
+            begin_(nullptr),
+            ptr_(nullptr),
+            end_(nullptr)
+    {
+    }
+
+    size_t Json_transcoder::transcode(const char* json, const size_t n, std::vector<uint8_t>& out)
+    {
+        begin_ = json;
+        ptr_ = json;
+        end_ = json + n;
+
+        // The output is grown ahead, and cut back to what was used.
+        builder_.start(out);
+        size_t count = 0;
+        try
+        {
+            for (skip_space(); ptr_ < end_; skip_space())
+            {
+                value(0);
+                ++count;
+            }
+        }
+        catch (...)
+        {
+            builder_.abandon();
+            throw;
+        }
+        builder_.finish();
+        return count;
+    }
+
+    Ngrdnt::Ptr Json_transcoder::transcode(const std::string& json)
+    {
+        single_.clear();
+        if (1 != transcode(json.data(), json.size(), single_))
+        {
+            throw std::runtime_error("Expected a single JSON value.");
+        }
+        return Ngrdnt::clone(single_.data());
+    }
+
+    void Json_transcoder::value(const size_t depth)
+    {
+        if (ptr_ >= end_)
+        {
+            fail("Expected a value");
+        }
+        switch (*ptr_)
+        {
+            case '{':
+                object(depth + 1);
+                break;
+            case '[':
+                array(depth + 1);
+                break;
+            case '"':
+                string();
+                break;
+            case 't':
+                literal("true", 4, Ngrdnt_type::k_true);
+                break;
+            case 'f':
+                literal("false", 5, Ngrdnt_type::k_false);
+                break;
+            case 'n':
+                literal("null", 4, Ngrdnt_type::k_null);
+                break;
+            default:
+                number();
+                break;
+        }
+    }
+
+    void Json_transcoder::object(const size_t depth)
+    {
+        if (depth > k_json_max_depth)
+        {
+            fail("Nested too deeply");
+        }
+        const size_t start = builder_.open();
+        ++ptr_;
+
+        skip_space();
+        if (ptr_ < end_ && '}' == *ptr_)
+        {
+            ++ptr_;
+            builder_.close(start, Ngrdnt_type::k_map);
+            return;
+        }
+        for (;;)
+        {
+            skip_space();
+            if (ptr_ >= end_ || '"' != *ptr_)
+            {
+                fail("Expected a key");
+            }
+            const char* key;
+            size_t n;
+            read_string(&key, &n);
+            builder_.key(key, n);
+
+            skip_space();
+            if (ptr_ >= end_ || ':' != *ptr_)
+            {
+                fail("Expected ':'");
+            }
+            ++ptr_;
+            skip_space();
+            value(depth);
+
+            skip_space();
+            if (ptr_ < end_ && ',' == *ptr_)
+            {
+                ++ptr_;
+                continue;
+            }
+            if (ptr_ < end_ && '}' == *ptr_)
+            {
+                ++ptr_;
+                break;
+            }
+            fail("Expected ',' or '}'");
+        }
+        builder_.close(start, Ngrdnt_type::k_map);
+    }
+
+    void Json_transcoder::array(const size_t depth)
+    {
+        if (depth > k_json_max_depth)
+        {
+            fail("Nested too deeply");
+        }
+        const size_t start = builder_.open();
+        ++ptr_;
+
+        skip_space();
+        if (ptr_ < end_ && ']' == *ptr_)
+        {
+            ++ptr_;
+            builder_.close(start, Ngrdnt_type::k_container);
+            return;
+        }
+        for (;;)
+        {
+            skip_space();
+            value(depth);
+
+            skip_space();
+            if (ptr_ < end_ && ',' == *ptr_)
+            {
+                ++ptr_;
+                continue;
+            }
+            if (ptr_ < end_ && ']' == *ptr_)
+            {
+                ++ptr_;
+                break;
+            }
+            fail("Expected ',' or ']'");
+        }
+        builder_.close(start, Ngrdnt_type::k_container);
+    }
+
+    void Json_transcoder::string()
+    {
+        const char* s;
+        size_t n;
+        read_string(&s, &n);
+        builder_.string(s, n);
+    }
+
+    void Json_transcoder::number()
+    {
+        const char* const start = ptr_;
+        const bool negative = ptr_ < end_ && '-' == *ptr_;
+        if (negative)
+        {
+            ++ptr_;
+        }
+        if (ptr_ >= end_ || !is_digit(*ptr_))
+        {
+            fail("Expected a value");
+        }
+        if ('0' == *ptr_ && ptr_ + 1 < end_ && is_digit(ptr_[1]))
+        {
+            fail("Leading zero");
+        }
+
+        // Integers are accumulated as they are scanned.
+        uint64_t magnitude = 0;
+        bool overflow = false;
+        for (; ptr_ < end_ && is_digit(*ptr_); ++ptr_)
+        {
+            const uint64_t digit = *ptr_ - '0';
+            overflow = overflow || magnitude > (std::numeric_limits<uint64_t>::max() - digit) / 10;
+            magnitude = magnitude * 10 + digit;
+        }
+        const bool fraction = ptr_ < end_ && ('.' == *ptr_ || 'e' == *ptr_ || 'E' == *ptr_);
+
+        if (!fraction && !overflow && builder_.integer(magnitude, negative))
+        {
+            return;
+        }
+
+        // The digits after the point carry on the same integer, as long
+        // as it stays exact.
+        int exponent = 0;
+        if (ptr_ < end_ && '.' == *ptr_)
+        {
+            ++ptr_;
+            if (ptr_ >= end_ || !is_digit(*ptr_))
+            {
+                fail("Expected a digit");
+            }
+            for (; ptr_ < end_ && is_digit(*ptr_); ++ptr_)
+            {
+                const uint64_t digit = *ptr_ - '0';
+                overflow = overflow || magnitude > (std::numeric_limits<uint64_t>::max() - digit) / 10;
+                magnitude = magnitude * 10 + digit;
+                --exponent;
+            }
+        }
+        if (ptr_ < end_ && ('e' == *ptr_ || 'E' == *ptr_))
+        {
+            ++ptr_;
+            const bool negative_exponent = ptr_ < end_ && '-' == *ptr_;
+            if (ptr_ < end_ && ('+' == *ptr_ || '-' == *ptr_))
+            {
+                ++ptr_;
+            }
+            if (ptr_ >= end_ || !is_digit(*ptr_))
+            {
+                fail("Expected a digit");
+            }
+            int written = 0;
+            for (; ptr_ < end_ && is_digit(*ptr_); ++ptr_)
+            {
+                written = std::min(written * 10 + (*ptr_ - '0'), 100000);
+            }
+            exponent += negative_exponent ? -written : written;
+        }
+
+        // When both the digits and the power of ten are exact doubles, a
+        // single multiplication or division rounds correctly. Anything
+        // else goes through strtod in the C locale, on a terminated copy.
+        double val;
+        if (!overflow && magnitude < (1ull << 53) && -22 <= exponent && exponent <= 22)
+        {
+            val = static_cast<double>(magnitude);
+            val = 0 > exponent ? val / k_exact_powers[-exponent] : val * k_exact_powers[exponent];
+            val = negative ? -val : val;
+        }
+        else
+        {
+            scratch_.assign(start, ptr_);
+            char* parsed = nullptr;
+            val = strtod_l(scratch_.c_str(), &parsed, c_locale());
+            if (scratch_.c_str() + scratch_.size() != parsed)
+            {
+                ptr_ = start;
+                fail("Invalid number");
+            }
+        }
+        builder_.real(val);
+    }
+
+    void Json_transcoder::literal(const char* text, const size_t n, const Ngrdnt_type type)
+    {
+        if (static_cast<size_t>(end_ - ptr_) < n || 0 != memcmp(ptr_, text, n))
+        {
+            fail("Expected a value");
+        }
+        ptr_ += n;
+        builder_.marker(type);
+    }
+
+    void Json_transcoder::read_string(const char** s, size_t* n)
+    {
+        const char* const start = ++ptr_;
+        ptr_ = scan_plain(ptr_, end_);
+        if (ptr_ < end_ && '"' == *ptr_)
+        {
+            // No escapes, so the input can be used as it is.
+            *s = start;
+            *n = ptr_ - start;
+            ++ptr_;
+            return;
+        }
+
+        scratch_.assign(start, ptr_);
+        while (ptr_ < end_ && '"' != *ptr_)
+        {
+            const char c = *ptr_++;
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                fail("Control character in string");
+            }
+            if ('\\' != c)
+            {
+                scratch_.push_back(c);
+                continue;
+            }
+            if (ptr_ >= end_)
+            {
+                break;
+            }
+            switch (*ptr_++)
+            {
+                case '"': scratch_.push_back('"'); break;
+                case '\\': scratch_.push_back('\\'); break;
+                case '/': scratch_.push_back('/'); break;
+                case 'b': scratch_.push_back('\b'); break;
+                case 'f': scratch_.push_back('\f'); break;
+                case 'n': scratch_.push_back('\n'); break;
+                case 'r': scratch_.push_back('\r'); break;
+                case 't': scratch_.push_back('\t'); break;
+                case 'u':
+                    {
+                        uint32_t cp = 0;
+                        for (int h = 0; h < 4; ++h)
+                        {
+                            const int v = ptr_ < end_ ? hex_value(*ptr_++) : -1;
+                            if (0 > v)
+                            {
+                                fail("Invalid \\u escape");
+                            }
+                            cp = (cp << 4) | v;
+                        }
+
+                        // A surrogate pair spells out one code point.
+                        if (0xD800 <= cp && cp < 0xDC00 && end_ - ptr_ >= 6 &&
+                                '\\' == ptr_[0] && 'u' == ptr_[1])
+                        {
+                            uint32_t low = 0;
+                            for (int h = 2; h < 6; ++h)
+                            {
+                                const int v = hex_value(ptr_[h]);
+                                low = 0 > v ? 0 : (low << 4) | v;
+                            }
+                            if (0xDC00 <= low && low < 0xE000)
+                            {
+                                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                                ptr_ += 6;
+                            }
+                        }
+                        append_utf8(scratch_, cp);
+                    }
+                    break;
+                default:
+                    fail("Invalid escape");
+            }
+        }
+        if (ptr_ >= end_)
+        {
+            fail("Unterminated string");
+        }
+        ++ptr_;
+        *s = scratch_.data();
+        *n = scratch_.size();
+    }
+
+    void Json_transcoder::skip_space()
+    {
+        while (ptr_ < end_ && is_space(*ptr_))
+        {
+            ++ptr_;
+        }
+    }
+
+    void Json_transcoder::fail(const std::string& what) const
+    {
+        detail::fail(what, "JSON", ptr_ - begin_);
+    }
+
+    // ----------------------------------------------------------------
+    // Json_emitter class
+    // ----------------------------------------------------------------
+
+    Json_emitter::Json_emitter(Glossary glossary) :
+            glossary_(std::move(glossary)),
+            arena_(),
+            buffer_(),
+            out_(nullptr),
+            os_(nullptr)
+    {
+    }
+
+    void Json_emitter::emit(const uint8_t* d, std::string& out)
+    {
+        out_ = &out;
+        os_ = nullptr;
+        const size_t mark = out.size();
+        try
+        {
+            value(d, 0);
+        }
+        catch (...)
+        {
+            out.resize(mark);
+            arena_.reset();
+            throw;
+        }
+        arena_.reset();
+    }
+
+    void Json_emitter::emit(const Ngrdnt::Ptr& val, std::ostream& os)
+    {
+        buffer_.clear();
+        out_ = &buffer_;
+        os_ = &os;
+        try
+        {
+            value(val->data(), 0);
+        }
+        catch (...)
+        {
+            arena_.reset();
+            throw;
+        }
+        arena_.reset();
+        flush(true);
+    }
+
+    std::string Json_emitter::emit(const Ngrdnt::Ptr& val)
+    {
+        std::string result;
+        emit(val->data(), result);
+        return result;
+    }
+
+    void Json_emitter::value(const uint8_t* d, const size_t depth)
+    {
+        switch (ngrdnt_type(d[0]))
+        {
+            case Ngrdnt_type::k_null:
+                out_->append("null", 4);
+                break;
+            case Ngrdnt_type::k_true:
+                out_->append("true", 4);
+                break;
+            case Ngrdnt_type::k_false:
+                out_->append("false", 5);
+                break;
+            case Ngrdnt_type::k_float:
+                real(detail::scalar<double>(d));
+                break;
+            case Ngrdnt_type::k_int32:
+                integer(static_cast<int64_t>(detail::scalar<int32_t>(d)));
+                break;
+            case Ngrdnt_type::k_int64:
+                integer(detail::scalar<int64_t>(d));
+                break;
+            case Ngrdnt_type::k_uint64:
+                integer(detail::scalar<uint64_t>(d));
+                break;
+            case Ngrdnt_type::k_string:
+                {
+                    uint64_t n;
+                    const uint8_t* s = detail::payload(d, &n);
+                    string(reinterpret_cast<const char*>(s), n);
+                }
+                break;
+            case Ngrdnt_type::k_binary:
+                bytes(d);
+                break;
+            case Ngrdnt_type::k_flags:
+                flags(d);
+                break;
+            case Ngrdnt_type::k_container:
+            case Ngrdnt_type::k_library:
+                array(d, depth + 1);
+                break;
+            case Ngrdnt_type::k_map:
+                object(d, depth + 1);
+                break;
+            case Ngrdnt_type::k_zip:
+                {
+                    if (depth >= k_json_max_depth)
+                    {
+                        throw std::runtime_error("WatSON nested too deeply for JSON.");
+                    }
+                    // The child lives in the arena until the end of emit().
+                    const Ngrdnt::Ptr raw(Ngrdnt::temp(d));
+                    const uint64_t sz = unzipped_size(raw);
+                    const uint8_t* child = arena_.unzip(raw);
+                    checked_ngrdnt_size(child, child + sz);
+                    value(child, depth + 1);
+                }
+                break;
+            default:
+                throw std::runtime_error("Unknown WatSON type " + std::to_string(d[0]) + ".");
+        }
+    }
+
+    void Json_emitter::array(const uint8_t* d, const size_t depth)
+    {
+        if (depth > k_json_max_depth)
+        {
+            throw std::runtime_error("WatSON nested too deeply for JSON.");
+        }
+        uint64_t n;
+        const uint8_t* ptr = detail::payload(d, &n);
+        const uint8_t* const end = ptr + n;
+
+        out_->push_back('[');
+        for (bool first = true; end > ptr; first = false)
+        {
+            const uint64_t sz = checked_ngrdnt_size(ptr, end);
+            if (!first)
+            {
+                out_->push_back(',');
+            }
+            value(ptr, depth);
+            ptr += sz;
+            flush(false);
+        }
+        out_->push_back(']');
+    }
+
+    void Json_emitter::object(const uint8_t* d, const size_t depth)
+    {
+        if (depth > k_json_max_depth)
+        {
+            throw std::runtime_error("WatSON nested too deeply for JSON.");
+        }
+        uint64_t n;
+        const uint8_t* ptr = detail::payload(d, &n);
+        const uint8_t* const end = ptr + n;
+
+        out_->push_back('{');
+        for (bool first = true; end > ptr; first = false)
+        {
+            uint32_t key;
+            if (static_cast<size_t>(end - ptr) < sizeof(key))
+            {
+                throw std::runtime_error("WatSON child extends past its map.");
+            }
+            memcpy(&key, ptr, sizeof(key));
+            ptr += sizeof(key);
+            const uint64_t sz = checked_ngrdnt_size(ptr, end);
+
+            if (!first)
+            {
+                out_->push_back(',');
+            }
+            if (key < glossary_.names.size())
+            {
+                const std::string& name = glossary_.names[key];
+                string(name.data(), name.size());
+            }
+            else
+            {
+                out_->push_back('"');
+                integer(static_cast<uint64_t>(key));
+                out_->push_back('"');
+            }
+            out_->push_back(':');
+            value(ptr, depth);
+            ptr += sz;
+            flush(false);
+        }
+        out_->push_back('}');
+    }
+
+    void Json_emitter::flags(const uint8_t* d)
+    {
+        uint64_t n;
+        const uint8_t* data = detail::payload(d, &n);
+        out_->push_back('[');
+        for (uint64_t h = 0; h < n * 8; ++h)
+        {
+            if (0 < h)
+            {
+                out_->push_back(',');
+            }
+            if (data[h >> 3] & (1 << (h % 8)))
+            {
+                out_->append("true", 4);
+            }
+            else
+            {
+                out_->append("false", 5);
+            }
+        }
+        out_->push_back(']');
+    }
+
+    void Json_emitter::bytes(const uint8_t* d)
+    {
+        uint64_t n;
+        const uint8_t* data = detail::payload(d, &n);
+        if (sizeof(uint32_t) > n)
+        {
+            throw std::runtime_error("WatSON bytes are missing their marshal hint.");
+        }
+        // The marshal hint has no place in JSON.
+        data += sizeof(uint32_t);
+        n -= sizeof(uint32_t);
+
+        const size_t start = out_->size();
+        out_->resize(start + 2 + (n + 2) / 3 * 4);
+        char* out = &(*out_)[start];
+        *out++ = '"';
+        uint64_t h = 0;
+        for (; h + 3 <= n; h += 3)
+        {
+            const uint32_t v = (data[h] << 16) | (data[h + 1] << 8) | data[h + 2];
+            *out++ = k_base64[v >> 18];
+            *out++ = k_base64[(v >> 12) & 0x3F];
+            *out++ = k_base64[(v >> 6) & 0x3F];
+            *out++ = k_base64[v & 0x3F];
+        }
+        if (h < n)
+        {
+            const uint32_t v = (data[h] << 16) | (h + 1 < n ? data[h + 1] << 8 : 0);
+            *out++ = k_base64[v >> 18];
+            *out++ = k_base64[(v >> 12) & 0x3F];
+            *out++ = h + 1 < n ? k_base64[(v >> 6) & 0x3F] : '=';
+            *out++ = '=';
+        }
+        *out = '"';
+    }
+
+    void Json_emitter::string(const char* s, const size_t n)
+    {
+        const char* const end = s + n;
+        out_->push_back('"');
+        for (;;)
+        {
+            // Copy plain runs whole, and escape what stopped them.
+            const char* const plain = scan_plain(s, end);
+            out_->append(s, plain - s);
+            if (plain == end)
+            {
+                break;
+            }
+            const unsigned char c = *plain;
+            s = plain + 1;
+            switch (c)
+            {
+                case '"': out_->append("\\\"", 2); break;
+                case '\\': out_->append("\\\\", 2); break;
+                case '\b': out_->append("\\b", 2); break;
+                case '\f': out_->append("\\f", 2); break;
+                case '\n': out_->append("\\n", 2); break;
+                case '\r': out_->append("\\r", 2); break;
+                case '\t': out_->append("\\t", 2); break;
+                default:
+                    {
+                        const char escape[] = {'\\', 'u', '0', '0', k_hex[c >> 4], k_hex[c & 0xF]};
+                        out_->append(escape, sizeof(escape));
+                    }
+                    break;
+            }
+        }
+        out_->push_back('"');
+    }
+
+    void Json_emitter::integer(const uint64_t val)
+    {
+        char text[k_max_number_text];
+        out_->append(text, write_number(text, val) - text);
+    }
+
+    void Json_emitter::integer(const int64_t val)
+    {
+        char text[k_max_number_text];
+        out_->append(text, write_number(text, val) - text);
+    }
+
+    void Json_emitter::real(const double val)
+    {
+        if (!std::isfinite(val))
+        {
+            out_->append("null", 4);
+            return;
+        }
+        char text[k_max_number_text];
+        char* const end = write_number(text, val);
+        out_->append(text, end - text);
+
+        // Keep it a float when it is read back.
+        if (end == std::find_if(text, end, [](const char c) { return '.' == c || 'e' == c; }))
+        {
+            out_->append(".0", 2);
+        }
+    }
+
+    void Json_emitter::flush(const bool all)
+    {
+        if (nullptr != os_ && (all || buffer_.size() >= k_flush_size))
+        {
+            os_->write(buffer_.data(), buffer_.size());
+            buffer_.clear();
+        }
+    }
+
+    std::string to_json(const Ngrdnt::Ptr& val, const Glossary& glossary)
+    {
+        Json_emitter emitter(glossary);
+        return emitter.emit(val);
+    }
+}; // namespace watson
@@ -0,0 +1,229 @@
+#pragma once
+/*!
+ \file watson/json.h
+ \brief WatSON conversion from and to JSON.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "transcode.h"
+#include "watson.h"
+#include "zip.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace watson
+{
+    /*!
+     \brief Deepest nesting of arrays and objects accepted in JSON.
+     \since 0.2
+     */
+    constexpr size_t k_json_max_depth = 512;
+
+    /*!
+     \brief Converts JSON text to WatSON without building a DOM.
+
+     The text is parsed in a single pass, and every value is written
+     straight into one output buffer as it is read. Object keys are
+     interned into a Glossary, and objects become maps keyed by the
+     position of the name in it. Numbers become \c k_int32 when they fit,
+     then \c k_int64, then \c k_uint64; anything with a fraction or an
+     exponent, or too large for 64 bits, becomes \c k_float.
+
+     The glossary grows over every call, so a stream of documents shares
+     one set of keys. Ship it along with library(), as the first item of
+     a Recipe, so the names can be looked up again.
+
+     \code
+     watson::Json_transcoder transcoder;
+     std::vector<uint8_t> out;
+     transcoder.transcode(text.data(), text.size(), out);
+     \endcode
+     \since 0.2
+     */
+    class Json_transcoder
+    {
+    public:
+        /*!
+         \brief Constructor.
+         \param glossary Keys already known, which keep their numbers.
+         */
+        explicit Json_transcoder(Glossary glossary = Glossary());
+        Json_transcoder(const Json_transcoder& o) = delete;
+        Json_transcoder(Json_transcoder&& o) = default;
+        ~Json_transcoder() = default;
+        Json_transcoder& operator=(const Json_transcoder& rhs) = delete;
+        Json_transcoder& operator=(Json_transcoder&& rhs) = default;
+
+        /*!
+         \brief Transcode every JSON value in a text.
+
+         The values may be separated by whitespace, as in newline
+         delimited JSON. Invalid JSON throws a std::runtime_error, and
+         leaves \c out as it was.
+
+         \param json The text.
+         \param n The size of the text.
+         \param out Receives one Ngrdnt per value, appended.
+         \return The number of values.
+         */
+        size_t transcode(const char* json, size_t n, std::vector<uint8_t>& out);
+
+        /*!
+         \brief Transcode a text holding a single JSON value.
+         \param json The text.
+         \return The Ngrdnt.
+         */
+        Ngrdnt::Ptr transcode(const std::string& json);
+
+        //! The keys seen so far.
+        inline const Glossary& glossary() const { return builder_.glossary(); }
+
+        //! The keys seen so far, as a \c k_library Ngrdnt.
+        inline Ngrdnt::Ptr library() const { return builder_.library(); }
+
+    private:
+        void value(size_t depth);
+        void object(size_t depth);
+        void array(size_t depth);
+        void string();
+        void number();
+        void literal(const char* text, size_t n, Ngrdnt_type type);
+
+        //! Read a string, pointing at the input or, if escaped, scratch_.
+        void read_string(const char** s, size_t* n);
+
+        void skip_space();
+        void fail(const std::string& what) const;
+
+        detail::Ngrdnt_builder builder_;
+        std::string scratch_;
+        std::vector<uint8_t> single_;
+        const char* begin_;
+        const char* ptr_;
+        const char* end_;
+    }; // class watson::Json_transcoder
+
+    /*!
+     \brief Writes WatSON as JSON text.
+
+     The Ngrdnt is walked in place and the text is appended to one
+     buffer, without a string per value. Maps become objects, with their
+     keys looked up in a Glossary; keys it does not know are written as
+     their number. Containers, libraries and flags become arrays, Bytes
+     become base64 strings, and \c k_zip Ngrdnts are decompressed and
+     written as their child. Floats are written with the fewest digits
+     that read back exactly, and become null when they are not finite.
+
+     \code
+     watson::Json_emitter emitter(recipe.glossary());
+     emitter.emit(recipe.ngrdnt({1}), std::cout);
+     \endcode
+     \since 0.2
+     */
+    class Json_emitter
+    {
+    public:
+        /*!
+         \brief Constructor.
+         \param glossary The names of the map keys.
+         */
+        explicit Json_emitter(Glossary glossary = Glossary());
+        Json_emitter(const Json_emitter& o) = delete;
+        Json_emitter(Json_emitter&& o) = default;
+        ~Json_emitter() = default;
+        Json_emitter& operator=(const Json_emitter& rhs) = delete;
+        Json_emitter& operator=(Json_emitter&& rhs) = default;
+
+        /*!
+         \brief Write an Ngrdnt as JSON.
+
+         A malformed Ngrdnt throws a std::runtime_error, and leaves
+         \c out as it was.
+
+         \param d The raw Ngrdnt bytes.
+         \param out Receives the text, appended.
+         */
+        void emit(const uint8_t* d, std::string& out);
+
+        //! Write an Ngrdnt as JSON, appended to \c out.
+        inline void emit(const Ngrdnt::Ptr& val, std::string& out) { emit(val->data(), out); }
+
+        /*!
+         \brief Write an Ngrdnt as JSON to a stream.
+
+         The text is handed to the stream in large pieces, as it is
+         produced.
+
+         \param val The Ngrdnt.
+         \param os The stream.
+         */
+        void emit(const Ngrdnt::Ptr& val, std::ostream& os);
+
+        //! Write an Ngrdnt as JSON.
+        std::string emit(const Ngrdnt::Ptr& val);
+
+        //! The names of the map keys.
+        inline const Glossary& glossary() const { return glossary_; }
+
+    private:
+        void value(const uint8_t* d, size_t depth);
+        void array(const uint8_t* d, size_t depth);
+        void object(const uint8_t* d, size_t depth);
+        void flags(const uint8_t* d);
+        void bytes(const uint8_t* d);
+        void string(const char* s, size_t n);
+        void integer(uint64_t val);
+        void integer(int64_t val);
+        void real(double val);
+
+        //! Hand what has been written to the stream, if there is one.
+        void flush(bool all);
+
+        Glossary glossary_;
+        Unzip_arena arena_;
+        std::string buffer_;
+        std::string* out_;
+        std::ostream* os_;
+    }; // class watson::Json_emitter
+
+    /*!
+     \brief Write an Ngrdnt as JSON.
+     \param val The Ngrdnt.
+     \param glossary The names of the map keys.
+     \return The text.
+     \sa Json_emitter
+     \since 0.2
+     */
+    std::string to_json(const Ngrdnt::Ptr& val, const Glossary& glossary = Glossary());
+}; // namespace watson
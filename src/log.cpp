@@ -0,0 +1,623 @@
+/*!
+ \file watson/log.cpp
+ \brief WatSON record logs implementation.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ios>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace watson
+{
+    namespace
+    {
+        const uint8_t k_index_magic[] = { 'W', 'L', 'O', 'G' };
+        const size_t k_index_header_size = 8;
+        const size_t k_write_buffer_size = 1 << 20;
+        const size_t k_scan_buffer_size = 64 * 1024;
+
+        std::ios_base::failure io_error(const std::string& what, const std::string& path)
+        {
+            return std::ios_base::failure(what + " " + path + ": " + strerror(errno));
+        }
+
+        int open_or_throw(const std::string& path, const int flags)
+        {
+            const int fd = ::open(path.c_str(), flags, 0644);
+            if (0 > fd)
+            {
+                throw io_error("Unable to open the WatSON log", path);
+            }
+            return fd;
+        }
+
+        void write_fully(const int fd, const uint8_t* d, size_t n)
+        {
+            while (0 < n)
+            {
+                const ssize_t written = ::write(fd, d, n);
+                if (0 > written && EINTR == errno)
+                {
+                    continue;
+                }
+                if (0 > written)
+                {
+                    throw std::ios_base::failure(std::string("Unable to write the WatSON log: ") + strerror(errno));
+                }
+                d += written;
+                n -= written;
+            }
+        }
+
+        uint64_t file_size(const int fd)
+        {
+            struct stat st;
+            if (0 != ::fstat(fd, &st))
+            {
+                throw std::ios_base::failure(std::string("Unable to read the WatSON log: ") + strerror(errno));
+            }
+            return st.st_size;
+        }
+
+        /*!
+         \brief Read an index file.
+
+         Entries that point past the end of the log were written for data
+         that was lost, and are dropped.
+
+         \param fd The index file, or -1 if there is none.
+         \param interval The interval to use when the index is empty.
+         \param log_size The size of the log.
+         \param index Receives the offsets.
+         \return The interval of the index.
+         */
+        uint32_t load_index(const int fd, uint32_t interval, const uint64_t log_size,
+                std::vector<uint64_t>& index)
+        {
+            index.clear();
+            const uint64_t sz = 0 > fd ? 0 : file_size(fd);
+            if (k_index_header_size > sz)
+            {
+                return interval;
+            }
+
+            std::vector<uint8_t> buffer(sz);
+            size_t done = 0;
+            while (done < sz)
+            {
+                const ssize_t got = ::pread(fd, buffer.data() + done, sz - done, done);
+                if (0 > got && EINTR == errno)
+                {
+                    continue;
+                }
+                if (0 >= got)
+                {
+                    throw std::ios_base::failure("Unable to read the WatSON log index.");
+                }
+                done += got;
+            }
+
+            if (0 != memcmp(buffer.data(), k_index_magic, sizeof(k_index_magic)))
+            {
+                throw std::runtime_error("Not a WatSON log index.");
+            }
+            memcpy(&interval, buffer.data() + sizeof(k_index_magic), sizeof(interval));
+            if (0 == interval)
+            {
+                throw std::runtime_error("Corrupt WatSON log index.");
+            }
+
+            for (size_t h = k_index_header_size; h + sizeof(uint64_t) <= sz; h += sizeof(uint64_t))
+            {
+                uint64_t offset;
+                memcpy(&offset, buffer.data() + h, sizeof(offset));
+                if (offset >= log_size || (index.empty() ? 0 != offset : offset <= index.back()))
+                {
+                    break;
+                }
+                index.push_back(offset);
+            }
+            return interval;
+        }
+
+        /*!
+         \brief Count the complete records past a known point.
+
+         The index is extended on the way. A partial record at the end,
+         still being written or cut short by a crash, is not counted.
+
+         \param fd The log file.
+         \param reader A reader on \c fd.
+         \param interval The interval of the index.
+         \param index The index to extend.
+         \param count The known number of records, updated.
+         \param end The offset after the last known record, updated.
+         */
+        void scan_log(const int fd, Ngrdnt_reader& reader, const uint32_t interval,
+                std::vector<uint64_t>& index, uint64_t& count, uint64_t& end)
+        {
+            if (0 > ::lseek(fd, end, SEEK_SET))
+            {
+                throw std::ios_base::failure(std::string("Unable to seek in the WatSON log: ") + strerror(errno));
+            }
+            reader.reset(end);
+            try
+            {
+                while (reader.next())
+                {
+                    if (0 == count % interval && index.size() == count / interval)
+                    {
+                        index.push_back(end);
+                    }
+                    ++count;
+                    end = reader.offset();
+                }
+            }
+            catch (const std::ios_base::failure&)
+            {
+                // Stop at the partial record.
+            }
+        }
+    }; // namespace watson::(anonymous)
+
+
+    // ----------------------------------------------------------------
+    // Log_writer class
+    // ----------------------------------------------------------------
+
+    Log_writer::Log_writer(const std::string& path, const uint32_t interval) :
+            fd_(open_or_throw(path, O_RDWR | O_CREAT)),
+            index_fd_(-1),
+            interval_(interval),
+            count_(0),
+            end_(0),
+            buffer_(),
+            index_(),
+            index_written_(0)
+    {
+        try
+        {
+            if (0 == interval)
+            {
+                throw std::runtime_error("WatSON log index interval must not be 0.");
+            }
+            index_fd_ = open_or_throw(path + ".idx", O_RDWR | O_CREAT);
+
+            // Recover from where the index leaves off.
+            const uint64_t log_size = file_size(fd_);
+            interval_ = load_index(index_fd_, interval, log_size, index_);
+            if (!index_.empty())
+            {
+                count_ = (index_.size() - 1) * interval_;
+                end_ = index_.back();
+            }
+            Ngrdnt_reader reader(fd_, k_scan_buffer_size);
+            scan_log(fd_, reader, interval_, index_, count_, end_);
+
+            // Drop a partial record, and rewrite the index as recovered.
+            if (end_ < log_size && 0 != ::ftruncate(fd_, end_))
+            {
+                throw io_error("Unable to truncate the WatSON log", path);
+            }
+            if (0 > ::lseek(fd_, end_, SEEK_SET))
+            {
+                throw io_error("Unable to seek in the WatSON log", path);
+            }
+
+            std::vector<uint8_t> header(k_index_header_size);
+            memcpy(header.data(), k_index_magic, sizeof(k_index_magic));
+            memcpy(header.data() + sizeof(k_index_magic), &interval_, sizeof(interval_));
+            if (0 != ::ftruncate(index_fd_, 0) || 0 > ::lseek(index_fd_, 0, SEEK_SET))
+            {
+                throw io_error("Unable to rewrite the WatSON log index", path);
+            }
+            write_fully(index_fd_, header.data(), header.size());
+            write_fully(index_fd_, reinterpret_cast<const uint8_t*>(index_.data()),
+                    index_.size() * sizeof(uint64_t));
+            index_written_ = index_.size();
+        }
+        catch (...)
+        {
+            ::close(fd_);
+            if (0 <= index_fd_)
+            {
+                ::close(index_fd_);
+            }
+            throw;
+        }
+        buffer_.reserve(k_write_buffer_size);
+    }
+
+    Log_writer::~Log_writer()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+        ::close(fd_);
+        ::close(index_fd_);
+    }
+
+    uint64_t Log_writer::append(const Ngrdnt::Ptr& val)
+    {
+        const uint64_t record = count_;
+        if (0 == record % interval_)
+        {
+            index_.push_back(end_);
+        }
+
+        const uint64_t sz = val->size();
+        if (buffer_.size() + sz > k_write_buffer_size)
+        {
+            write_fully(fd_, buffer_.data(), buffer_.size());
+            buffer_.clear();
+        }
+        if (sz >= k_write_buffer_size)
+        {
+            write_fully(fd_, val->data(), sz);
+        }
+        else
+        {
+            buffer_.insert(buffer_.end(), val->data(), val->data() + sz);
+        }
+
+        ++count_;
+        end_ += sz;
+        return record;
+    }
+
+    void Log_writer::flush()
+    {
+        // Data goes first, so the index never points at missing records.
+        write_fully(fd_, buffer_.data(), buffer_.size());
+        buffer_.clear();
+
+        write_fully(index_fd_, reinterpret_cast<const uint8_t*>(index_.data() + index_written_),
+                (index_.size() - index_written_) * sizeof(uint64_t));
+        index_written_ = index_.size();
+    }
+
+    void Log_writer::sync()
+    {
+        flush();
+        if (0 != ::fsync(fd_) || 0 != ::fsync(index_fd_))
+        {
+            throw std::ios_base::failure(std::string("Unable to sync the WatSON log: ") + strerror(errno));
+        }
+    }
+
+
+    // ----------------------------------------------------------------
+    // Group_writer class
+    // ----------------------------------------------------------------
+
+    Group_writer::Group_writer(const std::string& path, const std::chrono::microseconds max_delay,
+            const size_t max_bytes, const uint32_t interval) :
+            log_(path, interval),
+            max_delay_(max_delay),
+            max_bytes_(max_bytes),
+            mutex_(),
+            wake_(),
+            committed_(),
+            queue_(),
+            queued_bytes_(0),
+            oldest_(),
+            queued_(0),
+            finished_(0),
+            batches_(0),
+            urgent_(false),
+            stop_(false),
+            error_(),
+            thread_(&Group_writer::run, this)
+    {
+    }
+
+    Group_writer::~Group_writer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+
+    std::future<uint64_t> Group_writer::append(const Ngrdnt::Ptr& val)
+    {
+        Pending pending{val, Callback(), std::promise<uint64_t>()};
+        std::future<uint64_t> result(pending.promise.get_future());
+        enqueue(std::move(pending));
+        return result;
+    }
+
+    void Group_writer::append(const Ngrdnt::Ptr& val, Callback callback)
+    {
+        enqueue(Pending{val, std::move(callback), std::promise<uint64_t>()});
+    }
+
+    void Group_writer::sync()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const uint64_t target = queued_;
+        urgent_ = true;
+        wake_.notify_one();
+        committed_.wait(lock, [this, target]() { return finished_ >= target; });
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    uint64_t Group_writer::batches() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return batches_;
+    }
+
+    void Group_writer::finish(Pending& pending, const uint64_t record, const std::exception_ptr& error)
+    {
+        if (pending.callback)
+        {
+            pending.callback(record, error);
+        }
+        else if (error)
+        {
+            pending.promise.set_exception(error);
+        }
+        else
+        {
+            pending.promise.set_value(record);
+        }
+    }
+
+    void Group_writer::enqueue(Pending&& pending)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (error_)
+        {
+            const std::exception_ptr error(error_);
+            lock.unlock();
+            finish(pending, 0, error);
+            return;
+        }
+
+        if (queue_.empty())
+        {
+            oldest_ = std::chrono::steady_clock::now();
+        }
+        queued_bytes_ += pending.val->size();
+        ++queued_;
+        queue_.push_back(std::move(pending));
+        wake_.notify_one();
+    }
+
+    void Group_writer::run()
+    {
+        std::vector<Pending> batch;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            wake_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+            {
+                return;
+            }
+
+            // Give the batch a chance to fill.
+            wake_.wait_until(lock, oldest_ + max_delay_,
+                    [this]() { return stop_ || urgent_ || queued_bytes_ >= max_bytes_; });
+            batch.swap(queue_);
+            queued_bytes_ = 0;
+            urgent_ = false;
+            const std::exception_ptr error(error_);
+
+            // New records queue up while this batch is written.
+            lock.unlock();
+            const std::exception_ptr failed(commit(batch, error));
+            lock.lock();
+
+            error_ = failed;
+            finished_ += batch.size();
+            ++batches_;
+            batch.clear();
+            committed_.notify_all();
+        }
+    }
+
+    std::exception_ptr Group_writer::commit(std::vector<Pending>& batch, std::exception_ptr error)
+    {
+        const uint64_t first = log_.size();
+        if (!error)
+        {
+            try
+            {
+                for (Pending& pending : batch)
+                {
+                    log_.append(pending.val);
+                }
+                log_.sync();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+        }
+
+        for (size_t h = 0; h < batch.size(); ++h)
+        {
+            finish(batch[h], first + h, error);
+        }
+        return error;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Log_reader class
+    // ----------------------------------------------------------------
+
+    Log_reader::Log_reader(const std::string& path, const size_t buffer_size) :
+            fd_(open_or_throw(path, O_RDONLY)),
+            interval_(k_log_index_interval),
+            count_(0),
+            end_(0),
+            index_(),
+            reader_(fd_, buffer_size),
+            position_(0)
+    {
+        try
+        {
+            const int index_fd = ::open((path + ".idx").c_str(), O_RDONLY);
+            try
+            {
+                interval_ = load_index(index_fd, interval_, file_size(fd_), index_);
+            }
+            catch (...)
+            {
+                if (0 <= index_fd)
+                {
+                    ::close(index_fd);
+                }
+                throw;
+            }
+            if (0 <= index_fd)
+            {
+                ::close(index_fd);
+            }
+
+            if (!index_.empty())
+            {
+                count_ = (index_.size() - 1) * interval_;
+                end_ = index_.back();
+            }
+            refresh();
+        }
+        catch (...)
+        {
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    Log_reader::~Log_reader()
+    {
+        ::close(fd_);
+    }
+
+    const uint8_t* Log_reader::next()
+    {
+        if (position_ >= count_)
+        {
+            return nullptr;
+        }
+        const uint8_t* result = reader_.next();
+        if (!result)
+        {
+            throw std::ios_base::failure("WatSON log is shorter than its index.");
+        }
+        ++position_;
+        return result;
+    }
+
+    bool Log_reader::seek(const uint64_t record)
+    {
+        if (record > count_)
+        {
+            return false;
+        }
+
+        // Start from the closest index entry at or before the record.
+        uint64_t from_record = count_;
+        uint64_t from_offset = end_;
+        if (record < count_)
+        {
+            const uint64_t entry = record / interval_;
+            from_record = entry * interval_;
+            from_offset = index_[entry];
+        }
+        if (0 > ::lseek(fd_, from_offset, SEEK_SET))
+        {
+            throw std::ios_base::failure(std::string("Unable to seek in the WatSON log: ") + strerror(errno));
+        }
+        reader_.reset(from_offset);
+        position_ = from_record;
+
+        while (position_ < record)
+        {
+            next();
+        }
+        return true;
+    }
+
+    uint64_t Log_reader::seek_offset(const uint64_t offset)
+    {
+        if (offset >= end_)
+        {
+            seek(count_);
+            return position_;
+        }
+
+        const auto it = std::upper_bound(index_.begin(), index_.end(), offset);
+        seek((it - index_.begin() - 1) * interval_);
+        while (reader_.offset() < offset)
+        {
+            next();
+        }
+        return position_;
+    }
+
+    Ngrdnt::Ptr Log_reader::at(const uint64_t record)
+    {
+        if (record >= count_)
+        {
+            return k_not_found;
+        }
+        seek(record);
+        return Ngrdnt::clone(next());
+    }
+
+    void Log_reader::refresh()
+    {
+        const uint64_t position = position_;
+        scan_log(fd_, reader_, interval_, index_, count_, end_);
+        seek(std::min(position, count_));
+    }
+}; // namespace watson
@@ -0,0 +1,308 @@
+#pragma once
+/*!
+ \file watson/log.h
+ \brief WatSON record logs.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "reader.h"
+#include "watson.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace watson
+{
+    /*!
+     \brief Default number of records between two index entries.
+     \since 0.2
+     */
+    constexpr uint32_t k_log_index_interval = 1024;
+
+    /*!
+     \brief Appends records to a WatSON log.
+
+     A log is a plain file of Ngrdnts, one after the other, just as
+     written by operator<<(std::ostream&, const Ngrdnt::Ptr&). Next to it,
+     in \c path.idx, a sparse index holds the offset of every K-th
+     record, so a record can be found with a single seek.
+
+     \code
+     (Log-Index) ::= (Magic) (Interval) {(Record-Offset)}
+     (Magic) ::= 'W' 'L' 'O' 'G'
+     (Interval) ::= (Unsigned-32bit-Integer)
+     (Record-Offset) ::= (Unsigned-64bit-Integer)
+     \endcode
+
+     The data is always written before the index. Opening an existing
+     log drops a partial record left by a crash, and rebuilds any index
+     entries that did not make it to disk.
+     \since 0.2
+     */
+    class Log_writer
+    {
+    public:
+        /*!
+         \brief Open a log for appending, creating it when needed.
+         \param path The log file.
+         \param interval Records between index entries, for new logs.
+         */
+        explicit Log_writer(const std::string& path,
+                uint32_t interval = k_log_index_interval);
+        Log_writer(const Log_writer& o) = delete;
+        Log_writer& operator=(const Log_writer& rhs) = delete;
+
+        //! Flushes, and closes the files.
+        ~Log_writer();
+
+        /*!
+         \brief Append a record.
+
+         The record is buffered, and only written by flush(), sync(), or
+         once enough has been buffered.
+
+         \param val The record.
+         \return The record number.
+         */
+        uint64_t append(const Ngrdnt::Ptr& val);
+
+        //! Write everything buffered to the files.
+        void flush();
+
+        //! Write everything buffered, and wait for it to reach the disk.
+        void sync();
+
+        //! The number of records in the log.
+        inline uint64_t size() const { return count_; }
+
+        //! The size of the log in bytes, including buffered records.
+        inline uint64_t offset() const { return end_; }
+
+    private:
+        int fd_;
+        int index_fd_;
+        uint32_t interval_;
+        uint64_t count_;
+        uint64_t end_;
+        std::vector<uint8_t> buffer_;
+        std::vector<uint64_t> index_;
+        //! The number of index entries on disk.
+        size_t index_written_;
+    }; // class watson::Log_writer
+
+    /*!
+     \brief Appends records to a WatSON log from many threads.
+
+     Records are queued by the callers and written by a commit thread in
+     batches: everything that arrived while the previous batch was being
+     synced goes into a single write and a single fsync. A batch is
+     committed once it holds \c max_bytes, or once its oldest record has
+     waited \c max_delay.
+
+     Each caller learns the record number of its record once the record
+     is durable, through a future or a callback. When a batch fails, every
+     record in it gets the error, and so does every later record.
+     \sa Log_writer
+     \since 0.2
+     */
+    class Group_writer
+    {
+    public:
+        /*!
+         \brief Called once a record is durable.
+
+         Runs on the commit thread, so it should be quick.
+
+         \param record The record number.
+         \param error The reason the record was not written, or null.
+         */
+        using Callback = std::function<void(uint64_t record, std::exception_ptr error)>;
+
+        /*!
+         \brief Open a log for appending, creating it when needed.
+         \param path The log file.
+         \param max_delay The longest a record waits for its batch to fill.
+         With no delay, a batch is whatever arrived during the previous
+         fsync, which is usually the best choice for a busy log.
+         \param max_bytes The size at which a batch is committed at once.
+         \param interval Records between index entries, for new logs.
+         */
+        explicit Group_writer(const std::string& path,
+                std::chrono::microseconds max_delay = std::chrono::microseconds(0),
+                size_t max_bytes = 1 << 20,
+                uint32_t interval = k_log_index_interval);
+        Group_writer(const Group_writer& o) = delete;
+        Group_writer& operator=(const Group_writer& rhs) = delete;
+
+        //! Commits everything still queued.
+        ~Group_writer();
+
+        /*!
+         \brief Queue a record.
+         \param val The record, which must not change until it is durable.
+         \return The record number, once the record is durable.
+         */
+        std::future<uint64_t> append(const Ngrdnt::Ptr& val);
+
+        /*!
+         \brief Queue a record.
+         \param val The record, which must not change until it is durable.
+         \param callback Called once the record is durable.
+         */
+        void append(const Ngrdnt::Ptr& val, Callback callback);
+
+        //! Commit everything queued so far, and wait for it.
+        void sync();
+
+        //! The number of batches committed so far.
+        uint64_t batches() const;
+
+    private:
+        struct Pending
+        {
+            Ngrdnt::Ptr val;
+            Callback callback;
+            std::promise<uint64_t> promise;
+        };
+
+        static void finish(Pending& pending, uint64_t record, const std::exception_ptr& error);
+
+        void enqueue(Pending&& pending);
+        void run();
+        std::exception_ptr commit(std::vector<Pending>& batch, std::exception_ptr error);
+
+        Log_writer log_;
+        std::chrono::microseconds max_delay_;
+        size_t max_bytes_;
+        mutable std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable committed_;
+        std::vector<Pending> queue_;
+        size_t queued_bytes_;
+        std::chrono::steady_clock::time_point oldest_;
+        //! Records queued, and records finished, since opening.
+        uint64_t queued_;
+        uint64_t finished_;
+        uint64_t batches_;
+        bool urgent_;
+        bool stop_;
+        std::exception_ptr error_;
+        std::thread thread_;
+    }; // class watson::Group_writer
+
+    /*!
+     \brief Reads records from a WatSON log.
+
+     Records can be read in order, or found by record number or by offset
+     through the sparse index. A partial record at the end, as left by a
+     writer that is still busy, is not visible until refresh() finds it
+     complete.
+     \sa Log_writer
+     \since 0.2
+     */
+    class Log_reader
+    {
+    public:
+        /*!
+         \brief Open a log.
+
+         A missing index is rebuilt in memory.
+
+         \param path The log file.
+         \param buffer_size The size of the read buffer.
+         */
+        explicit Log_reader(const std::string& path,
+                size_t buffer_size = 64 * 1024);
+        Log_reader(const Log_reader& o) = delete;
+        Log_reader& operator=(const Log_reader& rhs) = delete;
+        ~Log_reader();
+
+        /*!
+         \brief Read the next record.
+         \return The raw record, valid until the next call, or nullptr at
+         the end of the log.
+         */
+        const uint8_t* next();
+
+        /*!
+         \brief Move to a record.
+
+         One seek, and skipping over at most the index interval of
+         records.
+
+         \param record The record number to read next.
+         \return false if there is no such record.
+         */
+        bool seek(uint64_t record);
+
+        /*!
+         \brief Move to the first record at or after an offset.
+         \param offset The offset in the log.
+         \return The record number that will be read next.
+         */
+        uint64_t seek_offset(uint64_t offset);
+
+        /*!
+         \brief Read a record by number.
+         \param record The record number.
+         \return A copy of the record, or k_not_found.
+         */
+        Ngrdnt::Ptr at(uint64_t record);
+
+        //! Pick up records appended since the log was opened.
+        void refresh();
+
+        //! The number of complete records in the log.
+        inline uint64_t size() const { return count_; }
+
+        //! The record number that next() reads.
+        inline uint64_t position() const { return position_; }
+
+        //! The offset of the record that next() reads.
+        inline uint64_t offset() const { return reader_.offset(); }
+
+    private:
+        int fd_;
+        uint32_t interval_;
+        uint64_t count_;
+        uint64_t end_;
+        std::vector<uint64_t> index_;
+        Ngrdnt_reader reader_;
+        uint64_t position_;
+    }; // class watson::Log_reader
+}; // namespace watson
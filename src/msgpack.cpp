@@ -0,0 +1,599 @@
+/*!
+ \file watson/msgpack.cpp
+ \brief WatSON conversion from and to MessagePack.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "msgpack.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace watson
+{
+    namespace
+    {
+        inline void write_be(uint8_t* out, uint64_t val, const size_t n)
+        {
+            for (size_t h = n; 0 < h--; val >>= 8)
+            {
+                out[h] = static_cast<uint8_t>(val);
+            }
+        }
+    }; // namespace watson::(anonymous)
+
+    // ----------------------------------------------------------------
+    // Msgpack_transcoder class
+    // ----------------------------------------------------------------
+
+    Msgpack_transcoder::Msgpack_transcoder(Glossary glossary) :
+            builder_(std::move(glossary)),
+            single_(),
+            begin_(nullptr),
+            ptr_(nullptr),
+            end_(nullptr)
+    {
+    }
+
+    size_t Msgpack_transcoder::transcode(const uint8_t* data, const size_t n, std::vector<uint8_t>& out)
+    {
+        begin_ = data;
+        ptr_ = data;
+        end_ = data + n;
+
+        // The output is grown ahead, and cut back to what was used.
+        builder_.start(out);
+        size_t count = 0;
+        try
+        {
+            for (; ptr_ < end_; ++count)
+            {
+                value(0);
+            }
+        }
+        catch (...)
+        {
+            builder_.abandon();
+            throw;
+        }
+        builder_.finish();
+        return count;
+    }
+
+    Ngrdnt::Ptr Msgpack_transcoder::transcode(const std::vector<uint8_t>& data)
+    {
+        single_.clear();
+        if (1 != transcode(data.data(), data.size(), single_))
+        {
+            throw std::runtime_error("Expected a single MessagePack value.");
+        }
+        return Ngrdnt::clone(single_.data());
+    }
+
+    void Msgpack_transcoder::value(const size_t depth)
+    {
+        const uint8_t marker = *take(1);
+        if (marker < 0x80)
+        {
+            builder_.integer(marker, false);
+            return;
+        }
+        if (marker >= 0xE0)
+        {
+            builder_.integer(0x100 - marker, true);
+            return;
+        }
+        switch (marker & 0xF0)
+        {
+            case 0x80:
+                map(marker & 0x0F, depth + 1);
+                return;
+            case 0x90:
+                array(marker & 0x0F, depth + 1);
+                return;
+            case 0xA0:
+            case 0xB0:
+                string(marker & 0x1F);
+                return;
+        }
+
+        switch (marker)
+        {
+            case 0xC0:
+                builder_.marker(Ngrdnt_type::k_null);
+                break;
+            case 0xC2:
+                builder_.marker(Ngrdnt_type::k_false);
+                break;
+            case 0xC3:
+                builder_.marker(Ngrdnt_type::k_true);
+                break;
+            case 0xC4:
+                binary(read_be(1));
+                break;
+            case 0xC5:
+                binary(read_be(2));
+                break;
+            case 0xC6:
+                binary(read_be(4));
+                break;
+            case 0xCA:
+                {
+                    const uint32_t bits = static_cast<uint32_t>(read_be(4));
+                    float val;
+                    memcpy(&val, &bits, sizeof(val));
+                    builder_.real(static_cast<double>(val));
+                }
+                break;
+            case 0xCB:
+                {
+                    const uint64_t bits = read_be(8);
+                    double val;
+                    memcpy(&val, &bits, sizeof(val));
+                    builder_.real(val);
+                }
+                break;
+            case 0xCC:
+                builder_.integer(read_be(1), false);
+                break;
+            case 0xCD:
+                builder_.integer(read_be(2), false);
+                break;
+            case 0xCE:
+                builder_.integer(read_be(4), false);
+                break;
+            case 0xCF:
+                builder_.integer(read_be(8), false);
+                break;
+            case 0xD0:
+            case 0xD1:
+            case 0xD2:
+            case 0xD3:
+                {
+                    // Sign extend from the top bit of the stored width.
+                    const size_t n = size_t(1) << (marker - 0xD0);
+                    const uint64_t raw = read_be(n);
+                    const uint64_t sign = 1ull << (n * 8 - 1);
+                    if (0 == (raw & sign))
+                    {
+                        builder_.integer(raw, false);
+                    }
+                    else
+                    {
+                        // The magnitude is the two's complement, within n bytes.
+                        builder_.integer(((~raw) & (sign * 2 - 1)) + 1, true);
+                    }
+                }
+                break;
+            case 0xD9:
+                string(read_be(1));
+                break;
+            case 0xDA:
+                string(read_be(2));
+                break;
+            case 0xDB:
+                string(read_be(4));
+                break;
+            case 0xDC:
+                array(read_be(2), depth + 1);
+                break;
+            case 0xDD:
+                array(read_be(4), depth + 1);
+                break;
+            case 0xDE:
+                map(read_be(2), depth + 1);
+                break;
+            case 0xDF:
+                map(read_be(4), depth + 1);
+                break;
+            case 0xC7:
+            case 0xC8:
+            case 0xC9:
+            case 0xD4:
+            case 0xD5:
+            case 0xD6:
+            case 0xD7:
+            case 0xD8:
+                --ptr_;
+                fail("Unsupported extension type");
+                break;
+            default:
+                --ptr_;
+                fail("Invalid marker");
+                break;
+        }
+    }
+
+    void Msgpack_transcoder::array(const uint64_t count, const size_t depth)
+    {
+        if (depth > k_msgpack_max_depth)
+        {
+            fail("Nested too deeply");
+        }
+        const size_t start = builder_.open();
+        for (uint64_t h = 0; h < count; ++h)
+        {
+            value(depth);
+        }
+        builder_.close(start, Ngrdnt_type::k_container);
+    }
+
+    void Msgpack_transcoder::map(const uint64_t count, const size_t depth)
+    {
+        if (depth > k_msgpack_max_depth)
+        {
+            fail("Nested too deeply");
+        }
+        const size_t start = builder_.open();
+        for (uint64_t h = 0; h < count; ++h)
+        {
+            const uint8_t marker = *take(1);
+            uint64_t n = 0;
+            if (0xA0 == (marker & 0xE0))
+            {
+                n = marker & 0x1F;
+            }
+            else if (0xD9 <= marker && marker <= 0xDB)
+            {
+                n = read_be(size_t(1) << (marker - 0xD9));
+            }
+            else
+            {
+                --ptr_;
+                fail("Map key is not a string");
+            }
+            builder_.key(reinterpret_cast<const char*>(take(n)), n);
+            value(depth);
+        }
+        builder_.close(start, Ngrdnt_type::k_map);
+    }
+
+    void Msgpack_transcoder::string(const uint64_t n)
+    {
+        builder_.string(reinterpret_cast<const char*>(take(n)), n);
+    }
+
+    void Msgpack_transcoder::binary(const uint64_t n)
+    {
+        const uint8_t* b = take(n);
+        const uint64_t data_size = sizeof(uint32_t) + n;
+        const size_t header = ngrdnt_header_size(size_type_necessary(data_size));
+        uint8_t* out = write_ngrdnt_header(builder_.grow(header + data_size), Ngrdnt_type::k_binary, data_size);
+
+        // No marshal hint.
+        memset(out, 0, sizeof(uint32_t));
+        memcpy(out + sizeof(uint32_t), b, n);
+    }
+
+    const uint8_t* Msgpack_transcoder::take(const uint64_t n)
+    {
+        if (n > static_cast<uint64_t>(end_ - ptr_))
+        {
+            fail("Truncated value");
+        }
+        const uint8_t* const at = ptr_;
+        ptr_ += n;
+        return at;
+    }
+
+    uint64_t Msgpack_transcoder::read_be(const size_t n)
+    {
+        const uint8_t* p = take(n);
+        uint64_t val = 0;
+        for (size_t h = 0; h < n; ++h)
+        {
+            val = (val << 8) | p[h];
+        }
+        return val;
+    }
+
+    void Msgpack_transcoder::fail(const std::string& what) const
+    {
+        detail::fail(what, "MessagePack", ptr_ - begin_);
+    }
+
+    // ----------------------------------------------------------------
+    // Msgpack_emitter class
+    // ----------------------------------------------------------------
+
+    Msgpack_emitter::Msgpack_emitter(Glossary glossary) :
+            glossary_(std::move(glossary)),
+            arena_(),
+            out_(nullptr),
+            mark_(0),
+            used_(0)
+    {
+    }
+
+    void Msgpack_emitter::emit(const uint8_t* d, std::vector<uint8_t>& out)
+    {
+        out_ = &out;
+        mark_ = out.size();
+        used_ = mark_;
+        try
+        {
+            value(d, 0);
+        }
+        catch (...)
+        {
+            out.resize(mark_);
+            arena_.reset();
+            throw;
+        }
+        out.resize(used_);
+        arena_.reset();
+    }
+
+    std::vector<uint8_t> Msgpack_emitter::emit(const Ngrdnt::Ptr& val)
+    {
+        std::vector<uint8_t> result;
+        emit(val->data(), result);
+        return result;
+    }
+
+    void Msgpack_emitter::value(const uint8_t* d, const size_t depth)
+    {
+        switch (ngrdnt_type(d[0]))
+        {
+            case Ngrdnt_type::k_null:
+                *grow(1) = 0xC0;
+                break;
+            case Ngrdnt_type::k_true:
+                *grow(1) = 0xC3;
+                break;
+            case Ngrdnt_type::k_false:
+                *grow(1) = 0xC2;
+                break;
+            case Ngrdnt_type::k_float:
+                {
+                    const double val = detail::scalar<double>(d);
+                    uint64_t bits;
+                    memcpy(&bits, &val, sizeof(bits));
+                    uint8_t* out = grow(9);
+                    *out = 0xCB;
+                    write_be(out + 1, bits, 8);
+                }
+                break;
+            case Ngrdnt_type::k_int32:
+                signed_integer(detail::scalar<int32_t>(d));
+                break;
+            case Ngrdnt_type::k_int64:
+                signed_integer(detail::scalar<int64_t>(d));
+                break;
+            case Ngrdnt_type::k_uint64:
+                unsigned_integer(detail::scalar<uint64_t>(d));
+                break;
+            case Ngrdnt_type::k_string:
+                {
+                    uint64_t n;
+                    const uint8_t* s = detail::payload(d, &n);
+                    header(n, 0xA0, 32, 0xD9, 0xDA, 0xDB);
+                    memcpy(grow(n), s, n);
+                }
+                break;
+            case Ngrdnt_type::k_binary:
+                {
+                    uint64_t n;
+                    const uint8_t* b = detail::payload(d, &n);
+                    if (sizeof(uint32_t) > n)
+                    {
+                        throw std::runtime_error("WatSON bytes are missing their marshal hint.");
+                    }
+                    // The marshal hint has no place in MessagePack.
+                    n -= sizeof(uint32_t);
+                    header(n, 0, 0, 0xC4, 0xC5, 0xC6);
+                    memcpy(grow(n), b + sizeof(uint32_t), n);
+                }
+                break;
+            case Ngrdnt_type::k_flags:
+                flags(d);
+                break;
+            case Ngrdnt_type::k_container:
+            case Ngrdnt_type::k_library:
+                array(d, depth + 1);
+                break;
+            case Ngrdnt_type::k_map:
+                map(d, depth + 1);
+                break;
+            case Ngrdnt_type::k_zip:
+                {
+                    if (depth >= k_msgpack_max_depth)
+                    {
+                        throw std::runtime_error("WatSON nested too deeply for MessagePack.");
+                    }
+                    // The child lives in the arena until the end of emit().
+                    const Ngrdnt::Ptr raw(Ngrdnt::temp(d));
+                    const uint64_t sz = unzipped_size(raw);
+                    const uint8_t* child = arena_.unzip(raw);
+                    checked_ngrdnt_size(child, child + sz);
+                    value(child, depth + 1);
+                }
+                break;
+            default:
+                throw std::runtime_error("Unknown WatSON type " + std::to_string(d[0]) + ".");
+        }
+    }
+
+    void Msgpack_emitter::array(const uint8_t* d, const size_t depth)
+    {
+        if (depth > k_msgpack_max_depth)
+        {
+            throw std::runtime_error("WatSON nested too deeply for MessagePack.");
+        }
+        uint64_t n;
+        const uint8_t* const begin = detail::payload(d, &n);
+        const uint8_t* const end = begin + n;
+
+        // The length comes first, so hop over the children to count them.
+        uint64_t count = 0;
+        for (const uint8_t* ptr = begin; end > ptr; ptr += checked_ngrdnt_size(ptr, end))
+        {
+            ++count;
+        }
+        header(count, 0x90, 16, 0, 0xDC, 0xDD);
+
+        for (const uint8_t* ptr = begin; end > ptr; ptr += checked_ngrdnt_size(ptr, end))
+        {
+            value(ptr, depth);
+        }
+    }
+
+    void Msgpack_emitter::map(const uint8_t* d, const size_t depth)
+    {
+        if (depth > k_msgpack_max_depth)
+        {
+            throw std::runtime_error("WatSON nested too deeply for MessagePack.");
+        }
+        uint64_t n;
+        const uint8_t* const begin = detail::payload(d, &n);
+        const uint8_t* const end = begin + n;
+
+        uint64_t count = 0;
+        for (const uint8_t* ptr = begin; end > ptr; ++count)
+        {
+            if (static_cast<size_t>(end - ptr) < sizeof(uint32_t))
+            {
+                throw std::runtime_error("WatSON child extends past its map.");
+            }
+            ptr += sizeof(uint32_t);
+            ptr += checked_ngrdnt_size(ptr, end);
+        }
+        header(count, 0x80, 16, 0, 0xDE, 0xDF);
+
+        for (const uint8_t* ptr = begin; end > ptr;)
+        {
+            uint32_t key;
+            memcpy(&key, ptr, sizeof(key));
+            ptr += sizeof(key);
+            if (key < glossary_.names.size())
+            {
+                const std::string& name = glossary_.names[key];
+                header(name.size(), 0xA0, 32, 0xD9, 0xDA, 0xDB);
+                memcpy(grow(name.size()), name.data(), name.size());
+            }
+            else
+            {
+                unsigned_integer(key);
+            }
+            value(ptr, depth);
+            ptr += ngrdnt_size(ptr);
+        }
+    }
+
+    void Msgpack_emitter::flags(const uint8_t* d)
+    {
+        uint64_t n;
+        const uint8_t* data = detail::payload(d, &n);
+        header(n * 8, 0x90, 16, 0, 0xDC, 0xDD);
+        uint8_t* out = grow(n * 8);
+        for (uint64_t h = 0; h < n * 8; ++h)
+        {
+            out[h] = (data[h >> 3] & (1 << (h % 8))) ? 0xC3 : 0xC2;
+        }
+    }
+
+    void Msgpack_emitter::unsigned_integer(const uint64_t val)
+    {
+        if (val < 0x80)
+        {
+            *grow(1) = static_cast<uint8_t>(val);
+            return;
+        }
+        const size_t n = val <= 0xFF ? 1 : val <= 0xFFFF ? 2 : val <= 0xFFFFFFFFull ? 4 : 8;
+        uint8_t* out = grow(1 + n);
+        *out = 1 == n ? 0xCC : 2 == n ? 0xCD : 4 == n ? 0xCE : 0xCF;
+        write_be(out + 1, val, n);
+    }
+
+    void Msgpack_emitter::signed_integer(const int64_t val)
+    {
+        if (0 <= val)
+        {
+            unsigned_integer(static_cast<uint64_t>(val));
+            return;
+        }
+        if (-32 <= val)
+        {
+            *grow(1) = static_cast<uint8_t>(val);
+            return;
+        }
+        const size_t n = -0x80 <= val ? 1 : -0x8000 <= val ? 2 :
+                std::numeric_limits<int32_t>::min() <= val ? 4 : 8;
+        uint8_t* out = grow(1 + n);
+        *out = 1 == n ? 0xD0 : 2 == n ? 0xD1 : 4 == n ? 0xD2 : 0xD3;
+        write_be(out + 1, static_cast<uint64_t>(val), n);
+    }
+
+    void Msgpack_emitter::header(const uint64_t n, const uint8_t fix, const uint64_t fix_count,
+            const uint8_t marker8, const uint8_t marker16, const uint8_t marker32)
+    {
+        if (n < fix_count)
+        {
+            *grow(1) = fix | static_cast<uint8_t>(n);
+            return;
+        }
+        if (0 != marker8 && n <= 0xFF)
+        {
+            uint8_t* out = grow(2);
+            out[0] = marker8;
+            out[1] = static_cast<uint8_t>(n);
+            return;
+        }
+        if (n <= 0xFFFF)
+        {
+            uint8_t* out = grow(3);
+            out[0] = marker16;
+            write_be(out + 1, n, 2);
+            return;
+        }
+        if (n > 0xFFFFFFFFull)
+        {
+            throw std::runtime_error("WatSON Ngrdnt too large for MessagePack.");
+        }
+        uint8_t* out = grow(5);
+        out[0] = marker32;
+        write_be(out + 1, n, 4);
+    }
+
+    uint8_t* Msgpack_emitter::grow(const size_t n)
+    {
+        if (used_ + n > out_->size())
+        {
+            // Grow ahead by what this call has written so far, so that
+            // many small calls appending to one buffer stay linear.
+            out_->resize(used_ + n + std::max<size_t>(64, used_ - mark_));
+        }
+        uint8_t* const at = out_->data() + used_;
+        used_ += n;
+        return at;
+    }
+}; // namespace watson
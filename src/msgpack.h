@@ -0,0 +1,219 @@
+#pragma once
+/*!
+ \file watson/msgpack.h
+ \brief WatSON conversion from and to MessagePack.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "transcode.h"
+#include "watson.h"
+#include "zip.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace watson
+{
+    /*!
+     \brief Deepest nesting of arrays and maps accepted in MessagePack.
+     \since 0.2
+     */
+    constexpr size_t k_msgpack_max_depth = 512;
+
+    /*!
+     \brief Converts MessagePack to WatSON without decoding to native
+     values.
+
+     The input is read in a single pass, and every value is written
+     straight into one output buffer as it is read. Map keys must be
+     strings; they are interned into a Glossary, and maps become
+     \c k_map Ngrdnts keyed by the position of the name in it. Integers
+     become \c k_int32 when they fit, then \c k_int64, then \c k_uint64.
+     Both float widths become \c k_float, and bin becomes Bytes with a
+     marshal hint of 0. Extension types have no WatSON counterpart and
+     are rejected.
+
+     The glossary grows over every call. Ship it along with library(),
+     as the first item of a Recipe, so the names can be looked up again.
+
+     \code
+     watson::Msgpack_transcoder transcoder;
+     std::vector<uint8_t> out;
+     transcoder.transcode(packed.data(), packed.size(), out);
+     \endcode
+     \since 0.2
+     */
+    class Msgpack_transcoder
+    {
+    public:
+        /*!
+         \brief Constructor.
+         \param glossary Keys already known, which keep their numbers.
+         */
+        explicit Msgpack_transcoder(Glossary glossary = Glossary());
+        Msgpack_transcoder(const Msgpack_transcoder& o) = delete;
+        Msgpack_transcoder(Msgpack_transcoder&& o) = default;
+        ~Msgpack_transcoder() = default;
+        Msgpack_transcoder& operator=(const Msgpack_transcoder& rhs) = delete;
+        Msgpack_transcoder& operator=(Msgpack_transcoder&& rhs) = default;
+
+        /*!
+         \brief Transcode every MessagePack value in a buffer.
+
+         The values follow each other directly, as in a MessagePack
+         stream. Invalid or truncated input throws a std::runtime_error,
+         and leaves \c out as it was.
+
+         \param data The MessagePack bytes.
+         \param n The number of bytes.
+         \param out Receives one Ngrdnt per value, appended.
+         \return The number of values.
+         */
+        size_t transcode(const uint8_t* data, size_t n, std::vector<uint8_t>& out);
+
+        /*!
+         \brief Transcode a buffer holding a single MessagePack value.
+         \param data The MessagePack bytes.
+         \return The Ngrdnt.
+         */
+        Ngrdnt::Ptr transcode(const std::vector<uint8_t>& data);
+
+        //! The keys seen so far.
+        inline const Glossary& glossary() const { return builder_.glossary(); }
+
+        //! The keys seen so far, as a \c k_library Ngrdnt.
+        inline Ngrdnt::Ptr library() const { return builder_.library(); }
+
+    private:
+        void value(size_t depth);
+        void array(uint64_t count, size_t depth);
+        void map(uint64_t count, size_t depth);
+        void string(uint64_t n);
+        void binary(uint64_t n);
+
+        //! Take \c n bytes of input.
+        const uint8_t* take(uint64_t n);
+
+        //! Read a big endian length or value of \c n bytes.
+        uint64_t read_be(size_t n);
+
+        void fail(const std::string& what) const;
+
+        detail::Ngrdnt_builder builder_;
+        std::vector<uint8_t> single_;
+        const uint8_t* begin_;
+        const uint8_t* ptr_;
+        const uint8_t* end_;
+    }; // class watson::Msgpack_transcoder
+
+    /*!
+     \brief Writes WatSON as MessagePack.
+
+     The Ngrdnt is walked in place and the MessagePack is appended to one
+     buffer. Maps keep their keys as strings, looked up in a Glossary;
+     keys it does not know are written as integers. Containers, libraries
+     and flags become arrays, whose lengths are counted from the headers
+     of their children. Integers take the smallest MessagePack format
+     that holds them, floats are always written with 64 bits, Bytes
+     become bin, and \c k_zip Ngrdnts are decompressed and written as
+     their child.
+
+     \code
+     watson::Msgpack_emitter emitter(recipe.glossary());
+     std::vector<uint8_t> packed;
+     emitter.emit(recipe.ngrdnt({1}), packed);
+     \endcode
+     \since 0.2
+     */
+    class Msgpack_emitter
+    {
+    public:
+        /*!
+         \brief Constructor.
+         \param glossary The names of the map keys.
+         */
+        explicit Msgpack_emitter(Glossary glossary = Glossary());
+        Msgpack_emitter(const Msgpack_emitter& o) = delete;
+        Msgpack_emitter(Msgpack_emitter&& o) = default;
+        ~Msgpack_emitter() = default;
+        Msgpack_emitter& operator=(const Msgpack_emitter& rhs) = delete;
+        Msgpack_emitter& operator=(Msgpack_emitter&& rhs) = default;
+
+        /*!
+         \brief Write an Ngrdnt as MessagePack.
+
+         A malformed Ngrdnt throws a std::runtime_error, and leaves
+         \c out as it was.
+
+         \param d The raw Ngrdnt bytes.
+         \param out Receives the MessagePack, appended.
+         */
+        void emit(const uint8_t* d, std::vector<uint8_t>& out);
+
+        //! Write an Ngrdnt as MessagePack, appended to \c out.
+        inline void emit(const Ngrdnt::Ptr& val, std::vector<uint8_t>& out) { emit(val->data(), out); }
+
+        //! Write an Ngrdnt as MessagePack.
+        std::vector<uint8_t> emit(const Ngrdnt::Ptr& val);
+
+        //! The names of the map keys.
+        inline const Glossary& glossary() const { return glossary_; }
+
+    private:
+        void value(const uint8_t* d, size_t depth);
+        void array(const uint8_t* d, size_t depth);
+        void map(const uint8_t* d, size_t depth);
+        void flags(const uint8_t* d);
+        void unsigned_integer(uint64_t val);
+        void signed_integer(int64_t val);
+
+        /*!
+         \brief Write a str, bin, array or map header.
+
+         Counts below \c fix_count fit in the marker \c fix. A zero
+         marker is a format that does not exist for the type.
+         */
+        void header(uint64_t n, uint8_t fix, uint64_t fix_count,
+                uint8_t marker8, uint8_t marker16, uint8_t marker32);
+
+        //! Make room for \c n more bytes of output.
+        uint8_t* grow(size_t n);
+
+        Glossary glossary_;
+        Unzip_arena arena_;
+        std::vector<uint8_t>* out_;
+        //! The size of out_ when the call started.
+        size_t mark_;
+        //! The bytes of out_ in use; the rest was grown ahead.
+        size_t used_;
+    }; // class watson::Msgpack_emitter
+}; // namespace watson
@@ -0,0 +1,539 @@
+/*!
+ \file watson/numeric.cpp
+ \brief WatSON number formatting.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "numeric.h"
+#include <cstring>
+#include <vector>
+
+namespace watson
+{
+    namespace
+    {
+        const char k_digit_pairs[] =
+                "00010203040506070809"
+                "10111213141516171819"
+                "20212223242526272829"
+                "30313233343536373839"
+                "40414243444546474849"
+                "50515253545556575859"
+                "60616263646566676869"
+                "70717273747576777879"
+                "80818283848586878889"
+                "90919293949596979899";
+
+        inline uint32_t decimal_length(const uint64_t v)
+        {
+            if (v < 100000000ull)
+            {
+                return v < 10000ull ?
+                        (v < 100ull ? (v < 10ull ? 1 : 2) : (v < 1000ull ? 3 : 4)) :
+                        (v < 1000000ull ? (v < 100000ull ? 5 : 6) : (v < 10000000ull ? 7 : 8));
+            }
+            uint32_t n = 9;
+            for (uint64_t limit = 1000000000ull; n < 20 && v >= limit; limit *= 10)
+            {
+                ++n;
+            }
+            return n;
+        }
+
+        //! Write the \c n digits of \c v, ending at \c end.
+        inline void write_digits(char* end, uint64_t v, uint32_t n)
+        {
+            // Work in 32 bits once the rest fits, where division is cheap.
+            for (; v > 0xFFFFFFFFull; n -= 2)
+            {
+                end -= 2;
+                memcpy(end, k_digit_pairs + (v % 100) * 2, 2);
+                v /= 100;
+            }
+            uint32_t w = static_cast<uint32_t>(v);
+            for (; n >= 2; n -= 2)
+            {
+                end -= 2;
+                memcpy(end, k_digit_pairs + (w % 100) * 2, 2);
+                w /= 100;
+            }
+            if (0 < n)
+            {
+                *--end = static_cast<char>('0' + w);
+            }
+        }
+
+        // ------------------------------------------------------------
+        // Ryu, after Ulf Adams, "Ryu: fast float-to-string conversion",
+        // PLDI 2018.
+        // ------------------------------------------------------------
+
+        const int k_mantissa_bits = 52;
+        const int k_exponent_bits = 11;
+        const int k_bias = 1023;
+        const int k_pow5_bitcount = 125;
+        const int k_pow5_inv_bitcount = 125;
+        const size_t k_pow5_table_size = 326;
+        const size_t k_pow5_inv_table_size = 342;
+
+        using uint128 = unsigned __int128;
+
+        //! ceil(log2(5^e)), or 1 for e == 0.
+        inline int32_t pow5_bits(const int32_t e)
+        {
+            return static_cast<int32_t>((static_cast<uint32_t>(e) * 1217359) >> 19) + 1;
+        }
+
+        //! floor(log10(2^e)).
+        inline uint32_t log10_pow2(const int32_t e)
+        {
+            return (static_cast<uint32_t>(e) * 78913) >> 18;
+        }
+
+        //! floor(log10(5^e)).
+        inline uint32_t log10_pow5(const int32_t e)
+        {
+            return (static_cast<uint32_t>(e) * 732923) >> 20;
+        }
+
+        inline bool multiple_of_pow5(uint64_t v, const uint32_t p)
+        {
+            uint32_t count = 0;
+            for (; 0 < v && 0 == v % 5 && count < p; v /= 5)
+            {
+                ++count;
+            }
+            return count >= p;
+        }
+
+        inline bool multiple_of_pow2(const uint64_t v, const uint32_t p)
+        {
+            return 0 == (v & ((1ull << p) - 1));
+        }
+
+        /*!
+         \brief The 125 leading bits of powers of five, and of their
+         inverses.
+
+         The tables are worked out once with plain long arithmetic, rather
+         than shipped as a few thousand constants.
+         */
+        struct Pow5_tables
+        {
+            uint64_t split[k_pow5_table_size][2];
+            uint64_t inv_split[k_pow5_inv_table_size][2];
+
+            Pow5_tables()
+            {
+                // Little endian 32 bit words.
+                std::vector<uint32_t> pow5(1, 1);
+                std::vector<uint32_t> rem;
+                for (size_t q = 0; q < k_pow5_inv_table_size; ++q)
+                {
+                    const int32_t len = bits(pow5);
+                    if (q < k_pow5_table_size)
+                    {
+                        // pow5 scaled to exactly 125 bits, truncated.
+                        const int32_t shift = len - k_pow5_bitcount;
+                        split[q][0] = extract(pow5, shift);
+                        split[q][1] = extract(pow5, shift + 64);
+                    }
+
+                    // floor(2^(len - 1 + 125) / pow5) + 1. The quotient
+                    // has 125 bits, so the division starts from 2^(len - 1).
+                    uint128 quotient = 0;
+                    if (0 == q)
+                    {
+                        quotient = static_cast<uint128>(1) << k_pow5_inv_bitcount;
+                    }
+                    else
+                    {
+                        rem.assign(pow5.size() + 1, 0);
+                        rem[(len - 1) / 32] = 1u << ((len - 1) % 32);
+                        for (int h = 0; h < k_pow5_inv_bitcount; ++h)
+                        {
+                            shift_left(rem);
+                            quotient <<= 1;
+                            if (!less(rem, pow5))
+                            {
+                                subtract(rem, pow5);
+                                quotient |= 1;
+                            }
+                        }
+                    }
+                    quotient += 1;
+                    inv_split[q][0] = static_cast<uint64_t>(quotient);
+                    inv_split[q][1] = static_cast<uint64_t>(quotient >> 64);
+
+                    multiply5(pow5);
+                }
+            }
+
+            static int32_t bits(const std::vector<uint32_t>& v)
+            {
+                int32_t n = static_cast<int32_t>(v.size()) * 32;
+                for (uint32_t top = v.back(); 0 == (top & 0x80000000u); top <<= 1)
+                {
+                    --n;
+                }
+                return n;
+            }
+
+            //! The 64 bits of \c v starting at bit \c lo, which may be negative.
+            static uint64_t extract(const std::vector<uint32_t>& v, const int32_t lo)
+            {
+                uint64_t result = 0;
+                for (int32_t h = 0; h < 64; ++h)
+                {
+                    const int32_t bit = lo + h;
+                    if (0 <= bit && bit / 32 < static_cast<int32_t>(v.size()) &&
+                            (v[bit / 32] >> (bit % 32)) & 1)
+                    {
+                        result |= 1ull << h;
+                    }
+                }
+                return result;
+            }
+
+            static void multiply5(std::vector<uint32_t>& v)
+            {
+                uint64_t carry = 0;
+                for (auto& word : v)
+                {
+                    const uint64_t product = static_cast<uint64_t>(word) * 5 + carry;
+                    word = static_cast<uint32_t>(product);
+                    carry = product >> 32;
+                }
+                if (0 < carry)
+                {
+                    v.push_back(static_cast<uint32_t>(carry));
+                }
+            }
+
+            static void shift_left(std::vector<uint32_t>& v)
+            {
+                uint32_t carry = 0;
+                for (auto& word : v)
+                {
+                    const uint32_t next = word >> 31;
+                    word = (word << 1) | carry;
+                    carry = next;
+                }
+            }
+
+            //! a < b, where \c a has at least as many words as \c b.
+            static bool less(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+            {
+                for (size_t h = a.size(); 0 < h--;)
+                {
+                    const uint32_t bw = h < b.size() ? b[h] : 0;
+                    if (a[h] != bw)
+                    {
+                        return a[h] < bw;
+                    }
+                }
+                return false;
+            }
+
+            static void subtract(std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+            {
+                int64_t borrow = 0;
+                for (size_t h = 0; h < a.size(); ++h)
+                {
+                    const int64_t diff = static_cast<int64_t>(a[h]) -
+                            (h < b.size() ? b[h] : 0) - borrow;
+                    a[h] = static_cast<uint32_t>(diff);
+                    borrow = 0 > diff ? 1 : 0;
+                }
+            }
+        };
+
+        const Pow5_tables& pow5_tables()
+        {
+            static const Pow5_tables tables;
+            return tables;
+        }
+
+        inline uint64_t mul_shift(const uint64_t m, const uint64_t* const mul, const int32_t j)
+        {
+            const uint128 low = static_cast<uint128>(m) * mul[0];
+            const uint128 high = static_cast<uint128>(m) * mul[1];
+            return static_cast<uint64_t>(((low >> 64) + high) >> (j - 64));
+        }
+
+        /*!
+         \brief The shortest decimal that reads back as a finite, positive
+         double.
+         \param ieee_mantissa The stored mantissa bits.
+         \param ieee_exponent The stored exponent bits.
+         \param exponent Receives the power of ten.
+         \return The decimal digits.
+         */
+        uint64_t shortest(const uint64_t ieee_mantissa, const uint32_t ieee_exponent,
+                int32_t* exponent)
+        {
+            int32_t e2;
+            uint64_t m2;
+            if (0 == ieee_exponent)
+            {
+                // Two extra bits, for the bounds.
+                e2 = 1 - k_bias - k_mantissa_bits - 2;
+                m2 = ieee_mantissa;
+            }
+            else
+            {
+                e2 = static_cast<int32_t>(ieee_exponent) - k_bias - k_mantissa_bits - 2;
+                m2 = (1ull << k_mantissa_bits) | ieee_mantissa;
+            }
+            const bool accept_bounds = 0 == (m2 & 1);
+
+            // The value and the halfway points to its neighbours, times four.
+            const uint64_t mv = 4 * m2;
+            const uint32_t mm_shift = 0 != ieee_mantissa || 1 >= ieee_exponent;
+
+            // Scale them by a power of ten, keeping enough bits.
+            const Pow5_tables& tables = pow5_tables();
+            uint64_t vr, vp, vm;
+            int32_t e10;
+            bool vm_trailing_zeros = false;
+            bool vr_trailing_zeros = false;
+            if (0 <= e2)
+            {
+                const uint32_t q = log10_pow2(e2) - (e2 > 3);
+                e10 = static_cast<int32_t>(q);
+                const int32_t k = k_pow5_inv_bitcount + pow5_bits(q) - 1;
+                const int32_t i = -e2 + static_cast<int32_t>(q) + k;
+                vr = mul_shift(4 * m2, tables.inv_split[q], i);
+                vp = mul_shift(4 * m2 + 2, tables.inv_split[q], i);
+                vm = mul_shift(4 * m2 - 1 - mm_shift, tables.inv_split[q], i);
+                if (q <= 21)
+                {
+                    // Only one of mp, mv and mm can be a multiple of 5.
+                    if (0 == mv % 5)
+                    {
+                        vr_trailing_zeros = multiple_of_pow5(mv, q);
+                    }
+                    else if (accept_bounds)
+                    {
+                        vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+                    }
+                    else
+                    {
+                        vp -= multiple_of_pow5(mv + 2, q);
+                    }
+                }
+            }
+            else
+            {
+                const uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+                e10 = static_cast<int32_t>(q) + e2;
+                const int32_t i = -e2 - static_cast<int32_t>(q);
+                const int32_t k = pow5_bits(i) - k_pow5_bitcount;
+                const int32_t j = static_cast<int32_t>(q) - k;
+                vr = mul_shift(4 * m2, tables.split[i], j);
+                vp = mul_shift(4 * m2 + 2, tables.split[i], j);
+                vm = mul_shift(4 * m2 - 1 - mm_shift, tables.split[i], j);
+                if (q <= 1)
+                {
+                    // mv has at least two trailing zero bits.
+                    vr_trailing_zeros = true;
+                    if (accept_bounds)
+                    {
+                        vm_trailing_zeros = 1 == mm_shift;
+                    }
+                    else
+                    {
+                        --vp;
+                    }
+                }
+                else if (q < 63)
+                {
+                    vr_trailing_zeros = multiple_of_pow2(mv, q);
+                }
+            }
+
+            // Drop digits while the bounds still differ.
+            int32_t removed = 0;
+            uint8_t last_removed = 0;
+            uint64_t output;
+            if (vm_trailing_zeros || vr_trailing_zeros)
+            {
+                // Rare: the exact value may sit on a bound or a tie.
+                for (; vp / 10 > vm / 10; ++removed)
+                {
+                    vm_trailing_zeros &= 0 == vm % 10;
+                    vr_trailing_zeros &= 0 == last_removed;
+                    last_removed = static_cast<uint8_t>(vr % 10);
+                    vr /= 10;
+                    vp /= 10;
+                    vm /= 10;
+                }
+                if (vm_trailing_zeros)
+                {
+                    for (; 0 == vm % 10; ++removed)
+                    {
+                        vr_trailing_zeros &= 0 == last_removed;
+                        last_removed = static_cast<uint8_t>(vr % 10);
+                        vr /= 10;
+                        vp /= 10;
+                        vm /= 10;
+                    }
+                }
+                if (vr_trailing_zeros && 5 == last_removed && 0 == vr % 2)
+                {
+                    // Round half to even.
+                    last_removed = 4;
+                }
+                output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+            }
+            else
+            {
+                bool round_up = false;
+                if (vp / 100 > vm / 100)
+                {
+                    round_up = vr % 100 >= 50;
+                    vr /= 100;
+                    vp /= 100;
+                    vm /= 100;
+                    removed += 2;
+                }
+                for (; vp / 10 > vm / 10; ++removed)
+                {
+                    round_up = vr % 10 >= 5;
+                    vr /= 10;
+                    vp /= 10;
+                    vm /= 10;
+                }
+                output = vr + (vr == vm || round_up);
+            }
+            *exponent = e10 + removed;
+            return output;
+        }
+    }; // namespace watson::(anonymous)
+
+    char* write_number(char* out, const uint64_t val)
+    {
+        const uint32_t n = decimal_length(val);
+        write_digits(out + n, val, n);
+        return out + n;
+    }
+
+    char* write_number(char* out, const int64_t val)
+    {
+        if (0 > val)
+        {
+            *out++ = '-';
+            return write_number(out, 0 - static_cast<uint64_t>(val));
+        }
+        return write_number(out, static_cast<uint64_t>(val));
+    }
+
+    char* write_number(char* out, const double val)
+    {
+        uint64_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        const bool negative = 0 != (bits >> 63);
+        const uint64_t ieee_mantissa = bits & ((1ull << k_mantissa_bits) - 1);
+        const uint32_t ieee_exponent = static_cast<uint32_t>((bits >> k_mantissa_bits) &
+                ((1u << k_exponent_bits) - 1));
+
+        if (((1u << k_exponent_bits) - 1) == ieee_exponent)
+        {
+            if (0 != ieee_mantissa)
+            {
+                memcpy(out, "nan", 3);
+                return out + 3;
+            }
+            if (negative)
+            {
+                *out++ = '-';
+            }
+            memcpy(out, "inf", 3);
+            return out + 3;
+        }
+        if (negative)
+        {
+            *out++ = '-';
+        }
+        if (0 == ieee_exponent && 0 == ieee_mantissa)
+        {
+            *out = '0';
+            return out + 1;
+        }
+
+        int32_t exponent;
+        const uint64_t digits = shortest(ieee_mantissa, ieee_exponent, &exponent);
+        const int32_t n = static_cast<int32_t>(decimal_length(digits));
+        // Digits before the decimal point.
+        const int32_t point = n + exponent;
+
+        if (0 < point && point <= 21)
+        {
+            if (0 <= exponent)
+            {
+                write_digits(out + n, digits, n);
+                memset(out + n, '0', exponent);
+                return out + point;
+            }
+            // Write the digits one place to the right, then pull the
+            // integral part back over the gap.
+            write_digits(out + n + 1, digits, n);
+            memmove(out, out + 1, point);
+            out[point] = '.';
+            return out + n + 1;
+        }
+        if (-6 < point && point <= 0)
+        {
+            out[0] = '0';
+            out[1] = '.';
+            memset(out + 2, '0', -point);
+            write_digits(out + 2 - point + n, digits, n);
+            return out + 2 - point + n;
+        }
+
+        // d[.ddd]e[+-]x
+        write_digits(out + n + 1, digits, n);
+        out[0] = out[1];
+        if (1 < n)
+        {
+            out[1] = '.';
+            out += n + 1;
+        }
+        else
+        {
+            out += 1;
+        }
+        *out++ = 'e';
+        const int32_t e = point - 1;
+        *out++ = 0 > e ? '-' : '+';
+        return write_number(out, static_cast<uint32_t>(0 > e ? -e : e));
+    }
+}; // namespace watson
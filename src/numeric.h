@@ -0,0 +1,85 @@
+#pragma once
+/*!
+ \file watson/numeric.h
+ \brief WatSON number formatting.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace watson
+{
+    /*!
+     \brief The most characters write_number() produces for any value.
+     \since 0.2
+     */
+    constexpr size_t k_max_number_text = 25;
+
+    /*!
+     \brief Write an integer in decimal.
+
+     Two digits are written at a time, from a table. Nothing depends on
+     the locale.
+
+     \param out Where to write, with room for k_max_number_text bytes.
+     \param val The value.
+     \return Pointer to the first byte after the text.
+     \since 0.2
+     */
+    char* write_number(char* out, uint64_t val);
+
+    //! \copydoc write_number(char*, uint64_t)
+    char* write_number(char* out, int64_t val);
+
+    //! \copydoc write_number(char*, uint64_t)
+    inline char* write_number(char* out, const uint32_t val) { return write_number(out, static_cast<uint64_t>(val)); }
+
+    //! \copydoc write_number(char*, uint64_t)
+    inline char* write_number(char* out, const int32_t val) { return write_number(out, static_cast<int64_t>(val)); }
+
+    /*!
+     \brief Write a double with the fewest digits that read back exactly.
+
+     The digits are found with the Ryu algorithm, so no big number
+     arithmetic is needed once its tables are built on first use. Values
+     from 1e-6 up to 1e21 are written without an exponent, as in
+     "0.001" or "123.5"; the others as in "1e+21" or "2.5e-8". Integral
+     values have no fraction, and the non-finite ones are written as
+     "nan", "inf" and "-inf". Nothing depends on the locale.
+
+     \param out Where to write, with room for k_max_number_text bytes.
+     \param val The value.
+     \return Pointer to the first byte after the text.
+     \since 0.2
+     */
+    char* write_number(char* out, double val);
+}; // namespace watson
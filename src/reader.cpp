@@ -0,0 +1,807 @@
+/*!
+ \file watson/reader.cpp
+ \brief WatSON buffered readers implementation.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "reader.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ios>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace watson
+{
+    namespace
+    {
+        double seconds_since(const std::chrono::steady_clock::time_point& start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        uint8_t* aligned_buffer(const size_t sz)
+        {
+            void* result = nullptr;
+            if (0 != posix_memalign(&result, k_direct_alignment, sz))
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<uint8_t*>(result);
+        }
+    }; // namespace watson::(anonymous)
+
+
+    // ----------------------------------------------------------------
+    // Fd_source class
+    // ----------------------------------------------------------------
+
+    Fd_source::Fd_source(const int fd, const size_t buffer_size) :
+            fd_(fd),
+            buffer_(new uint8_t[buffer_size]),
+            buffer_size_(buffer_size)
+    {
+    }
+
+    size_t Fd_source::next(const uint8_t** data)
+    {
+        ssize_t result;
+        do
+        {
+            result = ::read(fd_, buffer_.get(), buffer_size_);
+        } while (0 > result && EINTR == errno);
+
+        if (0 > result)
+        {
+            throw std::ios_base::failure(std::string("Unable to read WatSON data: ") + strerror(errno));
+        }
+        *data = buffer_.get();
+        return result;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Streambuf_source class
+    // ----------------------------------------------------------------
+
+    Streambuf_source::Streambuf_source(std::streambuf* sb, const size_t buffer_size) :
+            sb_(sb),
+            buffer_(new uint8_t[buffer_size]),
+            buffer_size_(buffer_size)
+    {
+    }
+
+    size_t Streambuf_source::next(const uint8_t** data)
+    {
+        *data = buffer_.get();
+        return sb_->sgetn(reinterpret_cast<char*>(buffer_.get()), buffer_size_);
+    }
+
+
+    // ----------------------------------------------------------------
+    // Direct_source class
+    // ----------------------------------------------------------------
+
+    Direct_source::Direct_source(const std::string& path, const size_t buffer_size,
+            const bool direct) :
+            fd_(-1),
+            direct_(false),
+            buffer_size_((std::max<size_t>(buffer_size, 1) + k_direct_alignment - 1) & ~(k_direct_alignment - 1)),
+            buffer_(aligned_buffer(buffer_size_), free),
+            chunk_size_(0),
+            offset_(0)
+    {
+#ifdef O_DIRECT
+        if (direct)
+        {
+            fd_ = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+            direct_ = 0 <= fd_;
+        }
+#endif
+        if (0 > fd_)
+        {
+            fd_ = ::open(path.c_str(), O_RDONLY);
+        }
+        if (0 > fd_)
+        {
+            throw std::ios_base::failure("Unable to open the WatSON file " + path + ".");
+        }
+
+#ifdef F_NOCACHE
+        // The closest macOS has to O_DIRECT.
+        if (direct && !direct_)
+        {
+            direct_ = -1 != ::fcntl(fd_, F_NOCACHE, 1);
+        }
+#endif
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (!direct_)
+        {
+            ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+#endif
+    }
+
+    Direct_source::~Direct_source()
+    {
+        ::close(fd_);
+    }
+
+    size_t Direct_source::next(const uint8_t** data)
+    {
+#ifdef POSIX_FADV_DONTNEED
+        // The last chunk has been used, and will not be read again.
+        if (!direct_ && 0 < chunk_size_)
+        {
+            ::posix_fadvise(fd_, offset_ - chunk_size_, chunk_size_, POSIX_FADV_DONTNEED);
+        }
+#endif
+
+        ssize_t result;
+        for (;;)
+        {
+            result = ::read(fd_, buffer_.get(), buffer_size_);
+            if (0 > result && EINTR == errno)
+            {
+                continue;
+            }
+#ifdef O_DIRECT
+            // Some file systems only refuse O_DIRECT once it is used.
+            if (0 > result && EINVAL == errno && direct_)
+            {
+                ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_DIRECT);
+                direct_ = false;
+                continue;
+            }
+#endif
+            break;
+        }
+
+        if (0 > result)
+        {
+            throw std::ios_base::failure(std::string("Unable to read WatSON data: ") + strerror(errno));
+        }
+        chunk_size_ = result;
+        offset_ += result;
+        *data = buffer_.get();
+        return result;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Prefetch_source class
+    // ----------------------------------------------------------------
+
+    Prefetch_source::Prefetch_source(const int fd, const size_t depth, const size_t buffer_size) :
+            fd_(fd),
+            source_(),
+            pending_(nullptr),
+            pending_size_(0),
+            buffer_size_(buffer_size),
+            buffers_(),
+            sizes_(std::max<size_t>(depth, 2)),
+            mutex_(),
+            space_(),
+            data_(),
+            head_(0),
+            tail_(0),
+            holding_(false),
+            done_(false),
+            stop_(false),
+            error_(),
+            stats_(),
+            thread_()
+    {
+        start();
+    }
+
+    Prefetch_source::Prefetch_source(std::unique_ptr<Ngrdnt_source>&& source, const size_t depth,
+            const size_t buffer_size) :
+            fd_(-1),
+            source_(std::move(source)),
+            pending_(nullptr),
+            pending_size_(0),
+            buffer_size_(buffer_size),
+            buffers_(),
+            sizes_(std::max<size_t>(depth, 2)),
+            mutex_(),
+            space_(),
+            data_(),
+            head_(0),
+            tail_(0),
+            holding_(false),
+            done_(false),
+            stop_(false),
+            error_(),
+            stats_(),
+            thread_()
+    {
+        start();
+    }
+
+    Prefetch_source::~Prefetch_source()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        space_.notify_all();
+        thread_.join();
+    }
+
+    size_t Prefetch_source::next(const uint8_t** data)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (holding_)
+        {
+            ++head_;
+            holding_ = false;
+            space_.notify_one();
+        }
+
+        if (head_ == tail_ && !done_)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            ++stats_.consumer_waits;
+            data_.wait(lock, [this]() { return head_ < tail_ || done_; });
+            stats_.consumer_stall += seconds_since(start);
+        }
+
+        if (head_ < tail_)
+        {
+            holding_ = true;
+            *data = buffers_[head_ % buffers_.size()].get();
+            return sizes_[head_ % buffers_.size()];
+        }
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+        return 0;
+    }
+
+    Prefetch_stats Prefetch_source::stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    void Prefetch_source::start()
+    {
+        for (size_t h = 0; h < sizes_.size(); ++h)
+        {
+            buffers_.emplace_back(new uint8_t[buffer_size_]);
+        }
+        thread_ = std::thread(&Prefetch_source::run, this);
+    }
+
+    void Prefetch_source::run()
+    {
+        try
+        {
+            for (;;)
+            {
+                uint8_t* buffer;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    if (tail_ - head_ == buffers_.size() && !stop_)
+                    {
+                        const auto start = std::chrono::steady_clock::now();
+                        ++stats_.io_waits;
+                        space_.wait(lock, [this]() { return stop_ || tail_ - head_ < buffers_.size(); });
+                        stats_.io_stall += seconds_since(start);
+                    }
+                    if (stop_)
+                    {
+                        return;
+                    }
+                    buffer = buffers_[tail_ % buffers_.size()].get();
+                }
+
+                // The buffer is not visible to the consumer until tail_ moves.
+                const size_t sz = read(buffer, buffer_size_);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (0 == sz)
+                    {
+                        done_ = true;
+                    }
+                    else
+                    {
+                        sizes_[tail_ % buffers_.size()] = sz;
+                        ++tail_;
+                        stats_.bytes += sz;
+                    }
+                }
+                data_.notify_one();
+                if (0 == sz)
+                {
+                    return;
+                }
+            }
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                error_ = std::current_exception();
+                done_ = true;
+            }
+            data_.notify_one();
+        }
+    }
+
+    size_t Prefetch_source::read(uint8_t* d, const size_t n)
+    {
+        if (0 <= fd_)
+        {
+            ssize_t result;
+            do
+            {
+                result = ::read(fd_, d, n);
+            } while (0 > result && EINTR == errno);
+
+            if (0 > result)
+            {
+                throw std::ios_base::failure(std::string("Unable to read WatSON data: ") + strerror(errno));
+            }
+            return result;
+        }
+
+        if (0 == pending_size_)
+        {
+            pending_size_ = source_->next(&pending_);
+        }
+        const size_t take = std::min(n, pending_size_);
+        memcpy(d, pending_, take);
+        pending_ += take;
+        pending_size_ -= take;
+        return take;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Ngrdnt_reader class
+    // ----------------------------------------------------------------
+
+    Ngrdnt_reader::Ngrdnt_reader(const int fd, const size_t buffer_size) :
+            Ngrdnt_reader(std::unique_ptr<Ngrdnt_source>(new Fd_source(fd, buffer_size)))
+    {
+    }
+
+    Ngrdnt_reader::Ngrdnt_reader(std::streambuf* sb, const size_t buffer_size) :
+            Ngrdnt_reader(std::unique_ptr<Ngrdnt_source>(new Streambuf_source(sb, buffer_size)))
+    {
+    }
+
+    Ngrdnt_reader::Ngrdnt_reader(std::unique_ptr<Ngrdnt_source>&& source) :
+            source_(std::move(source)),
+            ptr_(nullptr),
+            end_(nullptr),
+            spill_(),
+            offset_(0),
+            count_(0),
+            spilled_(0)
+    {
+    }
+
+    const uint8_t* Ngrdnt_reader::next()
+    {
+        if (end_ == ptr_ && !fill())
+        {
+            return nullptr;
+        }
+
+        // The common case, the whole Ngrdnt is in the chunk.
+        const size_t available = end_ - ptr_;
+        uint64_t header_size = ngrdnt_header_size(ptr_[0]);
+        if (available >= header_size)
+        {
+            const uint64_t sz = ngrdnt_size(ptr_);
+            if (sz < header_size)
+            {
+                throw std::ios_base::failure("Invalid WatSON Size in the input stream.");
+            }
+            if (available >= sz)
+            {
+                const uint8_t* result = ptr_;
+                ptr_ += sz;
+                offset_ += sz;
+                ++count_;
+                return result;
+            }
+        }
+
+        // Gather an Ngrdnt that spans chunks. The size is only known once
+        // the header is complete.
+        spill_.assign(ptr_, end_);
+        ptr_ = end_;
+        uint64_t sz = 0;
+        while (0 == sz || spill_.size() < sz)
+        {
+            if (0 == sz && spill_.size() >= header_size)
+            {
+                sz = ngrdnt_size(spill_.data());
+                if (sz < header_size)
+                {
+                    throw std::ios_base::failure("Invalid WatSON Size in the input stream.");
+                }
+                continue;
+            }
+            if (end_ == ptr_ && !fill())
+            {
+                throw std::ios_base::failure("Unable to read the WatSON Element data from the input stream.");
+            }
+            const uint64_t wanted = (0 == sz ? header_size : sz) - spill_.size();
+            const size_t take = std::min<uint64_t>(wanted, end_ - ptr_);
+            spill_.insert(spill_.end(), ptr_, ptr_ + take);
+            ptr_ += take;
+        }
+
+        offset_ += sz;
+        ++count_;
+        ++spilled_;
+        return spill_.data();
+    }
+
+    bool Ngrdnt_reader::next(Ngrdnt::Ptr& val)
+    {
+        const uint8_t* d = next();
+        if (!d)
+        {
+            return false;
+        }
+
+        if (val && 1 == val.use_count())
+        {
+            val->observe(d);
+        }
+        else
+        {
+            val = Ngrdnt::temp(d);
+        }
+        return true;
+    }
+
+    void Ngrdnt_reader::reset(const uint64_t offset)
+    {
+        ptr_ = end_ = nullptr;
+        offset_ = offset;
+    }
+
+    bool Ngrdnt_reader::fill()
+    {
+        const uint8_t* data;
+        const size_t sz = source_->next(&data);
+        if (0 == sz)
+        {
+            ptr_ = end_ = nullptr;
+            return false;
+        }
+
+        ptr_ = data;
+        end_ = data + sz;
+        return true;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Ngrdnt_parser class
+    // ----------------------------------------------------------------
+
+    Ngrdnt_parser::Ngrdnt_parser() :
+            ptr_(nullptr),
+            end_(nullptr),
+            spill_(),
+            spill_out_(false),
+            offset_(0),
+            count_(0),
+            spilled_(0)
+    {
+    }
+
+    void Ngrdnt_parser::feed(const uint8_t* d, const size_t n)
+    {
+        if (ptr_ != end_)
+        {
+            throw std::logic_error("The previous WatSON chunk was not fully parsed.");
+        }
+        ptr_ = d;
+        end_ = d + n;
+    }
+
+    const uint8_t* Ngrdnt_parser::next()
+    {
+        if (spill_out_)
+        {
+            spill_.clear();
+            spill_out_ = false;
+        }
+
+        // Finish an Ngrdnt started in an earlier chunk.
+        if (!spill_.empty())
+        {
+            if (!gather())
+            {
+                return nullptr;
+            }
+            offset_ += spill_.size();
+            ++count_;
+            ++spilled_;
+            spill_out_ = true;
+            return spill_.data();
+        }
+
+        if (end_ == ptr_)
+        {
+            return nullptr;
+        }
+
+        const size_t available = end_ - ptr_;
+        const uint64_t header_size = ngrdnt_header_size(ptr_[0]);
+        if (available >= header_size)
+        {
+            const uint64_t sz = ngrdnt_size(ptr_);
+            if (sz < header_size)
+            {
+                throw std::ios_base::failure("Invalid WatSON Size in the input stream.");
+            }
+            if (available >= sz)
+            {
+                const uint8_t* result = ptr_;
+                ptr_ += sz;
+                offset_ += sz;
+                ++count_;
+                return result;
+            }
+        }
+
+        // Keep the start of the Ngrdnt, the chunk is about to go away.
+        spill_.assign(ptr_, end_);
+        ptr_ = end_;
+        return nullptr;
+    }
+
+    bool Ngrdnt_parser::gather()
+    {
+        // The size is only known once the header is complete.
+        const uint64_t header_size = ngrdnt_header_size(spill_[0]);
+        if (spill_.size() < header_size)
+        {
+            const size_t take = std::min<uint64_t>(header_size - spill_.size(), end_ - ptr_);
+            spill_.insert(spill_.end(), ptr_, ptr_ + take);
+            ptr_ += take;
+            if (spill_.size() < header_size)
+            {
+                return false;
+            }
+        }
+
+        const uint64_t sz = ngrdnt_size(spill_.data());
+        if (sz < header_size)
+        {
+            throw std::ios_base::failure("Invalid WatSON Size in the input stream.");
+        }
+        const size_t take = std::min<uint64_t>(sz - spill_.size(), end_ - ptr_);
+        spill_.insert(spill_.end(), ptr_, ptr_ + take);
+        ptr_ += take;
+        return spill_.size() == sz;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Bounded_reader class
+    // ----------------------------------------------------------------
+
+    //! Shared with every Ngrdnt handed out, which gives its memory back.
+    struct Bounded_reader::Budget
+    {
+        explicit Budget(const uint64_t l) :
+                limit(l),
+                used(0)
+        {
+        }
+
+        bool acquire(const uint64_t n, const bool wait)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (used + n > limit)
+            {
+                if (!wait)
+                {
+                    return false;
+                }
+                released.wait(lock, [this, n]() { return used + n <= limit; });
+            }
+            used += n;
+            return true;
+        }
+
+        void release(const uint64_t n)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                used -= n;
+            }
+            released.notify_all();
+        }
+
+        const uint64_t limit;
+        uint64_t used;
+        std::mutex mutex;
+        std::condition_variable released;
+    };
+
+    Bounded_reader::Bounded_reader(std::unique_ptr<Ngrdnt_source>&& source,
+            const Reader_limits& limits) :
+            source_(std::move(source)),
+            limits_(limits),
+            budget_(std::make_shared<Budget>(limits.budget)),
+            ptr_(nullptr),
+            end_(nullptr),
+            header_(),
+            header_size_(0),
+            have_header_(false),
+            element_size_(0),
+            remaining_(0),
+            header_sent_(true),
+            offset_(0)
+    {
+        if (limits_.chunk_size > limits_.budget)
+        {
+            throw std::runtime_error("The WatSON reader chunk size is larger than its budget.");
+        }
+    }
+
+    Read_result Bounded_reader::next(Ngrdnt::Ptr& val)
+    {
+        const uint8_t* ignored;
+        while (0 < next_piece(&ignored))
+        {
+        }
+
+        // The header stays read while waiting for the budget.
+        if (!have_header_)
+        {
+            if (end_ == ptr_ && !fill())
+            {
+                return Read_result::k_end;
+            }
+            header_size_ = ngrdnt_header_size(ptr_[0]);
+            copy(header_, header_size_);
+            have_header_ = true;
+        }
+
+        const uint64_t sz = ngrdnt_size(header_);
+        if (sz < header_size_)
+        {
+            throw std::ios_base::failure("Invalid WatSON Size in the input stream.");
+        }
+        if (sz > limits_.max_element_size)
+        {
+            throw std::ios_base::failure("WatSON Element in the input stream is larger than allowed.");
+        }
+
+        if (sz > limits_.chunk_size)
+        {
+            have_header_ = false;
+            element_size_ = sz;
+            remaining_ = sz - header_size_;
+            header_sent_ = false;
+            return Read_result::k_large;
+        }
+
+        if (!budget_->acquire(sz, limits_.wait))
+        {
+            return Read_result::k_busy;
+        }
+        have_header_ = false;
+        const std::shared_ptr<Budget> budget(budget_);
+        const std::shared_ptr<uint8_t> owner(new uint8_t[sz], [budget, sz](uint8_t* p) {
+            delete[] p;
+            budget->release(sz);
+        });
+        memcpy(owner.get(), header_, header_size_);
+        copy(owner.get() + header_size_, sz - header_size_);
+        val = Ngrdnt::view(owner.get(), owner);
+        return Read_result::k_element;
+    }
+
+    size_t Bounded_reader::next_piece(const uint8_t** data)
+    {
+        if (!header_sent_)
+        {
+            header_sent_ = true;
+            *data = header_;
+            return header_size_;
+        }
+        if (0 == remaining_)
+        {
+            return 0;
+        }
+
+        if (end_ == ptr_ && !fill())
+        {
+            throw std::ios_base::failure("Unable to read the WatSON Element data from the input stream.");
+        }
+        const size_t take = std::min<uint64_t>(remaining_, end_ - ptr_);
+        *data = ptr_;
+        ptr_ += take;
+        remaining_ -= take;
+        offset_ += take;
+        return take;
+    }
+
+    uint64_t Bounded_reader::in_flight() const
+    {
+        std::lock_guard<std::mutex> lock(budget_->mutex);
+        return budget_->used;
+    }
+
+    bool Bounded_reader::fill()
+    {
+        const uint8_t* data;
+        const size_t sz = source_->next(&data);
+        if (0 == sz)
+        {
+            ptr_ = end_ = nullptr;
+            return false;
+        }
+
+        ptr_ = data;
+        end_ = data + sz;
+        return true;
+    }
+
+    void Bounded_reader::copy(uint8_t* out, uint64_t n)
+    {
+        while (0 < n)
+        {
+            if (end_ == ptr_ && !fill())
+            {
+                throw std::ios_base::failure("Unable to read the WatSON Element data from the input stream.");
+            }
+            const size_t take = std::min<uint64_t>(n, end_ - ptr_);
+            memcpy(out, ptr_, take);
+            out += take;
+            ptr_ += take;
+            offset_ += take;
+            n -= take;
+        }
+    }
+}; // namespace watson
@@ -0,0 +1,568 @@
+#pragma once
+/*!
+ \file watson/reader.h
+ \brief WatSON buffered readers.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "watson.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace watson
+{
+    /*!
+     \brief Default size of the buffers used by readers.
+     \since 0.2
+     */
+    constexpr size_t k_reader_buffer_size = 1 << 20;
+
+    /*!
+     \brief Supplies an Ngrdnt_reader with raw bytes, a chunk at a time.
+
+     Chunks may end anywhere, including in the middle of an Ngrdnt.
+     \since 0.2
+     */
+    class Ngrdnt_source
+    {
+    public:
+        virtual ~Ngrdnt_source() = default;
+
+        /*!
+         \brief Get the next chunk of bytes.
+
+         The chunk stays valid until the next call.
+
+         \param data Set to the start of the chunk.
+         \return The size of the chunk, 0 at the end of the input.
+         */
+        virtual size_t next(const uint8_t** data) = 0;
+    }; // class watson::Ngrdnt_source
+
+    /*!
+     \brief Reads chunks from a file descriptor.
+
+     The descriptor is not closed by the source.
+     \since 0.2
+     */
+    class Fd_source : public Ngrdnt_source
+    {
+    public:
+        /*!
+         \brief Constructor.
+         \param fd The descriptor to read.
+         \param buffer_size The largest chunk to read at once.
+         */
+        explicit Fd_source(int fd, size_t buffer_size = k_reader_buffer_size);
+
+        size_t next(const uint8_t** data) override;
+
+    private:
+        int fd_;
+        std::unique_ptr<uint8_t[]> buffer_;
+        size_t buffer_size_;
+    }; // class watson::Fd_source
+
+    /*!
+     \brief Reads chunks from a stream buffer.
+     \since 0.2
+     */
+    class Streambuf_source : public Ngrdnt_source
+    {
+    public:
+        /*!
+         \brief Constructor.
+         \param sb The stream buffer to read, for example \c is.rdbuf().
+         \param buffer_size The largest chunk to read at once.
+         */
+        explicit Streambuf_source(std::streambuf* sb, size_t buffer_size = k_reader_buffer_size);
+
+        size_t next(const uint8_t** data) override;
+
+    private:
+        std::streambuf* sb_;
+        std::unique_ptr<uint8_t[]> buffer_;
+        size_t buffer_size_;
+    }; // class watson::Streambuf_source
+
+    /*!
+     \brief Alignment of the buffers and reads of a Direct_source.
+     \since 0.2
+     */
+    constexpr size_t k_direct_alignment = 4096;
+
+    /*!
+     \brief Reads a file around the page cache.
+
+     A full scan through the page cache evicts whatever other processes
+     had cached. This source opens the file with O_DIRECT and reads whole
+     aligned blocks into its own aligned buffer. Ngrdnts that straddle
+     block boundaries are put back together by Ngrdnt_reader as usual.
+
+     Where O_DIRECT is not available, the file is read normally, and the
+     kernel is told to read ahead and to drop each chunk once it has been
+     handed out. Wrap the source in a Prefetch_source to keep the disk
+     busy while the Ngrdnts are processed.
+     \since 0.2
+     */
+    class Direct_source : public Ngrdnt_source
+    {
+    public:
+        /*!
+         \brief Open a file.
+         \param path The file.
+         \param buffer_size The size of each read, rounded up to the
+         alignment.
+         \param direct Try O_DIRECT, rather than going straight to the
+         fallback.
+         */
+        explicit Direct_source(const std::string& path,
+                size_t buffer_size = k_reader_buffer_size, bool direct = true);
+        Direct_source(const Direct_source& o) = delete;
+        Direct_source& operator=(const Direct_source& rhs) = delete;
+
+        //! Closes the file.
+        ~Direct_source();
+
+        size_t next(const uint8_t** data) override;
+
+        //! Whether reads bypass the page cache.
+        inline bool direct() const { return direct_; }
+
+    private:
+        int fd_;
+        bool direct_;
+        size_t buffer_size_;
+        std::unique_ptr<uint8_t, void (*)(void*)> buffer_;
+        //! The size of the chunk handed out last.
+        size_t chunk_size_;
+        uint64_t offset_;
+    }; // class watson::Direct_source
+
+    /*!
+     \brief Time spent waiting on either side of a Prefetch_source.
+     \since 0.2
+     */
+    struct Prefetch_stats
+    {
+        //! Bytes read by the I/O thread.
+        uint64_t bytes;
+        //! Times the I/O thread found every buffer full.
+        uint64_t io_waits;
+        //! Seconds the I/O thread waited for the consumer.
+        double io_stall;
+        //! Times the consumer found every buffer empty.
+        uint64_t consumer_waits;
+        //! Seconds the consumer waited for the I/O thread.
+        double consumer_stall;
+    }; // struct watson::Prefetch_stats
+
+    /*!
+     \brief Reads ahead on a dedicated thread.
+
+     The I/O thread fills a ring of buffers while the consumer works on
+     the one it was handed last, so the consumer only ever waits when the
+     input cannot keep up. Errors on the I/O thread are rethrown by next()
+     once the data read before them has been consumed.
+
+     Large io_stall means the consumer is the bottleneck; large
+     consumer_stall means the input is.
+
+     \code
+     auto source = new watson::Prefetch_source(fd, 4);
+     watson::Ngrdnt_reader reader(std::unique_ptr<watson::Ngrdnt_source>(source));
+     while (const uint8_t* d = reader.next()) { ... }
+     watson::Prefetch_stats stats = source->stats();
+     \endcode
+     \since 0.2
+     */
+    class Prefetch_source : public Ngrdnt_source
+    {
+    public:
+        /*!
+         \brief Read ahead from a file descriptor, straight into the ring.
+         \param fd The descriptor to read, which is not closed.
+         \param depth The number of buffers, at least 2.
+         \param buffer_size The size of each buffer.
+         */
+        explicit Prefetch_source(int fd, size_t depth = 4,
+                size_t buffer_size = k_reader_buffer_size);
+
+        /*!
+         \brief Read ahead from another source.
+
+         The source is only used from the I/O thread, and its chunks are
+         copied into the ring.
+
+         \param source The source to read on the I/O thread.
+         \param depth The number of buffers, at least 2.
+         \param buffer_size The size of each buffer.
+         */
+        explicit Prefetch_source(std::unique_ptr<Ngrdnt_source>&& source,
+                size_t depth = 4, size_t buffer_size = k_reader_buffer_size);
+
+        Prefetch_source(const Prefetch_source& o) = delete;
+        Prefetch_source& operator=(const Prefetch_source& rhs) = delete;
+
+        //! Stops the I/O thread, after any read it is blocked in.
+        ~Prefetch_source();
+
+        size_t next(const uint8_t** data) override;
+
+        //! A snapshot of the stall counters.
+        Prefetch_stats stats() const;
+
+    private:
+        void start();
+        void run();
+        size_t read(uint8_t* d, size_t n);
+
+        int fd_;
+        std::unique_ptr<Ngrdnt_source> source_;
+        const uint8_t* pending_;
+        size_t pending_size_;
+        size_t buffer_size_;
+        std::vector<std::unique_ptr<uint8_t[]>> buffers_;
+        std::vector<size_t> sizes_;
+        mutable std::mutex mutex_;
+        std::condition_variable space_;
+        std::condition_variable data_;
+        //! Buffers handed to the consumer, including the one it holds.
+        uint64_t head_;
+        //! Buffers filled by the I/O thread.
+        uint64_t tail_;
+        bool holding_;
+        bool done_;
+        bool stop_;
+        std::exception_ptr error_;
+        Prefetch_stats stats_;
+        std::thread thread_;
+    }; // class watson::Prefetch_source
+
+    /*!
+     \brief Reads a stream of Ngrdnts with as little copying as possible.
+
+     Unlike operator>>(std::istream&, Ngrdnt::Ptr&), the input is read in
+     large chunks, and an Ngrdnt that fits in a chunk is handed out in
+     place. Only an Ngrdnt that spans two chunks is copied, into a buffer
+     that is reused for the next one.
+
+     Everything handed out is only valid until the next call to next().
+     Use Ngrdnt::clone() to keep an Ngrdnt for longer.
+     \since 0.2
+     */
+    class Ngrdnt_reader
+    {
+    public:
+        /*!
+         \brief Read from a file descriptor.
+         \param fd The descriptor to read, which is not closed.
+         \param buffer_size The size of the read buffer.
+         */
+        explicit Ngrdnt_reader(int fd, size_t buffer_size = k_reader_buffer_size);
+
+        /*!
+         \brief Read from a stream buffer.
+         \param sb The stream buffer to read.
+         \param buffer_size The size of the read buffer.
+         */
+        explicit Ngrdnt_reader(std::streambuf* sb, size_t buffer_size = k_reader_buffer_size);
+
+        /*!
+         \brief Read from any source.
+         \param source Where the bytes come from.
+         */
+        explicit Ngrdnt_reader(std::unique_ptr<Ngrdnt_source>&& source);
+
+        Ngrdnt_reader(const Ngrdnt_reader& o) = delete;
+        Ngrdnt_reader(Ngrdnt_reader&& o) = default;
+        ~Ngrdnt_reader() = default;
+        Ngrdnt_reader& operator=(const Ngrdnt_reader& rhs) = delete;
+        Ngrdnt_reader& operator=(Ngrdnt_reader&& rhs) = default;
+
+        /*!
+         \brief Read the next Ngrdnt.
+         \return The raw Ngrdnt, or nullptr at the end of the input.
+         */
+        const uint8_t* next();
+
+        /*!
+         \brief Read the next Ngrdnt into an object.
+
+         When \c val is the only reference to its Ngrdnt, that Ngrdnt is
+         reused as a view of the next one, so nothing is allocated.
+
+         \param val Set to a view of the next Ngrdnt.
+         \return false at the end of the input.
+         */
+        bool next(Ngrdnt::Ptr& val);
+
+        /*!
+         \brief Drop any buffered input, after the source was repositioned.
+         \param offset The new value for offset().
+         */
+        void reset(uint64_t offset = 0);
+
+        //! The number of bytes handed out so far.
+        inline uint64_t offset() const { return offset_; }
+
+        //! The number of Ngrdnts handed out so far.
+        inline uint64_t count() const { return count_; }
+
+        //! The number of Ngrdnts that had to be copied.
+        inline uint64_t spilled() const { return spilled_; }
+
+    private:
+        //! Move to the next chunk, false at the end of the input.
+        bool fill();
+
+        std::unique_ptr<Ngrdnt_source> source_;
+        const uint8_t* ptr_;
+        const uint8_t* end_;
+        std::vector<uint8_t> spill_;
+        uint64_t offset_;
+        uint64_t count_;
+        uint64_t spilled_;
+    }; // class watson::Ngrdnt_reader
+
+    /*!
+     \brief Splits Ngrdnts out of chunks pushed by the caller.
+
+     For input that arrives on its own schedule, such as a non-blocking
+     socket, where Ngrdnt_reader would have to block. Each chunk is fed
+     in, and next() is called until it returns nullptr:
+
+     \code
+     parser.feed(buffer, n);
+     while (const uint8_t* d = parser.next()) { ... }
+     \endcode
+
+     An Ngrdnt that lies entirely in a chunk is handed out in place. Only
+     an Ngrdnt that spans chunks, including one whose header is split, is
+     gathered into a buffer that is reused for the next one.
+     \since 0.2
+     */
+    class Ngrdnt_parser
+    {
+    public:
+        Ngrdnt_parser();
+        Ngrdnt_parser(const Ngrdnt_parser& o) = delete;
+        Ngrdnt_parser(Ngrdnt_parser&& o) = default;
+        ~Ngrdnt_parser() = default;
+        Ngrdnt_parser& operator=(const Ngrdnt_parser& rhs) = delete;
+        Ngrdnt_parser& operator=(Ngrdnt_parser&& rhs) = default;
+
+        /*!
+         \brief Add the next chunk of input.
+
+         The chunk must stay valid, and unchanged, until next() returns
+         nullptr. Everything left of it is copied by then.
+
+         \param d The chunk.
+         \param n The size of the chunk.
+         */
+        void feed(const uint8_t* d, size_t n);
+
+        /*!
+         \brief Take the next complete Ngrdnt.
+         \return The raw Ngrdnt, valid until the next call, or nullptr
+         when more input is needed.
+         */
+        const uint8_t* next();
+
+        //! The bytes of an incomplete Ngrdnt held from earlier chunks.
+        inline size_t partial() const { return spill_out_ ? 0 : spill_.size(); }
+
+        //! The number of bytes handed out so far.
+        inline uint64_t offset() const { return offset_; }
+
+        //! The number of Ngrdnts handed out so far.
+        inline uint64_t count() const { return count_; }
+
+        //! The number of Ngrdnts that had to be copied.
+        inline uint64_t spilled() const { return spilled_; }
+
+    private:
+        //! Add to the spilled Ngrdnt, true once it is complete.
+        bool gather();
+
+        const uint8_t* ptr_;
+        const uint8_t* end_;
+        std::vector<uint8_t> spill_;
+        //! The spill buffer was handed out by the last call.
+        bool spill_out_;
+        uint64_t offset_;
+        uint64_t count_;
+        uint64_t spilled_;
+    }; // class watson::Ngrdnt_parser
+
+    /*!
+     \brief Limits on the memory a Bounded_reader may use.
+     \since 0.2
+     */
+    struct Reader_limits
+    {
+        Reader_limits() :
+                max_element_size(64 << 20),
+                budget(256 << 20),
+                chunk_size(1 << 20),
+                wait(true)
+        {
+        }
+
+        //! Larger Ngrdnts are rejected before anything is allocated.
+        uint64_t max_element_size;
+        //! The most memory held at once by Ngrdnts handed out whole.
+        uint64_t budget;
+        //! Larger Ngrdnts are delivered in pieces instead of whole.
+        uint64_t chunk_size;
+        //! Wait for memory to be released, instead of returning k_busy.
+        bool wait;
+    }; // struct watson::Reader_limits
+
+    /*!
+     \brief What Bounded_reader::next() found.
+     \since 0.2
+     */
+    enum class Read_result : uint8_t
+    {
+        k_element, //!< A whole Ngrdnt.
+        k_large, //!< An Ngrdnt to be read in pieces with next_piece().
+        k_busy, //!< The budget is spent, try again once memory is released.
+        k_end //!< The end of the input.
+    }; // enum class watson::Read_result
+
+    /*!
+     \brief Reads a stream of Ngrdnts within fixed memory limits.
+
+     operator>>(std::istream&, Ngrdnt::Ptr&) allocates whatever the size
+     field asks for. This reader checks the size against a limit first,
+     and charges every Ngrdnt it hands out against a memory budget until
+     the last reference to it is gone. Once the budget is spent, it stops
+     reading from its source, which pushes back on whoever is producing
+     the input.
+
+     Ngrdnts larger than the chunk size are not buffered at all. Their
+     bytes, header included, are handed out in pieces straight from the
+     read buffer, so they can be written on without ever being whole in
+     memory.
+
+     \code
+     watson::Ngrdnt::Ptr val;
+     for (;;)
+     {
+         const watson::Read_result r = reader.next(val);
+         if (watson::Read_result::k_end == r) break;
+         if (watson::Read_result::k_large == r)
+         {
+             const uint8_t* d;
+             while (size_t n = reader.next_piece(&d)) { ... }
+         }
+         else { ... }
+     }
+     \endcode
+     \since 0.2
+     */
+    class Bounded_reader
+    {
+    public:
+        /*!
+         \brief Constructor.
+         \param source Where the bytes come from.
+         \param limits The limits, where the chunk size may not be larger
+         than the budget.
+         */
+        explicit Bounded_reader(std::unique_ptr<Ngrdnt_source>&& source,
+                const Reader_limits& limits = Reader_limits());
+        Bounded_reader(const Bounded_reader& o) = delete;
+        Bounded_reader(Bounded_reader&& o) = default;
+        ~Bounded_reader() = default;
+        Bounded_reader& operator=(const Bounded_reader& rhs) = delete;
+        Bounded_reader& operator=(Bounded_reader&& rhs) = default;
+
+        /*!
+         \brief Move to the next Ngrdnt.
+
+         Any pieces of a large Ngrdnt that were not read are skipped.
+
+         \param val Set to the Ngrdnt for k_element.
+         \return What was found.
+         */
+        Read_result next(Ngrdnt::Ptr& val);
+
+        /*!
+         \brief Read the next piece of a large Ngrdnt.
+         \param data Set to the piece, valid until the next call.
+         \return The size of the piece, 0 after the last one.
+         */
+        size_t next_piece(const uint8_t** data);
+
+        //! The size of the large Ngrdnt being read in pieces.
+        inline uint64_t element_size() const { return element_size_; }
+
+        //! Memory held by Ngrdnts handed out and still referenced.
+        uint64_t in_flight() const;
+
+        //! The number of bytes read so far.
+        inline uint64_t offset() const { return offset_; }
+
+    private:
+        struct Budget;
+
+        //! Move to the next chunk, false at the end of the input.
+        bool fill();
+        //! Copy from the input, throwing at the end of it.
+        void copy(uint8_t* out, uint64_t n);
+
+        std::unique_ptr<Ngrdnt_source> source_;
+        Reader_limits limits_;
+        std::shared_ptr<Budget> budget_;
+        const uint8_t* ptr_;
+        const uint8_t* end_;
+        //! The header of the next Ngrdnt, once it has been read.
+        uint8_t header_[9];
+        size_t header_size_;
+        bool have_header_;
+        //! Of the large Ngrdnt being read in pieces.
+        uint64_t element_size_;
+        uint64_t remaining_;
+        bool header_sent_;
+        uint64_t offset_;
+    }; // class watson::Bounded_reader
+}; // namespace watson
@@ -0,0 +1,484 @@
+/*!
+ \file watson/ring.cpp
+ \brief WatSON single producer, single consumer rings implementation.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ring.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ios>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace watson
+{
+    namespace
+    {
+        //! The Length of a frame that sends the consumer back to the start.
+        const uint64_t k_ring_wrap = ~0ull;
+
+        const uint64_t k_frame_header_size = sizeof(uint64_t);
+
+        //! The space a frame of \c n bytes takes up.
+        inline uint64_t frame_size(const uint64_t n)
+        {
+            return k_frame_header_size + ((n + 7) & ~7ull);
+        }
+
+        size_t round_up_capacity(const size_t capacity)
+        {
+            size_t result = k_cache_line_size;
+            while (result < capacity)
+            {
+                result <<= 1;
+            }
+            return result;
+        }
+
+        const uint32_t k_shared_ring_magic = 0x474e5257;
+
+        std::chrono::steady_clock::time_point deadline_after(const std::chrono::milliseconds timeout)
+        {
+            if (std::chrono::milliseconds::max() == timeout)
+            {
+                return std::chrono::steady_clock::time_point::max();
+            }
+            return std::chrono::steady_clock::now() + timeout;
+        }
+
+        //! Sleep while \c word holds \c expected, for at most a while.
+        void sleep_on(std::atomic<uint32_t>& word, const uint32_t expected,
+                const std::chrono::steady_clock::time_point deadline)
+        {
+            const auto remaining = std::min<std::chrono::steady_clock::duration>(
+                    deadline - std::chrono::steady_clock::now(), std::chrono::seconds(1));
+#ifdef __linux__
+            const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+            struct timespec ts;
+            ts.tv_sec = ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+            // No futex to share between processes, so poll.
+            (void) word;
+            (void) expected;
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                    remaining, std::chrono::microseconds(100)));
+#endif
+        }
+
+        void wake(std::atomic<uint32_t>& word)
+        {
+            word.fetch_add(1);
+#ifdef __linux__
+            ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+        }
+    }; // namespace watson::(anonymous)
+
+
+    // ----------------------------------------------------------------
+    // Ngrdnt_ring class
+    // ----------------------------------------------------------------
+
+    size_t Ngrdnt_ring::region_size(const size_t capacity)
+    {
+        return sizeof(Control) + capacity;
+    }
+
+    Ngrdnt_ring::Ngrdnt_ring(const size_t capacity) :
+            owned_(new uint8_t[region_size(round_up_capacity(capacity)) + k_cache_line_size]),
+            control_(nullptr),
+            data_(nullptr),
+            mask_(round_up_capacity(capacity) - 1),
+            producer_(),
+            consumer_()
+    {
+        // new[] makes no promise about cache line alignment.
+        const uintptr_t base = reinterpret_cast<uintptr_t>(owned_.get());
+        const uintptr_t aligned = (base + k_cache_line_size - 1) & ~(k_cache_line_size - 1);
+        control_ = new (reinterpret_cast<void*>(aligned)) Control();
+        control_->tail.store(0);
+        control_->head.store(0);
+        data_ = reinterpret_cast<uint8_t*>(control_ + 1);
+    }
+
+    Ngrdnt_ring::Ngrdnt_ring(void* region, const size_t capacity, const bool initialize) :
+            owned_(),
+            control_(static_cast<Control*>(region)),
+            data_(reinterpret_cast<uint8_t*>(control_ + 1)),
+            mask_(capacity - 1),
+            producer_(),
+            consumer_()
+    {
+        if (capacity < k_cache_line_size || 0 != (capacity & mask_))
+        {
+            throw std::runtime_error("WatSON ring capacity must be a power of two.");
+        }
+        if (initialize)
+        {
+            new (region) Control();
+            control_->tail.store(0);
+            control_->head.store(0);
+        }
+
+        // Pick up where the ring is, in case it is already in use.
+        producer_.position = consumer_.other = control_->tail.load(std::memory_order_acquire);
+        consumer_.position = producer_.other = control_->head.load(std::memory_order_acquire);
+    }
+
+    uint8_t* Ngrdnt_ring::reserve(const size_t n)
+    {
+        const uint64_t need = frame_size(n);
+        if (need > capacity())
+        {
+            throw std::runtime_error("WatSON Ngrdnt is larger than the ring.");
+        }
+
+        // A frame that would run past the end starts over at the front.
+        // The skip is published on its own, so the consumer can pass it
+        // and free the tail even while the frame itself has to wait.
+        const uint64_t offset = producer_.position & mask_;
+        const uint64_t contiguous = capacity() - offset;
+        if (contiguous < need)
+        {
+            if (!room(contiguous))
+            {
+                return nullptr;
+            }
+            memcpy(data_ + offset, &k_ring_wrap, sizeof(k_ring_wrap));
+            producer_.position += contiguous;
+            publish();
+        }
+        if (!room(need))
+        {
+            return nullptr;
+        }
+        return data_ + (producer_.position & mask_) + k_frame_header_size;
+    }
+
+    bool Ngrdnt_ring::room(const uint64_t n)
+    {
+        if (producer_.position + n - producer_.other > capacity())
+        {
+            producer_.other = control_->head.load(std::memory_order_acquire);
+        }
+        return producer_.position + n - producer_.other <= capacity();
+    }
+
+    void Ngrdnt_ring::commit(const size_t n)
+    {
+        const uint64_t length = n;
+        memcpy(data_ + (producer_.position & mask_), &length, sizeof(length));
+        producer_.position += frame_size(n);
+    }
+
+    void Ngrdnt_ring::publish()
+    {
+        control_->tail.store(producer_.position, std::memory_order_release);
+    }
+
+    bool Ngrdnt_ring::push(const uint8_t* d)
+    {
+        const uint64_t sz = ngrdnt_size(d);
+        uint8_t* out = reserve(sz);
+        if (!out)
+        {
+            return false;
+        }
+        memcpy(out, d, sz);
+        commit(sz);
+        publish();
+        return true;
+    }
+
+    const uint8_t* Ngrdnt_ring::peek()
+    {
+        for (;;)
+        {
+            if (consumer_.position == consumer_.other)
+            {
+                consumer_.other = control_->tail.load(std::memory_order_acquire);
+                if (consumer_.position == consumer_.other)
+                {
+                    return nullptr;
+                }
+            }
+
+            const uint64_t offset = consumer_.position & mask_;
+            uint64_t length;
+            memcpy(&length, data_ + offset, sizeof(length));
+            if (k_ring_wrap != length)
+            {
+                return data_ + offset + k_frame_header_size;
+            }
+            // With nothing popped and held, the skipped tail goes back
+            // to the producer at once; otherwise the next release() does it.
+            const bool holding = control_->head.load(std::memory_order_relaxed) != consumer_.position;
+            consumer_.position += capacity() - offset;
+            if (!holding)
+            {
+                release();
+            }
+        }
+    }
+
+    void Ngrdnt_ring::pop()
+    {
+        uint64_t length;
+        memcpy(&length, data_ + (consumer_.position & mask_), sizeof(length));
+        consumer_.position += frame_size(length);
+    }
+
+    void Ngrdnt_ring::release()
+    {
+        control_->head.store(consumer_.position, std::memory_order_release);
+    }
+
+
+    // ----------------------------------------------------------------
+    // Shared_ring class
+    // ----------------------------------------------------------------
+
+    //! The start of the shared segment, followed by the ring.
+    struct Shared_ring::Header
+    {
+        //! Published last, once the rest of the segment is set up.
+        std::atomic<uint32_t> magic;
+        uint32_t reserved;
+        uint64_t capacity;
+        //! Bumped to wake the consumer.
+        alignas(k_cache_line_size) std::atomic<uint32_t> data;
+        std::atomic<uint32_t> consumer_sleeping;
+        //! Bumped to wake the producer.
+        alignas(k_cache_line_size) std::atomic<uint32_t> space;
+        std::atomic<uint32_t> producer_sleeping;
+    };
+
+    Shared_ring::Shared_ring(const std::string& name, size_t capacity) :
+            size_(0),
+            header_(create(name, capacity, &size_)),
+            ring_(header_ + 1, header_->capacity, true)
+    {
+        header_->magic.store(k_shared_ring_magic, std::memory_order_release);
+    }
+
+    Shared_ring::Shared_ring(const std::string& name) :
+            size_(0),
+            header_(open(name, &size_)),
+            ring_(header_ + 1, header_->capacity, false)
+    {
+    }
+
+    Shared_ring::~Shared_ring()
+    {
+        ::munmap(header_, size_);
+    }
+
+    void Shared_ring::remove(const std::string& name)
+    {
+        ::shm_unlink(name.c_str());
+    }
+
+    void Shared_ring::publish()
+    {
+        ring_.publish();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header_->consumer_sleeping.load())
+        {
+            wake(header_->data);
+        }
+    }
+
+    uint8_t* Shared_ring::reserve(const size_t n, const std::chrono::milliseconds timeout)
+    {
+        const auto deadline = deadline_after(timeout);
+        for (;;)
+        {
+            if (uint8_t* out = ring_.reserve(n))
+            {
+                return out;
+            }
+
+            // The consumer can only make room for what it can see.
+            publish();
+
+            const uint32_t seq = header_->space.load();
+            header_->producer_sleeping.store(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint8_t* out = ring_.reserve(n);
+            if (!out && std::chrono::steady_clock::now() < deadline)
+            {
+                sleep_on(header_->space, seq, deadline);
+            }
+            header_->producer_sleeping.store(0);
+            if (out || std::chrono::steady_clock::now() >= deadline)
+            {
+                return out;
+            }
+        }
+    }
+
+    bool Shared_ring::push(const uint8_t* d, const std::chrono::milliseconds timeout)
+    {
+        const uint64_t sz = ngrdnt_size(d);
+        uint8_t* out = reserve(sz, timeout);
+        if (!out)
+        {
+            return false;
+        }
+        memcpy(out, d, sz);
+        ring_.commit(sz);
+        publish();
+        return true;
+    }
+
+    void Shared_ring::release()
+    {
+        ring_.release();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header_->producer_sleeping.load())
+        {
+            wake(header_->space);
+        }
+    }
+
+    const uint8_t* Shared_ring::wait(const std::chrono::milliseconds timeout)
+    {
+        const auto deadline = deadline_after(timeout);
+        for (;;)
+        {
+            if (const uint8_t* d = ring_.peek())
+            {
+                return d;
+            }
+
+            // Passing a wrap may have freed the space the producer waits for.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (header_->producer_sleeping.load())
+            {
+                wake(header_->space);
+            }
+
+            // Say we are going to sleep, then look once more, so a publish
+            // in between is not missed.
+            const uint32_t seq = header_->data.load();
+            header_->consumer_sleeping.store(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const uint8_t* d = ring_.peek();
+            if (!d && std::chrono::steady_clock::now() < deadline)
+            {
+                sleep_on(header_->data, seq, deadline);
+            }
+            header_->consumer_sleeping.store(0);
+            if (d || std::chrono::steady_clock::now() >= deadline)
+            {
+                return d;
+            }
+        }
+    }
+
+    Shared_ring::Header* Shared_ring::create(const std::string& name, size_t capacity, size_t* size)
+    {
+        capacity = round_up_capacity(capacity);
+        ::shm_unlink(name.c_str());
+        const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (0 > fd)
+        {
+            throw std::ios_base::failure("Unable to create the WatSON shared ring " + name + ": " + strerror(errno));
+        }
+        const size_t sz = sizeof(Header) + Ngrdnt_ring::region_size(capacity);
+        void* addr = MAP_FAILED;
+        if (0 == ::ftruncate(fd, sz))
+        {
+            addr = ::mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        const std::string reason(strerror(errno));
+        ::close(fd);
+        if (MAP_FAILED == addr)
+        {
+            ::shm_unlink(name.c_str());
+            throw std::ios_base::failure("Unable to map the WatSON shared ring " + name + ": " + reason);
+        }
+
+        Header* header = new (addr) Header();
+        header->magic.store(0, std::memory_order_relaxed);
+        header->capacity = capacity;
+        header->data.store(0);
+        header->consumer_sleeping.store(0);
+        header->space.store(0);
+        header->producer_sleeping.store(0);
+        *size = sz;
+        return header;
+    }
+
+    Shared_ring::Header* Shared_ring::open(const std::string& name, size_t* size)
+    {
+        const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (0 > fd)
+        {
+            throw std::ios_base::failure("Unable to open the WatSON shared ring " + name + ": " + strerror(errno));
+        }
+        struct stat st;
+        void* addr = MAP_FAILED;
+        if (0 == ::fstat(fd, &st) && static_cast<size_t>(st.st_size) >= sizeof(Header))
+        {
+            addr = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (MAP_FAILED == addr)
+        {
+            throw std::runtime_error("Not a WatSON shared ring " + name + ".");
+        }
+
+        Header* header = static_cast<Header*>(addr);
+        if (k_shared_ring_magic != header->magic.load(std::memory_order_acquire) ||
+                static_cast<size_t>(st.st_size) != sizeof(Header) + Ngrdnt_ring::region_size(header->capacity))
+        {
+            ::munmap(addr, st.st_size);
+            throw std::runtime_error("Not a WatSON shared ring " + name + ".");
+        }
+        *size = st.st_size;
+        return header;
+    }
+}; // namespace watson
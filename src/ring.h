@@ -0,0 +1,286 @@
+#pragma once
+/*!
+ \file watson/ring.h
+ \brief WatSON single producer, single consumer rings.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "watson.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace watson
+{
+    /*!
+     \brief Size of a cache line, for keeping the two sides of a ring apart.
+     \since 0.2
+     */
+    constexpr size_t k_cache_line_size = 64;
+
+    /*!
+     \brief A lock-free ring of Ngrdnts between one producer and one consumer.
+
+     The producer encodes straight into the ring, and the consumer reads
+     each Ngrdnt where it lies, for example through Ngrdnt::temp(), so a
+     message costs no allocation and no reference count.
+
+     \code
+     (Ring-Frame) ::= (Length) (Ngrdnt) {(Padding)}
+     (Length) ::= (Unsigned-64bit-Integer)
+     \endcode
+
+     Frames are 8 byte aligned, and never wrap around the end of the
+     ring; a Length of all ones sends the consumer back to the start.
+
+     Each side keeps its position to itself until it calls publish() or
+     release(), so a batch of frames costs a single atomic store. The
+     shared head and tail live on separate cache lines, and each side
+     only reads the other's when it seems to have run out.
+
+     The ring can live in memory owned by someone else, such as a shared
+     memory segment, as long as both sides see it at the same layout.
+     \since 0.2
+     */
+    class Ngrdnt_ring
+    {
+    public:
+        /*!
+         \brief The memory needed for a ring.
+         \param capacity The ring capacity, a power of two.
+         \return The size of the control block and the data.
+         */
+        static size_t region_size(size_t capacity);
+
+        /*!
+         \brief Create a ring on the heap.
+         \param capacity The number of data bytes, rounded up to a power of two.
+         */
+        explicit Ngrdnt_ring(size_t capacity);
+
+        /*!
+         \brief Use a ring in memory owned by someone else.
+         \param region At least region_size(capacity) bytes, aligned to a
+         cache line.
+         \param capacity The ring capacity, a power of two.
+         \param initialize Reset the ring, which only one side should do.
+         */
+        Ngrdnt_ring(void* region, size_t capacity, bool initialize);
+
+        Ngrdnt_ring(const Ngrdnt_ring& o) = delete;
+        Ngrdnt_ring& operator=(const Ngrdnt_ring& rhs) = delete;
+        ~Ngrdnt_ring() = default;
+
+        //! The number of data bytes.
+        inline size_t capacity() const { return mask_ + 1; }
+
+        /*!
+         \brief Producer: get space to encode an Ngrdnt into.
+
+         When the frame does not fit before the end of the ring, the wrap
+         is written and published first, along with anything committed,
+         so the consumer can free the tail while the frame waits.
+
+         \param n The most bytes that will be committed.
+         \return The space, or nullptr while the ring is too full.
+         */
+        uint8_t* reserve(size_t n);
+
+        /*!
+         \brief Producer: keep the Ngrdnt encoded into reserved space.
+         \param n The size of the Ngrdnt, no more than was reserved.
+         */
+        void commit(size_t n);
+
+        //! Producer: make everything committed visible to the consumer.
+        void publish();
+
+        /*!
+         \brief Producer: copy an Ngrdnt in and publish it.
+         \param d The raw Ngrdnt.
+         \return false while the ring is too full.
+         */
+        bool push(const uint8_t* d);
+
+        //! Producer: copy an Ngrdnt in and publish it.
+        inline bool push(const Ngrdnt::Ptr& val) { return push(val->data()); }
+
+        /*!
+         \brief Consumer: look at the next Ngrdnt.
+         \return The raw Ngrdnt, valid until release(), or nullptr when
+         the ring is empty.
+         */
+        const uint8_t* peek();
+
+        //! Consumer: move past the Ngrdnt returned by peek().
+        void pop();
+
+        //! Consumer: give the space of everything popped back to the producer.
+        void release();
+
+    private:
+        //! Producer: whether \c n more bytes fit, looking at the head again if not.
+        bool room(uint64_t n);
+
+        //! The part shared by both sides.
+        struct Control
+        {
+            alignas(k_cache_line_size) std::atomic<uint64_t> tail;
+            alignas(k_cache_line_size) std::atomic<uint64_t> head;
+        };
+
+        //! The state private to one side.
+        struct alignas(k_cache_line_size) Side
+        {
+            //! Where this side is.
+            uint64_t position;
+            //! Where the other side was, last time we looked.
+            uint64_t other;
+        };
+
+        std::unique_ptr<uint8_t[]> owned_;
+        Control* control_;
+        uint8_t* data_;
+        uint64_t mask_;
+        Side producer_;
+        Side consumer_;
+    }; // class watson::Ngrdnt_ring
+
+    /*!
+     \brief An Ngrdnt_ring in shared memory, between two processes.
+
+     One process creates the segment and the other opens it by name.
+     Either may produce, but only one of them, and the other consumes.
+     The consumer reads Ngrdnts in place in the shared memory, so a
+     message crosses over with a single copy, made by the producer.
+
+     Each side only makes a system call to sleep when it has run out,
+     and the other side only makes one to wake it when it is asleep. On
+     Linux the sleeping is done with a futex in the segment; elsewhere
+     the waiting side polls.
+
+     \code
+     // Service
+     watson::Shared_ring ring("/watson.sidecar", 1 << 24);
+     ring.push(val->data());
+
+     // Sidecar
+     watson::Shared_ring ring("/watson.sidecar");
+     while (const uint8_t* d = ring.wait(std::chrono::milliseconds(100)))
+     {
+         process(watson::Ngrdnt::temp(d));
+         ring.ring().pop();
+         ring.release();
+     }
+     \endcode
+     \since 0.2
+     */
+    class Shared_ring
+    {
+    public:
+        /*!
+         \brief Create a shared ring, replacing any with the same name.
+         \param name The shared memory name, starting with '/'.
+         \param capacity The number of data bytes, rounded up to a power of two.
+         */
+        Shared_ring(const std::string& name, size_t capacity);
+
+        /*!
+         \brief Open a shared ring created by another process.
+         \param name The shared memory name.
+         */
+        explicit Shared_ring(const std::string& name);
+
+        Shared_ring(const Shared_ring& o) = delete;
+        Shared_ring(Shared_ring&& o) = delete;
+        Shared_ring& operator=(const Shared_ring& rhs) = delete;
+        Shared_ring& operator=(Shared_ring&& rhs) = delete;
+
+        //! Unmaps the segment, which stays until remove().
+        ~Shared_ring();
+
+        /*!
+         \brief Remove a shared ring once both sides are done with it.
+         \param name The shared memory name.
+         */
+        static void remove(const std::string& name);
+
+        //! The ring, for reserve(), commit(), peek() and pop().
+        inline Ngrdnt_ring& ring() { return ring_; }
+
+        //! Producer: publish, and wake the consumer if it sleeps.
+        void publish();
+
+        /*!
+         \brief Producer: wait for space to encode an Ngrdnt into.
+         \param n The most bytes that will be committed.
+         \param timeout How long to wait.
+         \return The space, or nullptr if the ring stayed too full.
+         */
+        uint8_t* reserve(size_t n, std::chrono::milliseconds timeout);
+
+        /*!
+         \brief Producer: copy an Ngrdnt in and publish it, waiting for space.
+         \param d The raw Ngrdnt.
+         \param timeout How long to wait.
+         \return false if the ring stayed too full.
+         */
+        bool push(const uint8_t* d,
+                std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+        //! Consumer: release, and wake the producer if it sleeps.
+        void release();
+
+        /*!
+         \brief Consumer: wait for the next Ngrdnt.
+         \param timeout How long to wait.
+         \return The raw Ngrdnt in shared memory, valid until release(),
+         or nullptr if nothing arrived.
+         */
+        const uint8_t* wait(std::chrono::milliseconds timeout);
+
+    private:
+        struct Header;
+
+        //! Create and map the segment, with an uninitialized ring.
+        static Header* create(const std::string& name, size_t capacity, size_t* size);
+
+        //! Map an existing segment.
+        static Header* open(const std::string& name, size_t* size);
+
+        size_t size_;
+        Header* header_;
+        Ngrdnt_ring ring_;
+    }; // class watson::Shared_ring
+}; // namespace watson
@@ -0,0 +1,843 @@
+/*!
+ \file watson/rpc.cpp
+ \brief WatSON remote procedure calls over local sockets.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rpc.h"
+#include <cerrno>
+#include <cstring>
+#include <ios>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+namespace watson
+{
+    namespace
+    {
+        const size_t k_max_header_size = 9;
+        const size_t k_rpc_read_size = 64 * 1024;
+        const int k_max_events = 64;
+#ifdef MSG_NOSIGNAL
+        const int k_send_flags = MSG_NOSIGNAL;
+#else
+        const int k_send_flags = 0;
+#endif
+
+        std::ios_base::failure io_error(const std::string& what)
+        {
+            return std::ios_base::failure(what + ": " + strerror(errno));
+        }
+
+        sockaddr_un local_address(const std::string& path)
+        {
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            if (path.size() >= sizeof(addr.sun_path))
+            {
+                throw std::runtime_error("WatSON RPC socket path is too long: " + path);
+            }
+            addr.sun_family = AF_UNIX;
+            memcpy(addr.sun_path, path.data(), path.size());
+            return addr;
+        }
+
+        void set_nonblocking(const int fd)
+        {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+            int on = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        }
+
+        void open_pipe(int* fds)
+        {
+            if (0 != ::pipe(fds))
+            {
+                throw io_error("Unable to create the WatSON RPC wake pipe");
+            }
+            set_nonblocking(fds[0]);
+            set_nonblocking(fds[1]);
+        }
+
+        void wake(const int fd)
+        {
+            const uint8_t b = 0;
+            while (0 > ::write(fd, &b, 1) && EINTR == errno)
+            {
+            }
+        }
+
+        void drain_pipe(const int fd)
+        {
+            uint8_t b[64];
+            while (0 < ::read(fd, b, sizeof(b)) || EINTR == errno)
+            {
+            }
+        }
+
+        void append(std::vector<uint8_t>& out, const uint8_t* d, const size_t n)
+        {
+            out.insert(out.end(), d, d + n);
+        }
+
+        std::string describe(const std::exception_ptr& error)
+        {
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch (const std::exception& ex)
+            {
+                return ex.what();
+            }
+            catch (...)
+            {
+                return "Unknown error.";
+            }
+        }
+
+        //! Encode an envelope straight into \c out, copying \c body once.
+        void append_envelope(std::vector<uint8_t>& out, const uint64_t id,
+                const Ngrdnt::Ptr& body, const std::exception_ptr& error)
+        {
+            uint32_t key = k_rpc_body;
+            Ngrdnt::Ptr child = body ? body : new_ngrdnt();
+            if (error)
+            {
+                key = k_rpc_error;
+                child = new_ngrdnt(describe(error));
+            }
+
+            uint8_t id_ngrdnt[k_max_header_size + sizeof(uint64_t)];
+            uint8_t* id_end = write_ngrdnt_header(id_ngrdnt, Ngrdnt_type::k_uint64, sizeof(id));
+            memcpy(id_end, &id, sizeof(id));
+            id_end += sizeof(id);
+
+            const uint64_t sz = 2 * sizeof(uint32_t) + (id_end - id_ngrdnt) + child->size();
+            uint8_t header[k_max_header_size];
+            const uint8_t* end = write_ngrdnt_header(header, Ngrdnt_type::k_map, sz);
+
+            append(out, header, end - header);
+            append(out, reinterpret_cast<const uint8_t*>(&k_rpc_id), sizeof(uint32_t));
+            append(out, id_ngrdnt, id_end - id_ngrdnt);
+            append(out, reinterpret_cast<const uint8_t*>(&key), sizeof(key));
+            append(out, child->data(), child->size());
+        }
+
+        Map open_envelope(const uint8_t* d)
+        {
+            if (Ngrdnt_type::k_map != ngrdnt_type(d[0]))
+            {
+                throw std::runtime_error("Not a WatSON RPC envelope.");
+            }
+            return Map::view(Ngrdnt::temp(d));
+        }
+
+        /*!
+         \brief Send as much of \c out as the socket takes.
+         \return true once everything is sent, false if the socket is full.
+         */
+        bool send_some(const int fd, std::vector<uint8_t>& out, size_t& sent,
+                std::atomic<uint64_t>& writes)
+        {
+            while (sent < out.size())
+            {
+                const ssize_t n = ::send(fd, out.data() + sent, out.size() - sent, k_send_flags);
+                if (0 > n && EINTR == errno)
+                {
+                    continue;
+                }
+                if (0 > n && (EAGAIN == errno || EWOULDBLOCK == errno))
+                {
+                    return false;
+                }
+                if (0 > n)
+                {
+                    throw io_error("Unable to write WatSON RPC data");
+                }
+                ++writes;
+                sent += n;
+            }
+            out.clear();
+            sent = 0;
+            return true;
+        }
+
+        /*!
+         \brief Read what the socket has.
+         \return The number of bytes, 0 if there is nothing more for now.
+         */
+        size_t receive_some(const int fd, std::vector<uint8_t>& in)
+        {
+            for (;;)
+            {
+                const ssize_t n = ::read(fd, in.data(), in.size());
+                if (0 > n && EINTR == errno)
+                {
+                    continue;
+                }
+                if (0 > n && (EAGAIN == errno || EWOULDBLOCK == errno))
+                {
+                    return 0;
+                }
+                if (0 > n)
+                {
+                    throw io_error("Unable to read WatSON RPC data");
+                }
+                if (0 == n)
+                {
+                    throw std::ios_base::failure("The WatSON RPC connection was closed.");
+                }
+                return n;
+            }
+        }
+    }; // namespace watson::(anonymous)
+
+    // ----------------------------------------------------------------
+    // Event_poller class
+    // ----------------------------------------------------------------
+
+#ifdef __linux__
+    Event_poller::Event_poller() :
+            fd_(::epoll_create1(EPOLL_CLOEXEC)),
+            events_()
+    {
+        if (0 > fd_)
+        {
+            throw io_error("Unable to create the WatSON event poller");
+        }
+    }
+
+    Event_poller::~Event_poller()
+    {
+        ::close(fd_);
+    }
+
+    void Event_poller::add(const int fd, const bool writable)
+    {
+        epoll_event ev;
+        ev.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+        ev.data.fd = fd;
+        if (0 != ::epoll_ctl(fd_, EPOLL_CTL_ADD, fd, &ev))
+        {
+            throw io_error("Unable to watch a descriptor");
+        }
+    }
+
+    void Event_poller::modify(const int fd, const bool writable)
+    {
+        epoll_event ev;
+        ev.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+        ev.data.fd = fd;
+        if (0 != ::epoll_ctl(fd_, EPOLL_CTL_MOD, fd, &ev))
+        {
+            throw io_error("Unable to watch a descriptor");
+        }
+    }
+
+    void Event_poller::remove(const int fd)
+    {
+        epoll_event ev;
+        ::epoll_ctl(fd_, EPOLL_CTL_DEL, fd, &ev);
+    }
+
+    const std::vector<Event_poller::Event>& Event_poller::wait(const int timeout_ms)
+    {
+        events_.clear();
+        epoll_event evs[k_max_events];
+        const int n = ::epoll_wait(fd_, evs, k_max_events, timeout_ms);
+        if (0 > n && EINTR != errno)
+        {
+            throw io_error("Unable to wait for events");
+        }
+        for (int h = 0; h < n; ++h)
+        {
+            Event ev;
+            ev.fd = evs[h].data.fd;
+            ev.readable = 0 != (evs[h].events & (EPOLLIN | EPOLLHUP | EPOLLERR));
+            ev.writable = 0 != (evs[h].events & EPOLLOUT);
+            events_.push_back(ev);
+        }
+        return events_;
+    }
+#else
+    Event_poller::Event_poller() :
+            fds_(),
+            events_()
+    {
+    }
+
+    Event_poller::~Event_poller()
+    {
+    }
+
+    void Event_poller::add(const int fd, const bool writable)
+    {
+        pollfd p;
+        p.fd = fd;
+        p.events = POLLIN | (writable ? POLLOUT : 0);
+        p.revents = 0;
+        fds_.push_back(p);
+    }
+
+    void Event_poller::modify(const int fd, const bool writable)
+    {
+        for (auto& p : fds_)
+        {
+            if (p.fd == fd)
+            {
+                p.events = POLLIN | (writable ? POLLOUT : 0);
+            }
+        }
+    }
+
+    void Event_poller::remove(const int fd)
+    {
+        for (auto h = fds_.begin(); h != fds_.end(); ++h)
+        {
+            if (h->fd == fd)
+            {
+                fds_.erase(h);
+                break;
+            }
+        }
+    }
+
+    const std::vector<Event_poller::Event>& Event_poller::wait(const int timeout_ms)
+    {
+        events_.clear();
+        const int n = ::poll(fds_.data(), fds_.size(), timeout_ms);
+        if (0 > n && EINTR != errno)
+        {
+            throw io_error("Unable to wait for events");
+        }
+        for (const auto& p : fds_)
+        {
+            if (0 < n && p.revents)
+            {
+                Event ev;
+                ev.fd = p.fd;
+                ev.readable = 0 != (p.revents & (POLLIN | POLLHUP | POLLERR));
+                ev.writable = 0 != (p.revents & POLLOUT);
+                events_.push_back(ev);
+            }
+        }
+        return events_;
+    }
+#endif
+
+
+    // ----------------------------------------------------------------
+    // Rpc_server class
+    // ----------------------------------------------------------------
+
+    Rpc_server::Rpc_server(const std::string& path, Handler handler) :
+            path_(path),
+            handler_(std::move(handler)),
+            listen_fd_(-1),
+            wake_(),
+            poller_(),
+            connections_(),
+            dirty_(),
+            next_serial_(0),
+            in_(k_rpc_read_size),
+            loop_(std::thread::id()),
+            mutex_(),
+            queue_(),
+            woken_(false),
+            stop_(false),
+            requests_(0),
+            writes_(0)
+    {
+        const sockaddr_un addr = local_address(path);
+        listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (0 > listen_fd_)
+        {
+            throw io_error("Unable to create the WatSON RPC socket " + path);
+        }
+        ::unlink(path.c_str());
+        if (0 != ::bind(listen_fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) ||
+                0 != ::listen(listen_fd_, SOMAXCONN))
+        {
+            const std::ios_base::failure error(io_error("Unable to listen on " + path));
+            ::close(listen_fd_);
+            throw error;
+        }
+        set_nonblocking(listen_fd_);
+        try
+        {
+            open_pipe(wake_);
+        }
+        catch (...)
+        {
+            ::close(listen_fd_);
+            throw;
+        }
+        poller_.add(listen_fd_);
+        poller_.add(wake_[0]);
+    }
+
+    Rpc_server::~Rpc_server()
+    {
+        for (const auto& h : connections_)
+        {
+            ::close(h.first);
+        }
+        ::close(listen_fd_);
+        ::close(wake_[0]);
+        ::close(wake_[1]);
+        ::unlink(path_.c_str());
+    }
+
+    void Rpc_server::run()
+    {
+        loop_.store(std::this_thread::get_id());
+        for (;;)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_)
+                {
+                    break;
+                }
+            }
+
+            for (const auto& ev : poller_.wait())
+            {
+                if (ev.fd == listen_fd_)
+                {
+                    accept();
+                    continue;
+                }
+                if (ev.fd == wake_[0])
+                {
+                    drain();
+                    continue;
+                }
+                auto conn = connections_.find(ev.fd);
+                if (conn == connections_.end())
+                {
+                    continue;
+                }
+                try
+                {
+                    if (ev.writable)
+                    {
+                        send(ev.fd, conn->second);
+                    }
+                    if (ev.readable)
+                    {
+                        receive(ev.fd, conn->second);
+                    }
+                }
+                catch (const std::exception&)
+                {
+                    close(ev.fd);
+                }
+            }
+            flush();
+        }
+        loop_.store(std::thread::id());
+    }
+
+    void Rpc_server::stop()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        if (!woken_)
+        {
+            woken_ = true;
+            wake(wake_[1]);
+        }
+    }
+
+    void Rpc_server::accept()
+    {
+        for (;;)
+        {
+            const int fd = ::accept(listen_fd_, nullptr, nullptr);
+            if (0 > fd && EINTR == errno)
+            {
+                continue;
+            }
+            if (0 > fd)
+            {
+                return;
+            }
+            set_nonblocking(fd);
+            Connection& conn = connections_[fd];
+            conn.serial = next_serial_++;
+            poller_.add(fd);
+        }
+    }
+
+    void Rpc_server::receive(const int fd, Connection& conn)
+    {
+        while (const size_t n = receive_some(fd, in_))
+        {
+            conn.parser.feed(in_.data(), n);
+            while (const uint8_t* d = conn.parser.next())
+            {
+                const Map envelope = open_envelope(d);
+                const uint64_t id = to_uint64(envelope[k_rpc_id]);
+                const uint64_t serial = conn.serial;
+                const Reply reply = [this, fd, serial, id](const Ngrdnt::Ptr& response, std::exception_ptr error) {
+                    this->reply(fd, serial, id, response, error);
+                };
+                try
+                {
+                    handler_(envelope[k_rpc_body], reply);
+                }
+                catch (...)
+                {
+                    reply(nullptr, std::current_exception());
+                }
+                ++requests_;
+            }
+            if (n < in_.size())
+            {
+                break;
+            }
+        }
+    }
+
+    void Rpc_server::send(const int fd, Connection& conn)
+    {
+        const bool done = send_some(fd, conn.out, conn.sent, writes_);
+        if (done == conn.writing)
+        {
+            conn.writing = !done;
+            poller_.modify(fd, conn.writing);
+        }
+    }
+
+    void Rpc_server::flush()
+    {
+        for (const int fd : dirty_)
+        {
+            auto conn = connections_.find(fd);
+            if (conn == connections_.end())
+            {
+                continue;
+            }
+            try
+            {
+                send(fd, conn->second);
+            }
+            catch (const std::exception&)
+            {
+                close(fd);
+            }
+        }
+        dirty_.clear();
+    }
+
+    void Rpc_server::close(const int fd)
+    {
+        poller_.remove(fd);
+        ::close(fd);
+        connections_.erase(fd);
+    }
+
+    void Rpc_server::reply(const int fd, const uint64_t serial, const uint64_t id,
+            const Ngrdnt::Ptr& response, const std::exception_ptr& error)
+    {
+        if (std::this_thread::get_id() == loop_.load())
+        {
+            auto conn = connections_.find(fd);
+            if (conn != connections_.end() && conn->second.serial == serial)
+            {
+                append_envelope(conn->second.out, id, response, error);
+                dirty_.push_back(fd);
+            }
+            return;
+        }
+
+        Queued queued;
+        queued.fd = fd;
+        queued.serial = serial;
+        append_envelope(queued.envelope, id, response, error);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(queued));
+        if (!woken_)
+        {
+            woken_ = true;
+            wake(wake_[1]);
+        }
+    }
+
+    void Rpc_server::drain()
+    {
+        drain_pipe(wake_[0]);
+        std::vector<Queued> queued;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued.swap(queue_);
+            woken_ = false;
+        }
+        for (const auto& h : queued)
+        {
+            auto conn = connections_.find(h.fd);
+            if (conn != connections_.end() && conn->second.serial == h.serial)
+            {
+                append(conn->second.out, h.envelope.data(), h.envelope.size());
+                dirty_.push_back(h.fd);
+            }
+        }
+    }
+
+
+    // ----------------------------------------------------------------
+    // Rpc_client class
+    // ----------------------------------------------------------------
+
+    Rpc_client::Rpc_client(const std::string& path) :
+            fd_(::socket(AF_UNIX, SOCK_STREAM, 0)),
+            wake_(),
+            poller_(),
+            mutex_(),
+            pending_(),
+            queue_(),
+            next_id_(0),
+            error_(),
+            woken_(false),
+            stop_(false),
+            writes_(0),
+            thread_()
+    {
+        if (0 > fd_)
+        {
+            throw io_error("Unable to create the WatSON RPC socket " + path);
+        }
+        const sockaddr_un addr = local_address(path);
+        if (0 != ::connect(fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)))
+        {
+            const std::ios_base::failure error(io_error("Unable to connect to " + path));
+            ::close(fd_);
+            throw error;
+        }
+        set_nonblocking(fd_);
+        try
+        {
+            open_pipe(wake_);
+        }
+        catch (...)
+        {
+            ::close(fd_);
+            throw;
+        }
+        poller_.add(fd_);
+        poller_.add(wake_[0]);
+        thread_ = std::thread(&Rpc_client::run, this);
+    }
+
+    Rpc_client::~Rpc_client()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            wake(wake_[1]);
+        }
+        thread_.join();
+        fail(std::make_exception_ptr(std::runtime_error("The WatSON RPC client was closed.")));
+        ::close(fd_);
+        ::close(wake_[0]);
+        ::close(wake_[1]);
+    }
+
+    std::future<Ngrdnt::Ptr> Rpc_client::call(const Ngrdnt::Ptr& request)
+    {
+        Pending pending;
+        std::future<Ngrdnt::Ptr> result = pending.promise.get_future();
+        enqueue(request, std::move(pending));
+        return result;
+    }
+
+    void Rpc_client::call(const Ngrdnt::Ptr& request, Callback callback)
+    {
+        Pending pending;
+        pending.callback = std::move(callback);
+        enqueue(request, std::move(pending));
+    }
+
+    size_t Rpc_client::in_flight() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pending_.size();
+    }
+
+    void Rpc_client::finish(Pending& pending, const Ngrdnt::Ptr& response,
+            const std::exception_ptr& error)
+    {
+        if (pending.callback)
+        {
+            pending.callback(response, error);
+        }
+        else if (error)
+        {
+            pending.promise.set_exception(error);
+        }
+        else
+        {
+            pending.promise.set_value(response);
+        }
+    }
+
+    void Rpc_client::enqueue(const Ngrdnt::Ptr& request, Pending&& pending)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (error_)
+        {
+            const std::exception_ptr error = error_;
+            lock.unlock();
+            finish(pending, nullptr, error);
+            return;
+        }
+
+        const uint64_t id = next_id_++;
+        append_envelope(queue_, id, request, nullptr);
+        pending_.insert(std::make_pair(id, std::move(pending)));
+        if (!woken_)
+        {
+            woken_ = true;
+            wake(wake_[1]);
+        }
+    }
+
+    void Rpc_client::run()
+    {
+        std::vector<uint8_t> in(k_rpc_read_size);
+        std::vector<uint8_t> out;
+        size_t sent = 0;
+        bool writing = false;
+        Ngrdnt_parser parser;
+        try
+        {
+            for (;;)
+            {
+                for (const auto& ev : poller_.wait())
+                {
+                    if (ev.fd == wake_[0])
+                    {
+                        drain_pipe(wake_[0]);
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        if (stop_)
+                        {
+                            return;
+                        }
+                        append(out, queue_.data(), queue_.size());
+                        queue_.clear();
+                        woken_ = false;
+                    }
+                    else if (ev.readable)
+                    {
+                        while (const size_t n = receive_some(fd_, in))
+                        {
+                            parser.feed(in.data(), n);
+                            while (const uint8_t* d = parser.next())
+                            {
+                                complete(d);
+                            }
+                            if (n < in.size())
+                            {
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                // Everything queued during this turn goes out in one write.
+                const bool done = send_some(fd_, out, sent, writes_);
+                if (done == writing)
+                {
+                    writing = !done;
+                    poller_.modify(fd_, writing);
+                }
+            }
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+        }
+    }
+
+    void Rpc_client::complete(const uint8_t* d)
+    {
+        const Map envelope = open_envelope(d);
+        Pending pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto iter = pending_.find(to_uint64(envelope[k_rpc_id]));
+            if (iter == pending_.end())
+            {
+                return;
+            }
+            pending = std::move(iter->second);
+            pending_.erase(iter);
+        }
+
+        const Ngrdnt::Ptr& error = envelope[k_rpc_error];
+        if (error != k_not_found)
+        {
+            finish(pending, nullptr, std::make_exception_ptr(std::runtime_error(to_string(error))));
+        }
+        else
+        {
+            finish(pending, Ngrdnt::clone(envelope[k_rpc_body]), nullptr);
+        }
+    }
+
+    void Rpc_client::fail(const std::exception_ptr& error)
+    {
+        std::map<uint64_t, Pending> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_)
+            {
+                error_ = error;
+            }
+            pending.swap(pending_);
+        }
+        for (auto& h : pending)
+        {
+            finish(h.second, nullptr, error);
+        }
+    }
+}; // namespace watson
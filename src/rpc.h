@@ -0,0 +1,332 @@
+#pragma once
+/*!
+ \file watson/rpc.h
+ \brief WatSON remote procedure calls over local sockets.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "reader.h"
+#include "watson.h"
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef __linux__
+#include <poll.h>
+#endif
+
+namespace watson
+{
+    /*!
+     \brief Map key of the request ID in an RPC envelope.
+
+     Requests and responses travel as maps. The response carries the ID
+     of its request, so responses can come back in any order.
+
+     \code
+     (Request) ::= {k_rpc_id: (Unsigned-64bit-Integer), k_rpc_body: (Ngrdnt)}
+     (Response) ::= {k_rpc_id: (Unsigned-64bit-Integer), k_rpc_body: (Ngrdnt)}
+                  | {k_rpc_id: (Unsigned-64bit-Integer), k_rpc_error: (String)}
+     \endcode
+     \since 0.2
+     */
+    constexpr uint32_t k_rpc_id = 0;
+
+    //! Map key of the request or response in an RPC envelope.
+    constexpr uint32_t k_rpc_body = 1;
+
+    //! Map key of the reason a request failed, in an RPC envelope.
+    constexpr uint32_t k_rpc_error = 2;
+
+    /*!
+     \brief Waits for descriptors to become ready.
+
+     Uses epoll on Linux, and poll() elsewhere. Readiness is level
+     triggered.
+     \since 0.2
+     */
+    class Event_poller
+    {
+    public:
+        struct Event
+        {
+            int fd;
+            //! Readable, closed or failed; a read tells which.
+            bool readable;
+            bool writable;
+        };
+
+        Event_poller();
+        Event_poller(const Event_poller& o) = delete;
+        Event_poller& operator=(const Event_poller& rhs) = delete;
+        ~Event_poller();
+
+        /*!
+         \brief Start watching a descriptor.
+         \param fd The descriptor.
+         \param writable Also wait for it to become writable.
+         */
+        void add(int fd, bool writable = false);
+
+        //! Change whether a watched descriptor is waited on for writing.
+        void modify(int fd, bool writable);
+
+        //! Stop watching a descriptor, before it is closed.
+        void remove(int fd);
+
+        /*!
+         \brief Wait for any descriptor to become ready.
+         \param timeout_ms How long to wait, -1 for ever.
+         \return The ready descriptors, valid until the next call.
+         */
+        const std::vector<Event>& wait(int timeout_ms = -1);
+
+    private:
+#ifdef __linux__
+        int fd_;
+#else
+        std::vector<pollfd> fds_;
+#endif
+        std::vector<Event> events_;
+    }; // class watson::Event_poller
+
+    /*!
+     \brief Serves WatSON requests on a local socket.
+
+     A single thread runs the event loop, in run(), for every connection.
+     Requests are read as they arrive, many at a time, and handed to the
+     handler. The handler replies when it is ready, from any thread, so
+     a slow request does not hold up the ones behind it on the same
+     connection. Responses are collected and written together, once per
+     turn of the loop.
+
+     \code
+     watson::Rpc_server server("/tmp/app.sock",
+             [](const watson::Ngrdnt::Ptr& request, const watson::Rpc_server::Reply& reply) {
+                 reply(handle(request), nullptr);
+             });
+     std::thread loop([&server]() { server.run(); });
+     \endcode
+     \since 0.2
+     */
+    class Rpc_server
+    {
+    public:
+        /*!
+         \brief Sends the response to a request.
+
+         Call it exactly once, from any thread, while the server exists.
+
+         \param response The response.
+         \param error The reason the request failed, sent instead.
+         */
+        using Reply = std::function<void(const Ngrdnt::Ptr& response, std::exception_ptr error)>;
+
+        /*!
+         \brief Handles a request, on the loop thread.
+
+         The request is only valid for the duration of the call. Use
+         Ngrdnt::clone() to keep it. An exception thrown by the handler
+         is sent as the reply.
+
+         \param request The request.
+         \param reply Sends the response.
+         */
+        using Handler = std::function<void(const Ngrdnt::Ptr& request, const Reply& reply)>;
+
+        /*!
+         \brief Listen on a local socket, replacing any file at \c path.
+         \param path The path of the socket.
+         \param handler Handles every request.
+         */
+        Rpc_server(const std::string& path, Handler handler);
+        Rpc_server(const Rpc_server& o) = delete;
+        Rpc_server& operator=(const Rpc_server& rhs) = delete;
+
+        //! Closes every connection and removes the socket.
+        ~Rpc_server();
+
+        //! Run the event loop on this thread, until stop().
+        void run();
+
+        //! Make run() return. Safe to call from any thread.
+        void stop();
+
+        //! The number of requests handled.
+        inline uint64_t requests() const { return requests_.load(); }
+
+        //! The number of writes made to send the responses.
+        inline uint64_t writes() const { return writes_.load(); }
+
+    private:
+        struct Connection
+        {
+            uint64_t serial = 0;
+            Ngrdnt_parser parser;
+            std::vector<uint8_t> out;
+            size_t sent = 0;
+            //! Waiting for the socket to become writable.
+            bool writing = false;
+        };
+
+        //! A response from another thread, waiting for the loop.
+        struct Queued
+        {
+            int fd;
+            uint64_t serial;
+            std::vector<uint8_t> envelope;
+        };
+
+        void accept();
+        void receive(int fd, Connection& conn);
+        void send(int fd, Connection& conn);
+        void flush();
+        void close(int fd);
+        void reply(int fd, uint64_t serial, uint64_t id, const Ngrdnt::Ptr& response,
+                const std::exception_ptr& error);
+        void drain();
+
+        std::string path_;
+        Handler handler_;
+        int listen_fd_;
+        int wake_[2];
+        Event_poller poller_;
+        std::map<int, Connection> connections_;
+        //! Connections with responses to send at the end of the turn.
+        std::vector<int> dirty_;
+        uint64_t next_serial_;
+        std::vector<uint8_t> in_;
+        //! The thread in run(), read by reply() from any thread.
+        std::atomic<std::thread::id> loop_;
+        std::mutex mutex_;
+        std::vector<Queued> queue_;
+        bool woken_;
+        bool stop_;
+        std::atomic<uint64_t> requests_;
+        std::atomic<uint64_t> writes_;
+    }; // class watson::Rpc_server
+
+    /*!
+     \brief Sends WatSON requests to an Rpc_server.
+
+     Calls do not wait for each other: every request gets an ID, and is
+     sent at once, however many are still waiting for their response.
+     Requests made while the previous ones are being written go out
+     together in the next write. A thread owned by the client does the
+     writing and reading, and completes the calls as their responses
+     arrive, in whatever order the server sends them.
+
+     The client is safe to share between threads.
+     \since 0.2
+     */
+    class Rpc_client
+    {
+    public:
+        /*!
+         \brief Called with the response to a request.
+
+         Runs on the client thread, so it should be quick.
+
+         \param response The response, or null on failure.
+         \param error The reason the request failed, or null.
+         */
+        using Callback = std::function<void(const Ngrdnt::Ptr& response, std::exception_ptr error)>;
+
+        /*!
+         \brief Connect to a server.
+         \param path The path of the server's socket.
+         */
+        explicit Rpc_client(const std::string& path);
+        Rpc_client(const Rpc_client& o) = delete;
+        Rpc_client& operator=(const Rpc_client& rhs) = delete;
+
+        //! Fails every call still waiting, and disconnects.
+        ~Rpc_client();
+
+        /*!
+         \brief Send a request.
+         \param request The request, which is copied.
+         \return The response. A failed request throws from get(), with
+         a std::runtime_error for a failure reported by the server.
+         */
+        std::future<Ngrdnt::Ptr> call(const Ngrdnt::Ptr& request);
+
+        /*!
+         \brief Send a request.
+         \param request The request, which is copied.
+         \param callback Called with the response.
+         */
+        void call(const Ngrdnt::Ptr& request, Callback callback);
+
+        //! The number of requests waiting for their response.
+        size_t in_flight() const;
+
+        //! The number of writes made to send the requests.
+        inline uint64_t writes() const { return writes_.load(); }
+
+    private:
+        struct Pending
+        {
+            Callback callback;
+            std::promise<Ngrdnt::Ptr> promise;
+        };
+
+        static void finish(Pending& pending, const Ngrdnt::Ptr& response,
+                const std::exception_ptr& error);
+
+        void enqueue(const Ngrdnt::Ptr& request, Pending&& pending);
+        void run();
+        void complete(const uint8_t* d);
+        //! Fail every waiting call, and every later one.
+        void fail(const std::exception_ptr& error);
+
+        int fd_;
+        int wake_[2];
+        Event_poller poller_;
+        mutable std::mutex mutex_;
+        //! Calls waiting for their response, by request ID.
+        std::map<uint64_t, Pending> pending_;
+        //! Requests not yet taken by the client thread.
+        std::vector<uint8_t> queue_;
+        uint64_t next_id_;
+        std::exception_ptr error_;
+        bool woken_;
+        bool stop_;
+        std::atomic<uint64_t> writes_;
+        std::thread thread_;
+    }; // class watson::Rpc_client
+}; // namespace watson
@@ -0,0 +1,220 @@
+/*!
+ \file watson/transcode.cpp
+ \brief Pieces shared by the WatSON format converters.
+
+  Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "transcode.h"
+#include <algorithm>
+
+namespace watson
+{
+    namespace
+    {
+        const size_t k_key_cache_size = 1024;
+        //! Room for the header of a small container, patched once the size is known.
+        const size_t k_open_header_size = 2;
+
+        template <Ngrdnt_type IT, typename T>
+        inline void write_scalar(uint8_t* out, const T val)
+        {
+            out = write_ngrdnt_header(out, IT, sizeof(T));
+            memcpy(out, &val, sizeof(T));
+        }
+    }; // namespace watson::(anonymous)
+
+    namespace detail
+    {
+        void fail(const std::string& what, const char* format, const size_t offset)
+        {
+            throw std::runtime_error(what + " in " + format + " at offset " + std::to_string(offset) + ".");
+        }
+
+        // ----------------------------------------------------------------
+        // Ngrdnt_builder class
+        // ----------------------------------------------------------------
+
+        Ngrdnt_builder::Ngrdnt_builder(Glossary glossary) :
+                glossary_(std::move(glossary)),
+                key_cache_(k_key_cache_size, 0),
+                out_(nullptr),
+                mark_(0),
+                used_(0)
+        {
+        }
+
+        Ngrdnt::Ptr Ngrdnt_builder::library() const
+        {
+            Library::Children names(glossary_.names);
+            return new_ngrdnt(Library(std::move(names)));
+        }
+
+        void Ngrdnt_builder::start(std::vector<uint8_t>& out)
+        {
+            out_ = &out;
+            mark_ = out.size();
+            used_ = mark_;
+        }
+
+        void Ngrdnt_builder::finish()
+        {
+            out_->resize(used_);
+        }
+
+        void Ngrdnt_builder::abandon()
+        {
+            out_->resize(mark_);
+        }
+
+        uint8_t* Ngrdnt_builder::grow(const size_t n)
+        {
+            if (used_ + n > out_->size())
+            {
+                out_->resize(std::max(out_->size() * 2, used_ + n + 4096));
+            }
+            uint8_t* const at = out_->data() + used_;
+            used_ += n;
+            return at;
+        }
+
+        size_t Ngrdnt_builder::open()
+        {
+            const size_t start = used_;
+            grow(k_open_header_size);
+            return start;
+        }
+
+        void Ngrdnt_builder::close(const size_t start, const Ngrdnt_type type)
+        {
+            // The children were written behind a header for a small
+            // container. Slide them over when the header has to change size.
+            const uint64_t data_size = used_ - start - k_open_header_size;
+            const size_t header_size = ngrdnt_header_size(size_type_necessary(data_size));
+            if (header_size > k_open_header_size)
+            {
+                grow(header_size - k_open_header_size);
+            }
+            uint8_t* const header = out_->data() + start;
+            if (header_size != k_open_header_size)
+            {
+                memmove(header + header_size, header + k_open_header_size, data_size);
+                used_ = start + header_size + data_size;
+            }
+            write_ngrdnt_header(header, type, data_size);
+        }
+
+        void Ngrdnt_builder::key(const char* name, const size_t n)
+        {
+            const uint32_t id = intern(name, n);
+            memcpy(grow(sizeof(id)), &id, sizeof(id));
+        }
+
+        void Ngrdnt_builder::marker(const Ngrdnt_type type)
+        {
+            *grow(1) = type_marker(Size_type::k_zero, type);
+        }
+
+        void Ngrdnt_builder::string(const char* s, const size_t n)
+        {
+            const size_t header = ngrdnt_header_size(size_type_necessary(n));
+            uint8_t* out = write_ngrdnt_header(grow(header + n), Ngrdnt_type::k_string, n);
+            memcpy(out, s, n);
+        }
+
+        bool Ngrdnt_builder::integer(const uint64_t magnitude, const bool negative)
+        {
+            if (negative && magnitude <= 0x80000000ull)
+            {
+                write_scalar<Ngrdnt_type::k_int32>(grow(6), static_cast<int32_t>(-static_cast<int64_t>(magnitude)));
+            }
+            else if (!negative && magnitude <= 0x7FFFFFFFull)
+            {
+                write_scalar<Ngrdnt_type::k_int32>(grow(6), static_cast<int32_t>(magnitude));
+            }
+            else if (negative && magnitude <= 0x8000000000000000ull)
+            {
+                write_scalar<Ngrdnt_type::k_int64>(grow(10), static_cast<int64_t>(0 - magnitude));
+            }
+            else if (!negative && magnitude <= 0x7FFFFFFFFFFFFFFFull)
+            {
+                write_scalar<Ngrdnt_type::k_int64>(grow(10), static_cast<int64_t>(magnitude));
+            }
+            else if (!negative)
+            {
+                write_scalar<Ngrdnt_type::k_uint64>(grow(10), magnitude);
+            }
+            else
+            {
+                return false;
+            }
+            return true;
+        }
+
+        void Ngrdnt_builder::real(const double val)
+        {
+            write_scalar<Ngrdnt_type::k_float>(grow(10), val);
+        }
+
+        uint32_t Ngrdnt_builder::intern(const char* name, const size_t n)
+        {
+            uint32_t hash = 2166136261u;
+            for (size_t h = 0; h < n; ++h)
+            {
+                hash = (hash ^ static_cast<uint8_t>(name[h])) * 16777619u;
+            }
+            uint32_t& slot = key_cache_[hash & (k_key_cache_size - 1)];
+            if (0 < slot)
+            {
+                const std::string& known = glossary_.names[slot - 1];
+                if (known.size() == n && 0 == memcmp(known.data(), name, n))
+                {
+                    return slot - 1;
+                }
+            }
+
+            std::string text(name, n);
+            auto iter = glossary_.index.find(text);
+            uint32_t id;
+            if (iter == glossary_.index.end())
+            {
+                id = glossary_.names.size();
+                glossary_.names.push_back(text);
+                glossary_.index.insert(std::make_pair(std::move(text), id));
+            }
+            else
+            {
+                id = iter->second;
+            }
+            slot = id + 1;
+            return id;
+        }
+    }; // namespace watson::detail
+}; // namespace watson
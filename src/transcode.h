@@ -0,0 +1,171 @@
+#pragma once
+/*!
+ \file watson/transcode.h
+ \brief Pieces shared by the WatSON format converters.
+
+ Nothing here is part of the public interface; it is what the JSON and
+ MessagePack converters have in common.
+
+  Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "watson.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace watson
+{
+    namespace detail
+    {
+        //! The data of the Ngrdnt at \c d.
+        inline const uint8_t* payload(const uint8_t* d, uint64_t* n)
+        {
+            const uint64_t header = ngrdnt_header_size(d[0]);
+            const uint64_t sz = ngrdnt_size(d);
+            if (sz < header)
+            {
+                throw std::runtime_error("Truncated WatSON Ngrdnt.");
+            }
+            *n = sz - header;
+            return d + header;
+        }
+
+        //! The value of the fixed size Ngrdnt at \c d.
+        template <typename T>
+        inline T scalar(const uint8_t* d)
+        {
+            uint64_t n;
+            const uint8_t* data = payload(d, &n);
+            if (sizeof(T) != n)
+            {
+                throw std::runtime_error("WatSON number has the wrong size.");
+            }
+            T val;
+            memcpy(&val, data, sizeof(T));
+            return val;
+        }
+
+        /*!
+         \brief Throw a std::runtime_error for malformed input.
+         \param what What was wrong.
+         \param format The name of the input format.
+         \param offset Where in the input it was found.
+         */
+        [[noreturn]] void fail(const std::string& what, const char* format, size_t offset);
+
+        /*!
+         \brief Writes Ngrdnts into one growing buffer.
+
+         The converters read their input in a single pass, and append
+         each value as it is read. Containers are opened with a header
+         for a small size, which is patched when they are closed. Map
+         keys are interned into a Glossary.
+
+         \since 0.2
+         */
+        class Ngrdnt_builder
+        {
+        public:
+            /*!
+             \brief Constructor.
+             \param glossary Keys already known, which keep their numbers.
+             */
+            explicit Ngrdnt_builder(Glossary glossary);
+            Ngrdnt_builder(const Ngrdnt_builder& o) = delete;
+            Ngrdnt_builder(Ngrdnt_builder&& o) = default;
+            ~Ngrdnt_builder() = default;
+            Ngrdnt_builder& operator=(const Ngrdnt_builder& rhs) = delete;
+            Ngrdnt_builder& operator=(Ngrdnt_builder&& rhs) = default;
+
+            //! The keys seen so far.
+            inline const Glossary& glossary() const { return glossary_; }
+
+            //! The keys seen so far, as a \c k_library Ngrdnt.
+            Ngrdnt::Ptr library() const;
+
+            //! Start appending to \c out.
+            void start(std::vector<uint8_t>& out);
+
+            //! Cut \c out back to what was written.
+            void finish();
+
+            //! Leave \c out as it was before start().
+            void abandon();
+
+            //! Make room for \c n more bytes of output.
+            uint8_t* grow(size_t n);
+
+            //! Write the header of a container, returning where it starts.
+            size_t open();
+
+            //! Patch the header of the container started at \c start.
+            void close(size_t start, Ngrdnt_type type);
+
+            //! Write a map key, by its number in the glossary.
+            void key(const char* name, size_t n);
+
+            //! Write an Ngrdnt that has no data.
+            void marker(Ngrdnt_type type);
+
+            //! Write a \c k_string.
+            void string(const char* s, size_t n);
+
+            /*!
+             \brief Write an integer in the smallest type that holds it.
+
+             \c k_int32 when it fits, then \c k_int64, then \c k_uint64.
+
+             \param magnitude The absolute value.
+             \param negative Whether the value is below zero.
+             \return False, with nothing written, when no type holds it.
+             */
+            bool integer(uint64_t magnitude, bool negative);
+
+            //! Write a \c k_float.
+            void real(double val);
+
+        private:
+            //! Find or add a key, through a small cache in front of the glossary.
+            uint32_t intern(const char* name, size_t n);
+
+            Glossary glossary_;
+            std::vector<uint32_t> key_cache_;
+            std::vector<uint8_t>* out_;
+            //! The size of out_ when start() was called.
+            size_t mark_;
+            //! The bytes of out_ in use; the rest was grown ahead.
+            size_t used_;
+        }; // class watson::detail::Ngrdnt_builder
+    }; // namespace watson::detail
+}; // namespace watson
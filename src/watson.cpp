@@ -34,16 +34,77 @@
  */
 
 #include "watson.h"
-#include "snappy.h"
+#include "numeric.h"
+#include "zip.h"
 #include <cassert>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace watson
 {
+    // ----------------------------------------------------------------
+    // Ngrdnt headers
+    // ----------------------------------------------------------------
+
+    uint64_t ngrdnt_size(const uint8_t* d)
+    {
+        uint64_t sz = 0;
+        switch (size_type(d[0]))
+        {
+            case Size_type::k_zero:
+                sz = 1;
+                break;
+            case Size_type::k_one:
+                sz = d[1];
+                break;
+            case Size_type::k_two:
+                memcpy(&sz, d + 1, sizeof(uint16_t));
+                break;
+            default:
+                memcpy(&sz, d + 1, sizeof(uint64_t));
+                break;
+        };
+        return sz;
+    }
+
+    uint64_t checked_ngrdnt_size(const uint8_t* d, const uint8_t* const end)
+    {
+        const uint64_t available = end - d;
+        const uint64_t header = ngrdnt_header_size(d[0]);
+        const uint64_t sz = available < header ? 0 : ngrdnt_size(d);
+        if (sz < header || sz > available)
+        {
+            throw std::runtime_error("WatSON child extends past its container.");
+        }
+        return sz;
+    }
+
+    uint8_t* write_ngrdnt_header(uint8_t* out, const Ngrdnt_type it,
+            const uint64_t data_size)
+    {
+        const Size_type st = size_type_necessary(data_size);
+        const uint64_t full_size = data_size + ngrdnt_header_size(st);
+
+        // type marker.
+        *out = type_marker(st, it);
+        ++out;
+
+        // Size
+        if (0 < data_size)
+        {
+            memcpy(out, &full_size, size_size(st));
+            out += size_size(st);
+        }
+        return out;
+    }
+
     // ----------------------------------------------------------------
     // Ngrdnt Class
     // ----------------------------------------------------------------
@@ -91,29 +152,22 @@ namespace watson
     {
         std::swap(ptr_, rhs.ptr_);
         std::swap(parent_, rhs.parent_);
+        std::swap(owner_, rhs.owner_);
         data_ = rhs.data_;
         return *this;
     };
 
     uint64_t Ngrdnt::size() const
     {
-        uint64_t sz;
-        switch (size_type(type_marker()))
-        {
-            case Size_type::k_zero:
-                sz = 1;
-                break;
-            case Size_type::k_one:
-                sz = data()[1];
-                break;
-            case Size_type::k_two:
-                sz = *(reinterpret_cast<const uint16_t*>(data() + 1));
-                break;
-            default:
-                sz = *(reinterpret_cast<const uint64_t*>(data() + 1));
-                break;
-        };
-        return sz;
+        return ngrdnt_size(data());
+    }
+
+    void Ngrdnt::observe(const uint8_t* bytes)
+    {
+        ptr_.reset();
+        data_ = bytes;
+        parent_.reset();
+        owner_.reset();
     }
 
     // ----------------------------------------------------------------
@@ -132,23 +186,10 @@ namespace watson
         inline std::unique_ptr<uint8_t[]> build_ngrdnt(const uint64_t data_size,
                 uint8_t** current)
         {
-            const Size_type st = size_type_necessary(data_size);
-            const int header_size = ngrdnt_header_size(st);
-            const uint64_t full_size = data_size + header_size;
+            const uint64_t full_size = data_size +
+                    ngrdnt_header_size(size_type_necessary(data_size));
             std::unique_ptr<uint8_t[]> ptr(new uint8_t[full_size]);
-            *current = ptr.get();
-
-            // type marker.
-            **current = type_marker(st, IT);
-            (*current)++;
-
-            // Size
-            if (0 < data_size)
-            {
-                memcpy(*current, &full_size, size_size(st));
-                (*current) += size_size(st);
-            }
-
+            *current = write_ngrdnt_header(ptr.get(), IT, data_size);
             return ptr;
         }
 
@@ -317,6 +358,7 @@ namespace watson
     std::string to_string(const Ngrdnt::Ptr& val)
     {
         size_t header_size;
+        char text[k_max_number_text];
         std::string result;
 
         switch(ngrdnt_type(val->type_marker()))
@@ -331,16 +373,16 @@ namespace watson
                 result = "false";
                 break;
             case Ngrdnt_type::k_float:
-                result = std::to_string(to_double(val));
+                result.assign(text, write_number(text, to_double(val)));
                 break;
             case Ngrdnt_type::k_int32:
-                result = std::to_string(to_int32(val));
+                result.assign(text, write_number(text, to_int32(val)));
                 break;
             case Ngrdnt_type::k_int64:
-                result = std::to_string(to_int64(val));
+                result.assign(text, write_number(text, to_int64(val)));
                 break;
             case Ngrdnt_type::k_uint64:
-                result = std::to_string(to_uint64(val));
+                result.assign(text, write_number(text, to_uint64(val)));
                 break;
             case Ngrdnt_type::k_string:
                 header_size = ngrdnt_header_size(val->type_marker());
@@ -381,42 +423,6 @@ namespace watson
     }
 
 
-    // ----------------------------------------------------------------
-    // Compressed class
-    // ----------------------------------------------------------------
-
-    Compressed::Compressed() :
-            child_(Ngrdnt::make())
-    {
-    }
-
-    Compressed::Compressed(Ngrdnt::Ptr&& raw) :
-            child_(std::move(raw))
-    {
-    }
-
-    Compressed::Compressed(const Ngrdnt::Ptr& raw)
-    {
-        const size_t header_size = ngrdnt_header_size(raw->type_marker());
-        const uint8_t* data = raw->data() + header_size;
-        const size_t data_size = raw->size() - header_size;
-
-        size_t output_size;
-        bool result = snappy::GetUncompressedLength(reinterpret_cast<const char*>(data),
-                    data_size,
-                    &output_size);
-        assert(result);
-
-        std::unique_ptr<uint8_t[]> output(new uint8_t[output_size]);
-        result = snappy::RawUncompress(reinterpret_cast<const char*>(data),
-                data_size,
-                reinterpret_cast<char*>(output.get()));
-        assert(result);
-
-        child_ = Ngrdnt::adopt(std::move(output));
-    }
-
-
     // ----------------------------------------------------------------
     // Map class
     // ----------------------------------------------------------------
@@ -449,6 +455,31 @@ namespace watson
         }
     }
 
+    Map Map::view(const Ngrdnt::Ptr& raw)
+    {
+        Map result;
+        const uint8_t* ptr = raw->data() + ngrdnt_header_size(raw->type_marker());
+        const uint8_t* const end = raw->data() + raw->size();
+
+        while (end > ptr)
+        {
+            // Read the key.
+            Children::key_type key;
+            if (sizeof(key) >= static_cast<size_t>(end - ptr))
+            {
+                throw std::runtime_error("WatSON map key has no value.");
+            }
+            memcpy(&key, ptr, sizeof(key));
+            ptr += sizeof(Children::key_type);
+
+            // Point at the value.
+            const uint64_t sz = checked_ngrdnt_size(ptr, end);
+            result.children_.insert(Children::value_type(key, Ngrdnt::child(ptr, raw)));
+            ptr += sz;
+        }
+        return result;
+    }
+
     const Ngrdnt::Ptr& Map::operator[](uint32_t key) const
     {
         auto iter = children().find(key);
@@ -569,27 +600,6 @@ namespace watson
         return Ngrdnt::adopt(std::move(ptr));
     }
 
-    Ngrdnt::Ptr new_ngrdnt(const Compressed& val)
-    {
-        uint64_t sz = snappy::MaxCompressedLength(val->size());
-
-        std::unique_ptr<char[]> buffer(new char[sz]);
-
-        snappy::RawCompress(reinterpret_cast<const char*>(val->data()),
-                val->size(),
-                reinterpret_cast<char*>(buffer.get()),
-                reinterpret_cast<size_t*>(&sz));
-
-        // I was originally not copying this. But I was noticing that Max
-        // Compressed Length can be pretty big. This doesn't use Ngrdnt::clone
-        // because the initial data isn't loaded into a Ngrdnt.
-        uint8_t* current;
-        std::unique_ptr<uint8_t[]> ptr(build_ngrdnt<Ngrdnt_type::k_zip>(sz, &current));
-        memcpy(current, buffer.get(), sz);
-
-        return Ngrdnt::adopt(std::move(ptr));
-    }
-
     Ngrdnt::Ptr new_ngrdnt(const Map& val)
     {
         uint64_t sz = 0;
@@ -746,7 +756,22 @@ namespace watson
         {
             container_.mutable_children().push_back(std::move(c));
         }
+        find_glossary();
+    }
+
+    Recipe::Recipe(Container&& c) :
+        container_(std::move(c))
+    {
+        find_glossary();
+    }
 
+    Recipe::Recipe(const Ngrdnt::Ptr& raw) :
+        Recipe(Ngrdnt::clone(raw))
+    {
+    }
+
+    void Recipe::find_glossary()
+    {
         for (const auto child : container_.children())
         {
             if (Ngrdnt_type::k_library == ngrdnt_type(child->type_marker()))
@@ -757,9 +782,44 @@ namespace watson
         }
     }
 
-    Recipe::Recipe(const Ngrdnt::Ptr& raw) :
-        Recipe(Ngrdnt::clone(raw))
+    Recipe Recipe::open_mapped(const std::string& path)
     {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (0 > fd)
+        {
+            throw std::ios_base::failure("Unable to open the WatSON file " + path + ".");
+        }
+
+        struct stat st;
+        if (0 != ::fstat(fd, &st) || 0 >= st.st_size)
+        {
+            ::close(fd);
+            throw std::ios_base::failure("Unable to read the WatSON file " + path + ".");
+        }
+        const size_t sz = st.st_size;
+
+        // The mapping stays valid after the descriptor is closed.
+        void* addr = ::mmap(nullptr, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (MAP_FAILED == addr)
+        {
+            throw std::ios_base::failure("Unable to map the WatSON file " + path + ".");
+        }
+        std::shared_ptr<const void> mapping(addr, [sz](void* p) {
+            ::munmap(p, sz);
+        });
+
+        const uint8_t* data = static_cast<const uint8_t*>(addr);
+        if (sz < ngrdnt_header_size(data[0]) || sz < ngrdnt_size(data))
+        {
+            throw std::runtime_error("Truncated WatSON file " + path + ".");
+        }
+        Ngrdnt::Ptr top(Ngrdnt::view(data, mapping));
+        if (Ngrdnt_type::k_container == ngrdnt_type(top->type_marker()))
+        {
+            return Recipe(Container::view(top));
+        }
+        return Recipe(std::move(top));
     }
 
     const Ngrdnt::Ptr Recipe::ngrdnt(const std::list<uint32_t>& steps) const
@@ -777,7 +837,7 @@ namespace watson
             {
                 case Ngrdnt_type::k_container:
                     {
-                        Container tmp(retval);
+                        const Container tmp(Container::view(retval));
                         if (*iter >= tmp.size())
                         {
                             return k_not_found;
@@ -787,11 +847,20 @@ namespace watson
                     }
                     break;
                 case Ngrdnt_type::k_map:
-                    retval = Map(retval)[*iter];
+                    retval = Map::view(retval)[*iter];
                     ++iter;
                     break;
                 case Ngrdnt_type::k_zip:
-                    retval = *Compressed(retval);
+                    if (Seekable_zip::is_seekable(retval))
+                    {
+                        // Only decompress the block holding the child.
+                        retval = Seekable_zip(retval)[*iter];
+                        ++iter;
+                    }
+                    else
+                    {
+                        retval = *Compressed(retval);
+                    }
                     break;
                 default:
                     return k_not_found;
@@ -40,6 +40,7 @@
 #include <map>
 #include <memory>
 #include <ostream>
+#include <stdexcept>
 #include <unordered_map>
 #include <string>
 #include <vector>
@@ -178,6 +179,47 @@ namespace watson
         return (static_cast<uint8_t>(st) << 6) | static_cast<uint8_t>(it);
     }
 
+    /*!
+     \brief Read the full size of an Ngrdnt from its raw bytes.
+     \since 0.2
+
+     Only the header is examined, so \c d only needs to point at
+     ngrdnt_header_size() readable bytes.
+
+     \param d The raw Ngrdnt bytes, starting at the type-marker.
+     \return Size of the Ngrdnt, including the header.
+     */
+    uint64_t ngrdnt_size(const uint8_t* d);
+
+    /*!
+     \brief Read the full size of an Ngrdnt that must end by \c end.
+     \since 0.2
+
+     Nothing past \c end is read. The header has to fit, the size has
+     to cover at least the header, and the whole Ngrdnt has to fit.
+
+     \param d The raw Ngrdnt bytes, before \c end.
+     \param end The end of the bytes holding the Ngrdnt.
+     \return Size of the Ngrdnt, including the header.
+     \throw std::runtime_error when the Ngrdnt does not fit.
+     */
+    uint64_t checked_ngrdnt_size(const uint8_t* d, const uint8_t* end);
+
+    /*!
+     \brief Write an Ngrdnt header.
+     \since 0.2
+
+     Writes the type-marker and the smallest size that can describe
+     \c data_size bytes of data.
+
+     \param out Where to write the header.
+     \param it The Ngrdnt_type.
+     \param data_size The number of data bytes following the header.
+     \return Pointer to the first byte after the header.
+     */
+    uint8_t* write_ngrdnt_header(uint8_t* out, const Ngrdnt_type it,
+            const uint64_t data_size);
+
     /*!
      \brief WatSON raw Ngrdnt.
      \since 0.1
@@ -217,6 +259,44 @@ namespace watson
             return Ngrdnt::Ptr(new Ngrdnt(bytes));
         }
 
+        /*!
+         \brief Create a view of memory that something else owns.
+
+         Nothing is copied. The owner is kept alive for as long as the
+         resulting object, including through children that have it as
+         their parent.
+
+         \param bytes The bytes to observe.
+         \param owner Keeps \c bytes valid, for example a file mapping.
+         \return A new Ngrdnt object.
+         \since 0.2
+         */
+        static inline Ngrdnt::Ptr view(const uint8_t* bytes,
+                const std::shared_ptr<const void>& owner)
+        {
+            Ngrdnt::Ptr result(new Ngrdnt(bytes));
+            result->owner_ = owner;
+            return result;
+        }
+
+        /*!
+         \brief Create a view of a child inside another Ngrdnt.
+
+         Nothing is copied. The parent is kept alive for as long as the
+         child.
+
+         \param bytes The bytes of the child, inside \c p.
+         \param p The Ngrdnt that holds the child.
+         \return A new Ngrdnt object.
+         \since 0.2
+         */
+        static inline Ngrdnt::Ptr child(const uint8_t* bytes, const Ngrdnt::Ptr& p)
+        {
+            Ngrdnt::Ptr result(new Ngrdnt(bytes));
+            result->parent_ = p;
+            return result;
+        }
+
         /*!
          \brief Create a new Ngrdnt from a series of bytes containing
          Ngrdnt data.
@@ -298,6 +378,18 @@ namespace watson
         //! Set the parent Ngrdnt.
         inline void parent(const Ngrdnt::Ptr& p) { parent_ = p; }
 
+        /*!
+         \brief Turn this object into a view of other bytes.
+
+         Memory owned by the object is released, along with its parent
+         and owner. This lets a reader reuse one object for every
+         Ngrdnt it hands out.
+
+         \param bytes The bytes to observe.
+         \since 0.2
+         */
+        void observe(const uint8_t* bytes);
+
     private:
         /*!
          \brief Constructor for creating blank Ngrdnt objects.
@@ -330,6 +422,9 @@ namespace watson
 
         //! Context for where the Ngrdnt was in the recipe. 
         Ngrdnt::Ptr parent_;
+
+        //! Keeps viewed memory valid.
+        std::shared_ptr<const void> owner_;
     }; // class watson::Ngrdnt
 
 
@@ -391,11 +486,35 @@ namespace watson
                 ptr += Ngrdnt::temp(ptr)->size();
             }
         }
-        // TODO need a cheap way to make temp collections.
         ~Basic_container() = default;
         Basic_container& operator=(const Basic_container& rhs) = default;
         Basic_container& operator=(Basic_container&& rhs) = default;
 
+        /*!
+         \brief Create a container whose children point into \c raw.
+
+         Nothing is copied. Every child keeps \c raw alive as its parent.
+
+         \param raw The container Ngrdnt.
+         \return The container.
+         \since 0.2
+         */
+        static Basic_container view(const Ngrdnt::Ptr& raw)
+        {
+            Basic_container result;
+            ETL etl;
+            const uint8_t* ptr = raw->data() + ngrdnt_header_size(raw->type_marker());
+            const uint8_t* const end = raw->data() + raw->size();
+
+            while (end > ptr)
+            {
+                const uint64_t sz = checked_ngrdnt_size(ptr, end);
+                result.children_.emplace_back(etl(Ngrdnt::child(ptr, raw)));
+                ptr += sz;
+            }
+            return result;
+        }
+
         inline Children& mutable_children() { return children_; }
         inline const Children& children() const { return children_; }
         inline const size_t size() const { return children().size(); }
@@ -446,11 +565,21 @@ namespace watson
         Map(Map&& o) = default;
         explicit Map(Children&& c);
         explicit Map(const Ngrdnt::Ptr& raw);
-        // TODO Need a cheap way to do temp maps.
         ~Map() = default;
         Map& operator=(const Map& rhs) = default;
         Map& operator=(Map&& rhs) = default;
 
+        /*!
+         \brief Create a map whose children point into \c raw.
+
+         Nothing is copied. Every child keeps \c raw alive as its parent.
+
+         \param raw The map Ngrdnt.
+         \return The map.
+         \since 0.2
+         */
+        static Map view(const Ngrdnt::Ptr& raw);
+
         inline Children& mutable_children() { return children_; }
         inline const Children& children() const { return children_; }
         inline const size_t size() const { return children().size(); }
@@ -634,12 +763,35 @@ namespace watson
         Recipe& operator=(Recipe&& rhs) = default;
         Recipe& operator=(const Recipe& rhs) = default;
 
+        /*!
+         \brief Open a recipe file without reading it.
+
+         The file is mapped read-only, and the recipe and every Ngrdnt
+         found through it are views into the mapping. Pages are only read
+         from disk when they are touched. The mapping is released when
+         the last of them is gone.
+
+         \param path The file, holding a single top level Ngrdnt.
+         \return The recipe.
+         \since 0.2
+         */
+        static Recipe open_mapped(const std::string& path);
+
         inline const Container& container() const { return container_; }
         inline const Glossary& glossary() const { return glossary_; }
 
         const Ngrdnt::Ptr ngrdnt(const std::list<uint32_t>& steps) const;
         Recipe recipe(const std::list<uint32_t>& steps) const;
     private:
+        /*!
+         \brief Build a recipe around an existing container.
+
+         Unlike the Ngrdnt constructors, nothing is copied, so the
+         children keep whatever they point into alive.
+         */
+        explicit Recipe(Container&& c);
+        void find_glossary();
+
         Container container_;
         Glossary glossary_;
     };
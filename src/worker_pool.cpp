@@ -0,0 +1,181 @@
+/*!
+ \file watson/worker_pool.cpp
+ \brief WatSON worker pool implementation.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "worker_pool.h"
+#include <algorithm>
+#include <atomic>
+
+namespace watson
+{
+    namespace
+    {
+        //! Set on pool threads, and while a thread runs a batch.
+        thread_local bool t_in_pool = false;
+    }; // namespace watson::(anonymous)
+
+    struct Worker_pool::Batch
+    {
+        Batch(const Task& t, size_t c) :
+                task(t),
+                count(c),
+                next(0)
+        {
+        }
+
+        const Task& task;
+        const size_t count;
+        std::atomic<size_t> next;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    }; // struct watson::Worker_pool::Batch
+
+    Worker_pool::Worker_pool(size_t threads) :
+            batch_(nullptr),
+            generation_(0),
+            users_(0),
+            stop_(false)
+    {
+        threads_.reserve(threads);
+        for (size_t h = 0; h < threads; ++h)
+        {
+            threads_.emplace_back(&Worker_pool::run, this);
+        }
+    }
+
+    Worker_pool::~Worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_)
+        {
+            thread.join();
+        }
+    }
+
+    void Worker_pool::for_each(size_t count, const Task& task)
+    {
+        if (threads_.empty() || t_in_pool || 2 > count)
+        {
+            for (size_t h = 0; h < count; ++h)
+            {
+                task(h);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> serial(serial_);
+        Batch batch(task, count);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batch_ = &batch;
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        t_in_pool = true;
+        work(batch);
+        t_in_pool = false;
+
+        // Wait for the threads that joined the batch to let go of it.
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this]() { return 0 == users_; });
+            batch_ = nullptr;
+        }
+
+        if (batch.error)
+        {
+            std::rethrow_exception(batch.error);
+        }
+    }
+
+    Worker_pool& Worker_pool::shared()
+    {
+        static Worker_pool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+
+    void Worker_pool::run()
+    {
+        t_in_pool = true;
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            wake_.wait(lock, [this, &seen]() {
+                return stop_ || (nullptr != batch_ && seen != generation_);
+            });
+            if (stop_)
+            {
+                return;
+            }
+
+            seen = generation_;
+            Batch* batch = batch_;
+            ++users_;
+            lock.unlock();
+
+            work(*batch);
+
+            lock.lock();
+            if (0 == --users_)
+            {
+                done_.notify_all();
+            }
+        }
+    }
+
+    void Worker_pool::work(Batch& batch)
+    {
+        for (size_t h = batch.next++; h < batch.count; h = batch.next++)
+        {
+            try
+            {
+                batch.task(h);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(batch.error_mutex);
+                if (!batch.error)
+                {
+                    batch.error = std::current_exception();
+                }
+            }
+        }
+    }
+}; // namespace watson
@@ -0,0 +1,109 @@
+#pragma once
+/*!
+ \file watson/worker_pool.h
+ \brief WatSON worker pool.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace watson
+{
+    /*!
+     \brief A fixed set of threads for data parallel work.
+
+     The pool runs one batch at a time. The calling thread takes part in
+     the batch, so a pool without threads simply runs the batch inline.
+     \since 0.2
+     */
+    class Worker_pool
+    {
+    public:
+        //! Work for a single item of a batch.
+        using Task = std::function<void(size_t)>;
+
+        /*!
+         \brief Constructor.
+         \param threads The number of background threads.
+         */
+        explicit Worker_pool(size_t threads);
+        Worker_pool(const Worker_pool& o) = delete;
+        Worker_pool(Worker_pool&& o) = delete;
+        ~Worker_pool();
+        Worker_pool& operator=(const Worker_pool& rhs) = delete;
+        Worker_pool& operator=(Worker_pool&& rhs) = delete;
+
+        //! The number of background threads.
+        inline size_t size() const { return threads_.size(); }
+
+        /*!
+         \brief Run a task for every index in [0, count).
+
+         Blocks until every index has been processed. The first exception
+         thrown by a task is rethrown once the batch is finished. Batches
+         started from inside a task run inline.
+
+         \param count The number of items.
+         \param task The work for a single item.
+         */
+        void for_each(size_t count, const Task& task);
+
+        /*!
+         \brief Process wide pool, with a thread for every core.
+         \return The shared pool.
+         */
+        static Worker_pool& shared();
+
+    private:
+        struct Batch;
+
+        void run();
+        static void work(Batch& batch);
+
+        std::vector<std::thread> threads_;
+        std::mutex serial_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        Batch* batch_;
+        uint64_t generation_;
+        size_t users_;
+        bool stop_;
+    }; // class watson::Worker_pool
+}; // namespace watson
@@ -0,0 +1,257 @@
+/*!
+ \file watson/writer.cpp
+ \brief WatSON memory-mapped writer implementation.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "writer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ios>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace watson
+{
+    namespace
+    {
+        //! Size of the header written by begin_container().
+        const size_t k_open_header_size = 1 + sizeof(uint64_t);
+
+        std::ios_base::failure io_error(const std::string& what, const std::string& path)
+        {
+            return std::ios_base::failure(what + " " + path + ": " + strerror(errno));
+        }
+    }; // namespace watson::(anonymous)
+
+
+    // ----------------------------------------------------------------
+    // Mapped_writer class
+    // ----------------------------------------------------------------
+
+    Mapped_writer::Mapped_writer(const std::string& path, const uint64_t size_hint,
+            const size_t window) :
+            path_(path),
+            fd_(::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)),
+            window_(std::max<size_t>(window, ::sysconf(_SC_PAGESIZE))),
+            size_(0),
+            capacity_(0),
+            map_(nullptr),
+            map_offset_(0),
+            map_size_(0),
+            containers_()
+    {
+        if (0 > fd_)
+        {
+            throw io_error("Unable to open the WatSON file", path_);
+        }
+        try
+        {
+            allocate(size_hint);
+        }
+        catch (...)
+        {
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    Mapped_writer::~Mapped_writer()
+    {
+        try
+        {
+            containers_.clear();
+            close();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    uint8_t* Mapped_writer::reserve(const uint64_t n)
+    {
+        if (!map_ || size_ + n > map_offset_ + map_size_)
+        {
+            map(n);
+        }
+        return map_ + (size_ - map_offset_);
+    }
+
+    void Mapped_writer::write(const uint8_t* d, const uint64_t n)
+    {
+        memcpy(reserve(n), d, n);
+        commit(n);
+    }
+
+    void Mapped_writer::write(const Container& val)
+    {
+        Ngrdnt_gather gather;
+        gather.add(val);
+        write(gather);
+    }
+
+    void Mapped_writer::write(const Map& val)
+    {
+        Ngrdnt_gather gather;
+        gather.add(val);
+        write(gather);
+    }
+
+    void Mapped_writer::write(const Ngrdnt_gather& val)
+    {
+        uint8_t* out = reserve(val.size());
+        for (const iovec& v : val.iov())
+        {
+            memcpy(out, v.iov_base, v.iov_len);
+            out += v.iov_len;
+        }
+        commit(val.size());
+    }
+
+    void Mapped_writer::begin_container()
+    {
+        containers_.push_back(size_);
+        reserve(k_open_header_size);
+        commit(k_open_header_size);
+    }
+
+    void Mapped_writer::end_container()
+    {
+        if (containers_.empty())
+        {
+            throw std::runtime_error("No WatSON container to finish.");
+        }
+        const uint64_t offset = containers_.back();
+        containers_.pop_back();
+
+        uint8_t header[k_open_header_size];
+        header[0] = type_marker(Size_type::k_eight, Ngrdnt_type::k_container);
+        const uint64_t full_size = size_ - offset;
+        memcpy(header + 1, &full_size, sizeof(full_size));
+
+        // The header may have left the mapped window long ago.
+        if (offset >= map_offset_)
+        {
+            memcpy(map_ + (offset - map_offset_), header, sizeof(header));
+        }
+        else if (sizeof(header) != ::pwrite(fd_, header, sizeof(header), offset))
+        {
+            throw io_error("Unable to write the WatSON file", path_);
+        }
+    }
+
+    void Mapped_writer::close()
+    {
+        if (0 > fd_)
+        {
+            return;
+        }
+        if (!containers_.empty())
+        {
+            throw std::runtime_error("Unfinished WatSON container in " + path_ + ".");
+        }
+
+        unmap();
+        const int fd = fd_;
+        fd_ = -1;
+        if (0 != ::ftruncate(fd, size_))
+        {
+            ::close(fd);
+            throw io_error("Unable to truncate the WatSON file", path_);
+        }
+        if (0 != ::close(fd))
+        {
+            throw io_error("Unable to close the WatSON file", path_);
+        }
+    }
+
+    void Mapped_writer::map(const uint64_t n)
+    {
+        unmap();
+
+        // Mappings start on a page boundary.
+        const uint64_t page = ::sysconf(_SC_PAGESIZE);
+        const uint64_t start = size_ & ~(page - 1);
+        const uint64_t end = std::max(size_ + n, start + window_);
+        allocate(end);
+
+        void* addr = ::mmap(nullptr, end - start, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, start);
+        if (MAP_FAILED == addr)
+        {
+            throw io_error("Unable to map the WatSON file", path_);
+        }
+        map_ = static_cast<uint8_t*>(addr);
+        map_offset_ = start;
+        map_size_ = end - start;
+    }
+
+    void Mapped_writer::unmap()
+    {
+        if (map_)
+        {
+            ::munmap(map_, map_size_);
+            map_ = nullptr;
+            map_offset_ = map_size_ = 0;
+        }
+    }
+
+    void Mapped_writer::allocate(const uint64_t n)
+    {
+        if (n <= capacity_)
+        {
+            return;
+        }
+
+        // Grow a window at a time, so small writes do not allocate often.
+        const uint64_t target = std::max(n, capacity_ + window_);
+#ifdef __linux__
+        if (0 == ::fallocate(fd_, 0, capacity_, target - capacity_))
+        {
+            capacity_ = target;
+            return;
+        }
+        if (EOPNOTSUPP != errno && ENOSYS != errno)
+        {
+            throw io_error("Unable to allocate the WatSON file", path_);
+        }
+#endif
+        if (0 != ::ftruncate(fd_, target))
+        {
+            throw io_error("Unable to allocate the WatSON file", path_);
+        }
+        capacity_ = target;
+    }
+}; // namespace watson
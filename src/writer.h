@@ -0,0 +1,161 @@
+#pragma once
+/*!
+ \file watson/writer.h
+ \brief WatSON memory-mapped writer.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "gather.h"
+#include "watson.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace watson
+{
+    /*!
+     \brief Default size of the file windows mapped by a Mapped_writer.
+     \since 0.2
+     */
+    constexpr size_t k_mapped_window_size = 64 << 20;
+
+    /*!
+     \brief Encodes Ngrdnts straight into a memory-mapped file.
+
+     Writing through a std::ostream copies every byte into the stream
+     buffer and again into the kernel. This writer maps a window of the
+     file and encodes into it directly, moving on to the next window as
+     it fills. The file is allocated ahead of the writes, and cut to the
+     size actually written when the writer is closed.
+
+     A top level container can be written one child at a time, between
+     begin_container() and end_container(), without knowing its size or
+     holding its children in memory:
+
+     \code
+     watson::Mapped_writer out(path, expected_size);
+     out.begin_container();
+     out.write(library);
+     for (...) { out.write(child); }
+     out.end_container();
+     out.close();
+     \endcode
+
+     Where the file system cannot allocate space up front, running out of
+     disk space shows up as a SIGBUS while writing instead of an error.
+     \since 0.2
+     */
+    class Mapped_writer
+    {
+    public:
+        /*!
+         \brief Create or replace a file.
+         \param path The file.
+         \param size_hint The expected size, allocated up front.
+         \param window The size of each mapped window.
+         */
+        explicit Mapped_writer(const std::string& path, uint64_t size_hint = 0,
+                size_t window = k_mapped_window_size);
+        Mapped_writer(const Mapped_writer& o) = delete;
+        Mapped_writer& operator=(const Mapped_writer& rhs) = delete;
+
+        //! Closes the file, ignoring errors.
+        ~Mapped_writer();
+
+        /*!
+         \brief Get space at the end of the file to encode into.
+         \param n The number of bytes needed.
+         \return The space, valid until the next call to the writer.
+         */
+        uint8_t* reserve(uint64_t n);
+
+        /*!
+         \brief Keep bytes encoded into reserved space.
+         \param n The number of bytes, no more than was reserved.
+         */
+        inline void commit(const uint64_t n) { size_ += n; }
+
+        //! Copy bytes to the end of the file.
+        void write(const uint8_t* d, uint64_t n);
+
+        //! Write an Ngrdnt as it is.
+        inline void write(const Ngrdnt::Ptr& val) { write(val->data(), val->size()); }
+
+        //! Encode a container, as new_ngrdnt(const Container&) would.
+        void write(const Container& val);
+
+        //! Encode a map, as new_ngrdnt(const Map&) would.
+        void write(const Map& val);
+
+        //! Copy everything in a gather list.
+        void write(const Ngrdnt_gather& val);
+
+        /*!
+         \brief Start a container whose children are written next.
+
+         The header always uses an 8 byte size, which is filled in by
+         end_container(). Containers may be nested.
+         */
+        void begin_container();
+
+        //! Finish the innermost container.
+        void end_container();
+
+        //! The number of bytes written.
+        inline uint64_t size() const { return size_; }
+
+        /*!
+         \brief Unmap the file and cut it to size.
+
+         Every container must have been finished.
+         */
+        void close();
+
+    private:
+        //! Map a window holding at least \c n bytes from the end of the file.
+        void map(uint64_t n);
+        void unmap();
+        //! Make the file at least \c n bytes long.
+        void allocate(uint64_t n);
+
+        std::string path_;
+        int fd_;
+        size_t window_;
+        uint64_t size_;
+        uint64_t capacity_;
+        uint8_t* map_;
+        uint64_t map_offset_;
+        uint64_t map_size_;
+        //! Offsets of the unfinished container headers.
+        std::vector<uint64_t> containers_;
+    }; // class watson::Mapped_writer
+}; // namespace watson
@@ -0,0 +1,1883 @@
+/*!
+ \file watson/zip.cpp
+ \brief WatSON compression helpers implementation.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "zip.h"
+#include "snappy.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace watson
+{
+    // ----------------------------------------------------------------
+    // Snappy framing format.
+    // ----------------------------------------------------------------
+
+    namespace
+    {
+        const uint8_t k_stream_identifier[] = {
+                0xFF, 0x06, 0x00, 0x00, 's', 'N', 'a', 'P', 'p', 'Y'
+        };
+
+        //! Leads the body of a block index, after its checksum.
+        const uint8_t k_block_index_magic[] = {'W', 'I', 'D', 'X'};
+
+        const size_t k_frame_header_size = 4;
+        const size_t k_frame_checksum_size = 4;
+
+        enum Frame_type : uint8_t
+        {
+            k_frame_compressed = 0x00,
+            k_frame_uncompressed = 0x01,
+            k_frame_skippable = 0x80,
+            //! In the reserved skippable range, so other readers pass over it.
+            k_frame_block_index = 0x9A,
+            k_frame_stream_identifier = 0xFF,
+        };
+
+        //! Scratch buffers above this size are not kept between calls.
+        const size_t k_scratch_retain = 64 << 20;
+
+        //! Per thread buffer for trial and whole compression.
+        struct Scratch
+        {
+            Scratch() :
+                    capacity(0)
+            {
+            }
+
+            std::unique_ptr<char[]> data;
+            size_t capacity;
+        };
+
+        thread_local Scratch t_scratch;
+
+        //! Get at least \c sz bytes of scratch for the current thread.
+        char* scratch(const size_t sz)
+        {
+            if (t_scratch.capacity < sz)
+            {
+                const size_t capacity = std::max(sz, t_scratch.capacity + t_scratch.capacity / 2);
+                t_scratch.data.reset();
+                t_scratch.data.reset(new char[capacity]);
+                t_scratch.capacity = capacity;
+            }
+            return t_scratch.data.get();
+        }
+
+        //! Release the scratch for the current thread if it got too large.
+        void trim_scratch()
+        {
+            if (t_scratch.capacity > k_scratch_retain)
+            {
+                t_scratch.data.reset();
+                t_scratch.capacity = 0;
+            }
+        }
+
+        /*!
+         \brief Compress into a new \c k_zip Ngrdnt of exactly the right size.
+
+         \c compress writes into the per thread scratch, behind room for
+         the largest header. The header is written just in front of the
+         payload, and both are copied into one exact allocation.
+
+         \param worst_case The most bytes \c compress may write.
+         \param compress Writes the payload, returning its size.
+         \return The Ngrdnt.
+         */
+        template <typename F>
+        Ngrdnt::Ptr zip_into_ngrdnt(const uint64_t worst_case, F compress)
+        {
+            const size_t reserved = ngrdnt_header_size(Size_type::k_eight);
+            uint8_t* const buffer = reinterpret_cast<uint8_t*>(scratch(reserved + worst_case));
+            const uint64_t data_size = compress(buffer + reserved);
+
+            const size_t header_size = ngrdnt_header_size(size_type_necessary(data_size));
+            uint8_t* const start = buffer + reserved - header_size;
+            write_ngrdnt_header(start, Ngrdnt_type::k_zip, data_size);
+            std::unique_ptr<uint8_t[]> ptr(new uint8_t[header_size + data_size]);
+            memcpy(ptr.get(), start, header_size + data_size);
+            trim_scratch();
+            return Ngrdnt::adopt(std::move(ptr));
+        }
+
+        //! CRC-32C (Castagnoli), slicing by 8.
+        struct Crc32c
+        {
+            Crc32c()
+            {
+                for (uint32_t h = 0; h < 256; ++h)
+                {
+                    uint32_t crc = h;
+                    for (int k = 0; k < 8; ++k)
+                    {
+                        crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+                    }
+                    table[0][h] = crc;
+                }
+                for (uint32_t h = 0; h < 256; ++h)
+                {
+                    for (int k = 1; k < 8; ++k)
+                    {
+                        table[k][h] = (table[k - 1][h] >> 8) ^
+                                table[0][table[k - 1][h] & 0xFF];
+                    }
+                }
+            }
+
+            uint32_t operator()(const uint8_t* d, size_t n) const
+            {
+                uint32_t crc = 0xFFFFFFFF;
+                while (n >= 8)
+                {
+                    uint32_t lo, hi;
+                    memcpy(&lo, d, sizeof(lo));
+                    memcpy(&hi, d + 4, sizeof(hi));
+                    lo ^= crc;
+                    crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+                            table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+                            table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+                            table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+                    d += 8;
+                    n -= 8;
+                }
+                while (n--)
+                {
+                    crc = (crc >> 8) ^ table[0][(crc ^ *d++) & 0xFF];
+                }
+                return ~crc;
+            }
+
+            uint32_t table[8][256];
+        };
+
+        //! Masked checksum, as required by the framing format.
+        uint32_t frame_checksum(const uint8_t* d, size_t n)
+        {
+            static const Crc32c crc32c;
+            const uint32_t crc = crc32c(d, n);
+            return ((crc >> 15) | (crc << 17)) + 0xA282EAD8;
+        }
+
+        inline uint64_t read_le(const uint8_t* d, size_t n)
+        {
+            uint64_t result = 0;
+            for (size_t h = 0; h < n; ++h)
+            {
+                result |= static_cast<uint64_t>(d[h]) << (8 * h);
+            }
+            return result;
+        }
+
+        inline uint8_t* write_le(uint8_t* d, uint64_t v, size_t n)
+        {
+            for (size_t h = 0; h < n; ++h)
+            {
+                *d++ = static_cast<uint8_t>(v >> (8 * h));
+            }
+            return d;
+        }
+
+        inline const uint8_t* zip_payload(const Ngrdnt::Ptr& raw, size_t* sz)
+        {
+            const size_t header_size = ngrdnt_header_size(raw->type_marker());
+            *sz = raw->size() - header_size;
+            return raw->data() + header_size;
+        }
+
+        /*!
+         \brief Decodes frames, by default into a reusable frame sized buffer.
+         */
+        class Frame_decoder
+        {
+        public:
+            Frame_decoder() :
+                    started_(false)
+            {
+            }
+
+            //! Decode from the middle of a payload, past the stream identifier.
+            inline void resume() { started_ = true; }
+
+            //! The buffer written by decode(const uint8_t, const uint8_t*, const size_t).
+            inline const uint8_t* output() const { return output_.get(); }
+
+            /*!
+             \brief Decode a single frame into output().
+             \param type The frame type.
+             \param body The frame body.
+             \param len The size of the frame body.
+             \return The number of bytes written to output().
+             */
+            size_t decode(const uint8_t type, const uint8_t* body, const size_t len)
+            {
+                if (!output_)
+                {
+                    output_.reset(new uint8_t[k_zip_frame_size]);
+                }
+                return decode(type, body, len, output_.get(), k_zip_frame_size);
+            }
+
+            /*!
+             \brief Decode a single frame.
+             \param type The frame type.
+             \param body The frame body.
+             \param len The size of the frame body.
+             \param out Where to write the uncompressed bytes.
+             \param capacity The space available at \c out.
+             \return The number of bytes written to \c out.
+             */
+            size_t decode(const uint8_t type, const uint8_t* body, const size_t len,
+                    uint8_t* out, const size_t capacity)
+            {
+                if (!started_ && k_frame_stream_identifier != type)
+                {
+                    throw std::runtime_error("Framed WatSON payload is missing the stream identifier.");
+                }
+
+                const size_t result = length(type, body, len);
+                if (result > std::min(k_zip_frame_size, capacity))
+                {
+                    throw std::runtime_error("Oversized frame in WatSON payload.");
+                }
+
+                switch (type)
+                {
+                    case k_frame_stream_identifier:
+                        if (len != sizeof(k_stream_identifier) - k_frame_header_size ||
+                                0 != memcmp(body, k_stream_identifier + k_frame_header_size, len))
+                        {
+                            throw std::runtime_error("Invalid stream identifier in framed WatSON payload.");
+                        }
+                        started_ = true;
+                        break;
+                    case k_frame_compressed:
+                        if (!snappy::RawUncompress(reinterpret_cast<const char*>(body + k_frame_checksum_size),
+                                len - k_frame_checksum_size,
+                                reinterpret_cast<char*>(out)))
+                        {
+                            throw std::runtime_error("Corrupt compressed frame in WatSON payload.");
+                        }
+                        verify(body, out, result);
+                        break;
+                    case k_frame_uncompressed:
+                        memcpy(out, body + k_frame_checksum_size, result);
+                        verify(body, out, result);
+                        break;
+                    default:
+                        if (k_frame_skippable > type)
+                        {
+                            throw std::runtime_error("Unsupported frame type in WatSON payload.");
+                        }
+                        break;
+                }
+                return result;
+            }
+
+            /*!
+             \brief The uncompressed length of a frame, without decoding it.
+             \param type The frame type.
+             \param body The frame body.
+             \param len The size of the frame body.
+             \return The number of bytes the frame decodes to.
+             */
+            static size_t length(const uint8_t type, const uint8_t* body, const size_t len)
+            {
+                size_t result = 0;
+                if (k_frame_compressed == type || k_frame_uncompressed == type)
+                {
+                    if (len < k_frame_checksum_size)
+                    {
+                        throw std::runtime_error("Truncated frame in WatSON payload.");
+                    }
+                    result = len - k_frame_checksum_size;
+                }
+                if (k_frame_compressed == type &&
+                        !snappy::GetUncompressedLength(reinterpret_cast<const char*>(body + k_frame_checksum_size),
+                                len - k_frame_checksum_size, &result))
+                {
+                    throw std::runtime_error("Corrupt compressed frame in WatSON payload.");
+                }
+                return result;
+            }
+
+        private:
+            static void verify(const uint8_t* body, const uint8_t* out, const size_t len)
+            {
+                if (read_le(body, k_frame_checksum_size) != frame_checksum(out, len))
+                {
+                    throw std::runtime_error("Checksum mismatch in framed WatSON payload.");
+                }
+            }
+
+            std::unique_ptr<uint8_t[]> output_;
+            bool started_;
+        };
+
+        //! Call \c f with the type, body and size of every frame in a payload.
+        template <typename F>
+        void each_frame(const uint8_t* ptr, const uint8_t* const end, F f)
+        {
+            while (end > ptr)
+            {
+                if (static_cast<size_t>(end - ptr) < k_frame_header_size)
+                {
+                    throw std::runtime_error("Truncated frame in WatSON payload.");
+                }
+                const uint8_t type = ptr[0];
+                const size_t len = read_le(ptr + 1, 3);
+                ptr += k_frame_header_size;
+                if (static_cast<size_t>(end - ptr) < len)
+                {
+                    throw std::runtime_error("Truncated frame in WatSON payload.");
+                }
+
+                f(type, ptr, len);
+                ptr += len;
+            }
+        }
+
+        //! Walk the frames of an in memory payload.
+        uint64_t unzip_frames(const uint8_t* ptr, const uint8_t* const end,
+                const Zip_sink& sink)
+        {
+            Frame_decoder decoder;
+            uint64_t total = 0;
+            each_frame(ptr, end, [&](const uint8_t type, const uint8_t* body, const size_t len) {
+                const size_t produced = decoder.decode(type, body, len);
+                if (0 < produced)
+                {
+                    sink(decoder.output(), produced);
+                    total += produced;
+                }
+            });
+            return total;
+        }
+
+        //! Frames are decompressed in groups of about this size.
+        const uint64_t k_parallel_group_size = 16 * k_zip_frame_size;
+
+        //! Below this, the shared pool costs more than it saves; its
+        //! batches run one at a time, so other threads would wait on it.
+        const uint64_t k_shared_pool_min_size = 4 * k_parallel_group_size;
+
+        /*!
+         \brief Decompress a framed payload on a worker pool.
+
+         Every frame is independent, and its position in the output is
+         known from the lengths alone. Groups of frames are decompressed
+         straight into place.
+         */
+        void unzip_frames(const uint8_t* data, const size_t n, uint8_t* out,
+                const uint64_t output_size, Worker_pool& pool)
+        {
+            struct Frame
+            {
+                uint8_t type;
+                const uint8_t* body;
+                size_t len;
+                uint64_t offset;
+            };
+
+            std::vector<Frame> frames;
+            std::vector<size_t> groups;
+            uint64_t offset = 0;
+            uint64_t group_offset = 0;
+            each_frame(data, data + n, [&](const uint8_t type, const uint8_t* body, const size_t len) {
+                if (frames.empty())
+                {
+                    // Only the stream identifier, which produces nothing.
+                    Frame_decoder().decode(type, body, len, out, 0);
+                }
+                if (groups.empty() || offset - group_offset >= k_parallel_group_size)
+                {
+                    groups.push_back(frames.size());
+                    group_offset = offset;
+                }
+                Frame f = { type, body, len, offset };
+                frames.push_back(f);
+                offset += Frame_decoder::length(type, body, len);
+            });
+            if (offset != output_size)
+            {
+                throw std::runtime_error("Framed WatSON payload does not match its length.");
+            }
+            groups.push_back(frames.size());
+
+            pool.for_each(groups.size() - 1, [&](const size_t g) {
+                Frame_decoder decoder;
+                decoder.resume();
+                for (size_t h = groups[g]; h < groups[g + 1]; ++h)
+                {
+                    const Frame& f = frames[h];
+                    decoder.decode(f.type, f.body, f.len, out + f.offset, output_size - f.offset);
+                }
+            });
+        }
+
+        //! Largest size of a frame holding \c len bytes.
+        inline size_t max_frame_size(const size_t len)
+        {
+            return k_frame_header_size + k_frame_checksum_size + snappy::MaxCompressedLength(len);
+        }
+
+        /*!
+         \brief Write a single data frame.
+         \param out Where to write the frame, max_frame_size() bytes.
+         \param input The bytes to store, at most k_zip_frame_size.
+         \param len The number of bytes to store.
+         \return Pointer to the first byte after the frame.
+         */
+        uint8_t* write_frame(uint8_t* out, const uint8_t* input, const size_t len)
+        {
+            uint8_t* current = out + k_frame_header_size;
+            current = write_le(current, frame_checksum(input, len), k_frame_checksum_size);
+
+            size_t compressed_size;
+            snappy::RawCompress(reinterpret_cast<const char*>(input), len,
+                    reinterpret_cast<char*>(current), &compressed_size);
+
+            // Store the frame as is when compression doesn't pay off.
+            uint8_t type = k_frame_compressed;
+            if (compressed_size >= len)
+            {
+                type = k_frame_uncompressed;
+                compressed_size = len;
+                memcpy(current, input, len);
+            }
+
+            out[0] = type;
+            write_le(out + 1, compressed_size + k_frame_checksum_size, 3);
+            return current + compressed_size;
+        }
+
+        // ------------------------------------------------------------
+        // Dictionary payloads.
+        //
+        // (payload) ::= 0x00 (dictionary-id) (snappy-stream)
+        //
+        // The snappy stream may copy from the dictionary, as if it was
+        // placed right before the output. A plain payload can never start
+        // with 0x00, because that would be an empty child.
+        // ------------------------------------------------------------
+
+        const uint8_t k_dictionary_marker = 0x00;
+        const size_t k_dictionary_header_size = 5;
+        const int k_dictionary_hash_bits = 15;
+        const int k_input_hash_bits = 14;
+
+        inline uint32_t load32(const uint8_t* d)
+        {
+            uint32_t result;
+            memcpy(&result, d, sizeof(result));
+            return result;
+        }
+
+        inline uint32_t hash32(const uint32_t v, const int bits)
+        {
+            return (v * 0x1E35A7BD) >> (32 - bits);
+        }
+
+        uint8_t* write_varint(uint8_t* d, uint64_t v)
+        {
+            while (0x80 <= v)
+            {
+                *d++ = static_cast<uint8_t>(v | 0x80);
+                v >>= 7;
+            }
+            *d++ = static_cast<uint8_t>(v);
+            return d;
+        }
+
+        const uint8_t* read_varint(const uint8_t* d, const uint8_t* const end, uint64_t* v)
+        {
+            uint64_t result = 0;
+            for (int shift = 0; end > d && 64 > shift; shift += 7)
+            {
+                const uint8_t b = *d++;
+                result |= static_cast<uint64_t>(b & 0x7F) << shift;
+                if (0 == (b & 0x80))
+                {
+                    *v = result;
+                    return d;
+                }
+            }
+            throw std::runtime_error("Corrupt length in WatSON compressed payload.");
+        }
+
+        uint8_t* emit_literal(uint8_t* op, const uint8_t* literal, const size_t len)
+        {
+            const size_t n = len - 1;
+            if (60 > n)
+            {
+                *op++ = static_cast<uint8_t>(n << 2);
+            }
+            else
+            {
+                const int bytes = 0x100 > n ? 1 : 0x10000 > n ? 2 : 0x1000000 > n ? 3 : 4;
+                *op++ = static_cast<uint8_t>((59 + bytes) << 2);
+                op = write_le(op, n, bytes);
+            }
+            memcpy(op, literal, len);
+            return op + len;
+        }
+
+        uint8_t* emit_copy_upto_64(uint8_t* op, const size_t offset, const size_t len)
+        {
+            if (12 > len && 2048 > offset)
+            {
+                *op++ = static_cast<uint8_t>(1 | ((len - 4) << 2) | ((offset >> 8) << 5));
+                *op++ = static_cast<uint8_t>(offset);
+            }
+            else if (0x10000 > offset)
+            {
+                *op++ = static_cast<uint8_t>(2 | ((len - 1) << 2));
+                op = write_le(op, offset, 2);
+            }
+            else
+            {
+                *op++ = static_cast<uint8_t>(3 | ((len - 1) << 2));
+                op = write_le(op, offset, 4);
+            }
+            return op;
+        }
+
+        uint8_t* emit_copy(uint8_t* op, const size_t offset, size_t len)
+        {
+            // Keep at least 4 bytes for the last copy.
+            while (68 <= len)
+            {
+                op = emit_copy_upto_64(op, offset, 64);
+                len -= 64;
+            }
+            if (64 < len)
+            {
+                op = emit_copy_upto_64(op, offset, 60);
+                len -= 60;
+            }
+            return emit_copy_upto_64(op, offset, len);
+        }
+
+        inline size_t match_length(const uint8_t* a, const uint8_t* b, const size_t limit)
+        {
+            size_t len = 0;
+            while (limit > len && a[len] == b[len])
+            {
+                ++len;
+            }
+            return len;
+        }
+
+        //! Worst case size of a dictionary payload.
+        inline size_t max_dictionary_payload(const size_t input_size)
+        {
+            return k_dictionary_header_size + 10 + input_size + input_size / 2 + 32;
+        }
+
+        //! Per thread hash table for the input side of dictionary compression.
+        thread_local std::vector<uint32_t> t_input_table;
+
+        size_t dictionary_compress(const Zip_dictionary& dict, const uint8_t* in,
+                const size_t n, uint8_t* out)
+        {
+            uint8_t* op = out;
+            *op++ = k_dictionary_marker;
+            op = write_le(op, dict.id(), 4);
+            op = write_varint(op, n);
+
+            // Size the input table to the input, so small messages stay cheap.
+            int bits = 8;
+            while (k_input_hash_bits > bits && (static_cast<size_t>(1) << bits) < n)
+            {
+                ++bits;
+            }
+            t_input_table.assign(static_cast<size_t>(1) << bits, 0);
+
+            const uint8_t* const dict_data = dict.data();
+            const size_t dict_size = dict.size();
+            const std::vector<uint32_t>& dict_table = dict.table();
+            size_t literal = 0;
+            size_t h = 0;
+            size_t misses = 0;
+            while (h + 4 <= n)
+            {
+                const uint32_t v = load32(in + h);
+                size_t best_len = 0;
+                size_t best_offset = 0;
+
+                uint32_t& slot = t_input_table[hash32(v, bits)];
+                if (0 < slot && v == load32(in + slot - 1))
+                {
+                    best_len = 4 + match_length(in + slot - 1 + 4, in + h + 4, n - h - 4);
+                    best_offset = h - (slot - 1);
+                }
+                slot = h + 1;
+
+                const uint32_t candidate = dict_table.empty() ? 0 : dict_table[hash32(v, k_dictionary_hash_bits)];
+                if (0 < candidate && candidate + 3 <= dict_size && v == load32(dict_data + candidate - 1))
+                {
+                    const size_t start = candidate - 1;
+                    const size_t len = 4 + match_length(dict_data + start + 4, in + h + 4,
+                            std::min(dict_size - start, n - h) - 4);
+                    if (len > best_len)
+                    {
+                        best_len = len;
+                        best_offset = h + dict_size - start;
+                    }
+                }
+
+                if (4 > best_len)
+                {
+                    // Skip ahead faster through data that doesn't match.
+                    h += 1 + (misses++ >> 5);
+                    continue;
+                }
+
+                misses = 0;
+                if (h > literal)
+                {
+                    op = emit_literal(op, in + literal, h - literal);
+                }
+                op = emit_copy(op, best_offset, best_len);
+                h += best_len;
+                literal = h;
+            }
+
+            if (n > literal)
+            {
+                op = emit_literal(op, in + literal, n - literal);
+            }
+            return op - out;
+        }
+
+        //! Find the dictionary a payload was compressed with.
+        Zip_dictionary::Ptr payload_dictionary(const uint8_t* data, const size_t n)
+        {
+            if (k_dictionary_header_size > n)
+            {
+                throw std::runtime_error("Truncated WatSON dictionary payload.");
+            }
+            Zip_dictionary::Ptr dict(find_dictionary(read_le(data + 1, 4)));
+            if (!dict)
+            {
+                throw std::runtime_error("Unknown WatSON compression dictionary.");
+            }
+            return dict;
+        }
+
+        uint64_t dictionary_length(const uint8_t* data, const size_t n)
+        {
+            if (k_dictionary_header_size > n)
+            {
+                throw std::runtime_error("Truncated WatSON dictionary payload.");
+            }
+            uint64_t result;
+            read_varint(data + k_dictionary_header_size, data + n, &result);
+            return result;
+        }
+
+        void dictionary_decompress(const uint8_t* data, const size_t n,
+                uint8_t* out, const uint64_t capacity)
+        {
+            const Zip_dictionary::Ptr dict(payload_dictionary(data, n));
+            const uint8_t* const dict_data = dict->data();
+            const uint64_t dict_size = dict->size();
+
+            const uint8_t* const end = data + n;
+            uint64_t output_size;
+            const uint8_t* ip = read_varint(data + k_dictionary_header_size, end, &output_size);
+            if (output_size > capacity)
+            {
+                throw std::runtime_error("Oversized WatSON dictionary payload.");
+            }
+
+            uint64_t q = 0;
+            while (end > ip)
+            {
+                const uint8_t tag = *ip++;
+                uint64_t len;
+                uint64_t offset;
+                switch (tag & 0x03)
+                {
+                    case 0:
+                        len = tag >> 2;
+                        if (60 <= len)
+                        {
+                            const size_t bytes = len - 59;
+                            if (static_cast<size_t>(end - ip) < bytes)
+                            {
+                                throw std::runtime_error("Truncated WatSON dictionary payload.");
+                            }
+                            len = read_le(ip, bytes);
+                            ip += bytes;
+                        }
+                        ++len;
+                        if (static_cast<uint64_t>(end - ip) < len || output_size - q < len)
+                        {
+                            throw std::runtime_error("Corrupt literal in WatSON dictionary payload.");
+                        }
+                        memcpy(out + q, ip, len);
+                        ip += len;
+                        q += len;
+                        continue;
+                    case 1:
+                        if (end == ip)
+                        {
+                            throw std::runtime_error("Truncated WatSON dictionary payload.");
+                        }
+                        len = 4 + ((tag >> 2) & 0x07);
+                        offset = (static_cast<uint64_t>(tag >> 5) << 8) | *ip++;
+                        break;
+                    case 2:
+                        if (2 > end - ip)
+                        {
+                            throw std::runtime_error("Truncated WatSON dictionary payload.");
+                        }
+                        len = 1 + (tag >> 2);
+                        offset = read_le(ip, 2);
+                        ip += 2;
+                        break;
+                    default:
+                        if (4 > end - ip)
+                        {
+                            throw std::runtime_error("Truncated WatSON dictionary payload.");
+                        }
+                        len = 1 + (tag >> 2);
+                        offset = read_le(ip, 4);
+                        ip += 4;
+                        break;
+                }
+
+                if (0 == offset || offset > q + dict_size || output_size - q < len)
+                {
+                    throw std::runtime_error("Corrupt copy in WatSON dictionary payload.");
+                }
+
+                // The part that comes from the dictionary.
+                if (offset > q)
+                {
+                    const uint64_t from_dict = std::min(len, offset - q);
+                    memcpy(out + q, dict_data + dict_size - (offset - q), from_dict);
+                    q += from_dict;
+                    len -= from_dict;
+                }
+
+                // The part that comes from the output, which may overlap.
+                uint8_t* dst = out + q;
+                const uint8_t* src = dst - offset;
+                if (offset >= len)
+                {
+                    memcpy(dst, src, len);
+                }
+                else
+                {
+                    for (uint64_t h = 0; h < len; ++h)
+                    {
+                        dst[h] = src[h];
+                    }
+                }
+                q += len;
+            }
+
+            if (q != output_size)
+            {
+                throw std::runtime_error("Truncated WatSON dictionary payload.");
+            }
+        }
+
+        // ------------------------------------------------------------
+        // Payload dispatch.
+        // ------------------------------------------------------------
+
+        inline bool framed_payload(const uint8_t* data, const size_t n)
+        {
+            return n >= sizeof(k_stream_identifier) &&
+                    0 == memcmp(data, k_stream_identifier, sizeof(k_stream_identifier));
+        }
+
+        inline bool dictionary_payload(const uint8_t* data, const size_t n)
+        {
+            return 0 < n && k_dictionary_marker == data[0];
+        }
+
+        //! Size of the child held by a payload.
+        uint64_t payload_length(const uint8_t* data, const size_t n)
+        {
+            if (framed_payload(data, n))
+            {
+                uint64_t total = 0;
+                each_frame(data, data + n, [&total](const uint8_t type, const uint8_t* body, const size_t len) {
+                    total += Frame_decoder::length(type, body, len);
+                });
+                return total;
+            }
+            if (dictionary_payload(data, n))
+            {
+                return dictionary_length(data, n);
+            }
+
+            size_t output_size;
+            if (!snappy::GetUncompressedLength(reinterpret_cast<const char*>(data), n, &output_size))
+            {
+                throw std::runtime_error("Corrupt WatSON compressed payload.");
+            }
+            return output_size;
+        }
+
+        //! Decompress a payload into memory sized by payload_length().
+        void unzip_payload(const uint8_t* data, const size_t n, uint8_t* out,
+                const uint64_t output_size, Worker_pool* pool = nullptr)
+        {
+            if (pool && k_parallel_group_size < output_size && framed_payload(data, n))
+            {
+                unzip_frames(data, n, out, output_size, *pool);
+            }
+            else if (framed_payload(data, n))
+            {
+                Frame_decoder decoder;
+                uint64_t written = 0;
+                each_frame(data, data + n, [&](const uint8_t type, const uint8_t* body, const size_t len) {
+                    written += decoder.decode(type, body, len, out + written, output_size - written);
+                });
+            }
+            else if (dictionary_payload(data, n))
+            {
+                dictionary_decompress(data, n, out, output_size);
+            }
+            else if (!snappy::RawUncompress(reinterpret_cast<const char*>(data),
+                    n, reinterpret_cast<char*>(out)))
+            {
+                throw std::runtime_error("Corrupt WatSON compressed payload.");
+            }
+
+            if (0 == output_size || output_size < ngrdnt_header_size(out[0]) ||
+                    output_size != ngrdnt_size(out))
+            {
+                throw std::runtime_error("WatSON compressed payload does not hold a single Ngrdnt.");
+            }
+        }
+
+        //! Decompress a payload in one piece.
+        uint64_t unzip_whole(const uint8_t* data, const size_t n, const Zip_sink& sink)
+        {
+            const uint64_t output_size = payload_length(data, n);
+            std::unique_ptr<uint8_t[]> output(new uint8_t[output_size]);
+            unzip_payload(data, n, output.get(), output_size);
+            sink(output.get(), output_size);
+            return output_size;
+        }
+
+        bool read_fully(std::istream& is, uint8_t* target, size_t sz)
+        {
+            is.read(reinterpret_cast<char*>(target), sz);
+            return static_cast<size_t>(is.gcount()) == sz;
+        }
+
+        /*!
+         \brief Splits a stream of decompressed bytes into Ngrdnts.
+
+         A top level container is unwrapped so its elements can be
+         visited individually. Elements that are contiguous in the
+         incoming bytes are visited in place.
+         */
+        class Ngrdnt_splitter
+        {
+        public:
+            explicit Ngrdnt_splitter(const Ngrdnt_visitor& visitor) :
+                    visitor_(visitor),
+                    unwrapped_(false),
+                    count_(0)
+            {
+            }
+
+            inline uint64_t count() const { return count_; }
+
+            void operator()(const uint8_t* d, size_t n)
+            {
+                if (!unwrapped_)
+                {
+                    const size_t used = unwrap(d, n);
+                    d += used;
+                    n -= used;
+                }
+
+                while (0 < n)
+                {
+                    if (pending_.empty())
+                    {
+                        const uint64_t sz = complete_size(d, n);
+                        if (0 < sz)
+                        {
+                            visit(d);
+                            d += sz;
+                            n -= sz;
+                            continue;
+                        }
+                    }
+
+                    const size_t used = fill(d, n);
+                    d += used;
+                    n -= used;
+                }
+            }
+
+            void finish() const
+            {
+                if (!unwrapped_ || !pending_.empty())
+                {
+                    throw std::runtime_error("Truncated Ngrdnt in WatSON compressed payload.");
+                }
+            }
+
+        private:
+            //! Size of an Ngrdnt with a complete header.
+            static uint64_t checked_size(const uint8_t* d)
+            {
+                const uint64_t sz = ngrdnt_size(d);
+                if (sz < ngrdnt_header_size(d[0]))
+                {
+                    throw std::runtime_error("Invalid Ngrdnt size in WatSON compressed payload.");
+                }
+                return sz;
+            }
+
+            //! Size of the Ngrdnt at \c d if it is entirely available.
+            static uint64_t complete_size(const uint8_t* d, size_t n)
+            {
+                if (n < ngrdnt_header_size(d[0]))
+                {
+                    return 0;
+                }
+                const uint64_t sz = checked_size(d);
+                return sz <= n ? sz : 0;
+            }
+
+            //! Consume the header of a top level container.
+            size_t unwrap(const uint8_t* d, size_t n)
+            {
+                const size_t before = pending_.size();
+                const uint64_t header_size = ngrdnt_header_size(pending_.empty() ? d[0] : pending_[0]);
+                const size_t used = std::min<uint64_t>(header_size - before, n);
+                pending_.insert(pending_.end(), d, d + used);
+                if (pending_.size() < header_size)
+                {
+                    return used;
+                }
+
+                unwrapped_ = true;
+                if (Ngrdnt_type::k_container == ngrdnt_type(pending_[0]))
+                {
+                    pending_.clear();
+                    return used;
+                }
+
+                // Not a container, let the header be handled as an element.
+                pending_.resize(before);
+                return 0;
+            }
+
+            //! Buffer an Ngrdnt that spans calls.
+            size_t fill(const uint8_t* d, size_t n)
+            {
+                const uint64_t header_size = ngrdnt_header_size(pending_.empty() ? d[0] : pending_[0]);
+                const uint64_t needed = pending_.size() < header_size ?
+                        header_size : checked_size(pending_.data());
+
+                const size_t used = std::min<uint64_t>(needed - pending_.size(), n);
+                pending_.insert(pending_.end(), d, d + used);
+                if (pending_.size() == needed)
+                {
+                    const uint64_t sz = checked_size(pending_.data());
+                    if (pending_.size() == sz)
+                    {
+                        visit(pending_.data());
+                        pending_.clear();
+                    }
+                    else
+                    {
+                        pending_.reserve(sz);
+                    }
+                }
+                return used;
+            }
+
+            void visit(const uint8_t* d)
+            {
+                visitor_(Ngrdnt::temp(d));
+                ++count_;
+            }
+
+            const Ngrdnt_visitor& visitor_;
+            std::vector<uint8_t> pending_;
+            bool unwrapped_;
+            uint64_t count_;
+        };
+
+        //! Trial compression of a sample.
+        bool compresses(const uint8_t* sample, const size_t sample_size,
+                const double min_ratio)
+        {
+            size_t compressed_size;
+            snappy::RawCompress(reinterpret_cast<const char*>(sample), sample_size,
+                    scratch(snappy::MaxCompressedLength(sample_size)), &compressed_size);
+            trim_scratch();
+            return sample_size >= compressed_size * min_ratio;
+        }
+    }; // namespace watson::(anonymous)
+
+    // ----------------------------------------------------------------
+    // Compressed class
+    // ----------------------------------------------------------------
+
+    Compressed::Compressed() :
+            child_(Ngrdnt::make())
+    {
+    }
+
+    Compressed::Compressed(Ngrdnt::Ptr&& raw) :
+            child_(std::move(raw))
+    {
+    }
+
+    Compressed::Compressed(const Ngrdnt::Ptr& raw)
+    {
+        const uint64_t output_size = unzipped_size(raw);
+        std::unique_ptr<uint8_t[]> output(new uint8_t[output_size]);
+        if (k_shared_pool_min_size <= output_size)
+        {
+            unzip(raw, output.get(), output_size, Worker_pool::shared());
+        }
+        else
+        {
+            unzip(raw, output.get(), output_size);
+        }
+        child_ = Ngrdnt::adopt(std::move(output));
+    }
+
+
+    // ----------------------------------------------------------------
+    // Zip_dictionary class
+    // ----------------------------------------------------------------
+
+    namespace
+    {
+        //! Length of the segments picked by training.
+        const size_t k_train_segment_size = 64;
+        //! Length of the substrings counted by training.
+        const size_t k_train_gram_size = 6;
+        const uint32_t k_no_gram = 0xFFFFFFFF;
+
+        std::mutex g_dictionaries_mutex;
+        std::unordered_map<uint32_t, Zip_dictionary::Ptr> g_dictionaries;
+    }; // namespace watson::(anonymous)
+
+    Zip_dictionary::Ptr Zip_dictionary::make(std::vector<uint8_t>&& content)
+    {
+        return Ptr(new Zip_dictionary(std::move(content)));
+    }
+
+    Zip_dictionary::Ptr Zip_dictionary::make(const Ngrdnt::Ptr& raw)
+    {
+        if (Ngrdnt_type::k_binary != ngrdnt_type(raw->type_marker()))
+        {
+            throw std::runtime_error("WatSON compression dictionaries are stored as Bytes.");
+        }
+        const Bytes bytes(raw);
+        Ptr result(make(std::vector<uint8_t>(bytes.data(), bytes.data() + bytes.size())));
+        if (result->id() != bytes.marshal_hint())
+        {
+            throw std::runtime_error("Checksum mismatch in WatSON compression dictionary.");
+        }
+        return result;
+    }
+
+    Zip_dictionary::Ptr Zip_dictionary::train(const std::vector<Ngrdnt::Ptr>& samples,
+            const size_t capacity)
+    {
+        // Lay the samples out end to end, and give every substring of
+        // k_train_gram_size bytes a number.
+        std::vector<uint8_t> corpus;
+        std::vector<size_t> ends;
+        for (const Ngrdnt::Ptr& sample : samples)
+        {
+            corpus.insert(corpus.end(), sample->data(), sample->data() + sample->size());
+            ends.push_back(corpus.size());
+        }
+
+        std::unordered_map<uint64_t, uint32_t> numbers;
+        std::vector<uint32_t> grams(corpus.size(), k_no_gram);
+        std::vector<uint32_t> counts;
+        std::vector<uint32_t> last_sample;
+        size_t start = 0;
+        for (size_t s = 0; s < ends.size(); ++s)
+        {
+            for (size_t h = start; h + k_train_gram_size <= ends[s]; ++h)
+            {
+                uint64_t key = 0;
+                memcpy(&key, corpus.data() + h, k_train_gram_size);
+                auto inserted = numbers.insert(std::make_pair(key, static_cast<uint32_t>(counts.size())));
+                if (inserted.second)
+                {
+                    counts.push_back(0);
+                    last_sample.push_back(k_no_gram);
+                }
+
+                // Count the samples a substring shows up in, not how often
+                // it repeats within one sample.
+                const uint32_t number = inserted.first->second;
+                grams[h] = number;
+                if (last_sample[number] != s)
+                {
+                    last_sample[number] = s;
+                    ++counts[number];
+                }
+            }
+            start = ends[s];
+        }
+
+        // Split the corpus into one epoch per segment that fits, and take
+        // the best scoring segment out of every epoch. Substrings only
+        // score once, so later segments favour content not seen yet.
+        struct Segment
+        {
+            uint64_t score;
+            size_t begin;
+        };
+        std::vector<Segment> segments;
+        const size_t epochs = std::max<size_t>(1, capacity / k_train_segment_size);
+        const size_t epoch_size = std::max<size_t>(1, corpus.size() / epochs);
+        size_t sample = 0;
+        for (size_t epoch = 0; epoch * epoch_size < corpus.size(); ++epoch)
+        {
+            const size_t epoch_end = std::min(corpus.size(), (epoch + 1) * epoch_size);
+            Segment best = { 0, 0 };
+            size_t begin = epoch * epoch_size;
+            while (begin < epoch_end)
+            {
+                while (ends[sample] <= begin)
+                {
+                    ++sample;
+                }
+
+                // Slide a window over the part of the sample in this epoch.
+                const size_t sample_end = ends[sample];
+                uint64_t score = 0;
+                const size_t scan_end = std::min(sample_end, epoch_end + k_train_segment_size);
+                for (size_t h = begin; h < scan_end; ++h)
+                {
+                    if (k_no_gram != grams[h] && 1 < counts[grams[h]])
+                    {
+                        score += counts[grams[h]];
+                    }
+                    if (h >= begin + k_train_segment_size)
+                    {
+                        const size_t dropped = h - k_train_segment_size;
+                        if (k_no_gram != grams[dropped] && 1 < counts[grams[dropped]])
+                        {
+                            score -= counts[grams[dropped]];
+                        }
+                    }
+                    const size_t window = std::min(h + 1, begin + k_train_segment_size) - begin;
+                    if (score > best.score && (k_train_segment_size == window || sample_end == h + 1) &&
+                            h + 1 - window < epoch_end)
+                    {
+                        best.score = score;
+                        best.begin = h + 1 - window;
+                    }
+                }
+                begin = sample_end;
+            }
+
+            if (0 == best.score)
+            {
+                continue;
+            }
+            segments.push_back(best);
+            for (size_t h = best.begin; h < best.begin + k_train_segment_size && h < corpus.size(); ++h)
+            {
+                if (k_no_gram != grams[h])
+                {
+                    counts[grams[h]] = 0;
+                }
+            }
+        }
+
+        // The best segments go last, where references to them are shortest.
+        std::stable_sort(segments.begin(), segments.end(), [](const Segment& lhs, const Segment& rhs) {
+            return lhs.score < rhs.score;
+        });
+        std::vector<uint8_t> content;
+        for (auto it = segments.rbegin(); it != segments.rend() && content.size() < capacity; ++it)
+        {
+            const size_t sample_end = *std::upper_bound(ends.begin(), ends.end(), it->begin);
+            const size_t len = std::min(std::min(k_train_segment_size, sample_end - it->begin),
+                    capacity - content.size());
+            content.insert(content.begin(), corpus.begin() + it->begin, corpus.begin() + it->begin + len);
+        }
+        return make(std::move(content));
+    }
+
+    Zip_dictionary::Zip_dictionary(std::vector<uint8_t>&& content) :
+            content_(std::move(content)),
+            table_(),
+            id_(frame_checksum(content_.data(), content_.size()))
+    {
+        if (0xFFFFFFF0 < content_.size())
+        {
+            throw std::runtime_error("WatSON compression dictionary is too large.");
+        }
+        if (4 <= content_.size())
+        {
+            // Later positions win, so matches prefer the shorter offsets.
+            table_.assign(static_cast<size_t>(1) << k_dictionary_hash_bits, 0);
+            for (size_t h = 0; h + 4 <= content_.size(); ++h)
+            {
+                table_[hash32(load32(content_.data() + h), k_dictionary_hash_bits)] = h + 1;
+            }
+        }
+    }
+
+    Ngrdnt::Ptr new_ngrdnt(const Zip_dictionary& val)
+    {
+        const uint32_t id = val.id();
+        return new_ngrdnt(Bytes::temp(val.size(), &id, val.data()));
+    }
+
+    void register_dictionary(const Zip_dictionary::Ptr& dict)
+    {
+        std::lock_guard<std::mutex> lock(g_dictionaries_mutex);
+        g_dictionaries[dict->id()] = dict;
+    }
+
+    Zip_dictionary::Ptr find_dictionary(const uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(g_dictionaries_mutex);
+        auto it = g_dictionaries.find(id);
+        return g_dictionaries.end() == it ? Zip_dictionary::Ptr() : it->second;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Compression
+    // ----------------------------------------------------------------
+
+    Ngrdnt::Ptr new_ngrdnt(const Compressed& val)
+    {
+        return zip_into_ngrdnt(snappy::MaxCompressedLength(val->size()), [&val](uint8_t* out) {
+            size_t sz;
+            snappy::RawCompress(reinterpret_cast<const char*>(val->data()),
+                    val->size(),
+                    reinterpret_cast<char*>(out),
+                    &sz);
+            return static_cast<uint64_t>(sz);
+        });
+    }
+
+    Ngrdnt::Ptr new_ngrdnt(const Compressed& val, const Zip_dictionary& dict)
+    {
+        const uint64_t input_size = val->size();
+        if (0xFFFFFFFF - dict.size() <= input_size)
+        {
+            // Offsets would not fit, and the dictionary hardly matters.
+            return new_ngrdnt(val);
+        }
+
+        return zip_into_ngrdnt(max_dictionary_payload(input_size), [&](uint8_t* out) {
+            return static_cast<uint64_t>(dictionary_compress(dict, val->data(), input_size, out));
+        });
+    }
+
+    Ngrdnt::Ptr new_ngrdnt(const Compressed& val, const Zip_policy& policy,
+            Zip_stats* stats)
+    {
+        Zip_stats ignored;
+        Zip_stats& counters = stats ? *stats : ignored;
+        const uint64_t input_size = val->size();
+        counters.bytes_in += input_size;
+
+        Ngrdnt::Ptr result;
+        if (input_size < policy.min_size)
+        {
+            ++counters.too_small;
+            result = *val;
+        }
+        else if (0 < policy.sample_size && input_size > policy.sample_size &&
+                !compresses(val->data(), policy.sample_size, policy.min_ratio))
+        {
+            ++counters.sampled_out;
+            result = *val;
+        }
+        else
+        {
+            result = new_ngrdnt(val);
+            if (input_size < result->size() * policy.min_ratio)
+            {
+                ++counters.rejected;
+                result = *val;
+            }
+            else
+            {
+                ++counters.compressed;
+            }
+        }
+
+        counters.bytes_out += result->size();
+        return result;
+    }
+
+    Ngrdnt::Ptr new_framed_ngrdnt(const Compressed& val)
+    {
+        const uint8_t* input = val->data();
+        const uint64_t input_size = val->size();
+        const uint64_t frames = (input_size + k_zip_frame_size - 1) / k_zip_frame_size;
+        const uint64_t worst_case = sizeof(k_stream_identifier) +
+                frames * max_frame_size(k_zip_frame_size);
+
+        return zip_into_ngrdnt(worst_case, [&](uint8_t* const buffer) {
+            uint8_t* current = buffer;
+            memcpy(current, k_stream_identifier, sizeof(k_stream_identifier));
+            current += sizeof(k_stream_identifier);
+
+            for (uint64_t offset = 0; offset < input_size; offset += k_zip_frame_size)
+            {
+                const size_t len = std::min<uint64_t>(k_zip_frame_size, input_size - offset);
+                current = write_frame(current, input + offset, len);
+            }
+            return static_cast<uint64_t>(current - buffer);
+        });
+    }
+
+    Ngrdnt::Ptr new_seekable_ngrdnt(const Container& val, const size_t block_size,
+            Worker_pool& pool)
+    {
+        const Container::Children& children = val.children();
+        uint64_t data_size = 0;
+        for (const Ngrdnt::Ptr& child : children)
+        {
+            data_size += child->size();
+        }
+        uint8_t header[9];
+        const size_t header_size = write_ngrdnt_header(header, Ngrdnt_type::k_container,
+                data_size) - header;
+
+        // Group the children into blocks, never splitting a child. The
+        // container header goes at the start of the first block.
+        std::vector<size_t> firsts(1, 0);
+        std::vector<uint64_t> offsets(1, 0);
+        uint64_t fill = header_size;
+        for (size_t h = 0; h < children.size(); ++h)
+        {
+            if (0 < h && fill >= block_size)
+            {
+                firsts.push_back(h);
+                offsets.push_back(offsets.back() + fill);
+                fill = 0;
+            }
+            fill += children[h]->size();
+        }
+        firsts.push_back(children.size());
+        offsets.push_back(offsets.back() + fill);
+        const size_t block_count = firsts.size() - 1;
+
+        const size_t index_size = k_frame_checksum_size + sizeof(k_block_index_magic) +
+                16 + block_count * 24;
+        if (index_size >= (1 << 24))
+        {
+            throw std::runtime_error("Too many blocks for a seekable WatSON container.");
+        }
+
+        // Every block is compressed on its own, so they can be done in
+        // parallel.
+        std::vector<std::vector<uint8_t>> frames(block_count);
+        pool.for_each(block_count, [&](const size_t b) {
+            std::vector<uint8_t> input;
+            input.reserve(offsets[b + 1] - offsets[b]);
+            if (0 == b)
+            {
+                input.insert(input.end(), header, header + header_size);
+            }
+            for (size_t h = firsts[b]; h < firsts[b + 1]; ++h)
+            {
+                input.insert(input.end(), children[h]->data(), children[h]->data() + children[h]->size());
+            }
+
+            std::vector<uint8_t>& out = frames[b];
+            out.resize((input.size() + k_zip_frame_size - 1) / k_zip_frame_size *
+                    max_frame_size(k_zip_frame_size));
+            uint8_t* current = out.data();
+            for (uint64_t offset = 0; offset < input.size(); offset += k_zip_frame_size)
+            {
+                const size_t len = std::min<uint64_t>(k_zip_frame_size, input.size() - offset);
+                current = write_frame(current, input.data() + offset, len);
+            }
+            out.resize(current - out.data());
+        });
+
+        uint64_t payload_size = sizeof(k_stream_identifier) + k_frame_header_size + index_size;
+        for (const std::vector<uint8_t>& f : frames)
+        {
+            payload_size += f.size();
+        }
+        std::unique_ptr<uint8_t[]> ptr(new uint8_t[payload_size +
+                ngrdnt_header_size(size_type_necessary(payload_size))]);
+        uint8_t* current = write_ngrdnt_header(ptr.get(), Ngrdnt_type::k_zip, payload_size);
+        memcpy(current, k_stream_identifier, sizeof(k_stream_identifier));
+        current += sizeof(k_stream_identifier);
+
+        // The block index.
+        *current++ = k_frame_block_index;
+        current = write_le(current, index_size, 3);
+        uint8_t* const index = current;
+        current += k_frame_checksum_size;
+        memcpy(current, k_block_index_magic, sizeof(k_block_index_magic));
+        current += sizeof(k_block_index_magic);
+        current = write_le(current, children.size(), 8);
+        current = write_le(current, offsets.back(), 8);
+        uint64_t payload_offset = sizeof(k_stream_identifier) + k_frame_header_size + index_size;
+        for (size_t b = 0; b < block_count; ++b)
+        {
+            current = write_le(current, firsts[b], 8);
+            current = write_le(current, offsets[b], 8);
+            current = write_le(current, payload_offset, 8);
+            payload_offset += frames[b].size();
+        }
+        write_le(index, frame_checksum(index + k_frame_checksum_size,
+                index_size - k_frame_checksum_size), k_frame_checksum_size);
+
+        for (const std::vector<uint8_t>& f : frames)
+        {
+            memcpy(current, f.data(), f.size());
+            current += f.size();
+        }
+        return Ngrdnt::adopt(std::move(ptr));
+    }
+
+    void compress_all(Container& val, Worker_pool& pool)
+    {
+        Container::Children& children = val.mutable_children();
+        pool.for_each(children.size(), [&children](size_t h) {
+            if (Ngrdnt_type::k_zip != ngrdnt_type(children[h]->type_marker()))
+            {
+                children[h] = new_ngrdnt(Compressed(std::move(children[h])));
+            }
+        });
+    }
+
+    void compress_all(Container& val, const Zip_policy& policy,
+            Zip_stats* stats, Worker_pool& pool)
+    {
+        Container::Children& children = val.mutable_children();
+        pool.for_each(children.size(), [&children, &policy, stats](size_t h) {
+            if (Ngrdnt_type::k_zip != ngrdnt_type(children[h]->type_marker()))
+            {
+                children[h] = new_ngrdnt(Compressed(std::move(children[h])), policy, stats);
+            }
+        });
+    }
+
+    // ----------------------------------------------------------------
+    // Decompression
+    // ----------------------------------------------------------------
+
+    bool is_framed(const Ngrdnt::Ptr& raw)
+    {
+        size_t data_size;
+        const uint8_t* data = zip_payload(raw, &data_size);
+        return framed_payload(data, data_size);
+    }
+
+    uint64_t unzip(const Ngrdnt::Ptr& raw, const Zip_sink& sink)
+    {
+        size_t data_size;
+        const uint8_t* data = zip_payload(raw, &data_size);
+        if (framed_payload(data, data_size))
+        {
+            return unzip_frames(data, data + data_size, sink);
+        }
+        return unzip_whole(data, data_size, sink);
+    }
+
+    uint64_t unzipped_size(const Ngrdnt::Ptr& raw)
+    {
+        size_t data_size;
+        const uint8_t* data = zip_payload(raw, &data_size);
+        return payload_length(data, data_size);
+    }
+
+    const uint8_t* unzip(const Ngrdnt::Ptr& raw, uint8_t* out, size_t capacity)
+    {
+        size_t data_size;
+        const uint8_t* data = zip_payload(raw, &data_size);
+        const uint64_t output_size = payload_length(data, data_size);
+        if (output_size > capacity)
+        {
+            return nullptr;
+        }
+
+        unzip_payload(data, data_size, out, output_size);
+        return out;
+    }
+
+    const uint8_t* unzip(const Ngrdnt::Ptr& raw, uint8_t* out, size_t capacity,
+            Worker_pool& pool)
+    {
+        size_t data_size;
+        const uint8_t* data = zip_payload(raw, &data_size);
+        const uint64_t output_size = payload_length(data, data_size);
+        if (output_size > capacity)
+        {
+            return nullptr;
+        }
+
+        unzip_payload(data, data_size, out, output_size, &pool);
+        return out;
+    }
+
+    uint64_t unzip(const Ngrdnt::Ptr& raw, std::ostream& os)
+    {
+        return unzip(raw, [&os](const uint8_t* d, size_t n) {
+            os.write(reinterpret_cast<const char*>(d), n);
+        });
+    }
+
+    uint64_t unzip(std::istream& is, const Zip_sink& sink)
+    {
+        uint8_t header[9];
+        if (!read_fully(is, header, 1))
+        {
+            return 0;
+        }
+        if (Ngrdnt_type::k_zip != ngrdnt_type(header[0]))
+        {
+            throw std::ios_base::failure("Expected a WatSON compressed Ngrdnt in the input stream.");
+        }
+
+        const uint64_t header_size = ngrdnt_header_size(header[0]);
+        if (!read_fully(is, header + 1, header_size - 1))
+        {
+            throw std::ios_base::failure("Unable to read the WatSON Size from the input stream.");
+        }
+        const uint64_t full_size = ngrdnt_size(header);
+        if (full_size < header_size)
+        {
+            throw std::ios_base::failure("WatSON Size is smaller than its header in the input stream.");
+        }
+        uint64_t remaining = full_size - header_size;
+
+        // Peek at the start of the payload to tell the formats apart.
+        std::vector<uint8_t> buffer(std::min<uint64_t>(remaining, sizeof(k_stream_identifier)));
+        if (!read_fully(is, buffer.data(), buffer.size()))
+        {
+            throw std::ios_base::failure("Unable to read the WatSON Element data from the input stream.");
+        }
+        remaining -= buffer.size();
+
+        if (buffer.size() < sizeof(k_stream_identifier) ||
+                0 != memcmp(buffer.data(), k_stream_identifier, sizeof(k_stream_identifier)))
+        {
+            buffer.resize(buffer.size() + remaining);
+            if (!read_fully(is, buffer.data() + buffer.size() - remaining, remaining))
+            {
+                throw std::ios_base::failure("Unable to read the WatSON Element data from the input stream.");
+            }
+            return unzip_whole(buffer.data(), buffer.size(), sink);
+        }
+
+        Frame_decoder decoder;
+        decoder.decode(k_frame_stream_identifier, buffer.data() + k_frame_header_size,
+                sizeof(k_stream_identifier) - k_frame_header_size);
+
+        uint64_t total = 0;
+        while (0 < remaining)
+        {
+            uint8_t frame_header[k_frame_header_size];
+            if (remaining < k_frame_header_size || !read_fully(is, frame_header, k_frame_header_size))
+            {
+                throw std::ios_base::failure("Unable to read a WatSON frame from the input stream.");
+            }
+            const size_t len = read_le(frame_header + 1, 3);
+            remaining -= k_frame_header_size;
+
+            buffer.resize(len);
+            if (remaining < len || !read_fully(is, buffer.data(), len))
+            {
+                throw std::ios_base::failure("Unable to read a WatSON frame from the input stream.");
+            }
+            remaining -= len;
+
+            const size_t produced = decoder.decode(frame_header[0], buffer.data(), len);
+            if (0 < produced)
+            {
+                sink(decoder.output(), produced);
+                total += produced;
+            }
+        }
+        return total;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Seekable_zip class
+    // ----------------------------------------------------------------
+
+    Seekable_zip::Seekable_zip(const Ngrdnt::Ptr& raw) :
+            raw_(raw),
+            child_count_(0),
+            blocks_(),
+            block_data_(),
+            loaded_(0)
+    {
+        if (!is_seekable(raw))
+        {
+            throw std::runtime_error("WatSON compressed Ngrdnt has no block index.");
+        }
+
+        size_t data_size;
+        const uint8_t* data = zip_payload(raw, &data_size);
+        const uint8_t* frame = data + sizeof(k_stream_identifier);
+        const size_t len = read_le(frame + 1, 3);
+        const uint8_t* body = frame + k_frame_header_size;
+        const size_t fixed = k_frame_checksum_size + sizeof(k_block_index_magic) + 16;
+        if (static_cast<size_t>(data + data_size - body) < len ||
+                fixed + 24 > len || 0 != (len - fixed) % 24)
+        {
+            throw std::runtime_error("Truncated block index in WatSON payload.");
+        }
+        if (read_le(body, k_frame_checksum_size) != frame_checksum(body + k_frame_checksum_size,
+                len - k_frame_checksum_size))
+        {
+            throw std::runtime_error("Checksum mismatch in WatSON block index.");
+        }
+
+        const uint8_t* ptr = body + k_frame_checksum_size + sizeof(k_block_index_magic);
+        child_count_ = read_le(ptr, 8);
+        const uint64_t total = read_le(ptr + 8, 8);
+        for (ptr += 16; body + len > ptr; ptr += 24)
+        {
+            Block b = { read_le(ptr, 8), read_le(ptr + 8, 8), read_le(ptr + 16, 8) };
+            blocks_.push_back(b);
+        }
+        Block end = { child_count_, total, data_size };
+        blocks_.push_back(end);
+
+        // Blocks must follow each other, and lie after the index.
+        if (0 != blocks_[0].first_child || 0 != blocks_[0].offset ||
+                static_cast<uint64_t>(body + len - data) != blocks_[0].payload_offset)
+        {
+            throw std::runtime_error("Corrupt block index in WatSON payload.");
+        }
+        for (size_t b = 1; b < blocks_.size(); ++b)
+        {
+            if (blocks_[b - 1].first_child > blocks_[b].first_child ||
+                    blocks_[b - 1].offset >= blocks_[b].offset ||
+                    blocks_[b - 1].payload_offset >= blocks_[b].payload_offset)
+            {
+                throw std::runtime_error("Corrupt block index in WatSON payload.");
+            }
+        }
+        loaded_ = blocks_.size();
+    }
+
+    bool Seekable_zip::is_seekable(const Ngrdnt::Ptr& raw)
+    {
+        if (Ngrdnt_type::k_zip != ngrdnt_type(raw->type_marker()))
+        {
+            return false;
+        }
+        size_t data_size;
+        const uint8_t* data = zip_payload(raw, &data_size);
+        // Other writers may use the same skippable frame type, so the
+        // body has to carry the magic as well.
+        const size_t magic_at = sizeof(k_stream_identifier) + k_frame_header_size + k_frame_checksum_size;
+        return framed_payload(data, data_size) &&
+                data_size >= magic_at + sizeof(k_block_index_magic) &&
+                k_frame_block_index == data[sizeof(k_stream_identifier)] &&
+                read_le(data + sizeof(k_stream_identifier) + 1, 3) >=
+                        k_frame_checksum_size + sizeof(k_block_index_magic) &&
+                0 == memcmp(data + magic_at, k_block_index_magic, sizeof(k_block_index_magic));
+    }
+
+    Ngrdnt::Ptr Seekable_zip::operator[](const uint64_t indx)
+    {
+        if (indx >= child_count_)
+        {
+            return k_not_found;
+        }
+
+        // The last block that starts at or before the child.
+        auto it = std::upper_bound(blocks_.begin(), blocks_.end() - 1, indx,
+                [](const uint64_t v, const Block& b) {
+            return v < b.first_child;
+        });
+        const size_t block = (it - blocks_.begin()) - 1;
+        load(block);
+
+        const uint8_t* ptr = block_data_.data();
+        const uint8_t* const end = ptr + block_data_.size();
+        if (0 == block)
+        {
+            ptr += ngrdnt_header_size(ptr[0]);
+        }
+        for (uint64_t h = blocks_[block].first_child; end > ptr; ++h)
+        {
+            if (static_cast<uint64_t>(end - ptr) < ngrdnt_header_size(ptr[0]) ||
+                    static_cast<uint64_t>(end - ptr) < ngrdnt_size(ptr))
+            {
+                break;
+            }
+            if (h == indx)
+            {
+                return Ngrdnt::clone(ptr);
+            }
+            ptr += ngrdnt_size(ptr);
+        }
+        throw std::runtime_error("Corrupt block in seekable WatSON payload.");
+    }
+
+    void Seekable_zip::load(const size_t block)
+    {
+        if (loaded_ == block)
+        {
+            return;
+        }
+        loaded_ = blocks_.size();
+
+        const uint64_t block_size = blocks_[block + 1].offset - blocks_[block].offset;
+        block_data_.resize(block_size);
+
+        size_t data_size;
+        const uint8_t* data = zip_payload(raw_, &data_size);
+        Frame_decoder decoder;
+        decoder.resume();
+
+        uint64_t written = 0;
+        each_frame(data + blocks_[block].payload_offset, data + blocks_[block + 1].payload_offset,
+                [&](const uint8_t type, const uint8_t* body, const size_t len) {
+            written += decoder.decode(type, body, len, block_data_.data() + written, block_size - written);
+        });
+        if (written != block_size)
+        {
+            throw std::runtime_error("Corrupt block in seekable WatSON payload.");
+        }
+        loaded_ = block;
+    }
+
+
+    // ----------------------------------------------------------------
+    // Unzip_arena class
+    // ----------------------------------------------------------------
+
+    Unzip_arena::Unzip_arena(size_t block_size) :
+            block_size_(block_size),
+            current_(0),
+            used_(0)
+    {
+    }
+
+    const uint8_t* Unzip_arena::unzip(const Ngrdnt::Ptr& raw)
+    {
+        const uint64_t sz = unzipped_size(raw);
+        return ::watson::unzip(raw, allocate(sz), sz);
+    }
+
+    uint8_t* Unzip_arena::allocate(size_t sz)
+    {
+        // Keep every allocation 8 byte aligned.
+        sz = (sz + 7) & ~static_cast<size_t>(7);
+        for (; current_ < blocks_.size(); ++current_, used_ = 0)
+        {
+            Block& block = blocks_[current_];
+            if (block.size - used_ >= sz)
+            {
+                uint8_t* result = block.data.get() + used_;
+                used_ += sz;
+                return result;
+            }
+        }
+
+        const size_t block_size = std::max(block_size_, sz);
+        blocks_.push_back(Block{std::unique_ptr<uint8_t[]>(new uint8_t[block_size]), block_size});
+        current_ = blocks_.size() - 1;
+        used_ = sz;
+        return blocks_.back().data.get();
+    }
+
+    void Unzip_arena::reset()
+    {
+        // Merge the blocks, so the next round fits in a single block.
+        if (1 < blocks_.size())
+        {
+            const size_t total = capacity();
+            blocks_.clear();
+            blocks_.push_back(Block{std::unique_ptr<uint8_t[]>(new uint8_t[total]), total});
+        }
+        current_ = 0;
+        used_ = 0;
+    }
+
+    size_t Unzip_arena::capacity() const
+    {
+        size_t total = 0;
+        for (const auto& block : blocks_)
+        {
+            total += block.size;
+        }
+        return total;
+    }
+
+    uint64_t unzip_each(const Ngrdnt::Ptr& raw, const Ngrdnt_visitor& visitor)
+    {
+        Ngrdnt_splitter splitter(visitor);
+        unzip(raw, std::ref(splitter));
+        splitter.finish();
+        return splitter.count();
+    }
+
+    uint64_t unzip_each(std::istream& is, const Ngrdnt_visitor& visitor)
+    {
+        Ngrdnt_splitter splitter(visitor);
+        if (0 == unzip(is, std::ref(splitter)))
+        {
+            return 0;
+        }
+        splitter.finish();
+        return splitter.count();
+    }
+}; // namespace watson
@@ -0,0 +1,556 @@
+#pragma once
+/*!
+ \file watson/zip.h
+ \brief WatSON compression helpers.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "watson.h"
+#include "worker_pool.h"
+#include <atomic>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace watson
+{
+    /*!
+     \brief Largest number of uncompressed bytes in a single frame.
+     \since 0.2
+     */
+    constexpr size_t k_zip_frame_size = 65536;
+
+    /*!
+     \brief Receives decompressed bytes.
+
+     The bytes are only valid for the duration of the call.
+     \since 0.2
+     */
+    using Zip_sink = std::function<void(const uint8_t*, size_t)>;
+
+    /*!
+     \brief Receives complete Ngrdnts.
+
+     The Ngrdnt may be a temporary view that is only valid for the
+     duration of the call. Use Ngrdnt::clone() to keep it.
+     \since 0.2
+     */
+    using Ngrdnt_visitor = std::function<void(const Ngrdnt::Ptr&)>;
+
+    /*!
+     \brief When adaptive compression is worth doing.
+
+     A child is only compressed when compression shrinks it by at least
+     \c min_ratio. A trial compression of the first \c sample_size bytes
+     decides this up front, so incompressible children cost very little.
+     \since 0.2
+     */
+    struct Zip_policy
+    {
+        Zip_policy() :
+                min_ratio(1.125),
+                sample_size(16384),
+                min_size(64)
+        {
+        }
+
+        //! Smallest acceptable uncompressed to compressed size ratio.
+        double min_ratio;
+        //! Bytes to trial compress, 0 to always compress the whole child.
+        size_t sample_size;
+        //! Children smaller than this are never compressed.
+        size_t min_size;
+    }; // struct watson::Zip_policy
+
+    /*!
+     \brief Counts the decisions made by adaptive compression.
+
+     The counters may be shared between threads.
+     \since 0.2
+     */
+    struct Zip_stats
+    {
+        Zip_stats() :
+                compressed(0),
+                too_small(0),
+                sampled_out(0),
+                rejected(0),
+                bytes_in(0),
+                bytes_out(0)
+        {
+        }
+
+        //! Children that were stored compressed.
+        std::atomic<uint64_t> compressed;
+        //! Children stored as is, because they were below Zip_policy::min_size.
+        std::atomic<uint64_t> too_small;
+        //! Children stored as is, because their sample did not compress.
+        std::atomic<uint64_t> sampled_out;
+        //! Children stored as is, because the full compression did not pay off.
+        std::atomic<uint64_t> rejected;
+        //! Bytes of children seen.
+        std::atomic<uint64_t> bytes_in;
+        //! Bytes of Ngrdnts produced.
+        std::atomic<uint64_t> bytes_out;
+    }; // struct watson::Zip_stats
+
+    /*!
+     \brief Compress an Ngrdnt when it pays off.
+
+     Children that do not compress according to the policy are returned
+     as is rather than wrapped in a \c k_zip Ngrdnt. Recipe lookups see
+     through \c k_zip Ngrdnts, so readers do not need to care which
+     decision was taken.
+
+     \param val The Compressed object to encode.
+     \param policy When compression is worth it.
+     \param stats Optional counters for the decision taken.
+     \return Either a new \c k_zip Ngrdnt or the child itself.
+     \since 0.2
+     */
+    Ngrdnt::Ptr new_ngrdnt(const Compressed& val, const Zip_policy& policy,
+            Zip_stats* stats = nullptr);
+
+    /*!
+     \brief Shared content for compressing many small, similar children.
+
+     Small messages carry too little data to repeat themselves, so they
+     barely compress on their own. A dictionary holds the content that
+     such messages have in common, and every compressed child may refer
+     back into it. Both ends have to agree on the dictionary: a
+     compressed child only records the id() of the dictionary, and
+     decompression looks it up through find_dictionary().
+
+     \code
+     (Zip-Payload) ::= 0x00 (Dictionary-Id) (Snappy-Stream)
+     (Dictionary-Id) ::= (Unsigned-32bit-Integer)
+     \endcode
+     \since 0.2
+     */
+    class Zip_dictionary
+    {
+    public:
+        using Ptr = std::shared_ptr<const Zip_dictionary>;
+
+        /*!
+         \brief Create a dictionary from its content.
+
+         Content that is used most often should be placed at the end,
+         where it is cheapest to refer to.
+
+         \param content The bytes of the dictionary.
+         \return The new dictionary.
+         */
+        static Ptr make(std::vector<uint8_t>&& content);
+
+        /*!
+         \brief Read a dictionary stored by new_ngrdnt(const Zip_dictionary&).
+         \param raw The \c k_binary Ngrdnt.
+         \return The dictionary.
+         */
+        static Ptr make(const Ngrdnt::Ptr& raw);
+
+        /*!
+         \brief Build a dictionary from representative samples.
+
+         The segments of the samples that recur across the most samples
+         are collected, until \c capacity bytes are filled.
+
+         \param samples Ngrdnts like the ones that will be compressed.
+         \param capacity The largest size of the dictionary.
+         \return The new dictionary.
+         */
+        static Ptr train(const std::vector<Ngrdnt::Ptr>& samples,
+                size_t capacity = 16384);
+
+        Zip_dictionary(const Zip_dictionary& o) = delete;
+        Zip_dictionary& operator=(const Zip_dictionary& rhs) = delete;
+
+        //! Checksum of the content, recorded in every compressed child.
+        inline uint32_t id() const { return id_; }
+        inline const uint8_t* data() const { return content_.data(); }
+        inline size_t size() const { return content_.size(); }
+
+        //! Positions of the content by hash, for the compressor.
+        inline const std::vector<uint32_t>& table() const { return table_; }
+
+    private:
+        explicit Zip_dictionary(std::vector<uint8_t>&& content);
+
+        std::vector<uint8_t> content_;
+        std::vector<uint32_t> table_;
+        uint32_t id_;
+    }; // class watson::Zip_dictionary
+
+    /*!
+     \brief Store a dictionary, so it can be shipped with the data.
+     \param val The dictionary.
+     \return A \c k_binary Ngrdnt, with the id() as the marshal hint.
+     \since 0.2
+     */
+    Ngrdnt::Ptr new_ngrdnt(const Zip_dictionary& val);
+
+    /*!
+     \brief Make a dictionary available for decompression.
+
+     Registering the same dictionary more than once is harmless.
+
+     \param dict The dictionary.
+     \since 0.2
+     */
+    void register_dictionary(const Zip_dictionary::Ptr& dict);
+
+    /*!
+     \brief Find a registered dictionary.
+     \param id The id() of the dictionary.
+     \return The dictionary, or an empty pointer.
+     \since 0.2
+     */
+    Zip_dictionary::Ptr find_dictionary(uint32_t id);
+
+    /*!
+     \brief Compress an Ngrdnt against a dictionary.
+
+     The dictionary must be registered wherever the result is
+     decompressed.
+
+     \param val The Compressed object to encode.
+     \param dict The dictionary to refer to.
+     \return A new \c k_zip Ngrdnt.
+     \since 0.2
+     */
+    Ngrdnt::Ptr new_ngrdnt(const Compressed& val, const Zip_dictionary& dict);
+
+    /*!
+     \brief Compress an Ngrdnt as a series of independent frames.
+
+     The payload of the resulting \c k_zip Ngrdnt uses the snappy framing
+     format. Every frame holds at most k_zip_frame_size bytes of the
+     child, so it can be decompressed with a fixed amount of memory
+     through unzip() or unzip_each(). Compressed understands both the
+     framed and the plain payloads.
+
+     \param val The Compressed object to encode.
+     \return A new \c k_zip Ngrdnt.
+     \since 0.2
+     */
+    Ngrdnt::Ptr new_framed_ngrdnt(const Compressed& val);
+
+    /*!
+     \brief Compress a container so that its children can be read
+     without decompressing all of it.
+
+     The children are grouped into blocks of about \c block_size bytes,
+     and every block is compressed on its own. A block index, listing
+     the first child of every block, is stored in a skippable frame at
+     the start of the payload. The result is an ordinary framed
+     \c k_zip Ngrdnt, that Seekable_zip can read one block at a time.
+
+     \param val The container to compress.
+     \param block_size The number of uncompressed bytes to aim for in a
+     block. Children are never split, so blocks may be larger.
+     \param pool The pool to compress the blocks on.
+     \return A new \c k_zip Ngrdnt.
+     \since 0.2
+     */
+    Ngrdnt::Ptr new_seekable_ngrdnt(const Container& val,
+            size_t block_size = 256 * 1024,
+            Worker_pool& pool = Worker_pool::shared());
+
+    /*!
+     \brief Random access to the children of a seekable \c k_zip Ngrdnt.
+
+     Reading a child only decompresses the block that holds it. The last
+     block read is kept, so reading neighbouring children is cheap. The
+     object is not safe to share between threads.
+
+     \code
+     (Block-Index) ::= (Checksum) (Child-Count) (Uncompressed-Size) {(Block-Entry)}
+     (Block-Entry) ::= (First-Child) (Uncompressed-Offset) (Payload-Offset)
+     \endcode
+     \sa new_seekable_ngrdnt()
+     \since 0.2
+     */
+    class Seekable_zip
+    {
+    public:
+        /*!
+         \brief Constructor.
+
+         Only the block index is read.
+
+         \param raw The \c k_zip Ngrdnt, made by new_seekable_ngrdnt().
+         */
+        explicit Seekable_zip(const Ngrdnt::Ptr& raw);
+        Seekable_zip(const Seekable_zip& o) = delete;
+        Seekable_zip(Seekable_zip&& o) = default;
+        ~Seekable_zip() = default;
+        Seekable_zip& operator=(const Seekable_zip& rhs) = delete;
+        Seekable_zip& operator=(Seekable_zip&& rhs) = default;
+
+        /*!
+         \brief Test if a \c k_zip Ngrdnt has a block index.
+         \param raw The \c k_zip Ngrdnt.
+         \return true if Seekable_zip can read it.
+         */
+        static bool is_seekable(const Ngrdnt::Ptr& raw);
+
+        //! The number of children in the container.
+        inline uint64_t size() const { return child_count_; }
+
+        //! The number of independently compressed blocks.
+        inline size_t block_count() const { return blocks_.size() - 1; }
+
+        /*!
+         \brief Read a child.
+         \param indx The position of the child in the container.
+         \return A copy of the child, or k_not_found when out of range.
+         */
+        Ngrdnt::Ptr operator[](uint64_t indx);
+
+    private:
+        struct Block
+        {
+            uint64_t first_child;
+            uint64_t offset;
+            uint64_t payload_offset;
+        };
+
+        //! Decompress a block into block_data_.
+        void load(size_t block);
+
+        Ngrdnt::Ptr raw_;
+        uint64_t child_count_;
+        //! Every block, followed by one that marks the end.
+        std::vector<Block> blocks_;
+        std::vector<uint8_t> block_data_;
+        size_t loaded_;
+    }; // class watson::Seekable_zip
+
+    /*!
+     \brief Compress every child of a container in parallel.
+
+     Each child is replaced, in place, by its \c k_zip Ngrdnt. Children
+     that are already compressed are left alone. Call new_ngrdnt() on the
+     container afterwards to assemble it.
+
+     \param val The container to compress.
+     \param pool The pool to do the compression on.
+     \since 0.2
+     */
+    void compress_all(Container& val, Worker_pool& pool = Worker_pool::shared());
+
+    /*!
+     \brief Compress the children of a container in parallel, when it
+     pays off.
+     \param val The container to compress.
+     \param policy When compression is worth it.
+     \param stats Optional counters for the decisions taken.
+     \param pool The pool to do the compression on.
+     \sa new_ngrdnt(const Compressed&, const Zip_policy&, Zip_stats*)
+     \since 0.2
+     */
+    void compress_all(Container& val, const Zip_policy& policy,
+            Zip_stats* stats = nullptr, Worker_pool& pool = Worker_pool::shared());
+
+    /*!
+     \brief Test if a \c k_zip Ngrdnt uses the framed payload.
+     \param raw The \c k_zip Ngrdnt.
+     \return true if the payload is framed.
+     \since 0.2
+     */
+    bool is_framed(const Ngrdnt::Ptr& raw);
+
+    /*!
+     \brief Decompress a \c k_zip Ngrdnt into a sink.
+
+     Framed payloads are handed to the sink one frame at a time. Plain
+     payloads are decompressed in one piece.
+
+     \param raw The \c k_zip Ngrdnt.
+     \param sink Receives the bytes of the child Ngrdnt.
+     \return The number of bytes produced.
+     \since 0.2
+     */
+    uint64_t unzip(const Ngrdnt::Ptr& raw, const Zip_sink& sink);
+
+    /*!
+     \brief The size of the child of a \c k_zip Ngrdnt.
+
+     Only the length prefixes are read, nothing is decompressed.
+
+     \param raw The \c k_zip Ngrdnt.
+     \return The number of bytes the child takes up.
+     \since 0.2
+     */
+    uint64_t unzipped_size(const Ngrdnt::Ptr& raw);
+
+    /*!
+     \brief Decompress a \c k_zip Ngrdnt into caller provided memory.
+
+     No memory is allocated. The child is written to the start of \c out,
+     and can be viewed with Ngrdnt::temp() for as long as \c out lives.
+
+     \param raw The \c k_zip Ngrdnt.
+     \param out Where to write the child.
+     \param capacity The space available at \c out.
+     \return \c out, or nullptr if the child needs more than \c capacity
+     bytes.
+     \sa unzipped_size()
+     \since 0.2
+     */
+    const uint8_t* unzip(const Ngrdnt::Ptr& raw, uint8_t* out, size_t capacity);
+
+    /*!
+     \brief Decompress a \c k_zip Ngrdnt into caller provided memory, on
+     a worker pool.
+
+     The frames of a framed payload are independent, so groups of them
+     are decompressed in parallel, each straight into its place in
+     \c out. Other payloads, and small ones, are decompressed on the
+     calling thread. Compressed uses this with Worker_pool::shared().
+
+     \param raw The \c k_zip Ngrdnt.
+     \param out Where to write the child.
+     \param capacity The space available at \c out.
+     \param pool The pool to decompress on.
+     \return \c out, or nullptr if the child needs more than \c capacity
+     bytes.
+     \since 0.2
+     */
+    const uint8_t* unzip(const Ngrdnt::Ptr& raw, uint8_t* out, size_t capacity,
+            Worker_pool& pool);
+
+    /*!
+     \brief Decompress a \c k_zip Ngrdnt into an output stream.
+     \param raw The \c k_zip Ngrdnt.
+     \param os The stream that receives the child Ngrdnt.
+     \return The number of bytes produced.
+     \since 0.2
+     */
+    uint64_t unzip(const Ngrdnt::Ptr& raw, std::ostream& os);
+
+    /*!
+     \brief Decompress the next \c k_zip Ngrdnt from an input stream.
+
+     Framed payloads are read one frame at a time, so the compressed
+     Ngrdnt never needs to be in memory as a whole.
+
+     \param is The stream to read from.
+     \param sink Receives the bytes of the child Ngrdnt.
+     \return The number of bytes produced, 0 at the end of the stream.
+     \since 0.2
+     */
+    uint64_t unzip(std::istream& is, const Zip_sink& sink);
+
+    /*!
+     \brief Memory to decompress into, reused between rounds.
+
+     Decompressed children are packed into large blocks, and stay valid
+     until reset(). Resetting keeps the memory. Once a round fits, later
+     rounds of a similar size do not allocate.
+     \since 0.2
+     */
+    class Unzip_arena
+    {
+    public:
+        /*!
+         \brief Constructor.
+         \param block_size The size of the blocks to allocate.
+         */
+        explicit Unzip_arena(size_t block_size = 1 << 20);
+        Unzip_arena(const Unzip_arena& o) = delete;
+        Unzip_arena(Unzip_arena&& o) = default;
+        ~Unzip_arena() = default;
+        Unzip_arena& operator=(const Unzip_arena& rhs) = delete;
+        Unzip_arena& operator=(Unzip_arena&& rhs) = default;
+
+        /*!
+         \brief Decompress a \c k_zip Ngrdnt into the arena.
+         \param raw The \c k_zip Ngrdnt.
+         \return The child, valid until reset().
+         */
+        const uint8_t* unzip(const Ngrdnt::Ptr& raw);
+
+        /*!
+         \brief Take memory from the arena.
+         \param sz The number of bytes.
+         \return Memory that is valid until reset().
+         */
+        uint8_t* allocate(size_t sz);
+
+        //! Release everything handed out, keeping the memory.
+        void reset();
+
+        //! The number of bytes held by the arena.
+        size_t capacity() const;
+
+    private:
+        struct Block
+        {
+            std::unique_ptr<uint8_t[]> data;
+            size_t size;
+        };
+
+        std::vector<Block> blocks_;
+        size_t block_size_;
+        size_t current_;
+        size_t used_;
+    }; // class watson::Unzip_arena
+
+    /*!
+     \brief Decompress a \c k_zip Ngrdnt, one child at a time.
+
+     When the compressed child is a container, every element is passed
+     to the visitor as soon as it has been decompressed, and only the
+     element currently spanning frames is buffered. Any other child is
+     passed to the visitor as a whole.
+
+     \param raw The \c k_zip Ngrdnt.
+     \param visitor Receives the Ngrdnts.
+     \return The number of Ngrdnts visited.
+     \since 0.2
+     */
+    uint64_t unzip_each(const Ngrdnt::Ptr& raw, const Ngrdnt_visitor& visitor);
+
+    /*!
+     \brief Decompress the next \c k_zip Ngrdnt from an input stream,
+     one child at a time.
+     \param is The stream to read from.
+     \param visitor Receives the Ngrdnts.
+     \return The number of Ngrdnts visited.
+     \sa unzip_each(const Ngrdnt::Ptr&, const Ngrdnt_visitor&)
+     \since 0.2
+     */
+    uint64_t unzip_each(std::istream& is, const Ngrdnt_visitor& visitor);
+}; // namespace watson
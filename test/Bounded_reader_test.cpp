@@ -0,0 +1,220 @@
+/*!
+ \file test/Bounded_reader_test.cpp
+ \brief Test cases for the WatSON memory-bounded reader.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "reader.h"
+#include "watson.h"
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    std::unique_ptr<watson::Ngrdnt_source> source(std::istringstream& iss)
+    {
+        return std::unique_ptr<watson::Ngrdnt_source>(new watson::Streambuf_source(iss.rdbuf(), 1000));
+    }
+}; // namespace (anonymous)
+
+void test_Bounded_reader_elements()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(200, 300, 70000));
+    std::istringstream iss(serialize(expected));
+    watson::Bounded_reader reader(source(iss));
+
+    std::vector<watson::Ngrdnt::Ptr> kept;
+    watson::Ngrdnt::Ptr val;
+    while (watson::Read_result::k_end != reader.next(val))
+    {
+        kept.push_back(val);
+    }
+    val.reset();
+    TEST_ASSERT(kept.size() == expected.size());
+    for (size_t h = 0; h < kept.size(); ++h)
+    {
+        TEST_ASSERT(bytes_of(kept[h]) == bytes_of(expected[h]));
+    }
+
+    // Memory is given back as the Ngrdnts go away.
+    TEST_ASSERT(reader.in_flight() == iss.str().size());
+    kept.clear();
+    TEST_ASSERT(reader.in_flight() == 0);
+}
+
+void test_Bounded_reader_large()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(200, 300, 70000));
+    std::istringstream iss(serialize(expected));
+    watson::Reader_limits limits;
+    limits.chunk_size = 1024;
+    watson::Bounded_reader reader(source(iss), limits);
+
+    size_t h = 0;
+    size_t pieces = 0;
+    watson::Ngrdnt::Ptr val;
+    for (watson::Read_result r; watson::Read_result::k_end != (r = reader.next(val)); ++h)
+    {
+        if (watson::Read_result::k_element == r)
+        {
+            TEST_ASSERT(bytes_of(val) == bytes_of(expected[h]));
+            continue;
+        }
+
+        TEST_ASSERT(watson::Read_result::k_large == r);
+        TEST_ASSERT(reader.element_size() == expected[h]->size());
+        std::string whole;
+        const uint8_t* d;
+        while (size_t n = reader.next_piece(&d))
+        {
+            TEST_ASSERT(n <= 1000);
+            whole.append(reinterpret_cast<const char*>(d), n);
+            ++pieces;
+        }
+        TEST_ASSERT(whole == bytes_of(expected[h]));
+    }
+    TEST_ASSERT(h == expected.size());
+    TEST_ASSERT(pieces > 70);
+
+    // Pieces that are not read are skipped.
+    std::istringstream again(serialize(expected));
+    watson::Bounded_reader skipping(source(again), limits);
+    h = 0;
+    while (watson::Read_result::k_end != skipping.next(val))
+    {
+        ++h;
+    }
+    TEST_ASSERT(h == expected.size());
+}
+
+void test_Bounded_reader_limit()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(200, 300, 70000));
+    std::istringstream iss(serialize(expected));
+    watson::Reader_limits limits;
+    limits.max_element_size = 65536;
+    watson::Bounded_reader reader(source(iss), limits);
+    watson::Ngrdnt::Ptr val;
+    try
+    {
+        while (watson::Read_result::k_end != reader.next(val))
+        {
+        }
+        TEST_FAILED("An Ngrdnt larger than the limit was read.");
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+
+    // A hostile size is refused before anything is allocated.
+    const uint8_t hostile[] = { 0xca, 0, 0, 0, 0, 0, 1, 0, 0, 'x' };
+    std::istringstream his(std::string(reinterpret_cast<const char*>(hostile), sizeof(hostile)));
+    watson::Bounded_reader guarded(source(his));
+    try
+    {
+        guarded.next(val);
+        TEST_FAILED("A hostile size was accepted.");
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+    TEST_ASSERT(guarded.in_flight() == 0);
+}
+
+void test_Bounded_reader_budget()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(200, 300, 70000));
+    std::istringstream iss(serialize(expected));
+    watson::Reader_limits limits;
+    limits.budget = 1024;
+    limits.chunk_size = 1024;
+    limits.wait = false;
+    watson::Bounded_reader reader(source(iss), limits);
+
+    // Holding on to everything runs out of budget.
+    std::vector<watson::Ngrdnt::Ptr> kept;
+    watson::Ngrdnt::Ptr val;
+    watson::Read_result r;
+    while (watson::Read_result::k_element == (r = reader.next(val)))
+    {
+        kept.push_back(val);
+    }
+    val.reset();
+    TEST_ASSERT(watson::Read_result::k_busy == r);
+    TEST_ASSERT(reader.in_flight() <= limits.budget);
+    const size_t first = kept.size();
+
+    // Letting go makes room again, for the same Ngrdnt.
+    kept.clear();
+    TEST_ASSERT(watson::Read_result::k_element == reader.next(val));
+    TEST_ASSERT(bytes_of(val) == bytes_of(expected[first]));
+
+    // A waiting reader is woken up by another thread letting go.
+    std::istringstream again(serialize(expected));
+    limits.wait = true;
+    watson::Bounded_reader waiting(source(again), limits);
+    std::vector<watson::Ngrdnt::Ptr> held;
+    while (waiting.in_flight() + 300 < limits.budget)
+    {
+        TEST_ASSERT(watson::Read_result::k_element == waiting.next(val));
+        held.push_back(val);
+    }
+    val.reset();
+    std::thread release([&held]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        held.clear();
+    });
+    size_t h = held.size();
+    while (watson::Read_result::k_end != waiting.next(val))
+    {
+        ++h;
+    }
+    release.join();
+    TEST_ASSERT(h == expected.size());
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Bounded_reader_elements),
+    PREPARE_TEST(test_Bounded_reader_large),
+    PREPARE_TEST(test_Bounded_reader_limit),
+    PREPARE_TEST(test_Bounded_reader_budget),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Bounded_reader", tests);
+}
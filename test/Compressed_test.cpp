@@ -34,6 +34,7 @@
 
 #include "testhelper.h"
 #include "watson.h"
+#include <cstring>
 
 const uint8_t test_container[] = {
         'C',
@@ -164,6 +165,22 @@ void test_Compressed_read_write()
     // TODO Actually test reading and writing to an IO stream.
 }
 
+void test_Compressed_repeated_writes()
+{
+    // Alternate between large and small children to exercise buffer reuse.
+    const size_t sizes[] = { 100000, 10, 5000, 300000, 64, 70000 };
+    for (auto sz : sizes)
+    {
+        const watson::Ngrdnt::Ptr expected(watson::new_ngrdnt(std::string(sz, 'w')));
+        const watson::Ngrdnt::Ptr i(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+        watson::Compressed b(i);
+
+        TEST_ASSERT(b->size() == expected->size());
+        TEST_ASSERT(memcmp(b->data(), expected->data(), expected->size()) == 0);
+        TEST_ASSERT(i->size() < expected->size() || sz < 64);
+    }
+}
+
 const Test_entry tests[] = {
     PREPARE_TEST(test_Compressed_default_ctr),
     PREPARE_TEST(test_Compressed_copy_ctr),
@@ -171,6 +188,7 @@ const Test_entry tests[] = {
     PREPARE_TEST(test_Compressed_move_semantics),
     PREPARE_TEST(test_Compressed_adoption_ctr),
     PREPARE_TEST(test_Compressed_read_write),
+    PREPARE_TEST(test_Compressed_repeated_writes),
     {0, ""}
 };
 
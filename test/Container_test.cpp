@@ -154,12 +154,49 @@ void test_Container_adoption_ctr()
     }
 }
 
+void test_Container_view()
+{
+    watson::Ngrdnt::Ptr raw(watson::Ngrdnt::clone(test_container));
+    const watson::Container obj(watson::Container::view(raw));
+    verify_object(obj);
+
+    // The children point into the original, and keep it alive.
+    TEST_ASSERT(obj[0]->data() == raw->data() + 2);
+    TEST_ASSERT(obj[0]->parent() == raw);
+    const uint8_t* data = raw->data();
+    raw.reset();
+    TEST_ASSERT(obj[6]->data() == data + test_container[1] - 6);
+    verify_object(obj);
+}
+
+void test_Container_view_malformed()
+{
+    const std::vector<std::vector<uint8_t>> malformed = {
+        {0x43, 4, 0x73, 0x00},  // A child smaller than its header.
+        {0x43, 4, 0x73, 0x09},  // A child running past the end.
+        {0x43, 3, 0xB3},        // A child header cut off by the end.
+    };
+    for (const std::vector<uint8_t>& bytes : malformed)
+    {
+        try
+        {
+            watson::Container::view(watson::Ngrdnt::clone(bytes.data()));
+            TEST_FAILED("A malformed container was accepted.");
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+}
+
 const Test_entry tests[] = {
     PREPARE_TEST(test_Container_default_ctr),
     PREPARE_TEST(test_Container_copy_ctr),
     PREPARE_TEST(test_Container_ingredient_ctr),
     PREPARE_TEST(test_Container_move_semantics),
     PREPARE_TEST(test_Container_adoption_ctr),
+    PREPARE_TEST(test_Container_view),
+    PREPARE_TEST(test_Container_view_malformed),
     {0, ""}
 };
 
@@ -0,0 +1,144 @@
+/*!
+ \file test/Json_emitter_test.cpp
+ \brief WatSON Json_emitter tests.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "testhelper.h"
+#include "json.h"
+#include "watson.h"
+#include "zip.h"
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+void test_Json_emitter_scalars()
+{
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt()) == "null");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(true)) == "true");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(false)) == "false");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(int32_t(-42))) == "-42");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(std::numeric_limits<int64_t>::min())) == "-9223372036854775808");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(std::numeric_limits<uint64_t>::max())) == "18446744073709551615");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(-1.5)) == "-1.5");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(3.0)) == "3.0");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(0.1)) == "0.1");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(1e300)) == "1e+300");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(std::numeric_limits<double>::infinity())) == "null");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt("a\"b\\c\n\x01\xc3\xa9")) == "\"a\\\"b\\\\c\\n\\u0001\xc3\xa9\"");
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(std::vector<bool>{true, false, true})) ==
+            "[true,false,true,false,false,false,false,false]");
+
+    const uint8_t raw[] = {'f', 'o', 'o', 'b'};
+    std::unique_ptr<uint8_t[]> data(new uint8_t[sizeof(uint32_t) + sizeof(raw)]);
+    memset(data.get(), 0, sizeof(uint32_t));
+    memcpy(data.get() + sizeof(uint32_t), raw, sizeof(raw));
+    const watson::Bytes b(std::move(data), sizeof(uint32_t) + sizeof(raw));
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(b)) == "\"Zm9vYg==\"");
+}
+
+void test_Json_emitter_nested()
+{
+    watson::Json_transcoder t;
+    const std::string json("{\"a\":1,\"b\":[true,\"x\",{}],\"c\":{\"a\":null}}");
+    const watson::Ngrdnt::Ptr val = t.transcode(json);
+    TEST_ASSERT(watson::to_json(val, t.glossary()) == json);
+
+    // Keys without a name keep their number.
+    TEST_ASSERT(watson::to_json(val) == "{\"0\":1,\"1\":[true,\"x\",{}],\"2\":{\"0\":null}}");
+
+    // Compressed children are written as what they hold.
+    watson::Container c;
+    c.mutable_children().push_back(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(val))));
+    c.mutable_children().push_back(watson::new_framed_ngrdnt(watson::Compressed(watson::new_ngrdnt("z"))));
+    TEST_ASSERT(watson::to_json(watson::new_ngrdnt(c), t.glossary()) == "[" + json + ",\"z\"]");
+
+    // A library is a list of names.
+    TEST_ASSERT(watson::to_json(t.library()) == "[\"a\",\"b\",\"c\"]");
+}
+
+void test_Json_emitter_stream()
+{
+    watson::Container big;
+    std::string expected("[");
+    for (int h = 0; h < 5000; ++h)
+    {
+        const std::string text(h % 300, 'a' + h % 26);
+        expected += (h ? ",\"" : "\"") + text + "\"";
+        big.mutable_children().push_back(watson::new_ngrdnt(text));
+    }
+    expected += "]";
+
+    watson::Json_emitter emitter;
+    std::ostringstream oss;
+    emitter.emit(watson::new_ngrdnt(big), oss);
+    TEST_ASSERT(oss.str() == expected);
+
+    // Appending keeps what was there.
+    std::string out("x");
+    emitter.emit(watson::new_ngrdnt(int32_t(7)), out);
+    TEST_ASSERT(out == "x7");
+}
+
+void test_Json_emitter_invalid()
+{
+    // A container claiming a child longer than itself.
+    const uint8_t bad[] = {watson::type_marker(watson::Size_type::k_one, watson::Ngrdnt_type::k_container), 4,
+            watson::type_marker(watson::Size_type::k_one, watson::Ngrdnt_type::k_string), 9};
+    watson::Json_emitter emitter;
+    std::string out("x");
+    try
+    {
+        emitter.emit(bad, out);
+        TEST_FAILED("A malformed container was written.");
+    }
+    catch (const std::runtime_error& ex)
+    {
+        TEST_ASSERT(out == "x");
+    }
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Json_emitter_scalars),
+    PREPARE_TEST(test_Json_emitter_nested),
+    PREPARE_TEST(test_Json_emitter_stream),
+    PREPARE_TEST(test_Json_emitter_invalid),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Json_emitter", tests);
+}
@@ -0,0 +1,185 @@
+/*!
+ \file test/Json_transcoder_test.cpp
+ \brief WatSON Json_transcoder tests.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "testhelper.h"
+#include "json.h"
+#include "watson.h"
+#include <clocale>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    bool rejects(const std::string& json)
+    {
+        return transcoder_rejects<watson::Json_transcoder>(json);
+    }
+}; // namespace (anonymous)
+
+void test_Json_transcoder_scalars()
+{
+    watson::Json_transcoder t;
+    TEST_ASSERT(same_bytes(t.transcode("42"), watson::new_ngrdnt(int32_t(42))));
+    TEST_ASSERT(same_bytes(t.transcode("-2147483648"), watson::new_ngrdnt(std::numeric_limits<int32_t>::min())));
+    TEST_ASSERT(same_bytes(t.transcode("2147483648"), watson::new_ngrdnt(int64_t(2147483648ll))));
+    TEST_ASSERT(same_bytes(t.transcode("-5000000000"), watson::new_ngrdnt(int64_t(-5000000000ll))));
+    TEST_ASSERT(same_bytes(t.transcode("-9223372036854775808"), watson::new_ngrdnt(std::numeric_limits<int64_t>::min())));
+    TEST_ASSERT(same_bytes(t.transcode("18446744073709551615"), watson::new_ngrdnt(std::numeric_limits<uint64_t>::max())));
+    TEST_ASSERT(same_bytes(t.transcode("18446744073709551616"), watson::new_ngrdnt(18446744073709551616.0)));
+    TEST_ASSERT(same_bytes(t.transcode("-1.5"), watson::new_ngrdnt(-1.5)));
+    TEST_ASSERT(same_bytes(t.transcode("25e-2"), watson::new_ngrdnt(0.25)));
+    TEST_ASSERT(same_bytes(t.transcode(" true "), watson::new_ngrdnt(true)));
+    TEST_ASSERT(same_bytes(t.transcode("false"), watson::new_ngrdnt(false)));
+    TEST_ASSERT(same_bytes(t.transcode("null"), watson::new_ngrdnt()));
+    TEST_ASSERT(same_bytes(t.transcode("\"plain\""), watson::new_ngrdnt("plain")));
+    TEST_ASSERT(same_bytes(t.transcode("\"a\\n\\\"\\u00e9\\ud83d\\ude00\""),
+            watson::new_ngrdnt("a\n\"\xc3\xa9\xf0\x9f\x98\x80")));
+}
+
+void test_Json_transcoder_locale()
+{
+    // The decimal point is '.' whatever LC_NUMERIC says.
+    const std::string previous(setlocale(LC_NUMERIC, nullptr));
+    const char* const comma_locales[] = {"de_DE.UTF-8", "de_DE", "fr_FR.UTF-8", "fr_FR", nullptr};
+    for (const char* const* name = comma_locales; *name && !setlocale(LC_NUMERIC, *name); ++name)
+    {
+    }
+
+    watson::Json_transcoder t;
+    TEST_ASSERT(same_bytes(t.transcode("1.7976931348623157e308"),
+            watson::new_ngrdnt(std::numeric_limits<double>::max())));
+    TEST_ASSERT(same_bytes(t.transcode("123456789012345678901.5"), watson::new_ngrdnt(123456789012345678901.5)));
+    TEST_ASSERT(same_bytes(t.transcode("4.9e-324"), watson::new_ngrdnt(std::numeric_limits<double>::denorm_min())));
+    setlocale(LC_NUMERIC, previous.c_str());
+}
+
+void test_Json_transcoder_nested()
+{
+    watson::Json_transcoder t;
+    const watson::Ngrdnt::Ptr val = t.transcode("{\"a\": 1, \"b\": [true, \"x\"], \"c\": {}}");
+
+    watson::Map expected;
+    expected.mutable_children()[0] = watson::new_ngrdnt(int32_t(1));
+    watson::Container b;
+    b.mutable_children().push_back(watson::new_ngrdnt(true));
+    b.mutable_children().push_back(watson::new_ngrdnt("x"));
+    expected.mutable_children()[1] = watson::new_ngrdnt(b);
+    expected.mutable_children()[2] = watson::new_ngrdnt(watson::Map());
+    TEST_ASSERT(same_bytes(val, watson::new_ngrdnt(expected)));
+
+    TEST_ASSERT(t.glossary().names.size() == 3);
+    TEST_ASSERT(t.glossary().names[1] == "b");
+
+    // Large enough for every size of header.
+    watson::Container big;
+    std::string json("[");
+    for (int h = 0; h < 300; ++h)
+    {
+        const std::string text(h, 'a' + h % 26);
+        json += (h ? ",\"" : "\"") + text + "\"";
+        big.mutable_children().push_back(watson::new_ngrdnt(text));
+    }
+    json += "]";
+    TEST_ASSERT(same_bytes(t.transcode(json), watson::new_ngrdnt(big)));
+    TEST_ASSERT(same_bytes(t.transcode("[" + json + ", []]"),
+            watson::new_ngrdnt(watson::Container({watson::new_ngrdnt(big), watson::new_ngrdnt(watson::Container())}))));
+}
+
+void test_Json_transcoder_stream()
+{
+    watson::Glossary known;
+    known.names.push_back("z");
+    known.index["z"] = 0;
+    watson::Json_transcoder t(known);
+
+    const std::string json("{\"a\": 1}\n{\"b\": 2, \"a\": 3, \"z\": 4}\n");
+    std::vector<uint8_t> out;
+    TEST_ASSERT(2 == t.transcode(json.data(), json.size(), out));
+    TEST_ASSERT(t.glossary().names.size() == 3);
+
+    // A recipe carries the keys along with the values.
+    watson::Container recipe;
+    recipe.mutable_children().push_back(t.library());
+    recipe.mutable_children().push_back(watson::Ngrdnt::clone(out.data()));
+    recipe.mutable_children().push_back(watson::Ngrdnt::clone(out.data() + watson::ngrdnt_size(out.data())));
+    const watson::Recipe r(watson::new_ngrdnt(recipe));
+    TEST_ASSERT(1 == watson::to_int32(r.ngrdnt({1, r.glossary().index.at("a")})));
+    TEST_ASSERT(2 == watson::to_int32(r.ngrdnt({2, r.glossary().index.at("b")})));
+    TEST_ASSERT(3 == watson::to_int32(r.ngrdnt({2, r.glossary().index.at("a")})));
+    TEST_ASSERT(4 == watson::to_int32(r.ngrdnt({2, 0})));
+}
+
+void test_Json_transcoder_invalid()
+{
+    TEST_ASSERT(rejects("{\"a\" 1}"));
+    TEST_ASSERT(rejects("{\"a\": 1,}"));
+    TEST_ASSERT(rejects("[1, 2"));
+    TEST_ASSERT(rejects("[1 2]"));
+    TEST_ASSERT(rejects("01"));
+    TEST_ASSERT(rejects("1."));
+    TEST_ASSERT(rejects("-"));
+    TEST_ASSERT(rejects("tru"));
+    TEST_ASSERT(rejects("\"abc"));
+    TEST_ASSERT(rejects("\"a\\qb\""));
+    TEST_ASSERT(rejects("\"a\nb\""));
+    TEST_ASSERT(rejects("[1] x"));
+    TEST_ASSERT(rejects(std::string(watson::k_json_max_depth + 1, '[')));
+
+    watson::Json_transcoder t;
+    try
+    {
+        t.transcode("1 2");
+        TEST_FAILED("Two values were taken as one.");
+    }
+    catch (const std::runtime_error& ex)
+    {
+    }
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Json_transcoder_scalars),
+    PREPARE_TEST(test_Json_transcoder_locale),
+    PREPARE_TEST(test_Json_transcoder_nested),
+    PREPARE_TEST(test_Json_transcoder_stream),
+    PREPARE_TEST(test_Json_transcoder_invalid),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Json_transcoder", tests);
+}
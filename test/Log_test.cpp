@@ -0,0 +1,329 @@
+/*!
+ \file test/Log_test.cpp
+ \brief Test cases for the WatSON record logs.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "log.h"
+#include "watson.h"
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    //! A fresh log path, removed along with its index when done.
+    class Temp_log
+    {
+    public:
+        Temp_log()
+        {
+            char path[] = "/tmp/watson_log_XXXXXX";
+            const int fd = mkstemp(path);
+            close(fd);
+            path_ = path;
+        }
+        ~Temp_log()
+        {
+            unlink(path_.c_str());
+            unlink((path_ + ".idx").c_str());
+        }
+        const std::string& path() const { return path_; }
+    private:
+        std::string path_;
+    };
+
+    watson::Ngrdnt::Ptr record(const uint32_t h)
+    {
+        return watson::new_ngrdnt(std::string(h % 37, 'a' + h % 26) + std::to_string(h));
+    }
+}; // namespace (anonymous)
+
+void test_Log_append_read()
+{
+    Temp_log log;
+    {
+        watson::Log_writer writer(log.path(), 16);
+        for (uint32_t h = 0; h < 1000; ++h)
+        {
+            TEST_ASSERT(writer.append(record(h)) == h);
+        }
+        TEST_ASSERT(writer.size() == 1000);
+    }
+
+    watson::Log_reader reader(log.path(), 100);
+    TEST_ASSERT(reader.size() == 1000);
+    for (uint32_t h = 0; h < 1000; ++h)
+    {
+        TEST_ASSERT(reader.position() == h);
+        TEST_ASSERT(same_bytes(reader.next(), record(h)));
+    }
+    TEST_ASSERT(reader.next() == nullptr);
+}
+
+void test_Log_seek()
+{
+    Temp_log log;
+    std::vector<uint64_t> offsets;
+    {
+        watson::Log_writer writer(log.path(), 16);
+        for (uint32_t h = 0; h < 1000; ++h)
+        {
+            offsets.push_back(writer.offset());
+            writer.append(record(h));
+        }
+    }
+
+    watson::Log_reader reader(log.path());
+    TEST_ASSERT(reader.seek(517));
+    TEST_ASSERT(reader.offset() == offsets[517]);
+    TEST_ASSERT(same_bytes(reader.next(), record(517)));
+    TEST_ASSERT(reader.seek(3));
+    TEST_ASSERT(same_bytes(reader.next(), record(3)));
+    TEST_ASSERT(reader.seek(1000));
+    TEST_ASSERT(reader.next() == nullptr);
+    TEST_ASSERT(!reader.seek(1001));
+
+    TEST_ASSERT(same_bytes(reader.at(999)->data(), record(999)));
+    TEST_ASSERT(same_bytes(reader.at(0)->data(), record(0)));
+    TEST_ASSERT(reader.at(1000) == watson::k_not_found);
+
+    // Offsets inside a record move to the one after it.
+    TEST_ASSERT(reader.seek_offset(offsets[200]) == 200);
+    TEST_ASSERT(reader.seek_offset(offsets[200] + 1) == 201);
+    TEST_ASSERT(same_bytes(reader.next(), record(201)));
+    TEST_ASSERT(reader.seek_offset(0) == 0);
+    TEST_ASSERT(reader.seek_offset(1 << 30) == 1000);
+}
+
+void test_Log_recover()
+{
+    Temp_log log;
+    uint64_t good_size;
+    {
+        watson::Log_writer writer(log.path(), 16);
+        for (uint32_t h = 0; h < 100; ++h)
+        {
+            writer.append(record(h));
+        }
+        good_size = writer.offset();
+        writer.append(record(100));
+    }
+
+    // A crash in the middle of the last record, and of the index.
+    TEST_ASSERT(0 == truncate(log.path().c_str(), good_size + 3));
+    TEST_ASSERT(0 == truncate((log.path() + ".idx").c_str(), 8 + 8 * 3 + 5));
+
+    {
+        watson::Log_reader reader(log.path());
+        TEST_ASSERT(reader.size() == 100);
+        TEST_ASSERT(same_bytes(reader.at(99)->data(), record(99)));
+    }
+
+    {
+        watson::Log_writer writer(log.path(), 64);
+        TEST_ASSERT(writer.size() == 100);
+        TEST_ASSERT(writer.offset() == good_size);
+        TEST_ASSERT(writer.append(record(100)) == 100);
+        TEST_ASSERT(writer.append(record(101)) == 101);
+        writer.sync();
+    }
+
+    // The interval of the existing index is kept.
+    watson::Log_reader reader(log.path());
+    TEST_ASSERT(reader.size() == 102);
+    for (uint32_t h = 0; h < 102; ++h)
+    {
+        TEST_ASSERT(same_bytes(reader.next(), record(h)));
+    }
+    TEST_ASSERT(reader.seek(50));
+    TEST_ASSERT(same_bytes(reader.next(), record(50)));
+}
+
+void test_Log_missing_index()
+{
+    Temp_log log;
+    {
+        watson::Log_writer writer(log.path(), 8);
+        for (uint32_t h = 0; h < 3000; ++h)
+        {
+            writer.append(record(h));
+        }
+    }
+    TEST_ASSERT(0 == unlink((log.path() + ".idx").c_str()));
+
+    watson::Log_reader reader(log.path());
+    TEST_ASSERT(reader.size() == 3000);
+    TEST_ASSERT(same_bytes(reader.at(2500)->data(), record(2500)));
+    TEST_ASSERT(same_bytes(reader.at(1024)->data(), record(1024)));
+}
+
+void test_Log_refresh()
+{
+    Temp_log log;
+    watson::Log_writer writer(log.path(), 4);
+    for (uint32_t h = 0; h < 10; ++h)
+    {
+        writer.append(record(h));
+    }
+    writer.flush();
+
+    watson::Log_reader reader(log.path());
+    TEST_ASSERT(reader.size() == 10);
+    while (reader.next())
+    {
+    }
+
+    // Half a record is not visible yet.
+    for (uint32_t h = 10; h < 20; ++h)
+    {
+        writer.append(record(h));
+    }
+    writer.flush();
+    const watson::Ngrdnt::Ptr last(record(20));
+    const int fd = open(log.path().c_str(), O_WRONLY | O_APPEND);
+    TEST_ASSERT(3 == write(fd, last->data(), 3));
+    close(fd);
+
+    reader.refresh();
+    TEST_ASSERT(reader.size() == 20);
+    TEST_ASSERT(reader.position() == 10);
+    for (uint32_t h = 10; h < 20; ++h)
+    {
+        TEST_ASSERT(same_bytes(reader.next(), record(h)));
+    }
+    TEST_ASSERT(reader.next() == nullptr);
+    TEST_ASSERT(same_bytes(reader.at(13)->data(), record(13)));
+}
+
+void test_Group_writer_threads()
+{
+    Temp_log log;
+    std::vector<std::vector<std::future<uint64_t>>> futures(8);
+    uint64_t batches;
+    {
+        watson::Group_writer writer(log.path(), std::chrono::microseconds(500));
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < futures.size(); ++t)
+        {
+            threads.emplace_back([&writer, &futures, t]() {
+                for (uint32_t h = 0; h < 250; ++h)
+                {
+                    futures[t].push_back(writer.append(record(t * 1000 + h)));
+                }
+            });
+        }
+        for (std::thread& t : threads)
+        {
+            t.join();
+        }
+        writer.sync();
+        batches = writer.batches();
+    }
+
+    // Every record got its own number, and was grouped with others.
+    watson::Log_reader reader(log.path());
+    TEST_ASSERT(reader.size() == 2000);
+    TEST_ASSERT(batches < 2000);
+    std::set<uint64_t> seen;
+    for (uint32_t t = 0; t < futures.size(); ++t)
+    {
+        uint64_t last = 0;
+        for (uint32_t h = 0; h < futures[t].size(); ++h)
+        {
+            const uint64_t n = futures[t][h].get();
+            TEST_ASSERT(seen.insert(n).second);
+            TEST_ASSERT(0 == h || n > last);
+            TEST_ASSERT(same_bytes(reader.at(n)->data(), record(t * 1000 + h)));
+            last = n;
+        }
+    }
+}
+
+void test_Group_writer_callback()
+{
+    Temp_log log;
+    std::mutex mutex;
+    std::vector<uint64_t> done;
+    {
+        watson::Group_writer writer(log.path(), std::chrono::seconds(10), 512);
+        for (uint32_t h = 0; h < 100; ++h)
+        {
+            writer.append(record(h), [&mutex, &done](uint64_t n, std::exception_ptr error) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.push_back(error ? ~0ull : n);
+            });
+        }
+
+        // The size limit commits without waiting out the delay.
+        for (int wait = 0; wait < 200 && 0 == writer.batches(); ++wait)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        TEST_ASSERT(writer.batches() > 0);
+        writer.sync();
+        TEST_ASSERT(done.size() == 100);
+        for (uint32_t h = 0; h < 100; ++h)
+        {
+            TEST_ASSERT(done[h] == h);
+        }
+
+        // Destruction commits what is left.
+        writer.append(record(100), [&done](uint64_t n, std::exception_ptr) { done.push_back(n); });
+    }
+    TEST_ASSERT(done.size() == 101);
+
+    watson::Log_reader reader(log.path());
+    TEST_ASSERT(reader.size() == 101);
+    TEST_ASSERT(same_bytes(reader.at(100)->data(), record(100)));
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Log_append_read),
+    PREPARE_TEST(test_Log_seek),
+    PREPARE_TEST(test_Log_recover),
+    PREPARE_TEST(test_Log_missing_index),
+    PREPARE_TEST(test_Log_refresh),
+    PREPARE_TEST(test_Group_writer_threads),
+    PREPARE_TEST(test_Group_writer_callback),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Log", tests);
+}
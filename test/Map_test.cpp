@@ -141,12 +141,53 @@ void test_Map_adoption_ctr()
     }
 }
 
+void test_Map_view()
+{
+    watson::Ngrdnt::Ptr raw(watson::Ngrdnt::clone(test_map));
+    const watson::Map m(watson::Map::view(raw));
+    raw.reset();
+
+    TEST_ASSERT(m.size() == 4);
+    TEST_ASSERT(watson::is_null(m[0]));
+    TEST_ASSERT(watson::to_bool(m[1]));
+    TEST_ASSERT(!watson::to_bool(m[2]));
+    TEST_ASSERT(watson::to_string(m[3]).compare(expected_string) == 0);
+
+    // The children point into the original.
+    TEST_ASSERT(m[0]->parent());
+    TEST_ASSERT(m[0]->data() == m[0]->parent()->data() + 6);
+}
+
+void test_Map_view_malformed()
+{
+    const std::vector<std::vector<uint8_t>> malformed = {
+        {0x4D, 4, 1, 0},                    // A key cut off by the end.
+        {0x4D, 6, 1, 0, 0, 0},              // A key without a value.
+        {0x4D, 7, 1, 0, 0, 0, 0x73},        // A value header cut off by the end.
+        {0x4D, 8, 1, 0, 0, 0, 0x73, 0x00},  // A value smaller than its header.
+        {0x4D, 8, 1, 0, 0, 0, 0x73, 0x09},  // A value running past the end.
+    };
+    for (const std::vector<uint8_t>& bytes : malformed)
+    {
+        try
+        {
+            watson::Map::view(watson::Ngrdnt::clone(bytes.data()));
+            TEST_FAILED("A malformed map was accepted.");
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+}
+
 const Test_entry tests[] = {
     PREPARE_TEST(test_Map_default_ctr),
     PREPARE_TEST(test_Map_copy_ctr),
     PREPARE_TEST(test_Map_ingredient_ctr),
     PREPARE_TEST(test_Map_move_semantics),
     PREPARE_TEST(test_Map_adoption_ctr),
+    PREPARE_TEST(test_Map_view),
+    PREPARE_TEST(test_Map_view_malformed),
     {0, ""}
 };
 
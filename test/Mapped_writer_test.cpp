@@ -0,0 +1,176 @@
+/*!
+ \file test/Mapped_writer_test.cpp
+ \brief Test cases for the WatSON memory-mapped writer.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "reader.h"
+#include "watson.h"
+#include "writer.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    std::string temp_path()
+    {
+        char path[] = "/tmp/watson_mapped_XXXXXX";
+        close(mkstemp(path));
+        return path;
+    }
+
+    std::string file_contents(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream oss;
+        oss << in.rdbuf();
+        return oss.str();
+    }
+}; // namespace (anonymous)
+
+void test_Mapped_writer_write()
+{
+    const std::string path(temp_path());
+    const watson::Container c(mixed_container(300, 500));
+    watson::Map m;
+    m.mutable_children()[3] = watson::new_ngrdnt(std::string(9000, 'm'));
+    m.mutable_children()[4] = watson::new_ngrdnt(c);
+
+    // A small window, so the writes cross several of them.
+    {
+        watson::Mapped_writer out(path, 100, 4096);
+        out.write(c);
+        out.write(m);
+        for (const watson::Ngrdnt::Ptr& ing : c.children())
+        {
+            out.write(ing);
+        }
+        uint8_t* d = out.reserve(3);
+        memcpy(d, watson::new_ngrdnt()->data(), 1);
+        out.commit(1);
+        out.close();
+    }
+
+    std::string expected(bytes_of(watson::new_ngrdnt(c)) + bytes_of(watson::new_ngrdnt(m)));
+    for (const watson::Ngrdnt::Ptr& ing : c.children())
+    {
+        expected += bytes_of(ing);
+    }
+    expected += bytes_of(watson::new_ngrdnt());
+    TEST_ASSERT(file_contents(path) == expected);
+    unlink(path.c_str());
+}
+
+void test_Mapped_writer_container()
+{
+    const std::string path(temp_path());
+    const watson::Container c(mixed_container(2000, 500));
+    {
+        watson::Mapped_writer out(path, 0, 4096);
+        out.begin_container();
+        out.write(c.children()[0]);
+        out.begin_container();
+        out.end_container();
+        for (size_t h = 1; h < c.size(); ++h)
+        {
+            out.write(c.children()[h]);
+        }
+        out.end_container();
+        // Destruction closes.
+    }
+
+    // The top level container reads back, with the empty one inside.
+    const watson::Recipe r(watson::Recipe::open_mapped(path));
+    const watson::Container& read = r.container();
+    TEST_ASSERT(read.size() == c.size() + 1);
+    TEST_ASSERT(bytes_of(read[0]) == bytes_of(c.children()[0]));
+    TEST_ASSERT(0 == watson::Container(read[1]).size());
+    for (size_t h = 1; h < c.size(); ++h)
+    {
+        TEST_ASSERT(bytes_of(read[h + 1]) == bytes_of(c.children()[h]));
+    }
+
+    // Cut to size, two 8 byte size headers and the children.
+    uint64_t children = 0;
+    for (const watson::Ngrdnt::Ptr& ing : c.children())
+    {
+        children += ing->size();
+    }
+    struct stat st;
+    TEST_ASSERT(0 == stat(path.c_str(), &st));
+    TEST_ASSERT(static_cast<uint64_t>(st.st_size) == 9 + 9 + children);
+    unlink(path.c_str());
+}
+
+void test_Mapped_writer_unfinished()
+{
+    const std::string path(temp_path());
+    watson::Mapped_writer out(path);
+    out.begin_container();
+    try
+    {
+        out.close();
+        TEST_FAILED("An unfinished container was accepted.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+    out.end_container();
+    out.close();
+    try
+    {
+        out.end_container();
+        TEST_FAILED("A container was finished twice.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+    TEST_ASSERT(9 == file_contents(path).size());
+    unlink(path.c_str());
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Mapped_writer_write),
+    PREPARE_TEST(test_Mapped_writer_container),
+    PREPARE_TEST(test_Mapped_writer_unfinished),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Mapped_writer", tests);
+}
@@ -0,0 +1,191 @@
+/*!
+ \file test/Msgpack_test.cpp
+ \brief WatSON MessagePack tests.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "testhelper.h"
+#include "msgpack.h"
+#include "watson.h"
+#include "zip.h"
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    bool rejects(const std::vector<uint8_t>& packed)
+    {
+        return transcoder_rejects<watson::Msgpack_transcoder>(packed);
+    }
+}; // namespace (anonymous)
+
+void test_Msgpack_transcoder_scalars()
+{
+    watson::Msgpack_transcoder t;
+    TEST_ASSERT(same_bytes(t.transcode({0xC0}), watson::new_ngrdnt()));
+    TEST_ASSERT(same_bytes(t.transcode({0xC3}), watson::new_ngrdnt(true)));
+    TEST_ASSERT(same_bytes(t.transcode({0xC2}), watson::new_ngrdnt(false)));
+    TEST_ASSERT(same_bytes(t.transcode({0x2A}), watson::new_ngrdnt(int32_t(42))));
+    TEST_ASSERT(same_bytes(t.transcode({0xFF}), watson::new_ngrdnt(int32_t(-1))));
+    TEST_ASSERT(same_bytes(t.transcode({0xD0, 0x80}), watson::new_ngrdnt(int32_t(-128))));
+    TEST_ASSERT(same_bytes(t.transcode({0xD1, 0xFF, 0x7F}), watson::new_ngrdnt(int32_t(-129))));
+    TEST_ASSERT(same_bytes(t.transcode({0xCE, 0x80, 0x00, 0x00, 0x00}), watson::new_ngrdnt(int64_t(2147483648ll))));
+    TEST_ASSERT(same_bytes(t.transcode({0xD3, 0x80, 0, 0, 0, 0, 0, 0, 0}),
+            watson::new_ngrdnt(std::numeric_limits<int64_t>::min())));
+    TEST_ASSERT(same_bytes(t.transcode({0xCF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}),
+            watson::new_ngrdnt(std::numeric_limits<uint64_t>::max())));
+    TEST_ASSERT(same_bytes(t.transcode({0xCA, 0x3F, 0xC0, 0x00, 0x00}), watson::new_ngrdnt(1.5)));
+    TEST_ASSERT(same_bytes(t.transcode({0xCB, 0xBF, 0xF8, 0, 0, 0, 0, 0, 0}), watson::new_ngrdnt(-1.5)));
+    TEST_ASSERT(same_bytes(t.transcode({0xA3, 'a', 'b', 'c'}), watson::new_ngrdnt("abc")));
+    TEST_ASSERT(same_bytes(t.transcode({0xD9, 0x01, 'x'}), watson::new_ngrdnt("x")));
+
+    const watson::Bytes b(watson::Ngrdnt::clone(t.transcode({0xC4, 0x02, 0x01, 0x02})));
+    TEST_ASSERT(0 == b.marshal_hint());
+    TEST_ASSERT(2 == b.size() && 0x01 == b.data()[0] && 0x02 == b.data()[1]);
+}
+
+void test_Msgpack_transcoder_nested()
+{
+    watson::Msgpack_transcoder t;
+    // {"a": 1, "b": [true, "x"], "c": {}}
+    const watson::Ngrdnt::Ptr val = t.transcode({0x83, 0xA1, 'a', 0x01, 0xA1, 'b', 0x92, 0xC3, 0xA1, 'x', 0xA1, 'c', 0x80});
+
+    watson::Map expected;
+    expected.mutable_children()[0] = watson::new_ngrdnt(int32_t(1));
+    watson::Container b;
+    b.mutable_children().push_back(watson::new_ngrdnt(true));
+    b.mutable_children().push_back(watson::new_ngrdnt("x"));
+    expected.mutable_children()[1] = watson::new_ngrdnt(b);
+    expected.mutable_children()[2] = watson::new_ngrdnt(watson::Map());
+    TEST_ASSERT(same_bytes(val, watson::new_ngrdnt(expected)));
+    TEST_ASSERT(t.glossary().names.size() == 3);
+    TEST_ASSERT(t.glossary().names[1] == "b");
+
+    // A stream of values, sharing the keys.
+    const std::vector<uint8_t> stream = {0x81, 0xA1, 'b', 0x02, 0x81, 0xA1, 'd', 0x03};
+    std::vector<uint8_t> out;
+    TEST_ASSERT(2 == t.transcode(stream.data(), stream.size(), out));
+    TEST_ASSERT(t.glossary().names.size() == 4);
+    const watson::Map first(watson::Ngrdnt::clone(out.data()));
+    TEST_ASSERT(2 == watson::to_int32(first[1]));
+}
+
+void test_Msgpack_round_trip()
+{
+    // Large enough for every size of header on both sides.
+    std::vector<uint8_t> packed = {0xDE, 0x01, 0x2C};
+    for (int h = 0; h < 300; ++h)
+    {
+        const std::string key("k" + std::to_string(h));
+        packed.push_back(0xA0 | key.size());
+        packed.insert(packed.end(), key.begin(), key.end());
+        packed.insert(packed.end(), {0xDC, 0x01, 0x00});
+        for (int j = 0; j < 256; ++j)
+        {
+            packed.insert(packed.end(), {0xCD, 0x01, static_cast<uint8_t>(j)});
+        }
+    }
+    packed.insert(packed.end(), {0x94, 0xD9, 0x20});
+    packed.insert(packed.end(), 32, 'y');
+    packed.insert(packed.end(), {0xC4, 0x01, 0x07, 0xD2, 0x80, 0x00, 0x00, 0x00});
+    packed.insert(packed.end(), {0xCB, 0x40, 0x09, 0x21, 0xFB, 0x54, 0x44, 0x2D, 0x18});
+
+    watson::Msgpack_transcoder t;
+    std::vector<uint8_t> watson_bytes;
+    TEST_ASSERT(2 == t.transcode(packed.data(), packed.size(), watson_bytes));
+
+    watson::Msgpack_emitter emitter(t.glossary());
+    std::vector<uint8_t> again;
+    for (size_t offset = 0; offset < watson_bytes.size(); offset += watson::ngrdnt_size(watson_bytes.data() + offset))
+    {
+        emitter.emit(watson_bytes.data() + offset, again);
+    }
+    TEST_ASSERT(again == packed);
+}
+
+void test_Msgpack_emitter()
+{
+    // Keys without a name are written as integers.
+    watson::Map m;
+    m.mutable_children()[7] = watson::new_ngrdnt(int64_t(-33));
+    watson::Msgpack_emitter emitter;
+    TEST_ASSERT(emitter.emit(watson::new_ngrdnt(m)) == std::vector<uint8_t>({0x81, 0x07, 0xD0, 0xDF}));
+
+    TEST_ASSERT(emitter.emit(watson::new_ngrdnt(std::vector<bool>{true})) ==
+            std::vector<uint8_t>({0x98, 0xC3, 0xC2, 0xC2, 0xC2, 0xC2, 0xC2, 0xC2, 0xC2}));
+
+    // Compressed children are written as what they hold.
+    TEST_ASSERT(emitter.emit(watson::new_ngrdnt(watson::Compressed(watson::new_ngrdnt("z")))) ==
+            std::vector<uint8_t>({0xA1, 'z'}));
+
+    // A container claiming a child longer than itself.
+    const uint8_t bad[] = {watson::type_marker(watson::Size_type::k_one, watson::Ngrdnt_type::k_container), 4,
+            watson::type_marker(watson::Size_type::k_one, watson::Ngrdnt_type::k_string), 9};
+    std::vector<uint8_t> out(1, 0xAA);
+    try
+    {
+        emitter.emit(bad, out);
+        TEST_FAILED("A malformed container was written.");
+    }
+    catch (const std::runtime_error& ex)
+    {
+        TEST_ASSERT(out.size() == 1);
+    }
+}
+
+void test_Msgpack_transcoder_invalid()
+{
+    TEST_ASSERT(rejects({0xC1}));
+    TEST_ASSERT(rejects({0x92, 0x01}));
+    TEST_ASSERT(rejects({0xA3, 'a'}));
+    TEST_ASSERT(rejects({0xCD, 0x01}));
+    TEST_ASSERT(rejects({0x81, 0x01, 0x02}));
+    TEST_ASSERT(rejects({0xD4, 0x01, 0x02}));
+    TEST_ASSERT(rejects(std::vector<uint8_t>(watson::k_msgpack_max_depth + 1, 0x91)));
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Msgpack_transcoder_scalars),
+    PREPARE_TEST(test_Msgpack_transcoder_nested),
+    PREPARE_TEST(test_Msgpack_round_trip),
+    PREPARE_TEST(test_Msgpack_emitter),
+    PREPARE_TEST(test_Msgpack_transcoder_invalid),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Msgpack_transcoder", tests);
+}
@@ -0,0 +1,148 @@
+/*!
+ \file test/Ngrdnt_gather_test.cpp
+ \brief Test cases for the WatSON scatter-gather output.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "gather.h"
+#include "watson.h"
+#include <cstring>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    //! Everything the gather would write, in one string.
+    std::string flatten(const watson::Ngrdnt_gather& gather)
+    {
+        std::string result;
+        for (const iovec& v : gather.iov())
+        {
+            result.append(static_cast<const char*>(v.iov_base), v.iov_len);
+        }
+        return result;
+    }
+}; // namespace (anonymous)
+
+void test_Ngrdnt_gather_container()
+{
+    const watson::Container c(mixed_container(200, 200));
+    watson::Ngrdnt_gather gather;
+    gather.add(c);
+    TEST_ASSERT(flatten(gather) == bytes_of(watson::new_ngrdnt(c)));
+    TEST_ASSERT(gather.size() == watson::new_ngrdnt(c)->size());
+
+    // Large children are referenced where they are.
+    const watson::Ngrdnt::Ptr& large = c.children()[2 * 150];
+    bool found = false;
+    for (const iovec& v : gather.iov())
+    {
+        found |= v.iov_base == large->data();
+    }
+    TEST_ASSERT(large->size() > watson::k_gather_copy_limit);
+    TEST_ASSERT(found);
+
+    // Small children are merged with their neighbours.
+    TEST_ASSERT(gather.iov().size() < c.size());
+
+    gather.clear();
+    TEST_ASSERT(gather.iov().empty());
+    TEST_ASSERT(0 == gather.size());
+    gather.add(watson::new_ngrdnt(watson::Container()));
+    TEST_ASSERT(flatten(gather) == bytes_of(watson::new_ngrdnt(watson::Container())));
+}
+
+void test_Ngrdnt_gather_map()
+{
+    watson::Map m;
+    m.mutable_children()[1] = watson::new_ngrdnt(std::string(1000, 'x'));
+    m.mutable_children()[7] = watson::new_ngrdnt(static_cast<int32_t>(7));
+    m.mutable_children()[9] = watson::new_ngrdnt(mixed_container(10, 200));
+
+    std::unique_ptr<uint8_t[]> data(new uint8_t[5000]);
+    memset(data.get(), 0x5a, 5000);
+    const watson::Bytes b(std::move(data), 5000);
+
+    watson::Ngrdnt_gather gather;
+    gather.add(m);
+    gather.add(b);
+    gather.add(watson::new_ngrdnt());
+    TEST_ASSERT(flatten(gather) ==
+            bytes_of(watson::new_ngrdnt(m)) + bytes_of(watson::new_ngrdnt(b)) + bytes_of(watson::new_ngrdnt()));
+}
+
+void test_Ngrdnt_gather_write()
+{
+    // More buffers than a single writev takes, and more data than the
+    // socket holds, so the writes are split.
+    watson::Container c;
+    for (uint32_t h = 0; h < 3000; ++h)
+    {
+        c.mutable_children().push_back(watson::new_ngrdnt(std::string(100 + h % 900, 'a' + h % 26)));
+    }
+    watson::Ngrdnt_gather gather;
+    gather.add(c);
+    TEST_ASSERT(gather.iov().size() > 2048);
+    const std::string expected(bytes_of(watson::new_ngrdnt(c)));
+
+    int fds[2];
+    TEST_ASSERT(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::string received;
+    std::thread reader([&received, &fds]() {
+        char buffer[4096];
+        ssize_t got;
+        while (0 < (got = read(fds[1], buffer, sizeof(buffer))))
+        {
+            received.append(buffer, got);
+        }
+    });
+    TEST_ASSERT(gather.write(fds[0]) == expected.size());
+    close(fds[0]);
+    reader.join();
+    close(fds[1]);
+    TEST_ASSERT(received == expected);
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Ngrdnt_gather_container),
+    PREPARE_TEST(test_Ngrdnt_gather_map),
+    PREPARE_TEST(test_Ngrdnt_gather_write),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Ngrdnt_gather", tests);
+}
@@ -0,0 +1,144 @@
+/*!
+ \file test/Ngrdnt_parser_test.cpp
+ \brief Test cases for the WatSON push parser.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "reader.h"
+#include "watson.h"
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+void test_Ngrdnt_parser_chunks()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(300, 300, 70000));
+    const std::string bytes(serialize(expected));
+
+    const size_t chunk_sizes[] = { 1, 2, 7, 256, 4093 };
+    for (size_t chunk : chunk_sizes)
+    {
+        watson::Ngrdnt_parser parser;
+        size_t h = 0;
+        for (size_t start = 0; start < bytes.size(); start += chunk)
+        {
+            // A fresh copy each time, as a socket buffer would be reused.
+            std::vector<uint8_t> buffer(bytes.begin() + start,
+                    bytes.begin() + std::min(bytes.size(), start + chunk));
+            parser.feed(buffer.data(), buffer.size());
+            while (const uint8_t* d = parser.next())
+            {
+                TEST_ASSERT(h < expected.size());
+                TEST_ASSERT(same_bytes(d, expected[h]));
+                ++h;
+            }
+            std::fill(buffer.begin(), buffer.end(), 0xff);
+        }
+        TEST_ASSERT(h == expected.size());
+        TEST_ASSERT(parser.count() == expected.size());
+        TEST_ASSERT(parser.offset() == bytes.size());
+        TEST_ASSERT(parser.partial() == 0);
+    }
+}
+
+void test_Ngrdnt_parser_in_place()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(300, 300, 70000));
+    const std::string bytes(serialize(expected));
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(bytes.data());
+
+    // Everything fits in one chunk, nothing is copied.
+    watson::Ngrdnt_parser parser;
+    parser.feed(data, bytes.size());
+    uint64_t offset = 0;
+    while (const uint8_t* d = parser.next())
+    {
+        TEST_ASSERT(d == data + offset);
+        offset = parser.offset();
+    }
+    TEST_ASSERT(parser.count() == expected.size());
+    TEST_ASSERT(parser.spilled() == 0);
+
+    // A split header is held until the rest arrives.
+    const watson::Ngrdnt::Ptr large(expected.back());
+    watson::Ngrdnt_parser split;
+    split.feed(large->data(), 2);
+    TEST_ASSERT(split.next() == nullptr);
+    TEST_ASSERT(split.partial() == 2);
+    split.feed(large->data() + 2, large->size() - 2);
+    TEST_ASSERT(same_bytes(split.next(), large));
+    TEST_ASSERT(split.next() == nullptr);
+    TEST_ASSERT(split.spilled() == 1);
+}
+
+void test_Ngrdnt_parser_misuse()
+{
+    const std::string bytes(serialize(mixed_records(300, 300, 70000)));
+    watson::Ngrdnt_parser parser;
+    parser.feed(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+    parser.next();
+    try
+    {
+        parser.feed(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+        TEST_FAILED("A chunk was dropped.");
+    }
+    catch (const std::logic_error&)
+    {
+    }
+
+    // A size smaller than its own header.
+    const uint8_t invalid[] = { 0x4a, 0x01, 0x00 };
+    watson::Ngrdnt_parser bad;
+    bad.feed(invalid, sizeof(invalid));
+    try
+    {
+        bad.next();
+        TEST_FAILED("An invalid size was accepted.");
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Ngrdnt_parser_chunks),
+    PREPARE_TEST(test_Ngrdnt_parser_in_place),
+    PREPARE_TEST(test_Ngrdnt_parser_misuse),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Ngrdnt_parser", tests);
+}
@@ -0,0 +1,296 @@
+/*!
+ \file test/Ngrdnt_reader_test.cpp
+ \brief WatSON Ngrdnt Reader Test Suite
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "reader.h"
+#include "watson.h"
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    //! Hands out its input, then fails.
+    class Failing_source : public watson::Ngrdnt_source
+    {
+    public:
+        explicit Failing_source(const std::string& bytes) : bytes_(bytes), done_(false) {}
+        size_t next(const uint8_t** data) override
+        {
+            if (done_)
+            {
+                throw std::ios_base::failure("Failing_source");
+            }
+            done_ = true;
+            *data = reinterpret_cast<const uint8_t*>(bytes_.data());
+            return bytes_.size();
+        }
+    private:
+        std::string bytes_;
+        bool done_;
+    };
+}; // namespace (anonymous)
+
+void test_Ngrdnt_reader_streambuf()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(500, 97, 100000));
+    const std::string bytes(serialize(expected));
+
+    std::istringstream iss(bytes);
+    watson::Ngrdnt_reader reader(iss.rdbuf(), 256);
+    for (const watson::Ngrdnt::Ptr& e : expected)
+    {
+        const uint8_t* d = reader.next();
+        TEST_ASSERT(d != nullptr);
+        TEST_ASSERT(same_bytes(d, e));
+    }
+    TEST_ASSERT(reader.next() == nullptr);
+    TEST_ASSERT(reader.count() == expected.size());
+    TEST_ASSERT(reader.offset() == bytes.size());
+
+    // Most records were handed out in place.
+    TEST_ASSERT(reader.spilled() > 0);
+    TEST_ASSERT(reader.spilled() < expected.size() / 4);
+}
+
+void test_Ngrdnt_reader_fd()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(500, 97, 100000));
+    const std::string bytes(serialize(expected));
+
+    char path[] = "/tmp/watson_reader_XXXXXX";
+    const int fd = mkstemp(path);
+    TEST_ASSERT(0 <= fd);
+    unlink(path);
+    TEST_ASSERT(write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+    lseek(fd, 0, SEEK_SET);
+
+    watson::Ngrdnt_reader reader(fd, 4096);
+    watson::Ngrdnt::Ptr val;
+    const watson::Ngrdnt* reused = nullptr;
+    size_t h = 0;
+    while (reader.next(val))
+    {
+        TEST_ASSERT(h < expected.size());
+        TEST_ASSERT(same_bytes(val->data(), expected[h]));
+
+        // The same object is reused for every record.
+        if (reused)
+        {
+            TEST_ASSERT(val.get() == reused);
+        }
+        reused = val.get();
+        ++h;
+    }
+    TEST_ASSERT(h == expected.size());
+
+    // Holding on to a record gets a fresh object for the next one.
+    lseek(fd, 0, SEEK_SET);
+    watson::Ngrdnt_reader again(fd);
+    TEST_ASSERT(again.next(val));
+    const watson::Ngrdnt::Ptr kept(val);
+    TEST_ASSERT(again.next(val));
+    TEST_ASSERT(val.get() != kept.get());
+    close(fd);
+}
+
+void test_Ngrdnt_reader_truncated()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(500, 97, 100000));
+    const std::string bytes(serialize(expected));
+
+    std::istringstream iss(bytes.substr(0, bytes.size() - 10));
+    watson::Ngrdnt_reader reader(iss.rdbuf(), 1000);
+    try
+    {
+        while (reader.next())
+        {
+        }
+        TEST_FAILED("Truncated input was accepted.");
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+    TEST_ASSERT(reader.count() == expected.size() - 1);
+}
+
+void test_Prefetch_source_fd()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(500, 97, 100000));
+    const std::string bytes(serialize(expected));
+
+    char path[] = "/tmp/watson_reader_XXXXXX";
+    const int fd = mkstemp(path);
+    TEST_ASSERT(0 <= fd);
+    unlink(path);
+    TEST_ASSERT(write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+    lseek(fd, 0, SEEK_SET);
+
+    watson::Prefetch_source* source = new watson::Prefetch_source(fd, 3, 4096);
+    watson::Ngrdnt_reader reader{std::unique_ptr<watson::Ngrdnt_source>(source)};
+    for (const watson::Ngrdnt::Ptr& e : expected)
+    {
+        TEST_ASSERT(same_bytes(reader.next(), e));
+
+        // A slow consumer leaves the I/O thread waiting.
+        if (0 == reader.count() % 500)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    TEST_ASSERT(reader.next() == nullptr);
+
+    const watson::Prefetch_stats stats = source->stats();
+    TEST_ASSERT(stats.bytes == bytes.size());
+    TEST_ASSERT(stats.io_waits > 0);
+    TEST_ASSERT(stats.io_stall > 0);
+    close(fd);
+}
+
+void test_Prefetch_source_source()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(500, 97, 100000));
+    const std::string bytes(serialize(expected));
+
+    // Chunks larger than the ring buffers are split.
+    std::istringstream iss(bytes);
+    std::unique_ptr<watson::Ngrdnt_source> inner(new watson::Streambuf_source(iss.rdbuf(), 3000));
+    watson::Ngrdnt_reader reader{std::unique_ptr<watson::Ngrdnt_source>(
+            new watson::Prefetch_source(std::move(inner), 2, 1000))};
+    for (const watson::Ngrdnt::Ptr& e : expected)
+    {
+        TEST_ASSERT(same_bytes(reader.next(), e));
+    }
+    TEST_ASSERT(reader.next() == nullptr);
+    TEST_ASSERT(reader.offset() == bytes.size());
+
+    // Stopping early does not wait for the rest of the input.
+    std::istringstream again(bytes);
+    watson::Prefetch_source early(std::unique_ptr<watson::Ngrdnt_source>(
+            new watson::Streambuf_source(again.rdbuf(), 100)), 2, 100);
+    const uint8_t* d;
+    TEST_ASSERT(early.next(&d) == 100);
+}
+
+void test_Prefetch_source_error()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(500, 97, 100000));
+    const std::string bytes(serialize(expected));
+
+    watson::Ngrdnt_reader reader{std::unique_ptr<watson::Ngrdnt_source>(
+            new watson::Prefetch_source(std::unique_ptr<watson::Ngrdnt_source>(
+                    new Failing_source(bytes)), 4, 8192))};
+    try
+    {
+        while (reader.next())
+        {
+        }
+        TEST_FAILED("The error was not passed on.");
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+
+    // Everything read before the error was handed out.
+    TEST_ASSERT(reader.count() == expected.size());
+}
+
+void test_Direct_source()
+{
+    const std::vector<watson::Ngrdnt::Ptr> expected(mixed_records(500, 97, 100000));
+    const std::string bytes(serialize(expected));
+    TEST_ASSERT(0 != bytes.size() % watson::k_direct_alignment);
+
+    char path[] = "/tmp/watson_reader_XXXXXX";
+    const int fd = mkstemp(path);
+    TEST_ASSERT(0 <= fd);
+    TEST_ASSERT(write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+    close(fd);
+
+    // Direct, falling back where the file system refuses, and not.
+    const bool modes[] = { true, false };
+    for (bool direct : modes)
+    {
+        watson::Direct_source* source = new watson::Direct_source(path, 5000, direct);
+        TEST_ASSERT(direct || !source->direct());
+        watson::Ngrdnt_reader reader{std::unique_ptr<watson::Ngrdnt_source>(source)};
+        for (const watson::Ngrdnt::Ptr& e : expected)
+        {
+            TEST_ASSERT(same_bytes(reader.next(), e));
+        }
+        TEST_ASSERT(reader.next() == nullptr);
+        TEST_ASSERT(reader.offset() == bytes.size());
+    }
+
+    // Read ahead on another thread.
+    watson::Ngrdnt_reader prefetched{std::unique_ptr<watson::Ngrdnt_source>(
+            new watson::Prefetch_source(std::unique_ptr<watson::Ngrdnt_source>(
+                    new watson::Direct_source(path, 8192)), 4, 8192))};
+    size_t h = 0;
+    while (const uint8_t* d = prefetched.next())
+    {
+        TEST_ASSERT(same_bytes(d, expected[h++]));
+    }
+    TEST_ASSERT(h == expected.size());
+
+    try
+    {
+        watson::Direct_source missing("/tmp/watson_reader_missing/none");
+        TEST_FAILED("A missing file was opened.");
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+    unlink(path);
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Ngrdnt_reader_streambuf),
+    PREPARE_TEST(test_Ngrdnt_reader_fd),
+    PREPARE_TEST(test_Ngrdnt_reader_truncated),
+    PREPARE_TEST(test_Prefetch_source_fd),
+    PREPARE_TEST(test_Prefetch_source_source),
+    PREPARE_TEST(test_Prefetch_source_error),
+    PREPARE_TEST(test_Direct_source),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Ngrdnt_reader", tests);
+}
@@ -0,0 +1,215 @@
+/*!
+ \file test/Ngrdnt_ring_test.cpp
+ \brief Test cases for the WatSON rings.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "ring.h"
+#include "watson.h"
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace
+{
+    watson::Ngrdnt::Ptr message(const uint32_t h)
+    {
+        return watson::new_ngrdnt(std::to_string(h) + std::string(h % 61, 'a' + h % 26));
+    }
+}; // namespace (anonymous)
+
+void test_Ngrdnt_ring_wrap()
+{
+    watson::Ngrdnt_ring ring(1000);
+    TEST_ASSERT(ring.capacity() == 1024);
+    TEST_ASSERT(ring.peek() == nullptr);
+
+    // Fill up, then drain, many times over so frames wrap.
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+    for (int round = 0; round < 50; ++round)
+    {
+        while (ring.push(message(pushed)))
+        {
+            ++pushed;
+        }
+        TEST_ASSERT(ring.peek() != nullptr);
+        for (int h = 0; h < 5; ++h)
+        {
+            TEST_ASSERT(same_bytes(ring.peek(), message(popped)));
+            ring.pop();
+            ++popped;
+        }
+        ring.release();
+    }
+    while (const uint8_t* d = ring.peek())
+    {
+        TEST_ASSERT(same_bytes(d, message(popped)));
+        ring.pop();
+        ++popped;
+    }
+    TEST_ASSERT(popped == pushed);
+    TEST_ASSERT(pushed > 250);
+
+    try
+    {
+        ring.reserve(1024);
+        TEST_FAILED("An Ngrdnt larger than the ring was reserved.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+void test_Ngrdnt_ring_large_frames()
+{
+    // Frames over half the ring never fit behind the one before.
+    watson::Ngrdnt_ring ring(128);
+    const watson::Ngrdnt::Ptr small(watson::new_ngrdnt(std::string(38, 's')));
+    TEST_ASSERT(ring.push(small));
+    TEST_ASSERT(same_bytes(ring.peek(), small));
+    ring.pop();
+    ring.release();
+
+    for (uint32_t h = 0; h < 20; ++h)
+    {
+        // Refused until the consumer has passed the wrap, even though
+        // nothing else is in the ring.
+        const watson::Ngrdnt::Ptr big(watson::new_ngrdnt(std::string(70 + h % 8, 'a' + h)));
+        int refused = 0;
+        while (!ring.push(big))
+        {
+            TEST_ASSERT(++refused < 2);
+            TEST_ASSERT(ring.peek() == nullptr);
+        }
+        TEST_ASSERT(same_bytes(ring.peek(), big));
+        ring.pop();
+        ring.release();
+    }
+    TEST_ASSERT(ring.peek() == nullptr);
+}
+
+void test_Ngrdnt_ring_batch()
+{
+    watson::Ngrdnt_ring ring(4096);
+
+    // Nothing is visible before publish(), nor reusable before release().
+    for (uint32_t h = 0; h < 10; ++h)
+    {
+        const watson::Ngrdnt::Ptr m(message(h));
+        uint8_t* out = ring.reserve(m->size() + 100);
+        TEST_ASSERT(out != nullptr);
+        memcpy(out, m->data(), m->size());
+        ring.commit(m->size());
+    }
+    TEST_ASSERT(ring.peek() == nullptr);
+    ring.publish();
+
+    for (uint32_t h = 0; h < 10; ++h)
+    {
+        TEST_ASSERT(same_bytes(ring.peek(), message(h)));
+        ring.pop();
+    }
+    TEST_ASSERT(ring.peek() == nullptr);
+
+    // The ring can be shared through memory it does not own.
+    std::unique_ptr<uint64_t[]> region(new uint64_t[watson::Ngrdnt_ring::region_size(256) / 8 + 16]);
+    void* aligned = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(region.get()) + 63) & ~uintptr_t(63));
+    watson::Ngrdnt_ring producer(aligned, 256, true);
+    watson::Ngrdnt_ring consumer(aligned, 256, false);
+    TEST_ASSERT(producer.push(message(7)));
+    TEST_ASSERT(same_bytes(consumer.peek(), message(7)));
+    consumer.pop();
+    consumer.release();
+    TEST_ASSERT(consumer.peek() == nullptr);
+
+    try
+    {
+        watson::Ngrdnt_ring odd(aligned, 200, false);
+        TEST_FAILED("A capacity that is not a power of two was accepted.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+void test_Ngrdnt_ring_threads()
+{
+    const uint32_t count = 200000;
+    watson::Ngrdnt_ring ring(1 << 14);
+    std::thread producer([&ring, count]() {
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            const watson::Ngrdnt::Ptr m(message(h));
+            while (!ring.push(m))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t h = 0;
+    bool ok = true;
+    while (h < count)
+    {
+        const uint8_t* d = ring.peek();
+        if (!d)
+        {
+            ring.release();
+            std::this_thread::yield();
+            continue;
+        }
+        ok = ok && same_bytes(d, message(h));
+        ring.pop();
+        if (0 == ++h % 64)
+        {
+            ring.release();
+        }
+    }
+    producer.join();
+    TEST_ASSERT(ok);
+    TEST_ASSERT(ring.peek() == nullptr);
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Ngrdnt_ring_wrap),
+    PREPARE_TEST(test_Ngrdnt_ring_large_frames),
+    PREPARE_TEST(test_Ngrdnt_ring_batch),
+    PREPARE_TEST(test_Ngrdnt_ring_threads),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Ngrdnt_ring", tests);
+}
@@ -0,0 +1,137 @@
+/*!
+ \file test/Numeric_test.cpp
+ \brief WatSON number formatting tests.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "testhelper.h"
+#include "numeric.h"
+#include "watson.h"
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+
+namespace
+{
+    template <typename T>
+    std::string text(const T val)
+    {
+        char out[watson::k_max_number_text];
+        return std::string(out, watson::write_number(out, val));
+    }
+}; // namespace (anonymous)
+
+void test_write_number_integers()
+{
+    TEST_ASSERT(text(int32_t(0)) == "0");
+    TEST_ASSERT(text(int32_t(-7)) == "-7");
+    TEST_ASSERT(text(uint32_t(4294967295u)) == "4294967295");
+    TEST_ASSERT(text(std::numeric_limits<int32_t>::min()) == "-2147483648");
+    TEST_ASSERT(text(std::numeric_limits<int64_t>::min()) == "-9223372036854775808");
+    TEST_ASSERT(text(std::numeric_limits<uint64_t>::max()) == "18446744073709551615");
+
+    std::mt19937_64 rng(1);
+    for (int h = 0; h < 10000; ++h)
+    {
+        const uint64_t u = rng() >> (h % 64);
+        const int64_t s = static_cast<int64_t>(rng()) >> (h % 64);
+        TEST_ASSERT(text(u) == std::to_string(u));
+        TEST_ASSERT(text(s) == std::to_string(s));
+    }
+}
+
+void test_write_number_doubles()
+{
+    TEST_ASSERT(text(0.0) == "0");
+    TEST_ASSERT(text(-0.0) == "-0");
+    TEST_ASSERT(text(0.1) == "0.1");
+    TEST_ASSERT(text(0.3) == "0.3");
+    TEST_ASSERT(text(3.0) == "3");
+    TEST_ASSERT(text(-123.5) == "-123.5");
+    TEST_ASSERT(text(1e20) == "100000000000000000000");
+    TEST_ASSERT(text(1e21) == "1e+21");
+    TEST_ASSERT(text(1e-6) == "0.000001");
+    TEST_ASSERT(text(1e-7) == "1e-7");
+    TEST_ASSERT(text(5e-324) == "5e-324");
+    TEST_ASSERT(text(2.2250738585072014e-308) == "2.2250738585072014e-308");
+    TEST_ASSERT(text(-std::numeric_limits<double>::max()) == "-1.7976931348623157e+308");
+    TEST_ASSERT(text(9007199254740993.0) == "9007199254740992");
+    TEST_ASSERT(text(std::numeric_limits<double>::infinity()) == "inf");
+    TEST_ASSERT(text(-std::numeric_limits<double>::infinity()) == "-inf");
+    TEST_ASSERT(text(std::numeric_limits<double>::quiet_NaN()) == "nan");
+
+    // Every bit pattern reads back as itself, with no more digits than needed.
+    std::mt19937_64 rng(2);
+    for (int h = 0; h < 100000; ++h)
+    {
+        const uint64_t bits = rng();
+        double val;
+        memcpy(&val, &bits, sizeof(val));
+        if (val != val || val - val != 0)
+        {
+            continue;
+        }
+        const std::string s(text(val));
+        TEST_ASSERT(s.size() <= watson::k_max_number_text);
+        TEST_ASSERT_MSG(s, strtod(s.c_str(), nullptr) == val);
+
+        const std::string mantissa(s.substr(0, s.find('e')));
+        const size_t first = mantissa.find_first_of("123456789");
+        const size_t last = mantissa.find_last_of("123456789");
+        const size_t digits = last - first + 1 - (first < mantissa.find('.') && mantissa.find('.') < last ? 1 : 0);
+        char shorter[32];
+        snprintf(shorter, sizeof(shorter), "%.*e", static_cast<int>(digits) - 2, val);
+        TEST_ASSERT_MSG(s, 1 == digits || strtod(shorter, nullptr) != val);
+    }
+}
+
+void test_to_string_numbers()
+{
+    TEST_ASSERT(watson::to_string(watson::new_ngrdnt(0.1)) == "0.1");
+    TEST_ASSERT(watson::to_string(watson::new_ngrdnt(1e-300)) == "1e-300");
+    TEST_ASSERT(watson::to_string(watson::new_ngrdnt(int32_t(-42))) == "-42");
+    TEST_ASSERT(watson::to_string(watson::new_ngrdnt(int64_t(-5000000000ll))) == "-5000000000");
+    TEST_ASSERT(watson::to_string(watson::new_ngrdnt(uint64_t(18446744073709551615ull))) == "18446744073709551615");
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_write_number_integers),
+    PREPARE_TEST(test_write_number_doubles),
+    PREPARE_TEST(test_to_string_numbers),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::write_number", tests);
+}
@@ -34,7 +34,11 @@
 
 #include "testhelper.h"
 #include "watson.h"
+#include "zip.h"
+#include <cstdlib>
+#include <fstream>
 #include <iomanip>
+#include <unistd.h>
 
 namespace
 {
@@ -161,11 +165,85 @@ void test_Recipe_copy_ctr()
     verify(r2);
 }
 
+void test_Recipe_copies_ngrdnt()
+{
+    const watson::Ngrdnt::Ptr src(produce());
+    const uint8_t* const begin = src->data();
+    const uint8_t* const end = begin + src->size();
+
+    // Neither constructor may leave the children pointing into src.
+    watson::Ngrdnt::Ptr moved(src);
+    watson::Recipe r1(std::move(moved));
+    watson::Recipe r2(src);
+    for (const watson::Recipe* r : {&r1, &r2})
+    {
+        verify(*r);
+        for (const auto& child : r->container().children())
+        {
+            TEST_ASSERT(child->data() < begin || child->data() >= end);
+        }
+    }
+}
+
+void test_Recipe_seekable_ngrdnt()
+{
+    watson::Container items;
+    for (int32_t h = 0; h < 5000; ++h)
+    {
+        items.mutable_children().push_back(watson::new_ngrdnt(h));
+    }
+
+    watson::Container c;
+    c.mutable_children().push_back(watson::new_seekable_ngrdnt(items, 1024));
+    c.mutable_children().push_back(watson::new_ngrdnt(watson::Compressed(watson::new_ngrdnt(items))));
+    watson::Recipe r(watson::new_ngrdnt(c));
+
+    TEST_ASSERT(watson::to_int32(r.ngrdnt(std::list<uint32_t>{0, 4321})) == 4321);
+    TEST_ASSERT(watson::to_int32(r.ngrdnt(std::list<uint32_t>{1, 4321})) == 4321);
+    TEST_ASSERT(r.ngrdnt(std::list<uint32_t>{0, 5000}) == watson::k_not_found);
+}
+
+void test_Recipe_open_mapped()
+{
+    char path[] = "/tmp/watson_recipe_XXXXXX";
+    const int fd = mkstemp(path);
+    TEST_ASSERT(0 <= fd);
+    close(fd);
+    {
+        std::ofstream ofs(path, std::ios::binary);
+        ofs << produce();
+    }
+
+    watson::Ngrdnt::Ptr child;
+    {
+        watson::Recipe r(watson::Recipe::open_mapped(path));
+        verify(r);
+        TEST_ASSERT(watson::xlate(r, std::list<std::string>{"second"}).front() == 1);
+        child = r.ngrdnt(std::list<uint32_t>{1, 2, 3});
+    }
+    unlink(path);
+
+    // The mapping outlives the recipe, for as long as a child needs it.
+    TEST_ASSERT(watson::to_string(child).compare("First Child of the Third Element") == 0);
+
+    try
+    {
+        watson::Recipe::open_mapped(path);
+        TEST_FAILED("Opened a missing file.");
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+}
+
 const Test_entry tests[] = {
     PREPARE_TEST(test_xlate_string_to_int),
     PREPARE_TEST(test_xlate_int_to_string),
     PREPARE_TEST(test_Recipe_default_ctr),
     PREPARE_TEST(test_Recipe_copy_ctr),
+    PREPARE_TEST(test_Recipe_copies_ngrdnt),
+    PREPARE_TEST(test_Recipe_seekable_ngrdnt),
+    PREPARE_TEST(test_Recipe_open_mapped),
     {0, ""}
 };
 
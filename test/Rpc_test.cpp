@@ -0,0 +1,233 @@
+/*!
+ \file test/Rpc_test.cpp
+ \brief WatSON Rpc_server and Rpc_client tests.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "testhelper.h"
+#include "rpc.h"
+#include "watson.h"
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace
+{
+    std::string socket_path()
+    {
+        return "/tmp/watson_rpc_test_" + std::to_string(::getpid()) + ".sock";
+    }
+
+    //! Runs a server on its own thread for the life of the object.
+    struct Running_server
+    {
+        explicit Running_server(watson::Rpc_server::Handler handler) :
+                server(socket_path(), std::move(handler)),
+                loop([this]() { server.run(); })
+        {
+        }
+
+        ~Running_server()
+        {
+            server.stop();
+            loop.join();
+        }
+
+        watson::Rpc_server server;
+        std::thread loop;
+    };
+
+    void echo(const watson::Ngrdnt::Ptr& request, const watson::Rpc_server::Reply& reply)
+    {
+        reply(request, nullptr);
+    }
+}; // namespace (anonymous)
+
+void test_Rpc_echo()
+{
+    Running_server running(echo);
+    watson::Rpc_client client(socket_path());
+
+    // Everything is in flight at once.
+    std::vector<std::future<watson::Ngrdnt::Ptr>> responses;
+    for (int h = 0; h < 1000; ++h)
+    {
+        responses.push_back(client.call(watson::new_ngrdnt(std::string(h, 'e'))));
+    }
+    for (int h = 0; h < 1000; ++h)
+    {
+        TEST_ASSERT(watson::to_string(responses[h].get()) == std::string(h, 'e'));
+    }
+    TEST_ASSERT(running.server.requests() == 1000);
+    TEST_ASSERT(client.in_flight() == 0);
+
+    // Responses were batched.
+    TEST_ASSERT(running.server.writes() < 1000);
+}
+
+void test_Rpc_out_of_order()
+{
+    // Even requests are answered late, from another thread.
+    std::vector<std::thread> late;
+    Running_server running([&late](const watson::Ngrdnt::Ptr& request, const watson::Rpc_server::Reply& reply) {
+        const int32_t n = watson::to_int32(request);
+        if (n % 2 == 0)
+        {
+            late.push_back(std::thread([n, reply]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                reply(watson::new_ngrdnt(n * 10), nullptr);
+            }));
+        }
+        else
+        {
+            reply(watson::new_ngrdnt(n * 10), nullptr);
+        }
+    });
+
+    std::mutex mutex;
+    std::vector<int32_t> order;
+    {
+        watson::Rpc_client client(socket_path());
+        for (int32_t h = 0; h < 10; ++h)
+        {
+            client.call(watson::new_ngrdnt(h),
+                    [&mutex, &order](const watson::Ngrdnt::Ptr& response, std::exception_ptr error) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        order.push_back(error ? -1 : watson::to_int32(response));
+                    });
+        }
+        while (client.in_flight() > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    for (auto& h : late)
+    {
+        h.join();
+    }
+
+    TEST_ASSERT(order.size() == 10);
+    for (size_t h = 0; h < 5; ++h)
+    {
+        TEST_ASSERT(order[h] == static_cast<int32_t>(h * 2 + 1) * 10);
+    }
+    for (size_t h = 5; h < 10; ++h)
+    {
+        TEST_ASSERT(order[h] % 20 == 0);
+    }
+}
+
+void test_Rpc_error()
+{
+    Running_server running([](const watson::Ngrdnt::Ptr& request, const watson::Rpc_server::Reply& reply) {
+        if (watson::to_string(request) == "bad")
+        {
+            throw std::runtime_error("Bad request.");
+        }
+        reply(request, nullptr);
+    });
+    watson::Rpc_client client(socket_path());
+
+    std::future<watson::Ngrdnt::Ptr> bad = client.call(watson::new_ngrdnt("bad"));
+    std::future<watson::Ngrdnt::Ptr> good = client.call(watson::new_ngrdnt("good"));
+    try
+    {
+        bad.get();
+        TEST_FAILED("The failed request did not throw.");
+    }
+    catch (const std::runtime_error& ex)
+    {
+        TEST_ASSERT(std::string(ex.what()) == "Bad request.");
+    }
+    TEST_ASSERT(watson::to_string(good.get()) == "good");
+}
+
+void test_Rpc_close()
+{
+    // Never replies.
+    std::vector<watson::Rpc_server::Reply> replies;
+    Running_server running([&replies](const watson::Ngrdnt::Ptr& request, const watson::Rpc_server::Reply& reply) {
+        replies.push_back(reply);
+    });
+
+    std::future<watson::Ngrdnt::Ptr> response;
+    {
+        watson::Rpc_client client(socket_path());
+        response = client.call(watson::new_ngrdnt("hello"));
+        while (running.server.requests() == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        TEST_ASSERT(client.in_flight() == 1);
+    }
+    try
+    {
+        response.get();
+        TEST_FAILED("The abandoned request did not throw.");
+    }
+    catch (const std::runtime_error& ex)
+    {
+    }
+
+    // Replying to a connection that is gone is harmless.
+    replies[0](watson::new_ngrdnt("late"), nullptr);
+}
+
+void test_Rpc_connect()
+{
+    try
+    {
+        watson::Rpc_client client(socket_path() + ".missing");
+        TEST_FAILED("Connected to a server that does not exist.");
+    }
+    catch (const std::ios_base::failure& ex)
+    {
+    }
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Rpc_echo),
+    PREPARE_TEST(test_Rpc_out_of_order),
+    PREPARE_TEST(test_Rpc_error),
+    PREPARE_TEST(test_Rpc_close),
+    PREPARE_TEST(test_Rpc_connect),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Rpc", tests);
+}
@@ -0,0 +1,207 @@
+/*!
+ \file test/Shared_ring_test.cpp
+ \brief WatSON Shared_ring tests.
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "testhelper.h"
+#include "ring.h"
+#include "watson.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    const uint32_t k_message_count = 100000;
+
+    std::string ring_name()
+    {
+        return "/watson_test_" + std::to_string(::getpid());
+    }
+
+    watson::Ngrdnt::Ptr message(const uint32_t h)
+    {
+        return watson::new_ngrdnt(std::to_string(h) + std::string(h % 61, 'a' + h % 26));
+    }
+
+    //! Consume in a child process, exit status 0 if every message matched.
+    int consume(const std::string& name)
+    {
+        watson::Shared_ring ring(name);
+        for (uint32_t h = 0; h < k_message_count; ++h)
+        {
+            const uint8_t* d = ring.wait(std::chrono::milliseconds(5000));
+            if (!same_bytes(d, message(h)))
+            {
+                return 1;
+            }
+            ring.ring().pop();
+            if (h % 16 == 15)
+            {
+                ring.release();
+            }
+        }
+        ring.release();
+        return ring.wait(std::chrono::milliseconds(10)) == nullptr ? 0 : 2;
+    }
+}; // namespace (anonymous)
+
+void test_Shared_ring_processes()
+{
+    const std::string name = ring_name();
+    watson::Shared_ring ring(name, 4096);
+
+    const pid_t pid = ::fork();
+    if (0 == pid)
+    {
+        int status = 3;
+        try
+        {
+            status = consume(name);
+        }
+        catch (...)
+        {
+        }
+        ::_exit(status);
+    }
+    TEST_ASSERT(0 < pid);
+
+    // A small ring, so the producer sleeps on a full ring as often as
+    // the consumer sleeps on an empty one.
+    for (uint32_t h = 0; h < k_message_count; ++h)
+    {
+        TEST_ASSERT(ring.push(message(h)->data(), std::chrono::milliseconds(5000)));
+    }
+
+    int status = -1;
+    TEST_ASSERT(pid == ::waitpid(pid, &status, 0));
+    watson::Shared_ring::remove(name);
+    TEST_ASSERT(WIFEXITED(status));
+    TEST_ASSERT(0 == WEXITSTATUS(status));
+}
+
+void test_Shared_ring_timeout()
+{
+    const std::string name = ring_name();
+    watson::Shared_ring producer(name, 256);
+    watson::Shared_ring consumer(name);
+    watson::Shared_ring::remove(name);
+
+    TEST_ASSERT(consumer.wait(std::chrono::milliseconds(1)) == nullptr);
+
+    // Fill up, without a consumer to make room.
+    uint32_t pushed = 0;
+    while (producer.push(message(pushed)->data(), std::chrono::milliseconds(1)))
+    {
+        ++pushed;
+    }
+    TEST_ASSERT(0 < pushed);
+    TEST_ASSERT(producer.reserve(64, std::chrono::milliseconds(1)) == nullptr);
+
+    for (uint32_t h = 0; h < pushed; ++h)
+    {
+        TEST_ASSERT(same_bytes(consumer.wait(std::chrono::milliseconds(1)), message(h)));
+        consumer.ring().pop();
+    }
+    TEST_ASSERT(consumer.wait(std::chrono::milliseconds(1)) == nullptr);
+    consumer.release();
+    TEST_ASSERT(producer.reserve(64, std::chrono::milliseconds(1)) != nullptr);
+}
+
+void test_Shared_ring_large_frames()
+{
+    // Frames over half the ring never fit behind the one before, so
+    // each one waits for the consumer to pass a wrap.
+    const std::string name = ring_name();
+    watson::Shared_ring producer(name, 256);
+    watson::Shared_ring consumer(name);
+    watson::Shared_ring::remove(name);
+
+    const uint32_t count = 200;
+    auto big = [](const uint32_t h) {
+        return watson::new_ngrdnt(std::string(150 + h % 40, 'a' + h % 26));
+    };
+    bool consumed = true;
+    std::thread reader([&]() {
+        for (uint32_t h = 0; h < count && consumed; ++h)
+        {
+            const uint8_t* d = consumer.wait(std::chrono::milliseconds(5000));
+            consumed = same_bytes(d, big(h));
+            if (d)
+            {
+                consumer.ring().pop();
+                consumer.release();
+            }
+        }
+    });
+
+    const auto start = std::chrono::steady_clock::now();
+    bool produced = true;
+    for (uint32_t h = 0; h < count && produced; ++h)
+    {
+        produced = producer.push(big(h)->data(), std::chrono::milliseconds(5000));
+    }
+    reader.join();
+    TEST_ASSERT(produced);
+    TEST_ASSERT(consumed);
+
+    // Nowhere near a timeout per frame.
+    TEST_ASSERT(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+}
+
+void test_Shared_ring_open()
+{
+    try
+    {
+        watson::Shared_ring ring(ring_name() + "_missing");
+        TEST_FAILED("Opened a shared ring that does not exist.");
+    }
+    catch (const std::ios_base::failure& ex)
+    {
+    }
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Shared_ring_processes),
+    PREPARE_TEST(test_Shared_ring_timeout),
+    PREPARE_TEST(test_Shared_ring_large_frames),
+    PREPARE_TEST(test_Shared_ring_open),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Shared_ring", tests);
+}
@@ -0,0 +1,119 @@
+/*!
+ \file test/Worker_pool_test.cpp
+ \brief WatSON Worker Pool Test Suite
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "worker_pool.h"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+void test_Worker_pool_for_each()
+{
+    watson::Worker_pool pool(4);
+    TEST_ASSERT(pool.size() == 4);
+
+    std::vector<int> visits(10000, 0);
+    pool.for_each(visits.size(), [&visits](size_t h) {
+        visits[h] += 1;
+    });
+
+    for (size_t h = 0; h < visits.size(); ++h)
+    {
+        TEST_ASSERT(visits[h] == 1);
+    }
+
+    // Reuse the pool.
+    std::atomic<size_t> sum(0);
+    pool.for_each(100, [&sum](size_t h) {
+        sum += h;
+    });
+    TEST_ASSERT(sum == 4950);
+}
+
+void test_Worker_pool_without_threads()
+{
+    watson::Worker_pool pool(0);
+    size_t count = 0;
+    pool.for_each(10, [&count](size_t) {
+        ++count;
+    });
+    TEST_ASSERT(count == 10);
+}
+
+void test_Worker_pool_nested()
+{
+    watson::Worker_pool pool(2);
+    std::atomic<size_t> count(0);
+    pool.for_each(8, [&pool, &count](size_t) {
+        pool.for_each(8, [&count](size_t) {
+            ++count;
+        });
+    });
+    TEST_ASSERT(count == 64);
+}
+
+void test_Worker_pool_exception()
+{
+    watson::Worker_pool pool(2);
+    std::atomic<size_t> count(0);
+    try
+    {
+        pool.for_each(100, [&count](size_t h) {
+            ++count;
+            if (h == 50)
+            {
+                throw std::runtime_error("Task failure.");
+            }
+        });
+        TEST_FAILED("Exception was not rethrown.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+    TEST_ASSERT(count == 100);
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_Worker_pool_for_each),
+    PREPARE_TEST(test_Worker_pool_without_threads),
+    PREPARE_TEST(test_Worker_pool_nested),
+    PREPARE_TEST(test_Worker_pool_exception),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::Worker_pool", tests);
+}
@@ -0,0 +1,572 @@
+/*!
+ \file test/Zip_test.cpp
+ \brief WatSON Framed Compression Test Suite
+
+ Copyright (c) 2015, Jason Watson
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the LogJammin nor the names of its contributors
+ may be used to endorse or promote products derived from this software
+ without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "testhelper.h"
+#include "watson.h"
+#include "zip.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    //! A container large enough to need several frames.
+    watson::Ngrdnt::Ptr produce(const uint32_t count)
+    {
+        watson::Container c;
+        for (uint32_t h = 0; h < count; ++h)
+        {
+            std::ostringstream oss;
+            oss << "Element number " << h << " of the framed container.";
+            c.mutable_children().push_back(watson::new_ngrdnt(oss.str()));
+            c.mutable_children().push_back(watson::new_ngrdnt(static_cast<int32_t>(h)));
+        }
+        return watson::new_ngrdnt(c);
+    }
+
+    //! A small message, much like its siblings.
+    watson::Ngrdnt::Ptr message(const uint32_t h)
+    {
+        std::ostringstream name;
+        name << "customer-" << h;
+        watson::Container c;
+        c.mutable_children().push_back(watson::new_ngrdnt(std::string("kind=order-placed;version=3")));
+        c.mutable_children().push_back(watson::new_ngrdnt(name.str()));
+        c.mutable_children().push_back(watson::new_ngrdnt(std::string("currency=USD;channel=web;region=us-east")));
+        c.mutable_children().push_back(watson::new_ngrdnt(static_cast<int32_t>(h * 7)));
+        return watson::new_ngrdnt(c);
+    }
+}; // namespace (anonymous)
+
+void test_framed_round_trip()
+{
+    const watson::Ngrdnt::Ptr expected(produce(10));
+    const watson::Ngrdnt::Ptr i(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+
+    TEST_ASSERT(watson::ngrdnt_type(i->type_marker()) == watson::Ngrdnt_type::k_zip);
+    TEST_ASSERT(watson::is_framed(i));
+    TEST_ASSERT(i->size() < expected->size());
+
+    watson::Compressed obj(i);
+    TEST_ASSERT(same_bytes(*obj, expected));
+
+    // The original format is still understood, and is not framed.
+    const watson::Ngrdnt::Ptr plain(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+    TEST_ASSERT(!watson::is_framed(plain));
+    TEST_ASSERT(same_bytes(*watson::Compressed(plain), expected));
+}
+
+void test_framed_large_round_trip()
+{
+    const watson::Ngrdnt::Ptr expected(produce(20000));
+    TEST_ASSERT(expected->size() > 8 * watson::k_zip_frame_size);
+
+    const watson::Ngrdnt::Ptr i(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+    TEST_ASSERT(same_bytes(*watson::Compressed(i), expected));
+
+    std::ostringstream os;
+    TEST_ASSERT(watson::unzip(i, os) == expected->size());
+    TEST_ASSERT(os.str().compare(std::string(reinterpret_cast<const char*>(expected->data()), expected->size())) == 0);
+}
+
+void test_unzip_sink_is_bounded()
+{
+    const watson::Ngrdnt::Ptr expected(produce(20000));
+    const watson::Ngrdnt::Ptr i(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+
+    size_t calls = 0;
+    uint64_t offset = 0;
+    bool matches = true;
+    watson::unzip(i, [&](const uint8_t* d, size_t n) {
+        TEST_ASSERT(n <= watson::k_zip_frame_size);
+        matches = matches && memcmp(expected->data() + offset, d, n) == 0;
+        offset += n;
+        ++calls;
+    });
+    TEST_ASSERT(matches);
+    TEST_ASSERT(offset == expected->size());
+    TEST_ASSERT(calls > 8);
+}
+
+void test_unzip_each()
+{
+    const watson::Ngrdnt::Ptr expected(produce(20000));
+    const watson::Container c(expected);
+    const watson::Ngrdnt::Ptr i(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+
+    size_t h = 0;
+    bool matches = true;
+    const uint64_t count = watson::unzip_each(i, [&](const watson::Ngrdnt::Ptr& val) {
+        matches = matches && h < c.size() && same_bytes(val, c[h]);
+        ++h;
+    });
+    TEST_ASSERT(matches);
+    TEST_ASSERT(count == c.size());
+    TEST_ASSERT(h == c.size());
+
+    // Anything other than a container is visited as a whole.
+    const watson::Ngrdnt::Ptr s(watson::new_ngrdnt("Not a container"));
+    const watson::Ngrdnt::Ptr zs(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(s))));
+    h = 0;
+    TEST_ASSERT(watson::unzip_each(zs, [&](const watson::Ngrdnt::Ptr& val) {
+        TEST_ASSERT(same_bytes(val, s));
+        ++h;
+    }) == 1);
+    TEST_ASSERT(h == 1);
+}
+
+void test_unzip_stream()
+{
+    const watson::Ngrdnt::Ptr expected(produce(5000));
+    const watson::Container c(expected);
+
+    std::stringstream ss;
+    ss << watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected)));
+    ss << watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected)));
+
+    for (int h = 0; h < 2; ++h)
+    {
+        size_t k = 0;
+        bool matches = true;
+        TEST_ASSERT(watson::unzip_each(ss, [&](const watson::Ngrdnt::Ptr& val) {
+            matches = matches && k < c.size() && same_bytes(val, c[k]);
+            ++k;
+        }) == c.size());
+        TEST_ASSERT(matches);
+    }
+
+    TEST_ASSERT(watson::unzip(ss, [](const uint8_t*, size_t) {}) == 0);
+
+    // A size smaller than the header is refused, not read as a huge size.
+    std::stringstream bad;
+    bad << watson::type_marker(watson::Size_type::k_one, watson::Ngrdnt_type::k_zip) << '\0' << "data";
+    try
+    {
+        watson::unzip(bad, [](const uint8_t*, size_t) {});
+        TEST_FAILED("A size smaller than the header was accepted.");
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+}
+
+void test_unzip_corrupt()
+{
+    const watson::Ngrdnt::Ptr expected(produce(10));
+    const watson::Ngrdnt::Ptr i(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+
+    // Flip a byte in the last frame.
+    watson::Ngrdnt::Ptr corrupt(watson::Ngrdnt::clone(i));
+    const_cast<uint8_t*>(corrupt->data())[corrupt->size() - 1] ^= 0xFF;
+
+    try
+    {
+        watson::Compressed obj(corrupt);
+        TEST_FAILED("Corrupt payload was accepted.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+void test_compress_all()
+{
+    const watson::Ngrdnt::Ptr expected(produce(2000));
+    watson::Container c(expected);
+    const watson::Container original(c);
+
+    watson::Worker_pool pool(3);
+    watson::compress_all(c, pool);
+    TEST_ASSERT(c.size() == original.size());
+
+    watson::Container result(watson::new_ngrdnt(c));
+    TEST_ASSERT(result.size() == original.size());
+    for (size_t h = 0; h < result.size(); ++h)
+    {
+        TEST_ASSERT(watson::ngrdnt_type(result[h]->type_marker()) == watson::Ngrdnt_type::k_zip);
+        TEST_ASSERT(same_bytes(*watson::Compressed(result[h]), original[h]));
+    }
+
+    // Compressed children are not compressed again.
+    const watson::Ngrdnt::Ptr first(c[0]);
+    watson::compress_all(c, pool);
+    TEST_ASSERT(first == c[0]);
+}
+
+void test_adaptive_compression()
+{
+    watson::Zip_policy policy;
+    watson::Zip_stats stats;
+
+    // Text compresses well.
+    const watson::Ngrdnt::Ptr text(produce(1000));
+    const watson::Ngrdnt::Ptr z(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(text)), policy, &stats));
+    TEST_ASSERT(watson::ngrdnt_type(z->type_marker()) == watson::Ngrdnt_type::k_zip);
+    TEST_ASSERT(same_bytes(*watson::Compressed(z), text));
+    TEST_ASSERT(stats.compressed == 1);
+
+    // Random bytes do not, and are caught by the sample.
+    std::unique_ptr<uint8_t[]> noise(new uint8_t[200004]);
+    uint32_t seed = 12345;
+    for (size_t h = 0; h < 200004; ++h)
+    {
+        seed = seed * 1103515245 + 12345;
+        noise[h] = static_cast<uint8_t>(seed >> 16);
+    }
+    const watson::Ngrdnt::Ptr random(watson::new_ngrdnt(watson::Bytes(std::move(noise), 200004)));
+    const watson::Ngrdnt::Ptr r(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(random)), policy, &stats));
+    TEST_ASSERT(same_bytes(r, random));
+    TEST_ASSERT(stats.sampled_out == 1);
+
+    // A compressible prefix gets past the sample, but not the full check.
+    std::unique_ptr<uint8_t[]> mixed(new uint8_t[220004]);
+    memset(mixed.get(), 0, 20000);
+    memcpy(mixed.get() + 20000, random->data() + 9, 200004);
+    const watson::Ngrdnt::Ptr partial(watson::new_ngrdnt(watson::Bytes(std::move(mixed), 220004)));
+    const watson::Ngrdnt::Ptr p(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(partial)), policy, &stats));
+    TEST_ASSERT(same_bytes(p, partial));
+    TEST_ASSERT(stats.rejected == 1);
+
+    // Tiny children are left alone.
+    const watson::Ngrdnt::Ptr tiny(watson::new_ngrdnt(42));
+    TEST_ASSERT(same_bytes(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(tiny)), policy, &stats), tiny));
+    TEST_ASSERT(stats.too_small == 1);
+
+    TEST_ASSERT(stats.compressed == 1);
+    TEST_ASSERT(stats.bytes_in == text->size() + random->size() + partial->size() + tiny->size());
+    TEST_ASSERT(stats.bytes_out == z->size() + random->size() + partial->size() + tiny->size());
+
+    // The same decisions in parallel.
+    watson::Container c;
+    c.mutable_children().push_back(text);
+    c.mutable_children().push_back(random);
+    c.mutable_children().push_back(tiny);
+    watson::Zip_stats parallel;
+    watson::compress_all(c, policy, &parallel);
+    TEST_ASSERT(parallel.compressed == 1);
+    TEST_ASSERT(parallel.sampled_out == 1);
+    TEST_ASSERT(parallel.too_small == 1);
+    TEST_ASSERT(watson::ngrdnt_type(c[0]->type_marker()) == watson::Ngrdnt_type::k_zip);
+    TEST_ASSERT(c[1] == random);
+}
+
+void test_unzip_into_buffer()
+{
+    const watson::Ngrdnt::Ptr expected(produce(3000));
+    const watson::Ngrdnt::Ptr plain(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+    const watson::Ngrdnt::Ptr framed(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+
+    TEST_ASSERT(watson::unzipped_size(plain) == expected->size());
+    TEST_ASSERT(watson::unzipped_size(framed) == expected->size());
+
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[expected->size()]);
+    TEST_ASSERT(watson::unzip(plain, buffer.get(), expected->size() - 1) == nullptr);
+    TEST_ASSERT(watson::unzip(framed, buffer.get(), expected->size() - 1) == nullptr);
+
+    const uint8_t* child = watson::unzip(plain, buffer.get(), expected->size());
+    TEST_ASSERT(child == buffer.get());
+    TEST_ASSERT(same_bytes(watson::Ngrdnt::temp(child), expected));
+
+    memset(buffer.get(), 0, expected->size());
+    child = watson::unzip(framed, buffer.get(), expected->size());
+    TEST_ASSERT(child == buffer.get());
+    TEST_ASSERT(same_bytes(watson::Ngrdnt::temp(child), expected));
+}
+
+void test_Unzip_arena()
+{
+    std::vector<watson::Ngrdnt::Ptr> expected;
+    std::vector<watson::Ngrdnt::Ptr> zipped;
+    for (uint32_t h = 1; h < 40; ++h)
+    {
+        expected.push_back(produce(h * 10));
+        zipped.push_back(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected.back()))));
+    }
+
+    watson::Unzip_arena arena(4096);
+    std::vector<const uint8_t*> first;
+    for (size_t h = 0; h < zipped.size(); ++h)
+    {
+        first.push_back(arena.unzip(zipped[h]));
+        TEST_ASSERT(same_bytes(watson::Ngrdnt::temp(first.back()), expected[h]));
+    }
+    // Everything is still valid until the reset.
+    for (size_t h = 0; h < zipped.size(); ++h)
+    {
+        TEST_ASSERT(same_bytes(watson::Ngrdnt::temp(first[h]), expected[h]));
+    }
+
+    // After a reset, the same round fits without growing.
+    arena.reset();
+    const size_t capacity = arena.capacity();
+    for (int round = 0; round < 3; ++round)
+    {
+        for (size_t h = 0; h < zipped.size(); ++h)
+        {
+            TEST_ASSERT(same_bytes(watson::Ngrdnt::temp(arena.unzip(zipped[h])), expected[h]));
+        }
+        TEST_ASSERT(arena.capacity() == capacity);
+        arena.reset();
+    }
+}
+
+void test_dictionary_round_trip()
+{
+    std::vector<watson::Ngrdnt::Ptr> samples;
+    for (uint32_t h = 0; h < 200; ++h)
+    {
+        samples.push_back(message(h));
+    }
+    const watson::Zip_dictionary::Ptr dict(watson::Zip_dictionary::train(samples, 1024));
+    TEST_ASSERT(0 < dict->size());
+    TEST_ASSERT(1024 >= dict->size());
+    watson::register_dictionary(dict);
+
+    uint64_t plain_size = 0;
+    uint64_t dict_size = 0;
+    for (uint32_t h = 1000; h < 1100; ++h)
+    {
+        const watson::Ngrdnt::Ptr expected(message(h));
+        const watson::Ngrdnt::Ptr plain(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+        const watson::Ngrdnt::Ptr z(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected)), *dict));
+        TEST_ASSERT(watson::unzipped_size(z) == expected->size());
+        TEST_ASSERT(same_bytes(*watson::Compressed(z), expected));
+        plain_size += plain->size();
+        dict_size += z->size();
+    }
+    TEST_ASSERT(dict_size * 2 < plain_size);
+
+    // Larger children refer to both the dictionary and themselves.
+    const watson::Ngrdnt::Ptr large(produce(500));
+    const watson::Ngrdnt::Ptr z(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(large)), *dict));
+    TEST_ASSERT(z->size() < large->size() / 2);
+    TEST_ASSERT(same_bytes(*watson::Compressed(z), large));
+
+    // Streams find the dictionary too.
+    std::ostringstream zipped;
+    zipped.write(reinterpret_cast<const char*>(z->data()), z->size());
+    std::istringstream zis(zipped.str());
+    std::string out;
+    TEST_ASSERT(watson::unzip(zis, [&out](const uint8_t* d, size_t n) {
+        out.append(reinterpret_cast<const char*>(d), n);
+    }) == large->size());
+    TEST_ASSERT(0 == memcmp(out.data(), large->data(), large->size()));
+}
+
+void test_dictionary_serialize()
+{
+    std::vector<uint8_t> content;
+    const std::string common("kind=order-placed;version=3;currency=USD;channel=web");
+    content.insert(content.end(), common.begin(), common.end());
+    const watson::Zip_dictionary::Ptr dict(watson::Zip_dictionary::make(std::move(content)));
+
+    const watson::Ngrdnt::Ptr stored(watson::new_ngrdnt(*dict));
+    TEST_ASSERT(watson::ngrdnt_type(stored->type_marker()) == watson::Ngrdnt_type::k_binary);
+    const watson::Zip_dictionary::Ptr loaded(watson::Zip_dictionary::make(stored));
+    TEST_ASSERT(loaded->id() == dict->id());
+    TEST_ASSERT(loaded->size() == common.size());
+
+    // Nothing can be decompressed until the dictionary is registered.
+    const watson::Ngrdnt::Ptr expected(message(7));
+    const watson::Ngrdnt::Ptr z(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected)), *dict));
+    TEST_ASSERT(!watson::find_dictionary(dict->id()));
+    try
+    {
+        watson::Compressed c(z);
+        TEST_FAILED("Decompressed without the dictionary.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    watson::register_dictionary(loaded);
+    TEST_ASSERT(watson::find_dictionary(dict->id()) == loaded);
+    TEST_ASSERT(same_bytes(*watson::Compressed(z), expected));
+
+    // A damaged dictionary is refused.
+    const watson::Ngrdnt::Ptr damaged(watson::Ngrdnt::clone(stored));
+    const_cast<uint8_t*>(damaged->data())[damaged->size() - 1] ^= 0xFF;
+    try
+    {
+        watson::Zip_dictionary::make(damaged);
+        TEST_FAILED("Loaded a damaged dictionary.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+void test_Seekable_zip()
+{
+    watson::Container c;
+    for (uint32_t h = 0; h < 20000; ++h)
+    {
+        std::ostringstream oss;
+        oss << "Element number " << h << " of the seekable container.";
+        c.mutable_children().push_back(watson::new_ngrdnt(oss.str()));
+    }
+    const watson::Ngrdnt::Ptr expected(watson::new_ngrdnt(c));
+    const watson::Ngrdnt::Ptr z(watson::new_seekable_ngrdnt(c, 16384));
+
+    // Everything that reads framed payloads still works.
+    TEST_ASSERT(watson::is_framed(z));
+    TEST_ASSERT(watson::unzipped_size(z) == expected->size());
+    TEST_ASSERT(same_bytes(*watson::Compressed(z), expected));
+    TEST_ASSERT(watson::unzip_each(z, [](const watson::Ngrdnt::Ptr&) {}) == c.size());
+
+    TEST_ASSERT(watson::Seekable_zip::is_seekable(z));
+    TEST_ASSERT(!watson::Seekable_zip::is_seekable(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected)))));
+    watson::Seekable_zip seekable(z);
+    TEST_ASSERT(seekable.size() == c.size());
+    TEST_ASSERT(seekable.block_count() > 1);
+    TEST_ASSERT(same_bytes(seekable[0], c[0]));
+    TEST_ASSERT(same_bytes(seekable[19999], c[19999]));
+    for (uint32_t h = 0; h < c.size(); h += 997)
+    {
+        TEST_ASSERT(same_bytes(seekable[h], c[h]));
+    }
+    TEST_ASSERT(seekable[c.size()] == watson::k_not_found);
+
+    // Small and empty containers are a single block.
+    watson::Container small;
+    small.mutable_children().push_back(watson::new_ngrdnt(42));
+    watson::Seekable_zip one(watson::new_seekable_ngrdnt(small, 1));
+    TEST_ASSERT(one.block_count() == 1);
+    TEST_ASSERT(same_bytes(one[0], small[0]));
+    const watson::Ngrdnt::Ptr empty(watson::new_seekable_ngrdnt(watson::Container()));
+    TEST_ASSERT(watson::Seekable_zip(empty).size() == 0);
+    TEST_ASSERT(same_bytes(*watson::Compressed(empty), watson::new_ngrdnt(watson::Container())));
+}
+
+void test_Seekable_zip_corrupt()
+{
+    watson::Container c;
+    for (uint32_t h = 0; h < 100; ++h)
+    {
+        c.mutable_children().push_back(watson::new_ngrdnt(static_cast<int32_t>(h)));
+    }
+    const watson::Ngrdnt::Ptr z(watson::new_seekable_ngrdnt(c, 64));
+
+    // Flip a byte in the block index.
+    watson::Ngrdnt::Ptr corrupt(watson::Ngrdnt::clone(z));
+    const size_t header_size = watson::ngrdnt_header_size(corrupt->type_marker());
+    const_cast<uint8_t*>(corrupt->data())[header_size + 24] ^= 0xFF;
+    try
+    {
+        watson::Seekable_zip s(corrupt);
+        TEST_FAILED("Corrupt block index was accepted.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    // Padding, or another writer's skippable frame, is not an index,
+    // and is still passed over when decompressing.
+    const size_t type_at = header_size + 10;
+    const size_t magic_at = header_size + 18;
+    for (const size_t at : {type_at, magic_at})
+    {
+        watson::Ngrdnt::Ptr other(watson::Ngrdnt::clone(z));
+        const_cast<uint8_t*>(other->data())[at] = type_at == at ? 0xFE : 'X';
+        TEST_ASSERT(!watson::Seekable_zip::is_seekable(other));
+        TEST_ASSERT(same_bytes(*watson::Compressed(other), watson::new_ngrdnt(c)));
+    }
+
+    // Plain payloads have no index.
+    try
+    {
+        watson::Seekable_zip s(watson::new_ngrdnt(watson::Compressed(watson::new_ngrdnt(c))));
+        TEST_FAILED("Plain payload was accepted.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+void test_unzip_parallel()
+{
+    const watson::Ngrdnt::Ptr expected(produce(40000));
+    const watson::Ngrdnt::Ptr framed(watson::new_framed_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+    TEST_ASSERT(expected->size() > 16 * watson::k_zip_frame_size);
+
+    watson::Worker_pool pool(4);
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[expected->size()]);
+    TEST_ASSERT(watson::unzip(framed, buffer.get(), expected->size() - 1, pool) == nullptr);
+    const uint8_t* child = watson::unzip(framed, buffer.get(), expected->size(), pool);
+    TEST_ASSERT(child == buffer.get());
+    TEST_ASSERT(same_bytes(watson::Ngrdnt::temp(child), expected));
+    TEST_ASSERT(same_bytes(*watson::Compressed(framed), expected));
+
+    // Plain payloads are decompressed on the calling thread.
+    const watson::Ngrdnt::Ptr plain(watson::new_ngrdnt(watson::Compressed(watson::Ngrdnt::clone(expected))));
+    memset(buffer.get(), 0, expected->size());
+    TEST_ASSERT(same_bytes(watson::Ngrdnt::temp(watson::unzip(plain, buffer.get(), expected->size(), pool)), expected));
+
+    // Errors in any of the frames are reported.
+    watson::Ngrdnt::Ptr corrupt(watson::Ngrdnt::clone(framed));
+    const_cast<uint8_t*>(corrupt->data())[corrupt->size() / 2] ^= 0xFF;
+    try
+    {
+        watson::unzip(corrupt, buffer.get(), expected->size(), pool);
+        TEST_FAILED("Corrupt payload was accepted.");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+const Test_entry tests[] = {
+    PREPARE_TEST(test_framed_round_trip),
+    PREPARE_TEST(test_framed_large_round_trip),
+    PREPARE_TEST(test_unzip_sink_is_bounded),
+    PREPARE_TEST(test_unzip_each),
+    PREPARE_TEST(test_unzip_stream),
+    PREPARE_TEST(test_unzip_corrupt),
+    PREPARE_TEST(test_compress_all),
+    PREPARE_TEST(test_adaptive_compression),
+    PREPARE_TEST(test_unzip_into_buffer),
+    PREPARE_TEST(test_Unzip_arena),
+    PREPARE_TEST(test_dictionary_round_trip),
+    PREPARE_TEST(test_dictionary_serialize),
+    PREPARE_TEST(test_Seekable_zip),
+    PREPARE_TEST(test_Seekable_zip_corrupt),
+    PREPARE_TEST(test_unzip_parallel),
+    {0, ""}
+};
+
+int main(int argc, char** argv)
+{
+    return Test_util::runner("watson::unzip", tests);
+}
@@ -31,12 +31,16 @@
  POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "watson.h"
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 #include <sys/time.h>
 
 struct Test_failure
@@ -139,6 +143,80 @@ struct Test_util
     }
 };
 
+//! Whether the Ngrdnt at \c a holds exactly the bytes of \c b.
+inline bool same_bytes(const uint8_t* a, const watson::Ngrdnt::Ptr& b)
+{
+    return a != nullptr &&
+            watson::Ngrdnt::temp(a)->size() == b->size() &&
+            0 == memcmp(a, b->data(), b->size());
+}
+
+inline bool same_bytes(const watson::Ngrdnt::Ptr& a, const watson::Ngrdnt::Ptr& b)
+{
+    return same_bytes(a->data(), b);
+}
+
+//! Whether a \c T transcoder throws on \c input, and leaves its output as it was.
+template <typename T, typename Input>
+bool transcoder_rejects(const Input& input)
+{
+    T transcoder;
+    std::vector<uint8_t> out(3, 0xAA);
+    try
+    {
+        transcoder.transcode(input.data(), input.size(), out);
+    }
+    catch (const std::runtime_error& ex)
+    {
+        return out.size() == 3;
+    }
+    return false;
+}
+
+//! The bytes of \c val, to compare Ngrdnts by value.
+inline std::string bytes_of(const watson::Ngrdnt::Ptr& val)
+{
+    return std::string(reinterpret_cast<const char*>(val->data()), val->size());
+}
+
+//! Records of many sizes: \c count rounds of a string shorter than
+//! \c longest, an int and a nil, then one string of \c large bytes.
+inline std::vector<watson::Ngrdnt::Ptr> mixed_records(const uint32_t count, const uint32_t longest, const size_t large)
+{
+    std::vector<watson::Ngrdnt::Ptr> result;
+    for (uint32_t h = 0; h < count; ++h)
+    {
+        result.push_back(watson::new_ngrdnt(std::string(h % longest, 'a' + h % 26)));
+        result.push_back(watson::new_ngrdnt(static_cast<int32_t>(h)));
+        result.push_back(watson::new_ngrdnt());
+    }
+    result.push_back(watson::new_ngrdnt(std::string(large, 'z')));
+    return result;
+}
+
+//! A Container of \c count strings shorter than \c longest, each followed by an int.
+inline watson::Container mixed_container(const uint32_t count, const uint32_t longest)
+{
+    watson::Container c;
+    for (uint32_t h = 0; h < count; ++h)
+    {
+        c.mutable_children().push_back(watson::new_ngrdnt(std::string(h % longest, 'a' + h % 26)));
+        c.mutable_children().push_back(watson::new_ngrdnt(static_cast<int32_t>(h)));
+    }
+    return c;
+}
+
+//! The records back to back, the way a stream of them is written.
+inline std::string serialize(const std::vector<watson::Ngrdnt::Ptr>& records)
+{
+    std::ostringstream oss;
+    for (const watson::Ngrdnt::Ptr& r : records)
+    {
+        oss << r;
+    }
+    return oss.str();
+}
+
 #define TEST_ASSERT_MSG(msg, expr) (Test_util::fail_if(!(expr), Test_failure(msg, #expr, __FILE__, __FUNCTION__, __LINE__)))
 #define TEST_ASSERT(expr) TEST_ASSERT_MSG("Assert Failed", expr)
 #define TEST_FAILED(msg) (Test_util::fail_if(true, Test_failure(msg, "<See Test>", __FILE__, __FUNCTION__, __LINE__)))